@@ -0,0 +1,224 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The Transport of an opened interface on MacOS X, over IOKit's asynchronous pipe transfers.
+//
+
+#include <AssertMacros.h>
+#include "CADebugPrintf.h"
+#include "IOKitTransport.h"
+#include "USBMIDIDriverBase.h"
+#include "Clock.h"
+
+// transfers a pipe's ring has room for before it first grows
+#define kInitialRequests	4
+
+IOKitTransport::IOKitTransport(IOUSBInterfaceInterface **interface, const Clock &clock, InterfaceState *owner) :
+	mInterface(interface),
+	mClock(clock),
+	mOwner(owner)
+{
+	UInt8 numEndpoints = 0;
+
+	// the refcon of each pipe's transfers is its element, which stays put once they are all made
+	if ((*mInterface)->GetNumEndpoints(mInterface, &numEndpoints) != kIOReturnSuccess)
+		numEndpoints = 0;
+	mPipes.resize(numEndpoints);
+	for (UInt8 i = 0; i < numEndpoints; ++i) {
+		Pipe &pipe = mPipes[i];
+
+		pipe.transport = this;
+		pipe.pipe = i + 1;
+		pipe.requests.resize(kInitialRequests);
+		pipe.first = pipe.count = 0;
+		pipe.clearing = false;
+	}
+}
+
+IOKitTransport::Pipe *	IOKitTransport::FindPipe(int pipe)
+{
+	return (pipe >= 1 && pipe <= (int)mPipes.size()) ? &mPipes[pipe - 1] : NULL;
+}
+
+int		IOKitTransport::NumPipes()
+{
+	return (int)mPipes.size();
+}
+
+bool	IOKitTransport::GetPipe(int pipe, PipeInfo &info)
+{
+	UInt8 direction, number, transferType, interval;
+	UInt16 maxPacketSize;
+
+	if (FindPipe(pipe) == NULL)
+		return false;
+	__Require_noErr((*mInterface)->GetPipeProperties(mInterface, (UInt8)pipe, &direction, &number, &transferType, &maxPacketSize, &interval), fail);
+	DebugPrintf("pipe index %d: dir=%d, num=%d, tt=%d, maxPacketSize=%d, interval=%d", pipe, direction, number, transferType, maxPacketSize, interval);
+	// IOKit's transfer types are USB's, as Transport's are
+	info.endpoint = number | ((direction == kUSBIn) ? 0x80 : 0);
+	info.transferType = transferType;
+	info.maxPacketSize = maxPacketSize;
+	return true;
+fail:
+	return false;
+}
+
+TransferResult	IOKitTransport::Read(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+{
+	Pipe *p = FindPipe(pipe);
+
+	if (p == NULL)
+		return kTransferFailed;
+	return Queued(p, (*mInterface)->ReadPipeAsync(mInterface, p->pipe, buffer, (UInt32)length, TransferCompleted, p), callback, refcon);
+}
+
+TransferResult	IOKitTransport::Write(int pipe, const Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+{
+	Pipe *p = FindPipe(pipe);
+
+	if (p == NULL)
+		return kTransferFailed;
+	return Queued(p, (*mInterface)->WritePipeAsync(mInterface, p->pipe, (void *)buffer, (UInt32)length, TransferCompleted, p), callback, refcon);
+}
+
+// The transfer is queued, so it waits on its pipe for its callback, and holds the interface until
+// it has returned. IOKit never calls back from within the call which queued the transfer.
+TransferResult	IOKitTransport::Queued(Pipe *p, IOReturn result, TransferCallback callback, void *refcon)
+{
+	if (result != kIOReturnSuccess) {
+		DebugPrintf("transfer on pipe %d could not be queued, 0x%x", p->pipe, result);
+		return ResultOfIOReturn(result);
+	}
+	if (p->count == p->requests.size()) {
+		std::vector<Request> requests(p->requests.size() * 2);
+
+		for (size_t i = 0; i < p->count; ++i)
+			requests[i] = p->requests[(p->first + i) % p->requests.size()];
+		p->requests.swap(requests);
+		p->first = 0;
+	}
+	Request &request = p->requests[(p->first + p->count) % p->requests.size()];
+
+	request.callback = callback;
+	request.refcon = refcon;
+	++p->count;
+	mOwner->Retain();
+	return kTransferSuccess;
+}
+
+// this is the IOAsyncCallback1 (static method), refcon is the Pipe transferred on
+// The transfer returning is the oldest of its pipe, which is free for another before the callback.
+void	IOKitTransport::TransferCompleted(void *refcon, IOReturn result, void *arg0)
+{
+	Pipe *p = (Pipe *)refcon;
+	IOKitTransport *self = p->transport;
+	MIDITimeStamp completed = self->mClock.Now();
+
+	if (p->count == 0) {
+		DebugPrintf("transfer on pipe %d returned, 0x%x, though none was queued", p->pipe, result);
+		return;
+	}
+	Request request = p->requests[p->first];
+
+	if (++p->first == p->requests.size())
+		p->first = 0;
+	--p->count;
+	request.callback(request.refcon, ResultOfIOReturn(result), (result == kIOReturnSuccess) ? (ByteCount)arg0 : 0, completed);
+	// last, the interface may be deleted once the transfer has returned
+	self->mOwner->TransferReturned();
+}
+
+// The transfers return with kIOReturnAborted, later, from the run loop.
+void	IOKitTransport::Abort(int pipe)
+{
+	if (FindPipe(pipe) != NULL)
+		__Verify_noErr((*mInterface)->AbortPipe(mInterface, (UInt8)pipe));
+}
+
+// ClearPipeStall aborts the transfers queued behind the one which failed and resets the host's
+// data toggle, leaving the endpoint halted in the device, which is then told to clear it too, so
+// the toggles of both ends agree whatever the failure was. The request is asynchronous, the run
+// loop going on with the other pipes' transfers while it waits its turn on the control pipe. It
+// completes within a frame or two, well inside the engine's first backoff before the pipe is
+// restarted, and holds the interface like a transfer until it has.
+TransferResult	IOKitTransport::ClearStall(int pipe)
+{
+	Pipe *p = FindPipe(pipe);
+	UInt8 direction, number, transferType, interval;
+	UInt16 maxPacketSize;
+	IOReturn result;
+
+	if (p == NULL)
+		return kTransferFailed;
+	__Verify_noErr((*mInterface)->ClearPipeStall(mInterface, p->pipe));
+	if (p->clearing)
+		return kTransferSuccess;	// the halt is already being cleared
+	result = (*mInterface)->GetPipeProperties(mInterface, p->pipe, &direction, &number, &transferType, &maxPacketSize, &interval);
+	if (result != kIOReturnSuccess)
+		return ResultOfIOReturn(result);
+	p->clearHalt.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBStandard, kUSBEndpoint);
+	p->clearHalt.bRequest = kUSBRqClearFeature;
+	p->clearHalt.wValue = kUSBFeatureEndpointStall;
+	p->clearHalt.wIndex = number | ((direction == kUSBIn) ? 0x80 : 0);
+	p->clearHalt.wLength = 0;
+	p->clearHalt.pData = NULL;
+	result = (*mInterface)->ControlRequestAsync(mInterface, 0, &p->clearHalt, ClearHaltCompleted, p);
+	if (result != kIOReturnSuccess) {
+		DebugPrintf("clearing the halt of endpoint 0x%02x could not be queued, 0x%x", p->clearHalt.wIndex, result);
+		return ResultOfIOReturn(result);
+	}
+	p->clearing = true;
+	mOwner->Retain();
+	return kTransferSuccess;
+}
+
+// this is the IOAsyncCallback1 (static method), refcon is the Pipe whose halt was cleared
+void	IOKitTransport::ClearHaltCompleted(void *refcon, IOReturn result, void *arg0)
+{
+	Pipe *p = (Pipe *)refcon;
+	IOKitTransport *self = p->transport;
+
+	p->clearing = false;
+	if (result != kIOReturnSuccess)
+		DebugPrintf("clearing the halt of endpoint 0x%02x failed, 0x%x", p->clearHalt.wIndex, result);
+	// last, the interface may be deleted once the request has returned
+	self->mOwner->TransferReturned();
+}
+
+TransferResult	IOKitTransport::VendorRequest(UInt8 request, UInt16 value, UInt16 index, const void *data, UInt16 length)
+{
+	IOUSBDevRequest vendorRequest;
+	IOReturn result;
+
+	vendorRequest.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBVendor, kUSBDevice);
+	vendorRequest.bRequest = request;
+	vendorRequest.wValue = value;
+	vendorRequest.wIndex = index;
+	vendorRequest.wLength = length;
+	vendorRequest.pData = (void *)data;
+	result = (*mInterface)->ControlRequest(mInterface, 0, &vendorRequest);
+	if (result != kIOReturnSuccess)
+		DebugPrintf("vendor request 0x%02x failed, 0x%x", request, result);
+	return ResultOfIOReturn(result);
+}
+
+// what a transfer's IOReturn says of its pipe
+TransferResult	IOKitTransport::ResultOfIOReturn(IOReturn result)
+{
+	switch (result) {
+	case kIOReturnSuccess:
+		return kTransferSuccess;
+	case kIOReturnAborted:
+		return kTransferAborted;
+	case kIOUSBPipeStalled:
+		return kTransferStalled;
+	case kIOReturnNoDevice:
+	case kIOReturnNotAttached:
+	case kIOReturnNotOpen:
+	case kIOReturnOffline:
+	case kIOReturnExclusiveAccess:
+		return kTransferNoDevice;
+	default:
+		return kTransferFailed;		// timeouts, overruns, CRC and data toggle errors
+	}
+}
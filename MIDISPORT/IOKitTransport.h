@@ -0,0 +1,72 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The Transport of an opened interface on MacOS X, over IOKit's asynchronous pipe transfers. Each
+// transfer goes straight from or into the engine's buffer. IOKit calls back with a refcon alone,
+// so the callback and refcon of each transfer wait on its pipe, in a ring, as the transfers of a
+// pipe complete in order. The callbacks come on the run loop of the interface's async event
+// source, the I/O run loop, stamped with the time of the clock as they come, IOKit telling no
+// earlier time of completion. Each transfer queued holds a reference to its InterfaceState, given
+// back once its callback has returned. Used only on the I/O run loop.
+//
+
+#ifndef __IOKitTransport_h__
+#define __IOKitTransport_h__
+
+#include <vector>
+#include "USBUtils.h"
+#include "Transport.h"
+
+class Clock;
+class InterfaceState;
+
+class IOKitTransport : public Transport {
+public:
+	IOKitTransport(IOUSBInterfaceInterface **interface, const Clock &clock, InterfaceState *owner);
+
+	// Transport
+	virtual int				NumPipes();
+	virtual bool			GetPipe(int pipe, PipeInfo &info);
+	virtual TransferResult	Read(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon);
+	virtual TransferResult	Write(int pipe, const Byte *buffer, ByteCount length, TransferCallback callback, void *refcon);
+	virtual void			Abort(int pipe);
+	virtual TransferResult	ClearStall(int pipe);
+								// the device is told to clear its halt asynchronously, the run loop
+								// not waiting on the control pipe
+	virtual TransferResult	VendorRequest(UInt8 request, UInt16 value, UInt16 index, const void *data, UInt16 length);
+								// synchronous, on the device's control pipe
+
+	static TransferResult	ResultOfIOReturn(IOReturn result);
+
+private:
+	// what to call as a transfer returns
+	struct Request {
+		TransferCallback	callback;
+		void *				refcon;
+	};
+
+	// The transfers queued on a pipe and not yet returned, oldest first, in a ring which grows only
+	// when more are queued at once than ever before. The refcon of TransferCompleted.
+	struct Pipe {
+		IOKitTransport *		transport;
+		UInt8					pipe;
+		std::vector<Request>	requests;
+		size_t					first;
+		size_t					count;
+		IOUSBDevRequest			clearHalt;		// the CLEAR_FEATURE in flight on the control pipe
+		bool					clearing;
+	};
+
+	static void				TransferCompleted(void *refcon, IOReturn result, void *arg0);
+	static void				ClearHaltCompleted(void *refcon, IOReturn result, void *arg0);
+
+	TransferResult			Queued(Pipe *p, IOReturn result, TransferCallback callback, void *refcon);
+	Pipe *					FindPipe(int pipe);
+
+	IOUSBInterfaceInterface **	mInterface;
+	const Clock &			mClock;
+	InterfaceState *		mOwner;
+	std::vector<Pipe>		mPipes;			// indexed by pipe - 1
+};
+
+#endif // __IOKitTransport_h__
@@ -0,0 +1,126 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// A thread running a run loop of its own.
+//
+
+#include <string.h>
+#include <sched.h>
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#include <CoreAudio/HostTime.h>
+#include "CADebugPrintf.h"
+#include "IOThread.h"
+
+IOThread::IOThread() :
+	mStarted(false),
+	mRunning(NULL),
+	mRunLoop(NULL),
+	mStopping(false)
+{
+	memset(&mPolicy, 0, sizeof(mPolicy));
+	mPolicy.cpu = -1;
+}
+
+IOThread::~IOThread()
+{
+	Stop();
+	if (mRunning != NULL)
+		dispatch_release(mRunning);
+}
+
+bool	IOThread::Start(const IOThreadPolicy &policy)
+{
+	mPolicy = policy;
+	mRunning = dispatch_semaphore_create(0);
+	if (mRunning == NULL)
+		return false;
+	if (pthread_create(&mThread, NULL, ThreadEntry, this) != 0)
+		return false;
+	mStarted = true;
+	dispatch_semaphore_wait(mRunning, DISPATCH_TIME_FOREVER);
+	return true;
+}
+
+// A stop asked for before the thread runs its run loop is kept by the run loop, which returns from
+// the next run at once, so the thread never misses one.
+void	IOThread::Stop()
+{
+	if (!mStarted)
+		return;
+	mStopping.store(true, std::memory_order_release);
+	CFRunLoopStop(mRunLoop);
+	pthread_join(mThread, NULL);
+	CFRelease(mRunLoop);
+	mRunLoop = NULL;
+	mStarted = false;
+}
+
+// this is the pthread start routine (static method) of the thread
+void *	IOThread::ThreadEntry(void *arg)
+{
+	IOThread *self = (IOThread *)arg;
+	self->Run();
+	return NULL;
+}
+
+void	IOThread::Run()
+{
+	ApplyPolicy();
+
+	// a source never signalled keeps the run loop from returning while it has nothing else
+	CFRunLoopSourceContext sourceContext = { 0, this, NULL, NULL, NULL, NULL, NULL, NULL, NULL, KeepAliveCallback };
+	CFRunLoopSourceRef keepAlive = CFRunLoopSourceCreate(NULL, 0, &sourceContext);
+
+	mRunLoop = (CFRunLoopRef)CFRetain(CFRunLoopGetCurrent());
+	if (keepAlive != NULL)
+		CFRunLoopAddSource(mRunLoop, keepAlive, kCFRunLoopDefaultMode);
+	dispatch_semaphore_signal(mRunning);
+
+	while (!mStopping.load(std::memory_order_acquire))
+		CFRunLoopRun();
+
+	if (keepAlive != NULL) {
+		CFRunLoopSourceInvalidate(keepAlive);
+		CFRelease(keepAlive);
+	}
+}
+
+// must only be called on the thread itself
+// The time constraint is what CoreAudio's I/O threads run with, the thread is given its computation
+// in each period ahead of every thread without one. The system has no way to keep a thread to one
+// CPU, the affinity tag only asks for the threads sharing it to share a cache, and those with other
+// tags to be spread across the CPUs, so each CPU asked for is given a tag of its own.
+void	IOThread::ApplyPolicy()
+{
+	thread_act_t thread = pthread_mach_thread_np(pthread_self());
+
+	if (mPolicy.period != 0) {
+		thread_time_constraint_policy_data_t timeConstraint;
+
+		timeConstraint.period = (uint32_t)AudioConvertNanosToHostTime(mPolicy.period * 1000ULL);
+		timeConstraint.computation = (uint32_t)AudioConvertNanosToHostTime(mPolicy.computation * 1000ULL);
+		timeConstraint.constraint = (uint32_t)AudioConvertNanosToHostTime(mPolicy.constraint * 1000ULL);
+		timeConstraint.preemptible = true;
+		if (thread_policy_set(thread, THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&timeConstraint,
+							  THREAD_TIME_CONSTRAINT_POLICY_COUNT) != KERN_SUCCESS)
+			DebugPrintf("I/O thread refused its time constraint, running at the default priority");
+	}
+	else if (mPolicy.fifoPriority != 0) {
+		struct sched_param param;
+
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = mPolicy.fifoPriority;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+			DebugPrintf("I/O thread refused SCHED_FIFO priority %d, running at the default priority", mPolicy.fifoPriority);
+	}
+
+	if (mPolicy.cpu >= 0) {
+		thread_affinity_policy_data_t affinity;
+
+		affinity.affinity_tag = mPolicy.cpu + 1;		// 0 is THREAD_AFFINITY_TAG_NULL
+		if (thread_policy_set(thread, THREAD_AFFINITY_POLICY, (thread_policy_t)&affinity,
+							  THREAD_AFFINITY_POLICY_COUNT) != KERN_SUCCESS)
+			DebugPrintf("I/O thread refused affinity to CPU %d", mPolicy.cpu);
+	}
+}
@@ -0,0 +1,58 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// A thread running a run loop of its own, for an interface whose transfers, timers and sources
+// are not to share the driver's I/O run loop with those of every other interface, so a busy
+// device cannot delay another's. The thread can be scheduled with a time constraint, or at a
+// fixed priority, and kept to a CPU where the system allows it.
+//
+
+#ifndef __IOThread_h__
+#define __IOThread_h__
+
+#include <atomic>
+#include <pthread.h>
+#include <dispatch/dispatch.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreMIDI/CoreMIDI.h>
+
+// how an I/O thread is scheduled, times are in microseconds
+struct IOThreadPolicy {
+	UInt32				period;			// between the thread's wakeups, 0 for no time constraint
+	UInt32				computation;	// the processing it needs in each period
+	UInt32				constraint;		// from the start of a period, by when it must be done
+	int					fifoPriority;	// without a time constraint, the SCHED_FIFO priority,
+										// 0 to leave the thread at the default
+	int					cpu;			// the CPU to keep the thread to, -1 for any
+};
+
+class IOThread {
+public:
+	IOThread();
+	~IOThread();
+						// stops the thread
+
+	bool				Start(const IOThreadPolicy &policy);
+							// returns once the run loop exists, false if the thread could not
+							// be created. A policy the system refuses leaves the thread running
+							// at the default priority.
+	void				Stop();
+							// stop the run loop and wait for the thread to exit
+
+	CFRunLoopRef		RunLoop() const		{ return mRunLoop; }
+
+private:
+	static void *		ThreadEntry(void *arg);
+	void				Run();
+	void				ApplyPolicy();
+	static void			KeepAliveCallback(void *info) { }
+
+	IOThreadPolicy		mPolicy;
+	pthread_t			mThread;
+	bool				mStarted;
+	dispatch_semaphore_t	mRunning;		// signalled once mRunLoop is set
+	CFRunLoopRef		mRunLoop;
+	std::atomic<bool>	mStopping;
+};
+
+#endif // __IOThread_h__
@@ -74,11 +74,6 @@
 // and these
 #define kMyManufacturerName	"M-Audio"
 
-#define kNumMaxPorts		9
-
-#define MIDIPACKETLEN		4		// number of bytes in a dword packet received and sent to the MIDISPORT
-#define CMDINDEX	        (MIDIPACKETLEN - 1)  // which byte in the packet has the length and port number.
-
 #define DEBUG_OUTBUFFER		1		// 1 to printout whenever a msg is to be sent.
 
 #define CONFIG_FILE_PATH    "/usr/local/etc/midisport_firmware/MIDISPORT_devices.xml"
@@ -206,12 +201,41 @@ void MIDISPORT::GetInterfaceInfo(InterfaceState *intf, InterfaceInfo &info)
     if (connectedMIDISPORT.coldBootProductID) {
         info.readBufferSize  = connectedMIDISPORT.readBufSize;
         info.writeBufferSize = connectedMIDISPORT.writeBufSize;
+        info.numInputPorts = connectedMIDISPORT.numberOfInputPorts;
+        info.outputPacketsPerPort = connectedMIDISPORT.outputPacketsPerPort;
+        info.writesInFlight = connectedMIDISPORT.writesInFlight;
+        info.readsInFlight = connectedMIDISPORT.readsInFlight;
+        info.coalesceOutput = connectedMIDISPORT.coalesceOutput;
+        info.sysexChunkSize = connectedMIDISPORT.sysexChunkSize;
+        info.sysexTimeout = connectedMIDISPORT.sysexTimeout;
+        info.timestampInputBytes = connectedMIDISPORT.timestampInputBytes;
+        info.runningStatus = connectedMIDISPORT.runningStatus;
+        info.noteOffAsNoteOn = connectedMIDISPORT.noteOffAsNoteOn;
+        info.packOutputBytes = connectedMIDISPORT.packOutputBytes;
+        info.outputBufferSize = connectedMIDISPORT.outputBufferSize;
+        info.allNotesOffOnFlush = connectedMIDISPORT.allNotesOffOnFlush;
+        info.allSoundOffOnFlush = connectedMIDISPORT.allSoundOffOnFlush;
         DebugPrintf("setting readBufferSize = %d, writeBufferSize = %d", (unsigned int) info.readBufferSize, (unsigned int) info.writeBufferSize);
     }
     else
         DebugPrintf("Assertion failed: connectedMIDISPORT == nul");
 }
 
+// Called for the device just matched, as GetInterfaceInfo is.
+bool MIDISPORT::GetIOThreadPolicy(UInt16 devVendor, UInt16 devProduct, IOThreadPolicy &policy)
+{
+    if (!connectedMIDISPORT.coldBootProductID || !connectedMIDISPORT.ownIOThread)
+        return false;
+    policy.period = connectedMIDISPORT.ioThreadPeriod;
+    policy.computation = connectedMIDISPORT.ioThreadComputation;
+    policy.constraint = connectedMIDISPORT.ioThreadConstraint;
+    policy.fifoPriority = connectedMIDISPORT.ioThreadPriority;
+    policy.cpu = connectedMIDISPORT.ioThreadCPU;
+    DebugPrintf("MIDISPORT 0x%x runs on its own I/O thread, period %d us, priority %d, CPU %d",
+                devProduct, policy.period, policy.fifoPriority, policy.cpu);
+    return true;
+}
+
 void MIDISPORT::StartInterface(InterfaceState *intf)
 {
     DebugPrintf("MIDISPORT::StartInterface");
@@ -221,280 +245,3 @@ void MIDISPORT::StopInterface(InterfaceState *intf)
 {
     DebugPrintf("MIDISPORT::StopInterface");
 }
-
-// The MIDI bytes are transmitted from the MIDISPORT in little-endian dword (4 byte) "packets",
-// these are termed mspackets to avoid confusion with the MIDIServices concept of packet.
-// The format of mspackets in received memory order is:
-// d0, d1, d2, cmd, d0, d1, d2, cmd, ...
-// d0 is typically (but not always!) the status MIDI byte, d1, d2 the subsequent message bytes in order.
-// cmd is: 0xxx00yy
-// Where the upper nibble (xxx) indicates the source MIDI in port, 0=MIDI-IN A, 1=MIDI-IN B, 2=MIDI-IN C, etc.
-// The lower nibble (yy) indicates the byte count of valid data in the preceding three bytes.
-// A byte count of 0 indicates a null packet and marks the end of the multiplex input buffer
-// for transmitting less than a full kReadBufSize of data.
-void MIDISPORT::HandleInput(InterfaceState *intf, MIDITimeStamp when, Byte *readBuf, ByteCount readBufSize)
-{
-    int prevInputPort = -1;	                         // signifies none
-    // is it possible to make this mInSysEx?
-    static bool inSysex[kNumMaxPorts] = {false, false, false, false, false, false, false, false, false};
-    // we gotta start somewhere... or make it mRunningStatus
-    static Byte runningStatus[kNumMaxPorts] = {0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90};
-    // how many bytes remain to be processed per MIDI message
-    static int remainingBytesInMsg[kNumMaxPorts] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-    static Byte completeMessage[kNumMaxPorts][MIDIPACKETLEN];
-    static int numCompleted[kNumMaxPorts] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int preservedMsgCount = 0;	// to preserve the message length when encountering a real-time msg
-                                // embedded in another channel message.
-    Byte *src = readBuf, *srcend = src + readBufSize;
-    static Byte pbuf[512];
-    MIDIPacketList *pktlist = (MIDIPacketList *)pbuf;
-    MIDIPacket *pkt = MIDIPacketListInit(pktlist);
-
-    for ( ; src < srcend; src += MIDIPACKETLEN) {
-        int bytesInPacket = src[CMDINDEX] & 0x03;   // number of valid bytes in a packet.
-        int inputPort = src[CMDINDEX] >> 4;
-
-        if (bytesInPacket == 0)	      // Indicates the end of the buffer, early out.
-            break;		
-
-        DebugPrintf("MIDISPORT::HandleInput %c %d: %02X %02X %02X %02X  \n", inputPort + 'A', bytesInPacket, src[0], src[1], src[2], src[3]);
-
-        // if input came from a different input port, flush the packet list.
-        if (prevInputPort != -1 && inputPort != prevInputPort) {
-            // DebugPrintf("flushing source %d", prevInputPort);
-            MIDIReceived(intf->mSources[prevInputPort], pktlist);
-            // TODO Flush partial messages when switching ports: Before resetting the packet list at line 266, add any partial message from prevInputPort to the packet list.
-            pkt = MIDIPacketListInit(pktlist);
-            inSysex[prevInputPort] = false;
-        }
-        prevInputPort = inputPort;
-
-        for (int byteIndex = 0; byteIndex < bytesInPacket; byteIndex++) {
-            if (src[byteIndex] & 0x80) {   // status was present
-                int dataInMessage;
-                Byte status = src[byteIndex];
-                // running status applies to channel (voice and mode) messages only
-                if (status < 0xF0)
-                    runningStatus[inputPort] = status;  // remember it, including the MIDI channel...
-
-                dataInMessage = MIDIDataBytes(status);
-                // if the message is a single real-time message, save the previous remainingBytesInMsg
-                // (since a real-time message can occur within another message) until we have shipped 
-                // the real-time packet.
-                if (remainingBytesInMsg[inputPort] > 0 && dataInMessage == 0) {
-                    preservedMsgCount = remainingBytesInMsg[inputPort];
-                }
-                else {
-                    preservedMsgCount = 0;
-                }
-                remainingBytesInMsg[inputPort] = dataInMessage;
-
-                if (status == 0xF0) {
-                    inSysex[inputPort] = true;
-                }
-                if (status == 0xF7) {
-                    if(numCompleted[inputPort] > 0)
-                        pkt = MIDIPacketListAdd(pktlist, sizeof(pbuf), pkt, when, numCompleted[inputPort], completeMessage[inputPort]);
-                    inSysex[inputPort] = false;
-                }
-
-                numCompleted[inputPort] = 1;
-                // store ready for packetting.
-                completeMessage[inputPort][0] = status;
-                // DebugPrintf("new status %02X, remainingBytesInMsg = %d", status, remainingBytesInMsg[inputPort]);
-            }
-            else if (remainingBytesInMsg[inputPort] > 0) {   // still within a message
-                remainingBytesInMsg[inputPort]--;
-                // store ready for packetting.
-                completeMessage[inputPort][numCompleted[inputPort]++] = src[byteIndex];
-                // DebugPrintf("in message remainingBytesInMsg = %d", remainingBytesInMsg[inputPort]);
-            }
-            else if (inSysex[inputPort]) {          // fill the packet with sysex bytes
-                // DebugPrintf("in sysex numCompleted = %d", numCompleted);
-                completeMessage[inputPort][numCompleted[inputPort]++] = src[byteIndex];
-            }
-            else {  // assume a running status message, assign status from the retained runnning status.
-                Byte status = runningStatus[inputPort];
-                // DebugPrintf("assuming runningStatus %02X", status);
-                completeMessage[inputPort][0] = status;
-                completeMessage[inputPort][1] = src[byteIndex];
-                numCompleted[inputPort] = 2;
-                remainingBytesInMsg[inputPort] = MIDIDataBytes(status) - 1;
-                // assert(remainingBytesInMsg[inputPort] > 0); // since System messages are prevented from being running status.
-            }
-
-            if (remainingBytesInMsg[inputPort] == 0 || numCompleted[inputPort] >= (MIDIPACKETLEN - 1)) { // completed
-#if DEBUG
-                DebugPrintf("Shipping a packet: ");
-                for(int i = 0; i < numCompleted; i++)
-                    DebugPrintf("%02X ", completeMessage[i]);
-#endif
-                pkt = MIDIPacketListAdd(pktlist, sizeof(pbuf), pkt, when, numCompleted[inputPort], completeMessage[inputPort]);
-                numCompleted[inputPort] = 0;
-                DebugPrintf("shipped packet");
-            }
-            if (preservedMsgCount != 0) {
-                remainingBytesInMsg[inputPort] = preservedMsgCount;
-            }
-        }
-    }
-    if (pktlist->numPackets > 0 && prevInputPort != -1) {
-        DebugPrintf("source %d receiving %d packets", prevInputPort, pktlist->numPackets);
-        DebugPrintf("number of entities %d", (unsigned int) intf->mNumEntities);
-        MIDIReceived(intf->mSources[prevInputPort], pktlist);
-    }
-}
-
-// WriteQueue is an STL list of VLMIDIPacket's to be transmitted, presumably containing
-// at least one element.
-// Fill two USB buffers, destBuf1 and destBuf2, each with a maximum size of writeBufSize (dependent on the device),
-// with outgoing data in MIDISPORT-MIDI format.
-// Return the number of bytes written.
-// From the 8x8 Spec:
-// "To ease the load on the MidiSport 8x8 processor, this limitation has been added: the host should send
-// no more than two packets per each MIDI OUT or SMPTE port in a given OUT transfer.  This limitation 
-// still allows MIDI data to be transferred at almost double bandwidth across the USB bus while reducing
-// the MidiSports internal buffer requirements."
-// Now that's going to be tricky to implement... :-(
-void MIDISPORT::PrepareOutput(InterfaceState *intf, WriteQueue &writeQueue,
-                              Byte *destBuf1, ByteCount *bufCount1,
-                              Byte *destBuf2, ByteCount *bufCount2)
-{
-    Byte *dest[2] = {destBuf1, destBuf2};
-    Byte *destEnd[2] = {dest[0] + connectedMIDISPORT.writeBufSize,
-                        dest[1] + connectedMIDISPORT.writeBufSize};
-   
-    while (true) {
-        if (writeQueue.empty()) {
-            ByteCount buf1Length = dest[0] - destBuf1;
-            ByteCount buf2Length = dest[1] - destBuf2;
-#if DEBUG_OUTBUFFER
-            DebugPrintf("MIDISPORT::PrepareOutput dest buffer = ");
-            for(int i = 0; i < dest[0] - destBuf1; i++)
-                DebugPrintf("%02X ", destBuf1[i]);
-            DebugPrintf("");
-#endif
-
-            if(buf1Length > 0) {
-                memset(dest[0], 0, MIDIPACKETLEN);  // signal the conclusion with a single null packet
-                *bufCount1 = buf1Length + MIDIPACKETLEN; // + MIDIPACKETLEN for null packet.
-            }
-            else
-                *bufCount1 = 0;
-            if(buf2Length > 0) {
-                memset(dest[1], 0, MIDIPACKETLEN);  // signal the conclusion with a single null packet
-                *bufCount2 = buf2Length + MIDIPACKETLEN; // + MIDIPACKETLEN for null packet.
-            }
-            else
-                *bufCount2 = 0;
-            return;
-        }
-                
-        WriteQueueElem *wqe = &writeQueue.front();
-        Byte cableNibble = wqe->portNum << 4;
-        // put Port 1,3,5,7 to destBuf1, Port 2,4,6,8 to destBuf2
-        Byte cableEndpoint = wqe->portNum & 0x01; 
-        VLMIDIPacket *pkt = wqe->packet;
-        Byte *src = pkt->data + wqe->bytesSent;
-        Byte *srcend = &pkt->data[pkt->length];
-
-        DebugPrintf("cableNibble = 0x%x, cableEndpoint = %d, portNum = %d", cableNibble, cableEndpoint, wqe->portNum);
-        while (src < srcend && dest[cableEndpoint] < destEnd[cableEndpoint]) {
-            long sysexDataLen;
-            Byte c = *src++;
-            
-            // DebugPrintf("byte %02X", c);
-            switch (c >> 4) {
-            case 0x0: case 0x1: case 0x2: case 0x3:
-            case 0x4: case 0x5: case 0x6: case 0x7:
-                // DebugPrintf("sysex databyte %02X", c);
-                // data byte, presumably a sysex continuation
-                *dest[cableEndpoint]++ = c;
-                // write up to 2 more sysex data bytes, if present in the packet
-                sysexDataLen = 1 + std::min(srcend - src, 2L);
-                *dest[cableEndpoint]++ = (src < srcend) ? *src++ : 0;
-                *dest[cableEndpoint]++ = (src < srcend) ? *src++ : 0;
-                *dest[cableEndpoint]++ = cableNibble | sysexDataLen; // mark length and cable
-                break;
-            case 0x8:	// note-on
-            case 0x9:	// note-off
-            case 0xA:	// poly pressure
-            case 0xB:	// control change
-            case 0xE:	// pitch bend
-                // DebugPrintf("channel %02X", c);
-                *dest[cableEndpoint]++ = c;
-                *dest[cableEndpoint]++ = *src++;
-                *dest[cableEndpoint]++ = *src++;
-                *dest[cableEndpoint]++ = cableNibble | 0x03;
-                break;
-            case 0xC:	// program change
-            case 0xD:	// mono pressure
-                // DebugPrintf("prch,pres %02X", c);
-                *dest[cableEndpoint]++ = c;
-                *dest[cableEndpoint]++ = *src++;
-                *dest[cableEndpoint]++ = 0;
-                *dest[cableEndpoint]++ = cableNibble | 0x02;
-                break;
-            case 0xF:	// system message
-                // DebugPrintf("system %02X", c);
-                switch (c) {
-                case 0xF0:	// sysex start
-                    *dest[cableEndpoint]++ = c;
-                    *dest[cableEndpoint]++ = *src++;
-                    *dest[cableEndpoint]++ = *src++;
-                    *dest[cableEndpoint]++ = cableNibble | 0x03;	// sysex start or continued
-                    break;
-                case 0xF6:	// tune request (0)
-                case 0xF7:	// sysex conclude (0)
-                case 0xF8:	// clock
-                case 0xFA:	// start
-                case 0xFB:	// continue
-                case 0xFC:	// stop
-                case 0xFE:	// active sensing
-                case 0xFF:	// system reset
-                    *dest[cableEndpoint]++ = c;
-                    *dest[cableEndpoint]++ = 0;
-                    *dest[cableEndpoint]++ = 0;
-                    *dest[cableEndpoint]++ = cableNibble | 0x01;    // 1-byte system realtime or system common
-                    break;
-                case 0xF1:	// MTC (1)
-                case 0xF3:	// song select (1)
-                    *dest[cableEndpoint]++ = c;
-                    *dest[cableEndpoint]++ = *src++;
-                    *dest[cableEndpoint]++ = 0;
-                    *dest[cableEndpoint]++ = cableNibble | 0x02;	// 2-byte system common
-                    break;
-                case 0xF2:	// song pointer (2)
-                    *dest[cableEndpoint]++ = c;
-                    *dest[cableEndpoint]++ = *src++;
-                    *dest[cableEndpoint]++ = *src++;
-                    *dest[cableEndpoint]++ = cableNibble | 0x03;	// 3-byte system common
-                    break;
-                default:
-                    // DebugPrintf("unknown %02X", c);
-                    // unknown MIDI message! advance until we find a status byte
-                    while (src < srcend && *src < 0x80)
-                        ++src;
-                    break;
-                }
-                break;
-            }
-
-            if (src == srcend) {
-                // source packet completely sent
-                delete wqe->packet;
-                writeQueue.pop_front();
-            }
-            else
-                wqe->bytesSent = src - pkt->data;
-
-            if (dest[cableEndpoint] > destEnd[cableEndpoint] - MIDIPACKETLEN) {
-                // one of the destBuf's are completely filled
-                *bufCount1 = dest[0] - destBuf1;
-                *bufCount2 = dest[1] - destBuf2;
-                return; 
-            }
-            // we didn't fill the output buffer, is there more source data in the write queue?
-        }
-    }
-}
@@ -24,6 +24,7 @@
 
 #include "USBMIDIDriverBase.h"
 #include "HardwareConfiguration.h"
+#include "MidisportFormat.h"
 
 class MIDISPORT : public USBMIDIDriverBase {
 public:
@@ -53,12 +54,10 @@ public:
 
     virtual void GetInterfaceInfo(InterfaceState *intf, InterfaceInfo &info);
 
+    virtual bool GetIOThreadPolicy(UInt16 devVendor, UInt16 devProduct, IOThreadPolicy &policy);
+
     virtual void StartInterface(InterfaceState *intf);
     virtual void StopInterface(InterfaceState *intf);
-    virtual void HandleInput( InterfaceState *intf, MIDITimeStamp when, Byte *readBuf, ByteCount readBufSize);
-    virtual void PrepareOutput(InterfaceState *intf, WriteQueue &writeQueue,
-                                 Byte *destBuf1, ByteCount *bufCount1,
-                                 Byte *destBuf2, ByteCount *bufCount2);
 private:
     HardwareConfiguration *hardwareConfig;
     struct DeviceFirmware connectedMIDISPORT;
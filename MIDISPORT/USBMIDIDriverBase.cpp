@@ -51,13 +51,35 @@
 
 #include <AssertMacros.h>
 #include <algorithm>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <CoreAudio/HostTime.h>
 #include "CADebugPrintf.h"
 #include "USBMIDIDriverBase.h"
+#include "Clock.h"
+
+// the period of timers when they are idle, long enough they never fire
+#define kTimerIdleInterval		1.0e8
+
+// how far ahead of their time stamps clients are asked to send, so the output can be held here
+// and written when it is due, clear of the MIDI server's scheduling jitter
+#define kAdvanceScheduleTimeMuSec	10000
+
+// bytes of packets Send can hand to the I/O run loop before it has taken them
+#define kSendQueueSize			65536
+
+// how often the interfaces of removed devices are retried, while a Send or Flush could still be
+// using them, and how long Stop waits for their transfers to return before leaking them
+#define kReclaimRetryNanos		1000000
+#define kDrainTimeoutMillis		1000
+#define kDrainRunInterval		0.01
+
+// how often the I/O threads of removed devices are checked for their interfaces having been deleted
+#define kReapIntervalNanos		10000000
 
 #if DEBUG
-	//#define DUMP_INPUT 1			// only works in USBMIDIHandleInput
-	#define DUMP_OUTPUT 1
 	//#define ANALYZE_THRU_TIMING 1
 #endif
 
@@ -103,158 +125,44 @@ TimingAnalyzer	gTimingAnalyzer;
 #endif
 
 
-// __________________________________________________________________________________________________
-// returns number of data bytes which follow the status byte.
-// returns -1 for 0xF0 sysex beginning (indicating a variable number of data bytes
-//		following).
-// returns 0 if an unknown MIDI status byte is received and prints a warning.
-int		MIDIDataBytes(Byte status)
-{
-	if (status >= 0x80 && status < 0xF0)
-		return ((status & 0xE0) == 0xC0) ? 1 : 2;
-
-	switch (status) {
-	case 0xF0:
-		return -1;
-	case 0xF1:		// MTC
-	case 0xF3:		// song select
-		return 1;
-	case 0xF2:		// song pointer
-		return 2;
-	case 0xF6:		// tune request
-	case 0xF7:		// sysex conclude, nothing follows.
-	case 0xF8:		// clock
-	case 0xFA:		// start
-	case 0xFB:		// continue
-	case 0xFC:		// stop
-	case 0xFE:		// active sensing
-	case 0xFF:		// system reset
-		return 0;
-	}
-
-	DebugPrintf("MIDIEventLength: illegal status byte %02X", status);
-	return 0;   // the MIDI spec says we should ignore illegals.
-}
-
-// __________________________________________________________________________________________________
-
-IOBuffer::IOBuffer() :
-	mBuffer(NULL),
-	mMemory(NULL)
-{
-}
-
-IOBuffer::~IOBuffer()
-{
-	if (mMemory)
-		delete[] mMemory;
-}
-
-void	IOBuffer::Allocate(UInt32 size)
-{
-	mBuffer = mMemory = new Byte[size];
-}
-
-// __________________________________________________________________________________________________
-
-Mutex::Mutex()
-{
-	__Verify_noErr(pthread_mutex_init(&mMutex, NULL));
-	mOwner = 0;
-}
-
-Mutex::~Mutex()
-{
-	pthread_mutex_destroy(&mMutex);
-}
-	
-bool	Mutex::Lock()
-{
-	pthread_t thisThread = pthread_self();
-	
-	if (mOwner == thisThread)
-		return false;	// already acquired
-	
-	__Require_noErr(pthread_mutex_lock(&mMutex), done);
-	mOwner = thisThread;
-	return true;	// did acquire lock
-
-done:
-	return false;	// error, didn't acquire lock
-}
-
-void	Mutex::Unlock()
-{
-	__Require_String(mOwner == pthread_self(), done, "non-owner thread is unlocking mutex");
-	mOwner = 0;
-	pthread_mutex_unlock(&mMutex);
-done: ;
-}
-
 // __________________________________________________________________________________________________
 
 // the device and interface are assumed to have been opened
 InterfaceState::InterfaceState(	USBMIDIDriverBase *			driver, 
+								InterfaceHandle *			handle,
+								IOThread *					ioThread,
 								MIDIDeviceRef 				midiDevice, 
 								io_service_t				ioDevice,
 								IOUSBDeviceInterface **		usbDevice,
 								IOUSBInterfaceInterface **	usbInterface) :
-	mSources(NULL)
+	mHandle(handle),
+	mRefCount(1),
+	mReclaimer(NULL),
+	mSources(NULL),
+	mTransport(usbInterface, HostClock::Shared(), this),
+	mEngine(NULL),
+	mStopping(false),
+	mServiceTimer(NULL),
+	mServiceDeadline(0),
+	mIOThread(ioThread),
+	mIORunLoop(ioThread != NULL ? ioThread->RunLoop() : MIDIGetDriverIORunLoop()),
+	mSendSource(NULL),
+	mSendSignalled(false),
+	mRestartReadSource(NULL),
+	mHaveDecodeThread(false),
+	mDecodeSemaphore(NULL),
+	mDecodeStopping(false)
 {
-	UInt8	   		numEndpoints, pipeNum, direction, transferType, interval;
-	UInt16			pipeIndex, maxPacketSize; 		
-	
 	mDriver = driver;
 	mMidiDevice = midiDevice;
 	mIODevice = ioDevice;
 	mDevice = usbDevice;
 	mInterface = usbInterface;
-	mHaveInPipe = false;
-	mHaveOutPipe1 = false;
- 	mHaveOutPipe2 = false;
  
+	memset(&mInterfaceInfo, 0, sizeof(mInterfaceInfo));
 	GetInterfaceInfo(mInterfaceInfo); 	// Get endpoint types and buffer sizes
-	mReadBuf.Allocate(mInterfaceInfo.readBufferSize);
-	mWriteBuf1.Allocate(mInterfaceInfo.writeBufferSize); // assumes both buffers are equal sized.
-	mWriteBuf2.Allocate(mInterfaceInfo.writeBufferSize);
-
-	DebugPrintf("mReadBuf=0x%lx, mWriteBuf1=0x%lx, mWriteBuf2=0x%lx", (long)mReadBuf.Buffer(), (long)mWriteBuf1.Buffer(), (long)mWriteBuf2.Buffer());
-
-	numEndpoints = 0;
-	__Require_noErr((*mInterface)->GetNumEndpoints(mInterface, &numEndpoints), errexit);
-		// find the number of endpoints for this interface
-
-	for (pipeIndex = 1; pipeIndex <= numEndpoints; ++pipeIndex) { 
-		__Require_noErr((*mInterface)->GetPipeProperties(mInterface, pipeIndex, &direction, &pipeNum, &transferType, &maxPacketSize, &interval), nextPipe);
-		DebugPrintf("pipe index %d: dir=%d, num=%d, tt=%d, maxPacketSize=%d, interval=%d", pipeIndex,  direction, pipeNum, transferType, maxPacketSize, interval);
-        // MIDISPORT_SPECIFIC
-        // The MIDIMan MIDISPORT devices output different ports via different endPoints.
-        // This is quite a logical approach but unfortunately differs from the USB-MIDI spec.
-		if (direction == kUSBOut && pipeNum == 2) { // MIDIMan machines are fixed to their endPoints
-			mOutPipe1 = pipeIndex; 
-			mHaveOutPipe1 = true;
-		}
-        else if (direction == kUSBOut && pipeNum == 4) { // MIDIMan machines are fixed to their endPoints
-			mOutPipe2 = pipeIndex; 
-			mHaveOutPipe2 = true;
-		}
-        else if (direction == kUSBIn && pipeNum == 1) { // MIDIMan machines are fixed to their endPoints
-			mInPipe = pipeIndex;  
-			mHaveInPipe = true;
-		}
-        else if (direction == kUSBIn && pipeNum == 2 && !mHaveInPipe) {
-            // MIDIMan MIDISPORT 8x8 uses pipeNum == 2, yet all the other MIDISPORTs use 1?
-            // This is not right, we should be checking that we are actually using an 8x8,
-            // but until the comms mechanism is in place between the object
-            // (and this whole member function should be virtual anyway), we fudge it...
-			mInPipe = pipeIndex;  
-			mHaveInPipe = true;
-		}
-nextPipe: ;
-	}
-	// don't go any further if we don't have a valid pipe
-	__Require(mHaveOutPipe1 || mHaveOutPipe2 || mHaveInPipe, errexit);
-    DebugPrintf("starting MIDI, mOutPipe1=0x%lX, mOutPipe2=0x%lX, mInPipe=0x%lX", (long)mOutPipe1, (long)mOutPipe2, (long)mInPipe);
+	// before the handle lets Send find the interface
+	mSendQueue.Allocate(kSendQueueSize);
 
     // now set up all the sources and destinations
 	// !!! this may be too specific; it assumes that every entity has 1 source and 1 destination
@@ -271,66 +179,120 @@ nextPipe: ;
 		// destination refCons: output pipe, cable number (0-based)
         for (int destIndex = 0; destIndex < MIDIEntityGetNumberOfDestinations(ent); destIndex++) {
             MIDIEndpointRef dest = MIDIEntityGetDestination(ent, destIndex);
-            MIDIEndpointSetRefCons(dest, this, (void *)ient);
+            MIDIEndpointSetRefCons(dest, mHandle, (void *)ient);
+            MIDIObjectSetIntegerProperty(dest, kMIDIPropertyAdvanceScheduleTimeMuSec, kAdvanceScheduleTimeMuSec);
 		}
         for (int sourceIndex = 0; sourceIndex < MIDIEntityGetNumberOfSources(ent); sourceIndex++)
             mSources[ient] = MIDIEntityGetSource(ent, sourceIndex);
 	}
-	mWriteCable = 0xFF;
-	mReadCable = 0;
-	mInSysEx = false;
-	mRunningStatus = 0;
 
-	{
-		CFRunLoopRef ioRunLoop = MIDIGetDriverIORunLoop();
-		CFRunLoopSourceRef source;
-		
-		if (ioRunLoop != NULL) {
-			source = (*mInterface)->GetInterfaceAsyncEventSource(mInterface);
-			if (source == NULL) {
-				__Require_noErr((*mInterface)->CreateInterfaceAsyncEventSource(mInterface, &source), errexit);
-				__Require(source != NULL, errexit);
-			}
-			if (!CFRunLoopContainsSource(ioRunLoop, source, kCFRunLoopDefaultMode))
-				CFRunLoopAddSource(ioRunLoop, source, kCFRunLoopDefaultMode);
+	// MIDISPORT_SPECIFIC
+	// The engine finds the MIDISPORT's pipes, which are fixed to their endpoints, and parses the
+	// input and output of this interface alone, so multiple MIDISPORTs never share parse state.
+	// Its input is decoded on the decode thread, read only once there is one.
+	mEngine = new MidisportEngine(mTransport, HostClock::Shared(), *this, mInterfaceInfo, (int)mNumEntities);
+	mEngine->SetInputHandoff(this);
+	if (!mEngine->Start()) {
+		// don't go any further if we don't have a valid pipe
+		delete mEngine;
+		mEngine = NULL;
+		goto errexit;
+	}
+
+	if (mIORunLoop != NULL) {
+		CFRunLoopSourceRef source = (*mInterface)->GetInterfaceAsyncEventSource(mInterface);
+
+		if (source == NULL) {
+			__Require_noErr((*mInterface)->CreateInterfaceAsyncEventSource(mInterface, &source), errexit);
+			__Require(source != NULL, errexit);
 		}
+		if (!CFRunLoopContainsSource(mIORunLoop, source, kCFRunLoopDefaultMode))
+			CFRunLoopAddSource(mIORunLoop, source, kCFRunLoopDefaultMode);
+
+		// idle until the engine has output to release or a pipe to restart
+		CFRunLoopTimerContext timerContext = { 0, this, NULL, NULL, NULL };
+		mServiceTimer = CFRunLoopTimerCreate(NULL, CFAbsoluteTimeGetCurrent() + kTimerIdleInterval, kTimerIdleInterval, 0, 0, ServiceTimerCallback, &timerContext);
+		if (mServiceTimer != NULL)
+			CFRunLoopAddTimer(mIORunLoop, mServiceTimer, kCFRunLoopDefaultMode);
+
+		// once the engine is started, what Send hands over can be taken
+		CFRunLoopSourceContext sourceContext = { 0, this, NULL, NULL, NULL, NULL, NULL, NULL, NULL, SendCallback };
+		mSendSource = CFRunLoopSourceCreate(NULL, 0, &sourceContext);
+		if (mSendSource != NULL) {
+			CFRunLoopAddSource(mIORunLoop, mSendSource, kCFRunLoopDefaultMode);
+			// packets sent before the source existed
+			CFRunLoopSourceSignal(mSendSource);
+			CFRunLoopWakeUp(mIORunLoop);
+		}
+		CFRunLoopSourceContext restartContext = { 0, this, NULL, NULL, NULL, NULL, NULL, NULL, NULL, RestartReadCallback };
+		mRestartReadSource = CFRunLoopSourceCreate(NULL, 0, &restartContext);
+		if (mRestartReadSource != NULL)
+			CFRunLoopAddSource(mIORunLoop, mRestartReadSource, kCFRunLoopDefaultMode);
+	}
+	// The reads are started on the I/O run loop, like every other transfer, so only it counts the
+	// references they hold.
+	if (mEngine->HasInputPipe()) {
+		mDecodeSemaphore = dispatch_semaphore_create(0);
+		if (mDecodeSemaphore != NULL && pthread_create(&mDecodeThread, NULL, DecodeThread, this) == 0)
+			mHaveDecodeThread = true;
+		else
+			DebugPrintf("no decode thread, input is not read");
+	}
+	if (mHaveDecodeThread) {
+		if (mRestartReadSource != NULL) {
+			CFRunLoopSourceSignal(mRestartReadSource);
+			CFRunLoopWakeUp(mIORunLoop);
+		}
+		else
+			mEngine->RestartReads();
 	}
-	mWritePending = false;
-	DoRead();
 
 	mDriver->StartInterface(this);
 	// Start MIDI.  Do driver specific initialization.
 	// Here, the driver can do things like send MIDI to the interface to
 	// configure it.
+
+	// Send and Flush can find the interface
+	mHandle->state.store(this, std::memory_order_release);
 errexit:
 	;
 }
 
 // __________________________________________________________________________________________________
+// Called on the I/O run loop by the InterfaceReclaimer, or by the InterfaceRunner when there is
+// no I/O run loop, once Send and Flush no longer find the interface through its handle.
 InterfaceState::~InterfaceState()
 {
-    // MIDISPORT_SPECIFIC
-	if (mHaveOutPipe1 || mHaveOutPipe2 || mHaveInPipe)
-		mDriver->StopInterface(this);
+	Stop();
+
+	// the decode thread finishes the read it is decoding
+	if (mHaveDecodeThread) {
+		mDecodeStopping.store(true, std::memory_order_release);
+		dispatch_semaphore_signal(mDecodeSemaphore);
+		pthread_join(mDecodeThread, NULL);
+	}
+	if (mDecodeSemaphore != NULL)
+		dispatch_release(mDecodeSemaphore);
+
+	if (mServiceTimer != NULL) {
+		CFRunLoopTimerInvalidate(mServiceTimer);
+		CFRelease(mServiceTimer);
+	}
+	if (mSendSource != NULL) {
+		CFRunLoopSourceInvalidate(mSendSource);
+		CFRelease(mSendSource);
+	}
+	if (mRestartReadSource != NULL) {
+		CFRunLoopSourceInvalidate(mRestartReadSource);
+		CFRelease(mRestartReadSource);
+	}
 
-	if (mHaveOutPipe1) {
-		__Verify_noErr((*mInterface)->AbortPipe(mInterface, mOutPipe1));
-    }
-	if (mHaveOutPipe2) {
-		__Verify_noErr((*mInterface)->AbortPipe(mInterface, mOutPipe2));
-    }
-    // End of MIDISPORT_SPECIFIC
-        
-	if (mHaveInPipe)
-		__Verify_noErr((*mInterface)->AbortPipe(mInterface, mInPipe)); 
-
-	CFRunLoopRef ioRunLoop = MIDIGetDriverIORunLoop();
 	CFRunLoopSourceRef source;
 	
-	if (ioRunLoop != NULL) {
+	if (mIORunLoop != NULL) {
 		source = (*mInterface)->GetInterfaceAsyncEventSource(mInterface);
-		if (source != NULL && CFRunLoopContainsSource(ioRunLoop, source, kCFRunLoopDefaultMode))
-			CFRunLoopRemoveSource(ioRunLoop, source, kCFRunLoopDefaultMode);
+		if (source != NULL && CFRunLoopContainsSource(mIORunLoop, source, kCFRunLoopDefaultMode))
+			CFRunLoopRemoveSource(mIORunLoop, source, kCFRunLoopDefaultMode);
 	}
 	
 	if (mInterface) {
@@ -345,130 +307,240 @@ InterfaceState::~InterfaceState()
 	
 	delete[] mSources;
 
+	if (mEngine != NULL) {
+		const InputStatistics &input = mEngine->GetInputStatistics();
+		const TransferStatistics &transfers = mEngine->GetTransferStatistics();
+
+		DebugPrintf("input: %llu reads, %llu MIDIReceived calls (%llu on full packet lists), %llu saved by collecting input per source",
+					input.readsHandled, input.receivedCalls, input.overflowFlushes,
+					input.inputPortRuns - (input.receivedCalls - input.overflowFlushes));
+		DebugPrintf("input: %llu sysex bytes in %llu packets", input.sysexBytes, input.sysexPackets);
+		DebugPrintf("input: %llu bytes of disabled sources skipped", input.bytesSkipped);
+		if (input.readsCompleted != 0) {
+			UInt64 decodeNanos = AudioConvertHostTimeToNanos(input.decodeTime);
+
+			DebugPrintf("input: %llu reads of %llu bytes, handed off in %llu us mean, %llu us max, %llu times with no read pending",
+						input.readsCompleted, input.bytesRead,
+						AudioConvertHostTimeToNanos(input.handoffTime) / 1000 / input.readsCompleted,
+						AudioConvertHostTimeToNanos(input.maxHandoffTime) / 1000, input.readStarvations);
+			DebugPrintf("input: decoded after %llu us mean, %llu us max, in %llu us mean, %llu us max, %llu bytes/s while decoding",
+						AudioConvertHostTimeToNanos(input.decodeWaitTime) / 1000 / input.readsCompleted,
+						AudioConvertHostTimeToNanos(input.maxDecodeWaitTime) / 1000,
+						decodeNanos / 1000 / input.readsCompleted,
+						AudioConvertHostTimeToNanos(input.maxDecodeTime) / 1000,
+						decodeNanos != 0 ? input.bytesRead * 1000000000ULL / decodeNanos : 0ULL);
+		}
+		DebugPrintf("transfers: %llu reads and %llu writes failed, %llu stalls cleared, %llu restarts, %llu writes resent, %llu pipes lost",
+					transfers.readErrors, transfers.writeErrors, transfers.stallsCleared,
+					transfers.restarts, transfers.transfersResent, transfers.fatalErrors);
+		DebugPrintf("output: %llu packets dropped on a full write queue", mEngine->GetOutput().Overflows());
+		DebugPrintf("output: %llu messages superseded before being written", mEngine->GetOutput().Coalesced());
+		DebugPrintf("output: %llu packets written early on a full schedule", mEngine->GetScheduledOutput().Overflows());
+		// the transfers have all returned, see InterfaceReclaimer
+		delete mEngine;
+	}
+	DebugPrintf("output: %llu packets dropped on a full send queue", mSendQueue.Overflows());
 	DebugPrintf("driver stopped MIDI");
 }
 
-// __________________________________________________________________________________________________
-void	InterfaceState::HandleInput(ByteCount bytesReceived)
+// must only be called on the I/O run loop, unless there is none
+// The transfers in flight return, aborted if not before, and are not recovered, each releasing
+// its reference to the interface as it does. Nothing starts another.
+void	InterfaceState::Stop()
 {
-	UInt64 now = AudioGetCurrentHostTime();
-#if 0
-	DebugPrintf("InterfaceState::HandleInput bytesReceived = %ld", bytesReceived);
-	DebugPrintf("mReadBuf[0-23]: ");
-	for (int i = 0; i < 24; i++)
-		DebugPrintf("%02X ", mReadBuf[i]);
-	   DebugPrintf("");
-#endif
-	mDriver->HandleInput(this, now, mReadBuf, bytesReceived);
+	if (mStopping)
+		return;
+	mStopping = true;
+	if (mEngine != NULL) {
+		mDriver->StopInterface(this);
+		mEngine->Stop();
+	}
 }
 
-// __________________________________________________________________________________________________
-void	InterfaceState::Send(const MIDIPacketList *pktlist, UInt64 portNumber)
+// must only be called on the I/O run loop
+void	InterfaceState::TransferReturned()
 {
-	bool shouldUnlock = mWriteQueueMutex.Lock();
-	const MIDIPacket *srcpkt = pktlist->packet;
-    DebugPrintf("InterfaceState::Send %d packets to port %lu", pktlist->numPackets, (unsigned long) portNumber);
-	for (int i = pktlist->numPackets; --i >= 0; ) {
-		WriteQueueElem wqe;
-		
-		wqe.packet = NewMIDIPacket(srcpkt);
-		wqe.portNum = portNumber;
-		wqe.bytesSent = 0;
-		mWriteQueue.push_back(wqe);
-		
-		srcpkt = MIDIPacketNext(srcpkt);
+	ScheduleService();
+	// last, the interface may be deleted once the transfer has returned
+	Release();
+}
+
+// fire the timer at the host time deadline, 0 idles it
+static void	SetTimerDeadline(CFRunLoopTimerRef timer, MIDITimeStamp deadline)
+{
+	if (timer == NULL)
+		return;
+	if (deadline == 0) {
+		CFRunLoopTimerSetNextFireDate(timer, CFAbsoluteTimeGetCurrent() + kTimerIdleInterval);
+	}
+	else {
+		UInt64 now = AudioGetCurrentHostTime();
+		UInt64 nanosToDeadline = (deadline > now) ? AudioConvertHostTimeToNanos(deadline - now) : 0;
+		CFRunLoopTimerSetNextFireDate(timer, CFAbsoluteTimeGetCurrent() + nanosToDeadline * 1.0e-9);
 	}
-	if (!mWritePending)
-		DoWrite();
-	if (shouldUnlock)
-		mWriteQueueMutex.Unlock();
+}
+
+// must only be called on the I/O run loop
+// Called after whatever may have changed when the engine is next due, the timer only being set
+// again when it has.
+void	InterfaceState::ScheduleService()
+{
+	MIDITimeStamp deadline = (mEngine != NULL) ? mEngine->NextDeadline() : 0;
+
+	if (deadline != mServiceDeadline) {
+		mServiceDeadline = deadline;
+		SetTimerDeadline(mServiceTimer, deadline);
+	}
+}
+
+// this is the CFRunLoopTimerCallBack (static method), on the same run loop as the transfer callbacks
+void	InterfaceState::ServiceTimerCallback(CFRunLoopTimerRef timer, void *info)
+{
+	InterfaceState *self = (InterfaceState *)info;
+
+	self->mServiceDeadline = 0;		// fired, whatever it was set for
+	self->mEngine->Service();
+	self->ScheduleService();
 }
 
 // __________________________________________________________________________________________________
+// called on the I/O run loop by the engine as each read completes
+void	InterfaceState::ReadCompleted()
+{
+	dispatch_semaphore_signal(mDecodeSemaphore);
+}
 
-void	InterfaceState::DoRead()
+// called on the decode thread by the engine, as it releases a buffer after every one was waiting
+void	InterfaceState::ReadsStarved()
 {
-	if (mHaveInPipe) {
-		__Verify_noErr((*mInterface)->ReadPipeAsync(mInterface, mInPipe, mReadBuf, mInterfaceInfo.readBufferSize, ReadCallback, this));
+	if (mRestartReadSource != NULL) {
+		CFRunLoopSourceSignal(mRestartReadSource);
+		CFRunLoopWakeUp(mIORunLoop);
 	}
 }
 
-// this is the IOAsyncCallback (static method)
-void	InterfaceState::ReadCallback(void *refcon, IOReturn asyncReadResult, void *arg0)
+// this is the CFRunLoopSource perform callback (static method), on the same run loop as the transfer callbacks
+void	InterfaceState::RestartReadCallback(void *info)
 {
-	if (asyncReadResult == kIOReturnAborted) goto done;
-	__Require_noErr(asyncReadResult, done);
-	{
-		InterfaceState *self = (InterfaceState *)refcon;
-		ByteCount bytesReceived = (ByteCount)arg0;
-		//DebugPrintf("ReadCallback: arg0 is %ld", (long)bytesReceived);
-		self->HandleInput(bytesReceived);
-		// chain another async read
-		self->DoRead();
+	InterfaceState *self = (InterfaceState *)info;
+
+	self->mEngine->RestartReads();
+	self->ScheduleService();
+}
+
+// this is the pthread start routine (static method) of the decode thread
+void *	InterfaceState::DecodeThread(void *arg)
+{
+	InterfaceState *self = (InterfaceState *)arg;
+	self->DecodeInput();
+	return NULL;
+}
+
+// Between reads the thread waits on mDecodeSemaphore, which ReadCompleted signals, until the
+// deadline of any sysex the engine holds back for more of its bytes.
+void	InterfaceState::DecodeInput()
+{
+	while (!mDecodeStopping.load(std::memory_order_acquire)) {
+		MIDITimeStamp deadline, now;
+
+		mEngine->DecodeInput();
+		deadline = mEngine->InputDeadline();
+		now = AudioGetCurrentHostTime();
+		if (deadline != 0 && deadline <= now)
+			continue;
+		dispatch_semaphore_wait(mDecodeSemaphore, deadline == 0 ? DISPATCH_TIME_FOREVER
+								: dispatch_time(DISPATCH_TIME_NOW, (int64_t)AudioConvertHostTimeToNanos(deadline - now)));
 	}
-done:
-	;
 }
 
-// whole function is MIDISPORT_SPECIFIC
-// must only be called with mWriteQueueMutex acquired and mWritePending false
-void	InterfaceState::DoWrite()
+// called on the decode thread as the engine delivers the input of a port
+void	InterfaceState::Received(int port, const MIDIPacketList *packets)
 {
-	if (mHaveOutPipe1 || mHaveOutPipe2) {
-		if (!mWriteQueue.empty()) {
-			ByteCount msglen1 = 0, msglen2 = 0;
-            mDriver->PrepareOutput(this, mWriteQueue, mWriteBuf1, &msglen1, mWriteBuf2, &msglen2);
-			if (msglen1 > 0) {
-#if DUMP_OUTPUT
-                IOReturn pipeStatus;
-                                
-				DebugPrintf("OUT1, %ld: ", msglen1);
-				for (ByteCount i = 0; i < msglen1; i += 4) {
-					//if (mWriteBuf1[i+3] == 0)
-					//	break;
-					DebugPrintf("%02X %02X %02X %02X ", mWriteBuf1[i], mWriteBuf1[i+1], mWriteBuf1[i+2], mWriteBuf1[i+3]);
-				}
-				DebugPrintf("");
-                pipeStatus = (*mInterface)->GetPipeStatus(mInterface, mOutPipe1);
-                DebugPrintf("mInterface = 0x%lx, pipeStatus = 0x%x", (unsigned long) mInterface, pipeStatus);
-#endif
-				mWritePending = true;
-				__Verify_noErr((*mInterface)->WritePipeAsync(mInterface, mOutPipe1, mWriteBuf1, (UInt32) msglen1, WriteCallback, this));
+	if ((ItemCount)port < mNumEntities)
+		MIDIReceived(mSources[port], packets);
+}
+
+// __________________________________________________________________________________________________
+// wake the I/O run loop to take what was handed to it, unless it has yet to since it was last woken
+static inline void	SignalSource(CFRunLoopRef runLoop, CFRunLoopSourceRef source, std::atomic<bool> &signalled)
+{
+	if (source != NULL && !signalled.exchange(true, std::memory_order_acq_rel)) {
+		CFRunLoopSourceSignal(source);
+		CFRunLoopWakeUp(runLoop);
+	}
+}
+
+// Called on any of CoreMIDI's threads, the packets are only copied for the I/O run loop to handle.
+// A packet too long for one record is divided between messages, or within a sysex.
+void	InterfaceState::Send(const MIDIPacketList *pktlist, UInt64 portNumber)
+{
+	const MIDIPacket *srcpkt = pktlist->packet;
+    DebugPrintf("InterfaceState::Send %d packets to port %lu", pktlist->numPackets, (unsigned long) portNumber);
+	__Require(portNumber < (UInt64)mNumEntities, done);
+	for (int i = pktlist->numPackets; --i >= 0; ) {
+		const Byte *data = srcpkt->data;
+		ByteCount length = srcpkt->length;
+
+		while (length > 0) {
+			ByteCount recordLength = OutputScheduler::MessagesLength(data, length, mSendQueue.MaxRecordLength());
+
+			if (!mSendQueue.Push(portNumber, srcpkt->timeStamp, data, recordLength)) {
+				DebugPrintf("send queue full, dropped %lu bytes for port %lu", (unsigned long) length, (unsigned long) portNumber);
+				break;
 			}
-			if (msglen2 > 0) {
-#if DUMP_OUTPUT
-				DebugPrintf("OUT2, %ld: ", msglen2);
-				for (ByteCount i = 0; i < msglen2; i += 4) {
-					//if (mWriteBuf2[i+3] == 0)
-					//	break;
-					DebugPrintf("%02X %02X %02X %02X ", mWriteBuf2[i], mWriteBuf2[i+1], mWriteBuf2[i+2], mWriteBuf2[i+3]);
-				}
-				DebugPrintf("");
-#endif
-                mWritePending = true;
-                __Verify_noErr((*mInterface)->WritePipeAsync(mInterface, mOutPipe2, mWriteBuf2, (UInt32) msglen2, WriteCallback, this));
-            }
+			data += recordLength;
+			length -= recordLength;
 		}
+		srcpkt = MIDIPacketNext(srcpkt);
 	}
+	SignalSource(mIORunLoop, mSendSource, mSendSignalled);
+done:
+	;
 }
 
-// this is the IOAsyncCallback (static method)
-void	InterfaceState::WriteCallback(void *refcon, IOReturn asyncWriteResult, void *arg0)
+// Called on any of CoreMIDI's threads, the flush follows the packets already sent through the queue.
+void	InterfaceState::Flush(UInt64 portNumber)
 {
-	__Require_noErr(asyncWriteResult, done);
-	{
-		InterfaceState *self = (InterfaceState *)refcon;
-		bool shouldUnlock = self->mWriteQueueMutex.Lock();
-		// chain another write
-		self->mWritePending = false;
-		self->DoWrite();
-		if (shouldUnlock)
-			self->mWriteQueueMutex.Unlock();
-	}
+	__Require(portNumber < (UInt64)mNumEntities, done);
+	if (!mSendQueue.PushFlush(portNumber))
+		DebugPrintf("send queue full, flush of port %lu dropped", (unsigned long) portNumber);
+	SignalSource(mIORunLoop, mSendSource, mSendSignalled);
 done:
 	;
 }
 
+// Called on any of CoreMIDI's threads, the input of a disabled source is dropped as it is decoded.
+void	InterfaceState::EnableSource(ItemCount port, bool enabled)
+{
+	if (mEngine != NULL)
+		mEngine->SetSourceEnabled((int)port, enabled);
+}
+
+// this is the CFRunLoopSource perform callback (static method), on the same run loop as the transfer callbacks
+void	InterfaceState::SendCallback(void *info)
+{
+	InterfaceState *self = (InterfaceState *)info;
+	self->HandleSent();
+}
+
+// The packets and flushes go to the engine in the order they were sent, which holds the packets
+// stamped for later than the next transfer until they are due, and writes the rest.
+void	InterfaceState::HandleSent()
+{
+	const SentPacket *packet;
+
+	// records handed over from here on signal the source again
+	mSendSignalled.exchange(false, std::memory_order_acq_rel);
+	while ((packet = mSendQueue.Front()) != NULL) {
+		if (packet->flush)
+			mEngine->Flush(packet->portNum);
+		else
+			mEngine->Send(packet->portNum, packet->timeStamp, packet->data, packet->length);
+		mSendQueue.PopFront();
+	}
+	ScheduleService();
+}
+
 // __________________________________________________________________________________________________
 // This class finds interface instances, called from FindDevices()
 class InterfaceLocator : public USBDeviceManager {
@@ -514,19 +586,214 @@ private:
 	USBMIDIDriverBase *	mDriver;
 };
 
+// __________________________________________________________________________________________________
+// This class takes apart the interfaces of removed devices on the I/O run loop, where their
+// transfers complete and their timers and sources fire, so none of those runs once an interface
+// is deleted. Each interface retired is stopped there, releasing the InterfaceRunner's reference,
+// and deleted once the transfers it had outstanding have released theirs, and the driver's epoch
+// has moved past every Send and Flush which could have found it through its handle.
+// One reclaimer serves the driver's I/O run loop, and one is made for each interface on an I/O
+// thread of its own, on that thread's run loop, as the interface is retired.
+class InterfaceReclaimer {
+public:
+	InterfaceReclaimer(Epoch &epoch, CFRunLoopRef ioRunLoop) :
+		mEpoch(epoch),
+		mIORunLoop(ioRunLoop),
+		mSource(NULL),
+		mTimer(NULL),
+		mPending(0)
+	{
+		if (mIORunLoop != NULL) {
+			CFRunLoopSourceContext sourceContext = { 0, this, NULL, NULL, NULL, NULL, NULL, NULL, NULL, PerformCallback };
+			mSource = CFRunLoopSourceCreate(NULL, 0, &sourceContext);
+			if (mSource != NULL)
+				CFRunLoopAddSource(mIORunLoop, mSource, kCFRunLoopDefaultMode);
+
+			// idle until an interface waits for the epoch to advance
+			CFRunLoopTimerContext timerContext = { 0, this, NULL, NULL, NULL };
+			mTimer = CFRunLoopTimerCreate(NULL, CFAbsoluteTimeGetCurrent() + kTimerIdleInterval, kTimerIdleInterval, 0, 0, TimerCallback, &timerContext);
+			if (mTimer != NULL)
+				CFRunLoopAddTimer(mIORunLoop, mTimer, kCFRunLoopDefaultMode);
+		}
+	}
+
+	~InterfaceReclaimer()
+	{
+		if (mTimer != NULL) {
+			CFRunLoopTimerInvalidate(mTimer);
+			CFRelease(mTimer);
+		}
+		if (mSource != NULL) {
+			CFRunLoopSourceInvalidate(mSource);
+			CFRelease(mSource);
+		}
+	}
+
+	// Called on the thread the device is removed on, once the interface is unlinked from its handle.
+	// Without the I/O run loop, no transfer ever calls back, nor does a timer or source fire, so the
+	// interface is deleted as soon as no Send or Flush can be using it.
+	void	Retire(InterfaceState *intf)
+	{
+		intf->mReclaimer = this;
+		if (mSource == NULL) {
+			intf->Stop();
+			mEpoch.Synchronize();
+			delete intf;
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mRetired.push_back(intf);
+			++mPending;
+		}
+		CFRunLoopSourceSignal(mSource);
+		CFRunLoopWakeUp(mIORunLoop);
+	}
+
+	// called on the I/O run loop as the interface's last reference is released
+	void	Unreferenced(InterfaceState *intf)
+	{
+		UnreferencedInterface unreferenced = { intf, mEpoch.Current() };
+
+		mUnreferenced.push_back(unreferenced);
+		CFRunLoopSourceSignal(mSource);
+	}
+
+	// Wait for every interface retired to be deleted, returning false if their transfers have not
+	// all returned within the timeout. On the I/O run loop itself, it is run for them to return.
+	bool	Drain()
+	{
+		if (mIORunLoop != NULL && CFRunLoopGetCurrent() == mIORunLoop) {
+			CFAbsoluteTime until = CFAbsoluteTimeGetCurrent() + kDrainTimeoutMillis * 1.0e-3;
+
+			while (Pending() != 0 && CFAbsoluteTimeGetCurrent() < until)
+				CFRunLoopRunInMode(kCFRunLoopDefaultMode, kDrainRunInterval, true);
+			return Pending() == 0;
+		}
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(kDrainTimeoutMillis);
+
+		while (mPending != 0) {
+			if (mDrained.wait_until(lock, until) == std::cv_status::timeout)
+				break;
+		}
+		return mPending == 0;
+	}
+
+	// whether every interface retired has been deleted, without waiting
+	bool	Drained()
+	{
+		return Pending() == 0;
+	}
+
+private:
+	struct UnreferencedInterface {
+		InterfaceState *	intf;
+		UInt32				epoch;		// when its last reference was released
+	};
+
+	int		Pending()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mPending;
+	}
+
+	// this is the CFRunLoopSource perform callback (static method), on the I/O run loop
+	static void	PerformCallback(void *info)
+	{
+		InterfaceReclaimer *self = (InterfaceReclaimer *)info;
+		self->Reclaim();
+	}
+
+	// this is the CFRunLoopTimerCallBack (static method), on the I/O run loop
+	static void	TimerCallback(CFRunLoopTimerRef timer, void *info)
+	{
+		InterfaceReclaimer *self = (InterfaceReclaimer *)info;
+		self->Reclaim();
+	}
+
+	// must only be called on the I/O run loop
+	// Interfaces are only ever deleted here, between the callbacks of the run loop.
+	void	Reclaim()
+	{
+		std::vector<InterfaceState *> retired;
+		int deleted = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			retired.swap(mRetired);
+		}
+		for (size_t i = 0; i < retired.size(); ++i) {
+			retired[i]->Stop();
+			retired[i]->Release();
+		}
+		// twice, so without a Send or Flush under way an interface goes on the pass it is unreferenced
+		for (int i = 0; i < 2 && !mUnreferenced.empty(); ++i)
+			mEpoch.TryAdvance();
+		for (std::vector<UnreferencedInterface>::iterator it = mUnreferenced.begin(); it != mUnreferenced.end(); ) {
+			if (mEpoch.Passed(it->epoch)) {
+				delete it->intf;
+				it = mUnreferenced.erase(it);
+				++deleted;
+			}
+			else
+				++it;
+		}
+		SetTimerDeadline(mTimer, mUnreferenced.empty() ? 0 : AudioGetCurrentHostTime() + AudioConvertNanosToHostTime(kReclaimRetryNanos));
+		if (deleted != 0) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			mPending -= deleted;
+			if (mPending == 0)
+				mDrained.notify_all();
+		}
+	}
+
+	Epoch &								mEpoch;
+	CFRunLoopRef						mIORunLoop;
+	CFRunLoopSourceRef					mSource;		// calls Reclaim
+	CFRunLoopTimerRef					mTimer;			// calls Reclaim while the epoch has yet to advance
+	std::mutex							mMutex;
+	std::condition_variable				mDrained;
+	std::vector<InterfaceState *>		mRetired;		// waiting to be stopped, guarded by mMutex
+	int									mPending;		// retired and not yet deleted, guarded by mMutex
+	std::vector<UnreferencedInterface>	mUnreferenced;	// only used on the I/O run loop
+};
+
+// must only be called on the I/O run loop
+void	InterfaceState::Release()
+{
+	if (mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		mReclaimer->Unreferenced(this);
+}
+
 // __________________________________________________________________________________________________
 // This class creates runtime states for interface instances, created in Start(), deleted in Stop()
+// The list of interfaces is guarded by mListMutex for EnableSource and FlushAll, which CoreMIDI
+// calls on its own threads. Send and Flush find their interface through its handle instead.
+// The I/O threads of interfaces which the driver wants on their own are started here too, before
+// their interfaces, and stopped once their interfaces have been taken apart on them.
 class InterfaceRunner : public USBDeviceManager {
 public:
 	InterfaceRunner(	USBMIDIDriverBase *	driver,
 						MIDIDeviceListRef	devices ) :
 		USBDeviceManager(CFRunLoopGetCurrent()),
 		mDriver(driver),
+		mReclaimer(new InterfaceReclaimer(driver->mEpoch, MIDIGetDriverIORunLoop())),
+		mReapTimer(NULL),
 		mInitialDeviceList(devices),
 		mNumDevicesFound(0)
 	{
 		ItemCount nDevs = MIDIDeviceListGetNumberOfDevices(mInitialDeviceList);
 
+		// idle until an I/O thread waits for its interface to be deleted
+		if (mRunLoop != NULL) {
+			CFRunLoopTimerContext timerContext = { 0, this, NULL, NULL, NULL };
+			mReapTimer = CFRunLoopTimerCreate(NULL, CFAbsoluteTimeGetCurrent() + kTimerIdleInterval, kTimerIdleInterval, 0, 0, ReapTimerCallback, &timerContext);
+			if (mReapTimer != NULL)
+				CFRunLoopAddTimer(mRunLoop, mReapTimer, kCFRunLoopDefaultMode);
+		}
+
 #if V2_MIDI_DRIVER_SUPPORT
 		if (driver->mVersion >= 2) {
 			// mark everything previously present as offline
@@ -543,13 +810,32 @@ public:
 			ScanDevices();
 	}
 	
+	// the interfaces are taken apart as if their devices were removed, before the driver is
 	~InterfaceRunner()
 	{
-		for (InterfaceStateList::iterator it = mInterfaceStateList.begin(); 
-		it != mInterfaceStateList.end(); ++it) {
+		InterfaceStateList interfaces;
+
+		{
+			std::lock_guard<std::mutex> lock(mListMutex);
+			interfaces.swap(mInterfaceStateList);
+		}
+		for (InterfaceStateList::iterator it = interfaces.begin(); 
+		it != interfaces.end(); ++it) {
 			InterfaceState *rs = *it;
-			delete rs;
+			Retire(rs);
 		}
+		// an interface left with transfers outstanding would call back into the reclaimer
+		if (mReclaimer->Drain())
+			delete mReclaimer;
+		else
+			DebugPrintf("transfers of stopped interfaces have not returned, leaking them");
+		ReapIOThreads(true);
+		if (mReapTimer != NULL) {
+			CFRunLoopTimerInvalidate(mReapTimer);
+			CFRelease(mReapTimer);
+		}
+		for (HandleMap::iterator it = mHandles.begin(); it != mHandles.end(); ++it)
+			delete it->second;
 	}
 
 	virtual bool	MatchDevice(		IOUSBDeviceInterface **	device,
@@ -637,8 +923,9 @@ public:
 			} else {
 				DebugPrintf("old device found");
 			}
-			InterfaceState *ifs = new InterfaceState(mDriver, midiDevice, ioDevice, device, interface);
-			mInterfaceStateList.push_back(ifs);
+			InterfaceState *ifs = new InterfaceState(mDriver, HandleFor(midiDevice), StartIOThread(devVendor, devProduct),
+													 midiDevice, ioDevice, device, interface);
+			AddInterface(ifs);
             DebugPrintf("marking midiDevice online");
 			MIDIObjectSetIntegerProperty(midiDevice, kMIDIPropertyOffline, false);
 		}
@@ -655,8 +942,9 @@ public:
 			// To support multiple device instances properly, we'd need more complex matching code.
 			if (mNumDevicesFound < MIDIDeviceListGetNumberOfDevices(mInitialDeviceList)) {
 				midiDevice = MIDIDeviceListGetDevice(mInitialDeviceList, mNumDevicesFound);
-				InterfaceState *ifs = new InterfaceState(mDriver, midiDevice, ioDevice, device, interface);
-				mInterfaceStateList.push_back(ifs);
+				InterfaceState *ifs = new InterfaceState(mDriver, HandleFor(midiDevice), StartIOThread(devVendor, devProduct),
+														 midiDevice, ioDevice, device, interface);
+				AddInterface(ifs);
 				++mNumDevicesFound;
 				return true;	// keep device/interface open
 			}
@@ -669,25 +957,157 @@ errexit:
 		return false;
 	}
 	
+	// The interface's transfers and the threads sending to it may still be using it, so it is
+	// only unlinked here, and deleted by the reclaimer once they are done with it.
 	virtual void	DeviceRemoved(io_service_t removedDevice)
 	{
+		InterfaceState *removed = NULL;
+
+		{
+			std::lock_guard<std::mutex> lock(mListMutex);
+			for (InterfaceStateList::iterator it = mInterfaceStateList.begin(); 
+			it != mInterfaceStateList.end(); ++it) {
+				InterfaceState *rs = *it;
+				if (rs->mIODevice == removedDevice) {
+					removed = rs;
+					mInterfaceStateList.erase(it);
+					break;
+				}
+			}
+		}
+		if (removed != NULL) {
+            DebugPrintf("shutting down removed device 0x%X", (int)removedDevice);
+			MIDIObjectSetIntegerProperty(removed->mMidiDevice, kMIDIPropertyOffline, true);
+			Retire(removed);
+		}
+	}
+
+	// the handle of a device's destinations stays with it when unplugged, for when it is plugged in again
+	InterfaceHandle *	HandleFor(MIDIDeviceRef midiDevice)
+	{
+		InterfaceHandle *&handle = mHandles[midiDevice];
+
+		if (handle == NULL)
+			handle = new InterfaceHandle;
+		return handle;
+	}
+
+	void			AddInterface(InterfaceState *rs)
+	{
+		std::lock_guard<std::mutex> lock(mListMutex);
+		mInterfaceStateList.push_back(rs);
+	}
+
+	// Send and Flush no longer find the interface, unless the device has been plugged in again already
+	void			Retire(InterfaceState *rs)
+	{
+		InterfaceState *expected = rs;
+
+		rs->mHandle->state.compare_exchange_strong(expected, NULL);
+		if (rs->mIOThread != NULL) {
+			// the interface is taken apart on its own thread, which is stopped once it has been
+			RetiringThread retiring = { rs->mIOThread, new InterfaceReclaimer(mDriver->mEpoch, rs->mIOThread->RunLoop()) };
+
+			mRetiringThreads.push_back(retiring);
+			retiring.reclaimer->Retire(rs);
+			SetTimerDeadline(mReapTimer, AudioGetCurrentHostTime() + AudioConvertNanosToHostTime(kReapIntervalNanos));
+		}
+		else
+			mReclaimer->Retire(rs);
+	}
+
+	// an I/O thread of the interface's own if the driver wants one, NULL to use the driver's
+	IOThread *		StartIOThread(UInt16 devVendor, UInt16 devProduct)
+	{
+		IOThreadPolicy policy = { 0, 0, 0, 0, -1 };
+		IOThread *thread;
+
+		if (!mDriver->GetIOThreadPolicy(devVendor, devProduct, policy))
+			return NULL;
+		thread = new IOThread;
+		if (!thread->Start(policy)) {
+			DebugPrintf("no I/O thread for the interface, using the driver's I/O run loop");
+			delete thread;
+			return NULL;
+		}
+		return thread;
+	}
+
+	// Stop the I/O threads whose interfaces have been deleted, or when draining, wait for each to
+	// be first. A thread is stopped before its reclaimer is deleted, as the reclaimer runs on it.
+	void			ReapIOThreads(bool drain)
+	{
+		for (RetiringThreadList::iterator it = mRetiringThreads.begin(); it != mRetiringThreads.end(); ) {
+			if (drain ? it->reclaimer->Drain() : it->reclaimer->Drained()) {
+				delete it->thread;
+				delete it->reclaimer;
+				it = mRetiringThreads.erase(it);
+			}
+			else if (drain) {
+				DebugPrintf("transfers of a stopped interface have not returned, leaking its I/O thread");
+				it = mRetiringThreads.erase(it);
+			}
+			else
+				++it;
+		}
+		SetTimerDeadline(mReapTimer, mRetiringThreads.empty() ? 0 : AudioGetCurrentHostTime() + AudioConvertNanosToHostTime(kReapIntervalNanos));
+	}
+
+	// this is the CFRunLoopTimerCallBack (static method), on the run loop devices are removed on
+	static void		ReapTimerCallback(CFRunLoopTimerRef timer, void *info)
+	{
+		InterfaceRunner *self = (InterfaceRunner *)info;
+		self->ReapIOThreads(false);
+	}
+	
+	bool			EnableSource(MIDIEndpointRef src, bool enabled)
+	{
+		std::lock_guard<std::mutex> lock(mListMutex);
+
 		for (InterfaceStateList::iterator it = mInterfaceStateList.begin(); 
 		it != mInterfaceStateList.end(); ++it) {
 			InterfaceState *rs = *it;
-			if (rs->mIODevice == removedDevice) {
-                DebugPrintf("shutting down removed device 0x%X", (int)removedDevice);
-				MIDIObjectSetIntegerProperty(rs->mMidiDevice, kMIDIPropertyOffline, true);
-				delete rs;
-				mInterfaceStateList.erase(it);
-				break;
+			if (rs->mSources == NULL)
+				continue;
+			for (ItemCount ient = 0; ient < rs->mNumEntities; ++ient) {
+				if (rs->mSources[ient] == src) {
+					rs->EnableSource(ient, enabled);
+					return true;
+				}
 			}
 		}
+		return false;
 	}
 	
+	void			FlushAll()
+	{
+		std::lock_guard<std::mutex> lock(mListMutex);
+
+		for (InterfaceStateList::iterator it = mInterfaceStateList.begin(); 
+		it != mInterfaceStateList.end(); ++it) {
+			InterfaceState *rs = *it;
+			for (ItemCount port = 0; port < rs->mNumEntities; ++port)
+				rs->Flush(port);
+		}
+	}
+	
+	// the I/O thread of a removed device, and the reclaimer taking its interface apart on it
+	struct RetiringThread {
+		IOThread *				thread;
+		InterfaceReclaimer *	reclaimer;
+	};
+
     typedef std::vector<InterfaceState *> InterfaceStateList;
+	typedef std::map<MIDIDeviceRef, InterfaceHandle *> HandleMap;
+	typedef std::vector<RetiringThread> RetiringThreadList;
 
 	USBMIDIDriverBase *		mDriver;
+	InterfaceReclaimer *	mReclaimer;			// of the interfaces on the driver's I/O run loop
+	std::mutex				mListMutex;
 	InterfaceStateList		mInterfaceStateList;
+	HandleMap				mHandles;			// only used on the thread devices are found and removed on
+	RetiringThreadList		mRetiringThreads;	// likewise
+	CFRunLoopTimerRef		mReapTimer;			// calls ReapIOThreads while a thread waits to be stopped
 	MIDIDeviceListRef		mInitialDeviceList;
 	ItemCount				mNumDevicesFound;
 };
@@ -738,10 +1158,11 @@ OSStatus	USBMIDIDriverBase::Stop()
 }
 
 // __________________________________________________________________________________________________
+// The interface found through the handle is used within an epoch, see InterfaceHandle.
 OSStatus	USBMIDIDriverBase::Send(const MIDIPacketList *pktlist, void *endptRef1, void *endptRef2)
 {
-	InterfaceState *intf = (InterfaceState *)endptRef1;
-	if (intf == NULL)
+	InterfaceHandle *handle = (InterfaceHandle *)endptRef1;
+	if (handle == NULL)
         return kMIDIUnknownEndpoint;
 #if ANALYZE_THRU_TIMING
 	const MIDIPacket *pkt = &pktlist->packet[0];
@@ -755,226 +1176,46 @@ OSStatus	USBMIDIDriverBase::Send(const MIDIPacketList *pktlist, void *endptRef1,
 	}
 #endif
 
-	intf->Send(pktlist, (UInt64)endptRef2);	// endptRef2 = port number
+	UInt32 epoch = mEpoch.Enter();
+	InterfaceState *intf = handle->state.load(std::memory_order_acquire);
+	if (intf != NULL)
+		intf->Send(pktlist, (UInt64)endptRef2);	// endptRef2 = port number
+	mEpoch.Exit(epoch);
 
+	if (intf == NULL)
+		return kMIDIUnknownEndpoint;	// the device is unplugged
 	return noErr;
 }
 
 // __________________________________________________________________________________________________
-void	USBMIDIDriverBase::USBMIDIHandleInput(	InterfaceState *intf, 
-												MIDITimeStamp when, 
-												Byte *readBuf,
-												ByteCount bufSize )
+// CoreMIDI enables a source while a client is connected to it, the input of the others is not
+// delivered. Sources are enabled until disabled, so no input is lost waiting for the first call.
+OSStatus	USBMIDIDriverBase::EnableSource(MIDIEndpointRef src, Boolean enabled)
 {
-	Byte *src = readBuf, *srcend = src + bufSize;
-	Byte pbuf[512];
-	MIDIPacketList *pktlist = (MIDIPacketList *)pbuf;
-	MIDIPacket *pkt = MIDIPacketListInit(pktlist);
-	ItemCount prevCable = -1;	// signifies none
-	bool insysex = false;
-	int nbytes;
-	
-#if DUMP_INPUT
-	if (src[0] == 0) return;
-	DebugPrintf("IN:  ");
-#endif
-
-	for ( ; src < srcend; src += 4) {
-		if (src[0] == 0)
-			break;		// done (is this according to spec or Roland-specific???)
-		
-#if DUMP_INPUT		
-		DebugPrintf("%02X %02X %02X %02X  ", src[0], src[1], src[2], src[3]);
-#endif
-		
-		ItemCount cable = src[0] >> 4;
-		
-		// support single-entity devices that seem to use an arbitrary cable number
-		// (besides which, it's good to have range-checking)
-		if (cable < 0) cable = 0;
-		else if (cable >= intf->mNumEntities) cable = intf->mNumEntities - 1;
-		
-		if (prevCable != -1 && cable != prevCable) {
-			MIDIReceived(intf->mSources[prevCable], pktlist);
-			pkt = MIDIPacketListInit(pktlist);
-			insysex = false;
-		}
-		prevCable = cable;
-		int cin = src[0] & 0x0F;
-		switch (cin) {
-		case 0x0:		// reserved
-		case 0x1:		// reserved
-			break;
-		case 0xF:		// single byte
-			pkt = MIDIPacketListAdd(pktlist, sizeof(pbuf), pkt, when, 1, src + 1);
-			break;
-		case 0x2:		// 2-byte system common
-		case 0xC:		// program change
-		case 0xD:		// mono pressure
-			pkt = MIDIPacketListAdd(pktlist, sizeof(pbuf), pkt, when, 2, src + 1);
-			break;
-		case 0x4:		// sysex starts or continues
-			insysex = true;
-			// --- fall ---
-		case 0x3:		// 3-byte system common
-		case 0x8:		// note-off
-		case 0x9:		// note-on
-		case 0xA:		// poly pressure
-		case 0xB:		// control change
-		case 0xE:		// pitch bend
-			pkt = MIDIPacketListAdd(pktlist, sizeof(pbuf), pkt, when, 3, src + 1);
-			break;
-		case 0x5:		// single byte system-common, or sys-ex ends with one byte
-			if (src[1] != 0xF7) {
-				pkt = MIDIPacketListAdd(pktlist, sizeof(pbuf), pkt, when, 1, src + 1);
-				break;
-			}
-			// --- fall ---
-		case 0x6:		// sys-ex ends with two bytes
-		case 0x7:		// sys-ex ends with three bytes
-			nbytes = cin - 4;
-			if (insysex) {
-				insysex = false;
-				// MIDIPacketListAdd will make a separate packet unnecessarily,
-				// so do our own concatentation onto the current packet
-				memcpy(&pkt->data[pkt->length], src + 1, nbytes);
-				pkt->length += nbytes;
-			} else {
-				pkt = MIDIPacketListAdd(pktlist, sizeof(pbuf), pkt, when, nbytes, src + 1);
-			}
-			break;
-		}
-	}
-	if (pktlist->numPackets > 0 && prevCable != -1) {
-		MIDIReceived(intf->mSources[prevCable], pktlist);
-#if DUMP_INPUT
-		DebugPrintf("");
-#endif
-	}
+	if (mInterfaceRunner == NULL || !mInterfaceRunner->EnableSource(src, enabled))
+		return kMIDIUnknownEndpoint;
+	return noErr;
 }
 
 // __________________________________________________________________________________________________
-// WriteQueue is an STL list of VLMIDIPacket's to be transmitted, presumably containing
-// at least one element.
-// Fill one USB buffer, destBuf, with a size of bufSize, with outgoing data in USB-MIDI format.
-// Return the number of bytes written.
-ByteCount	USBMIDIDriverBase::USBMIDIPrepareOutput(	InterfaceState *intf, 
-														WriteQueue &writeQueue, 			
-														Byte *destBuf, 
-														ByteCount bufSize )
+// dest is 0 when every destination is flushed
+OSStatus	USBMIDIDriverBase::Flush(MIDIEndpointRef dest, void *endptRef1, void *endptRef2)
 {
-	Byte *dest = destBuf, *destend = dest + bufSize;
-	
-	while (true) {
-		if (writeQueue.empty()) {
-			// the MPU64 wants a full 4 bytes of zeroes for termination, not just 1
-			*dest++ = 0;
-			*dest++ = 0;
-			*dest++ = 0;
-			*dest++ = 0;
-			return dest - destBuf;
-			
-			//return bufSize;	//dest - destBuf;
-		}
-		
-		WriteQueueElem *wqe = &writeQueue.front();
-		Byte cableNibble = wqe->portNum << 4;
-		VLMIDIPacket *pkt = wqe->packet;
-		Byte *src = pkt->data + wqe->bytesSent;
-		Byte *srcend = &pkt->data[pkt->length];
-
-		while (src < srcend && dest < destend) {
-			Byte c = *src++;
-			
-			switch (c >> 4) {
-			case 0x0: case 0x1: case 0x2: case 0x3:
-			case 0x4: case 0x5: case 0x6: case 0x7:
-				// data byte, presumably a sysex continuation
-				// F0 is also handled the same way
-inSysEx:
-				dest[1] = c;
-				if ((dest[2] = *src++) == 0xF7) {
-					dest[0] = cableNibble | 6;		// sysex ends with following 2 bytes
-					dest[3] = 0;
-				} else if ((dest[3] = *src++) == 0xF7)
-					dest[0] = cableNibble | 7;		// sysex ends with following 3 bytes
-				else
-					dest[0] = cableNibble | 4;		// sysex continues
-				dest += 4;
-				break;
-			case 0x8:	// note-off
-			case 0x9:	// note-on
-			case 0xA:	// poly pressure
-			case 0xB:	// control change
-			case 0xE:	// pitch bend
-				*dest++ = cableNibble | (c >> 4);
-				*dest++ = c;
-				*dest++ = *src++;
-				*dest++ = *src++;
-				break;
-			case 0xC:	// program change
-			case 0xD:	// mono pressure
-				*dest++ = cableNibble | (c >> 4);
-				*dest++ = c;
-				*dest++ = *src++;
-				*dest++ = 0;
-				break;
-			case 0xF:	// system message
-				switch (c) {
-				case 0xF0:	// sysex start
-					goto inSysEx;
-				case 0xF8:	// clock
-				case 0xFA:	// start
-				case 0xFB:	// continue
-				case 0xFC:	// stop
-				case 0xFE:	// active sensing
-				case 0xFF:	// system reset
-					*dest++ = cableNibble | 0xF;// 1-byte system realtime
-					*dest++ = c;
-					*dest++ = 0;
-					*dest++ = 0;
-					break;
-				case 0xF6:	// tune request (0)
-				case 0xF7:	// EOX
-					*dest++ = cableNibble | 5;	// 1-byte system common or sysex ends with one byte
-					*dest++ = c;
-					*dest++ = 0;
-					*dest++ = 0;
-					break;
-				case 0xF1:	// MTC (1)
-				case 0xF3:	// song select (1)
-					*dest++ = cableNibble | 2;	// 2-byte system common
-					*dest++ = c;
-					*dest++ = *src++;
-					*dest++ = 0;
-					break;
-				case 0xF2:	// song pointer (2)
-					*dest++ = cableNibble | 3;	// 3-byte system common
-					*dest++ = c;
-					*dest++ = *src++;
-					*dest++ = *src++;
-					break;
-				default:
-					// unknown MIDI message! advance until we find a status byte
-					while (src < srcend && *src < 0x80)
-						++src;
-					break;
-				}
-				break;
-			}
-		
-			if (src == srcend) {
-				// source packet completely sent
-				delete wqe->packet;
-				writeQueue.pop_front();
-			} else
-				wqe->bytesSent = src - pkt->data;
-			
-			if (dest > destend - 4) {
-				// destBuf completely filled
-				return dest - destBuf;
-			}
-			// we didn't fill the output buffer, is there more source data in the write queue?
-		}
+	if (dest == 0) {
+		if (mInterfaceRunner != NULL)
+			mInterfaceRunner->FlushAll();
+		return noErr;
 	}
+	InterfaceHandle *handle = (InterfaceHandle *)endptRef1;
+	if (handle == NULL)
+        return kMIDIUnknownEndpoint;
+
+	UInt32 epoch = mEpoch.Enter();
+	InterfaceState *intf = handle->state.load(std::memory_order_acquire);
+	if (intf != NULL)
+		intf->Flush((UInt64)endptRef2);	// endptRef2 = port number
+	mEpoch.Exit(epoch);
+	if (intf == NULL)
+		return kMIDIUnknownEndpoint;
+	return noErr;
 }
@@ -42,32 +42,25 @@
 
 #include <vector>
 #include <list>
+#include <atomic>
 #include <pthread.h>
+#include <dispatch/dispatch.h>
 #include <CoreMIDI/MIDISetup.h>
 #include "MIDIDriverClass.h"
 #include "USBUtils.h"
-#include "VLMIDIPacket.h"
+#include "SendQueue.h"
+#include "InterfaceInfo.h"
+#include "MIDISink.h"
+#include "MidisportEngine.h"
+#include "IOKitTransport.h"
+#include "Epoch.h"
+#include "IOThread.h"
 
 class InterfaceState;
 class InterfaceRunner;
+class InterfaceReclaimer;
 
 
-class WriteQueueElem {
-public:
-	VLMIDIPacket *		packet;
-	UInt8				portNum;
-	ByteCount			bytesSent;	// this much of the packet has been sent
-};
-
-typedef std::list<WriteQueueElem> WriteQueue;
-
-struct InterfaceInfo {
-	UInt8				inEndpointType;		// kUSBBulk, etc.
-	UInt8				outEndpointType;
-	UInt32  			readBufferSize;
-	UInt32  			writeBufferSize;
-};
-
 // some Apple-defined properties useful for USB drivers to attach to their devices
 #define kUSBLocationProperty		CFSTR("USBLocationID")
 #define kUSBVendorProductProperty	CFSTR("USBVendorProduct")
@@ -77,6 +70,14 @@ struct InterfaceInfo {
 // USBMIDIDriverBase
 //
 // MIDIDriver subclass, derive your USB MIDI driver from this
+// It runs each interface's data path on a MidisportEngine, from MIDISPORTCore, so it drives
+// devices which speak the MIDISPORT's mspacket format alone. A subclass says which devices it
+// wants and how to run them, by MatchDevice, GetInterfaceToUse, CreateDevice and
+// GetInterfaceInfo, and may talk to the device as its interface starts and stops. There are no
+// HandleInput and PrepareOutput virtuals to encode MIDI, nor the class compliant
+// USBMIDIHandleInput and USBMIDIPrepareOutput of Apple's sample: the engine decodes, queues and
+// encodes, and a USB MIDI class compliant device needs a driver of its own, or none, CoreMIDI's
+// own class driver serving it.
 class USBMIDIDriverBase : public MIDIDriver {
 public:
 	USBMIDIDriverBase(CFUUIDRef factoryID);
@@ -89,6 +90,11 @@ public:
 	virtual OSStatus	Send(				const MIDIPacketList *pktlist,
 											void *endptRef1,
 											void *endptRef2 );
+	virtual OSStatus	EnableSource(		MIDIEndpointRef src,
+											Boolean enabled );
+	virtual OSStatus	Flush(				MIDIEndpointRef dest,
+											void *endptRef1,
+											void *endptRef2 );
 
 	// our own virtual methods
 
@@ -120,95 +126,93 @@ public:
 							// given an interface, get its info: endpoint types to use,
 							// read size
 
+	virtual bool		GetIOThreadPolicy(	UInt16			devVendor,
+											UInt16			devProduct,
+											IOThreadPolicy	&policy ) { return false; }
+							// given a USB device's vendor/product IDs, return whether its
+							// interface is to run on an I/O thread of its own, rather than
+							// the driver's I/O run loop, and how that thread is scheduled
+
 	virtual void		StartInterface(		InterfaceState *intf ) = 0;
 							// pipes are opened, do any extra initialization (send config msgs etc)
 							
 	virtual void		StopInterface(		InterfaceState *intf ) = 0;
 							// pipes are about to be closed, do any preliminary cleanup
 							
-	virtual void		HandleInput(		InterfaceState *intf,
-											MIDITimeStamp when,
-											Byte *readBuf,
-											ByteCount readBufSize ) = 0;
-							// a USB message arrived, parse it into a MIDIPacketList and
-							// call MIDIReceived
-	virtual void	PrepareOutput(InterfaceState *intf, WriteQueue &writeQueue, 
-                            Byte *destBuf1, ByteCount *bufCount1,
-                            Byte *destBuf2, ByteCount *bufCount2) = 0;
-                                                        //  Called with the queue mutex locked.
-
-	// Utilities to implement the USB MIDI class spec methods of encoding MIDI in USB packets
-	static void			USBMIDIHandleInput(	InterfaceState *intf, 
-											MIDITimeStamp when,
-											Byte *readBuf,
-											ByteCount bufSize );
-
-	static ByteCount	USBMIDIPrepareOutput(InterfaceState *intf,
-											WriteQueue &writeQueue, 
-											Byte *destBuf,
-											ByteCount bufSize );
-
 private:
-	InterfaceRunner		*mInterfaceRunner;
-};
+	friend class InterfaceRunner;
 
-// _________________________________________________________________________________________
-// IOBuffer
-// 
-// encapsulates everything needed for a piece of memory which is used as an I/O buffer
-// not necessary but is future-looking...
-class IOBuffer {
-public:
-	IOBuffer();
-	~IOBuffer();
-
-	void		Allocate(UInt32 size);
-	Byte *		Buffer() const		{ return mBuffer; }
-	operator Byte * () const		{ return mBuffer; }
-
-private:
-	Byte *		mBuffer;		// points into region in mMemory
-	Byte *		mMemory;		// allocated with operator new[]
+	InterfaceRunner		*mInterfaceRunner;
+	Epoch				mEpoch;			// of the threads in Send and Flush, see InterfaceHandle
 };
 
 // _________________________________________________________________________________________
-// Mutex
+// InterfaceHandle
 //
-// a pthread mutex with handling of recursive locking
-class Mutex {
-public:
-	Mutex();
-	~Mutex();
-	
-	bool			Lock();		// return true if Unlock() should be called
-	void			Unlock();
-
-private:
-	pthread_mutex_t	mMutex;
-	pthread_t		mOwner;
+// The refcon of a device's destinations, which stands for the device across it being unplugged
+// and plugged in again. Send and Flush find the interface through it within an epoch of the
+// driver's, so an interface unlinked from its handle is only deleted once every thread which
+// could have found it has left, without a lock taken in either.
+struct InterfaceHandle {
+	InterfaceHandle() : state(NULL) { }
+
+	std::atomic<InterfaceState *>	state;		// NULL while the device is unplugged
 };
 
 // _________________________________________________________________________________________
 // InterfaceState
 // 
 // This class is the runtime state for one interface instance
-class InterfaceState {
+// Its MidisportEngine runs the data path over an IOKitTransport, on the I/O run loop, where the
+// transfers complete and the service timer fires when the engine is next due.
+// Send and Flush only hand their requests to the I/O run loop, which alone runs the engine,
+// so CoreMIDI's threads never wait on a transfer being prepared or completed.
+// Likewise the engine only hands completed reads to the interface's decode thread, which
+// alone decodes them, so a slow MIDIReceived never holds up the reads.
+// An interface is taken apart on the I/O run loop, by the InterfaceReclaimer of the removed device,
+// once every transfer it started has returned, each holding a reference to it until then.
+// "The I/O run loop" is mIORunLoop throughout, the driver's, or that of an IOThread the
+// InterfaceRunner started for the interface alone.
+class InterfaceState : public MIDISink, public InputHandoff {
 public:
 	InterfaceState(	USBMIDIDriverBase *			driver,
+					InterfaceHandle *			handle,
+					IOThread *					ioThread,
 					MIDIDeviceRef				midiDevice, 
 					io_service_t				ioDevice,
 					IOUSBDeviceInterface **		usbDevice, 
 					IOUSBInterfaceInterface **	usbInterface);
 
 	virtual ~InterfaceState();
-	
-	void		DoRead();	
-	static void	ReadCallback(void *refcon, IOReturn result, void *arg0);
-	void		DoWrite();	
-	static void	WriteCallback(void *refcon, IOReturn result, void *arg0);
 
-	void		HandleInput(ByteCount bytesReceived);
+	void		Stop();
+					// abort the pipes, no transfer is started again
+	void		Retain()	{ mRefCount.fetch_add(1, std::memory_order_relaxed); }
+	void		Release();
+					// the last release hands the interface to mReclaimer to be deleted
+	void		TransferReturned();
+					// called by mTransport once a transfer's callback has returned
+	
+	void		ScheduleService();
+					// fire the service timer when the engine is next due
+	static void	ServiceTimerCallback(CFRunLoopTimerRef timer, void *info);
+
+	virtual void	ReadCompleted();
+	virtual void	ReadsStarved();
+					// InputHandoff, wake the decode thread, or restart the reads it starved
+	static void	RestartReadCallback(void *info);
+	static void *	DecodeThread(void *arg);
+	void		DecodeInput();
+					// the decode thread's loop, until mDecodeStopping
+	virtual void	Received(int port, const MIDIPacketList *packets);
+					// MIDISink, passes the packets the engine decodes to MIDIReceived on the port's source
 	void		Send(const MIDIPacketList *pktlist, UInt64 portNumber);
+	void		Flush(UInt64 portNumber);
+					// drop the output sent to the port and not yet written, held or queued
+	void		EnableSource(ItemCount port, bool enabled);
+	static void	SendCallback(void *info);
+	void		HandleSent();
+					// hand the engine the packets Send handed over, and carry out Flush
 	
 	void		GetInterfaceInfo(InterfaceInfo &info) 
 	{
@@ -217,35 +221,34 @@ public:
 	
 	// leave data members public, for benefit of driver methods
 	USBMIDIDriverBase *			mDriver;
+	InterfaceHandle *			mHandle;			// the refcon of the destinations
+	std::atomic<int>			mRefCount;			// the InterfaceRunner's, and one per transfer outstanding
+	InterfaceReclaimer *		mReclaimer;			// set once the device is removed
 	MIDIDeviceRef				mMidiDevice;
 	io_service_t				mIODevice;
 	IOUSBDeviceInterface **		mDevice; 
 	IOUSBInterfaceInterface	**	mInterface;
-	UInt8						mInPipe, mOutPipe1, mOutPipe2;
-	bool						mHaveInPipe, mHaveOutPipe1, mHaveOutPipe2;
 	InterfaceInfo				mInterfaceInfo;
 	ItemCount					mNumEntities;
 	MIDIEndpointRef *			mSources;
-	IOBuffer					mReadBuf, mWriteBuf1, mWriteBuf2;
+	IOKitTransport				mTransport;
+	MidisportEngine *			mEngine;			// NULL if the interface has none of the MIDISPORT's pipes
+	bool						mStopping;			// the pipes are aborted, not recovered
+	CFRunLoopTimerRef			mServiceTimer;		// calls the engine's Service
+	MIDITimeStamp				mServiceDeadline;	// the timer's, 0 while it idles
 	
-	WriteQueue					mWriteQueue;
-	Mutex						mWriteQueueMutex;
-
-	bool						mWritePending;
-
-	// input parse state
-	Byte						mReadCable;
-	bool						mInSysEx;
-	Byte						mRunningStatus;
-	
-	// output state
-	Byte						mWriteCable;
+	SendQueue					mSendQueue;			// the packets sent, on their way to the I/O run loop
+	IOThread *					mIOThread;			// the interface's own, owned by the InterfaceRunner,
+													// NULL on the driver's I/O run loop
+	CFRunLoopRef				mIORunLoop;
+	CFRunLoopSourceRef			mSendSource;		// calls HandleSent on the I/O run loop
+	std::atomic<bool>			mSendSignalled;		// mSendSource is signalled, HandleSent has yet to run
+	CFRunLoopSourceRef			mRestartReadSource;	// calls the engine's RestartReads on the I/O run loop
+	pthread_t					mDecodeThread;		// runs DecodeInput
+	bool						mHaveDecodeThread;
+	dispatch_semaphore_t		mDecodeSemaphore;	// wakes the decode thread
+	std::atomic<bool>			mDecodeStopping;
 };
 
 
-// utilities
-int		MIDIDataBytes(Byte statusByte);
-			// returns number of data bytes that follow a given status byte
-			// (which can be anything except F0, F7, and realtime status bytes)
-
 #endif // __USBMIDIDriverBase_h__
@@ -0,0 +1,1080 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Benchmarks of the protocol engine, run over InMemoryTransport and ManualClock, so what is timed is
+// the engine's own work, without USB or CoreMIDI, and without threads unless they are what is
+// measured. Each prints a line of its rate. The benchmarks named on the command line are run, all
+// of them if none is.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "TestSupport.h"
+#include "DeviceDefaults.h"
+#include "MidisportOutputEncoder.h"
+#include "OutputScheduler.h"
+#include "SendQueue.h"
+
+typedef void (*BenchFunction)();
+
+// every allocation of the benchmarks counted, for the allocations benchmark
+static std::atomic<UInt64>	sAllocations(0);
+
+void *	operator new(size_t size)
+{
+	void *p = malloc(size != 0 ? size : 1);
+
+	sAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void	operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void	operator delete(void *p, size_t /*size*/) noexcept
+{
+	free(p);
+}
+
+static double	SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// reads full of note-ons for both ports, decoded and delivered
+static void	BenchInput()
+{
+	const int kReads = 200000;
+	EngineFixture f;
+	std::vector<Byte> read;
+
+	for (int i = 0; i < 8; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)(0x3C + i), 0x40 };
+		std::vector<Byte> mspacket = MSPackets(i & 1, std::vector<Byte>(noteOn, noteOn + 3));
+
+		read.insert(read.end(), mspacket.begin(), mspacket.end());
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < kReads; ++i) {
+		f.transport.Input(f.inPipe, read.data(), read.size());
+		f.transport.Deliver();
+		f.sink.Clear();
+	}
+	double seconds = SecondsSince(start);
+	printf("input: %d reads of 8 messages in %.1f ms, %.2fM messages/s\n", kReads, seconds * 1e3, kReads * 8 / seconds / 1e6);
+}
+
+// messages to both ports, encoded and written as fast as the writes complete
+static void	BenchOutput()
+{
+	const int kMessages = 500000;
+	EngineFixture f;
+	ItemCount written = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < kMessages; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+
+		f.engine.Send(i & 1, 0, noteOn, sizeof(noteOn));
+		if ((i & 7) == 7) {
+			written += f.transport.CompleteWrites(f.outPipe1) + f.transport.CompleteWrites(f.outPipe2);
+			f.transport.Deliver();
+			f.transport.ClearWritten(f.outPipe1);
+			f.transport.ClearWritten(f.outPipe2);
+		}
+	}
+	f.WriteAll();
+	double seconds = SecondsSince(start);
+	printf("output: %d messages in %.1f ms, %lu transfers, %.2fM messages/s\n", kMessages, seconds * 1e3,
+		   (unsigned long)written, kMessages / seconds / 1e6);
+}
+
+// messages sent ahead of their time stamps, held and released as the clock reaches them
+static void	BenchHeldOutput()
+{
+	const int kMessages = 200000;
+	const int kAhead = 256;
+	EngineFixture f;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < kMessages; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+
+		// a message a millisecond, sent kAhead milliseconds ahead
+		f.engine.Send(i & 1, f.clock.Now() + kAhead * 1000000ULL, noteOn, sizeof(noteOn));
+		f.clock.Advance(1000000);
+		f.Run();
+		f.transport.CompleteWrites(f.outPipe1);
+		f.transport.CompleteWrites(f.outPipe2);
+		f.transport.ClearWritten(f.outPipe1);
+		f.transport.ClearWritten(f.outPipe2);
+	}
+	double seconds = SecondsSince(start);
+	printf("held output: %d messages held %d ms in %.1f ms, %.2fM messages/s\n", kMessages, kAhead, seconds * 1e3,
+		   kMessages / seconds / 1e6);
+}
+
+// A mix of messages, program changes, notes and clock bytes, encoded a message per mspacket and then
+// packed, the mspackets counted as the dwords each takes of the OUT transfers. kMessages is a
+// multiple of 32, so every message is written.
+static void	BenchPacking()
+{
+	const int kMessages = 300000;
+
+	for (int packed = 0; packed < 2; ++packed) {
+		InterfaceInfo info = TestInterfaceInfo();
+		ItemCount mspackets = 0;
+
+		info.packOutputBytes = packed != 0;
+		EngineFixture f(info);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < kMessages; i += 4) {
+			const Byte programChange[2] = { 0xC0, (Byte)(i & 0x7F) };
+			const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+			const Byte clock[1] = { 0xF8 };
+			const Byte noteOff[3] = { 0x80, (Byte)(i & 0x7F), 0x40 };
+
+			f.engine.Send(0, 0, programChange, sizeof(programChange));
+			f.engine.Send(0, 0, noteOn, sizeof(noteOn));
+			f.engine.Send(0, 0, clock, sizeof(clock));
+			f.engine.Send(0, 0, noteOff, sizeof(noteOff));
+			// the device takes the transfers of every 32 messages at once, the rest waiting meanwhile
+			if ((i & 31) != 28)
+				continue;
+			f.WriteAll();
+
+			const std::vector<Byte> &written = f.transport.Written(f.outPipe1);
+			for (size_t m = 0; m < written.size(); m += MIDIPACKETLEN)
+				if (written[m + CMDINDEX] != 0)
+					++mspackets;
+			f.transport.ClearWritten(f.outPipe1);
+		}
+		double seconds = SecondsSince(start);
+		printf("packing %s: %d messages in %.1f ms, %.2f dwords/message, %.2fM messages/s\n", packed ? "on" : "off",
+			   kMessages, seconds * 1e3, (double)mspackets / kMessages, kMessages / seconds / 1e6);
+	}
+}
+
+// Dense chords, struck and released, and controller sweeps, sent without running status, with it,
+// and with the note-offs sent as note-ons too, the bytes written for the cable timed at 31250 baud.
+// kMessages is a multiple of 16, so every message is written.
+static void	BenchRunningStatus()
+{
+	const int kMessages = 160000;
+	const char *modes[3] = { "off", "on", "on, note-offs as note-ons" };
+	UInt64 unshortened = 0;
+
+	for (int mode = 0; mode < 3; ++mode) {
+		InterfaceInfo info = TestInterfaceInfo();
+		UInt64 cableBytes = 0;
+
+		info.runningStatus = mode >= 1;
+		info.noteOffAsNoteOn = mode >= 2;
+		EngineFixture f(info);
+		for (int i = 0; i < kMessages; i += 16) {
+			for (int note = 0; note < 4; ++note) {
+				const Byte noteOn[3] = { 0x90, (Byte)(0x3C + note * 4), 0x64 };
+				f.engine.Send(0, 0, noteOn, sizeof(noteOn));
+			}
+			for (int cc = 0; cc < 8; ++cc) {
+				const Byte controller[3] = { 0xB0, 0x07, (Byte)((i + cc) & 0x7F) };
+				f.engine.Send(0, 0, controller, sizeof(controller));
+			}
+			for (int note = 0; note < 4; ++note) {
+				const Byte noteOff[3] = { 0x80, (Byte)(0x3C + note * 4), 0x40 };
+				f.engine.Send(0, 0, noteOff, sizeof(noteOff));
+			}
+			f.WriteAll();
+
+			std::vector<Byte> streams[MAX_PORTS];
+			DecodeOutput(f.transport.Written(f.outPipe1), streams);
+			cableBytes += streams[0].size();
+			f.transport.ClearWritten(f.outPipe1);
+		}
+		if (mode == 0)
+			unshortened = cableBytes;
+		printf("running status %s: %d messages, %llu bytes, %.2f s of cable time, %.1f%% saved\n", modes[mode], kMessages,
+			   (unsigned long long)cableBytes, cableBytes * MIDI_BYTE_NANOS / 1e9,
+			   100.0 * (unshortened - cableBytes) / unshortened);
+	}
+}
+
+// A port paced to its cable and sent twice what the cable carries, a controller sweep and pitch
+// bend each millisecond with a note every ten, its transfers taken each USB frame. How long the notes
+// wait to be taken by the device, with the queues coalescing and without, in simulated time.
+static void	BenchCoalescing()
+{
+	const int kMilliseconds = 2000;
+	const int kNotes = kMilliseconds / 10;
+
+	for (int coalesce = 0; coalesce < 2; ++coalesce) {
+		InterfaceInfo info = TestInterfaceInfo();
+		std::vector<MIDITimeStamp> sent(kNotes), taken(kNotes, 0);
+		int notes = 0;
+
+		info.coalesceOutput = coalesce != 0;
+		info.outputBufferSize = 16;
+		EngineFixture f(info);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int ms = 0; ms < 4 * kMilliseconds; ++ms) {
+			if (ms < kMilliseconds) {
+				const Byte modWheel[3] = { 0xB0, 1, (Byte)(ms & 0x7F) };
+				const Byte pitchBend[3] = { 0xE0, 0, (Byte)((ms >> 1) & 0x7F) };
+
+				f.engine.Send(0, 0, modWheel, sizeof(modWheel));
+				f.engine.Send(0, 0, pitchBend, sizeof(pitchBend));
+				if (ms % 10 == 0) {
+					const Byte noteOn[3] = { 0x90, (Byte)(notes & 0x7F), (Byte)(1 + (notes >> 7)) };
+
+					sent[notes++] = f.clock.Now();
+					f.engine.Send(0, 0, noteOn, sizeof(noteOn));
+				}
+			}
+			f.AdvanceTo(f.clock.Now() + 1000000);
+			f.transport.CompleteWrites(f.outPipe1);
+			f.Run();
+
+			std::vector<Byte> streams[MAX_PORTS];
+			DecodeOutput(f.transport.Written(f.outPipe1), streams);
+			for (size_t m = 0; m + 3 <= streams[0].size(); m += 3)
+				if (streams[0][m] == 0x90)
+					taken[streams[0][m + 1] + ((streams[0][m + 2] - 1) << 7)] = f.clock.Now();
+			f.transport.ClearWritten(f.outPipe1);
+		}
+		double seconds = SecondsSince(start);
+
+		MIDITimeStamp maxWait = 0, totalWait = 0;
+		int lost = 0;
+		for (int n = 0; n < kNotes; ++n) {
+			if (taken[n] == 0) {
+				++lost;
+				continue;
+			}
+			maxWait = std::max(maxWait, taken[n] - sent[n]);
+			totalWait += taken[n] - sent[n];
+		}
+		printf("coalescing %s: %d notes at twice the cable rate, wait mean %.1f ms, max %.1f ms, %d untaken, "
+			   "%llu coalesced, %.1f ms\n", coalesce ? "on" : "off", kNotes, totalWait / 1e6 / (kNotes - lost),
+			   maxWait / 1e6, lost, (unsigned long long)f.engine.GetOutput().Coalesced(), seconds * 1e3);
+	}
+}
+
+// Full reads of an 8x8/S, as the device list has it, each of MTC quarter frames from its SMPTE port
+// and note-ons to its eight MIDI ins, decoded with every source enabled, with the SMPTE port's
+// disabled, and with all but the first MIDI in's disabled. What a read costs, and what is received.
+static void	BenchDisabledSources()
+{
+	const int kReads = 200000;
+	const char *modes[3] = { "none", "SMPTE", "all but one" };
+	DeviceEntry entry;
+	int numOutputPorts;
+
+	if (!ReadDeviceEntry("MIDISPORT 8x8/S", entry)) {
+		printf("disabled sources: no 8x8/S in the device list\n");
+		return;
+	}
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+	int smptePort = DeviceInteger(entry, "SMPTEPort", info.numInputPorts - 1);
+	std::vector<Byte> read;
+	int notes = 0;
+
+	for (int m = 0; m < (int)info.readBufferSize / MIDIPACKETLEN; ++m) {
+		std::vector<Byte> mspacket;
+
+		if (m % 8 == 0) {
+			const Byte quarterFrame[2] = { 0xF1, (Byte)(m << 1) };
+			mspacket = MSPackets(smptePort, std::vector<Byte>(quarterFrame, quarterFrame + 2));
+		}
+		else {
+			const Byte noteOn[3] = { 0x90, (Byte)(0x3C + m), 0x40 };
+			mspacket = MSPackets(notes++ % 8, std::vector<Byte>(noteOn, noteOn + 3));
+		}
+		read.insert(read.end(), mspacket.begin(), mspacket.end());
+	}
+	for (int mode = 0; mode < 3; ++mode) {
+		EngineFixture f(info, numOutputPorts);
+		ItemCount received = 0;
+
+		for (int port = 0; port < info.numInputPorts; ++port)
+			f.engine.SetSourceEnabled(port, mode == 0 || (mode == 1 ? port != smptePort : port == 0));
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < kReads; ++i) {
+			f.transport.Input(f.inPipe, read.data(), read.size());
+			f.transport.Deliver();
+			received += f.sink.packets.size();
+			f.sink.Clear();
+		}
+		double seconds = SecondsSince(start);
+		printf("disabled sources %s: %d reads of %lu bytes in %.1f ms, %.0f ns/read, %.2f packets received/read, "
+			   "%llu bytes skipped\n", modes[mode], kReads, (unsigned long)read.size(), seconds * 1e3, seconds / kReads * 1e9,
+			   (double)received / kReads, (unsigned long long)f.engine.GetInputStatistics().bytesSkipped);
+	}
+}
+
+// Threads sending note-ons at once through a SendQueue while another pops them, as CoreMIDI's send
+// threads and the I/O run loop do, and through the same ring with a lock taken for each push and pop,
+// as Send and the run loop did before. How long a push takes, retries of a full ring included.
+static void	PushNotes(SendQueue *queue, std::mutex *lock, int producer, std::vector<double> *pushTimes,
+					  std::atomic<int> *finished)
+{
+	for (size_t i = 0; i < pushTimes->size(); ++i) {
+		const Byte noteOn[3] = { (Byte)(0x90 | producer), (Byte)(i & 0x7F), 0x40 };
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool pushed;
+
+		do {
+			if (lock != NULL) {
+				std::lock_guard<std::mutex> guard(*lock);
+				pushed = queue->Push((UInt8)producer, 0, noteOn, sizeof(noteOn));
+			}
+			else
+				pushed = queue->Push((UInt8)producer, 0, noteOn, sizeof(noteOn));
+			if (!pushed)
+				std::this_thread::yield();
+		} while (!pushed);
+		(*pushTimes)[i] = SecondsSince(start);
+	}
+	finished->fetch_add(1);
+}
+
+static void	BenchSendContention()
+{
+	const int kPushes = 100000;
+	const int producerCounts[4] = { 1, 2, 4, 8 };
+
+	for (int locked = 0; locked < 2; ++locked)
+		for (int c = 0; c < 4; ++c) {
+			int numProducers = producerCounts[c];
+			SendQueue queue;
+			std::mutex lock;
+			std::atomic<int> finished(0);
+			std::vector<std::vector<double> > pushTimes(numProducers, std::vector<double>(kPushes));
+			std::vector<std::thread> producers;
+			ItemCount popped = 0;
+
+			queue.Allocate(4096);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int producer = 0; producer < numProducers; ++producer)
+				producers.push_back(std::thread(PushNotes, &queue, locked ? &lock : NULL, producer, &pushTimes[producer],
+												&finished));
+			for (;;) {
+				bool done = finished.load() == numProducers;
+				bool popping = true;
+
+				// drained once every producer has finished and nothing is left
+				while (popping) {
+					if (locked)
+						lock.lock();
+					popping = queue.Front() != NULL;
+					if (popping) {
+						queue.PopFront();
+						++popped;
+					}
+					if (locked)
+						lock.unlock();
+				}
+				if (done)
+					break;
+				std::this_thread::yield();
+			}
+			double seconds = SecondsSince(start);
+			for (size_t i = 0; i < producers.size(); ++i)
+				producers[i].join();
+
+			std::vector<double> times;
+			for (int producer = 0; producer < numProducers; ++producer)
+				times.insert(times.end(), pushTimes[producer].begin(), pushTimes[producer].end());
+			std::sort(times.begin(), times.end());
+			printf("send contention %s, %d thread%s: %lu pushes in %.1f ms, %.2fM/s, push p50 %.2f us, p99 %.2f us, "
+				   "max %.1f us\n", locked ? "locked" : "lock-free", numProducers, numProducers == 1 ? "" : "s",
+				   (unsigned long)popped, seconds * 1e3, popped / seconds / 1e6, times[times.size() / 2] * 1e6,
+				   times[times.size() * 99 / 100] * 1e6, times.back() * 1e6);
+		}
+}
+
+// An 8x8/S kept busy, writing to all eight ports and reading full transfers without pause, and a
+// 2x2 sent a note each millisecond from a thread of its own, as CoreMIDI's send thread. Run on one
+// I/O thread between them, the note waits for whatever of the 8x8's work is under way, run on a
+// thread of each, only for the scheduler. How long from the push of each note onto the 2x2's
+// SendQueue until its OUT transfer is submitted, in the time of the steady clock.
+struct IsolationProbe {
+	IsolationProbe() : stopping(false), pushed(0) { queue.Allocate(4096); }
+
+	// on the sending thread, a note each millisecond, each stamped with when it was pushed
+	void		Send(int notes)
+	{
+		for (int i = 0; i < notes; ++i) {
+			const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			queue.Push(0, std::chrono::steady_clock::now().time_since_epoch().count(), noteOn, sizeof(noteOn));
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				++pushed;
+			}
+			wake.notify_one();
+		}
+	}
+
+	// on the 2x2's I/O thread, the notes pushed handed to its engine, as HandleSent does
+	void		HandleSent(EngineFixture &f)
+	{
+		const SentPacket *packet;
+
+		while ((packet = queue.Front()) != NULL) {
+			f.engine.Send(packet->portNum, 0, packet->data, packet->length);
+			waits.push_back(std::chrono::steady_clock::now().time_since_epoch().count() - packet->timeStamp);
+			queue.PopFront();
+			f.transport.CompleteWrites(f.outPipe1);
+			f.transport.Deliver();
+			f.transport.ClearWritten(f.outPipe1);
+		}
+	}
+
+	// on the 2x2's own I/O thread, sleeping until notes are pushed, as its run loop does
+	void		Handle(EngineFixture &f, int notes)
+	{
+		for (int handled = 0; handled < notes; ) {
+			std::unique_lock<std::mutex> guard(lock);
+
+			while (pushed == handled)
+				wake.wait(guard);
+			handled = pushed;
+			guard.unlock();
+			HandleSent(f);
+		}
+		stopping = true;
+	}
+
+	SendQueue					queue;
+	std::mutex					lock;
+	std::condition_variable		wake;
+	std::atomic<bool>			stopping;
+	int							pushed;
+	std::vector<SInt64>			waits;
+};
+
+// a round of the 8x8's work: notes to every port, a transfer of each OUT pipe completed and a read
+static void	BusyInterfaceWork(EngineFixture &f, int numOutputPorts, const std::vector<Byte> &read, int &note)
+{
+	for (int port = 0; port < numOutputPorts; ++port)
+		for (int i = 0; i < 8; ++i, ++note) {
+			const Byte noteOn[3] = { 0x90, (Byte)(note & 0x7F), 0x40 };
+
+			f.engine.Send(port, 0, noteOn, sizeof(noteOn));
+		}
+	f.transport.CompleteWrites(f.outPipe1);
+	f.transport.CompleteWrites(f.outPipe2);
+	f.transport.Input(f.inPipe, read.data(), read.size());
+	f.transport.Deliver();
+	f.transport.ClearWritten(f.outPipe1);
+	f.transport.ClearWritten(f.outPipe2);
+	f.sink.Clear();
+}
+
+static void	BenchInterfaceIsolation()
+{
+	const int kNotes = 2000;
+	DeviceEntry entry;
+	int numOutputPorts;
+
+	if (!ReadDeviceEntry("MIDISPORT 8x8/S", entry)) {
+		printf("isolation: no 8x8/S in the device list\n");
+		return;
+	}
+	InterfaceInfo busyInfo = DeviceInterfaceInfo(entry, numOutputPorts);
+	std::vector<Byte> read;
+
+	for (int m = 0; m < (int)busyInfo.readBufferSize / MIDIPACKETLEN; ++m) {
+		const Byte noteOn[3] = { 0x90, (Byte)m, 0x40 };
+		std::vector<Byte> mspacket = MSPackets(m % 8, std::vector<Byte>(noteOn, noteOn + 3));
+
+		read.insert(read.end(), mspacket.begin(), mspacket.end());
+	}
+	for (int ownThreads = 0; ownThreads < 2; ++ownThreads) {
+		EngineFixture busy(busyInfo, numOutputPorts), probed;
+		IsolationProbe probe;
+		ItemCount busyWork = 0;
+		int note = 0;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::thread sender(&IsolationProbe::Send, &probe, kNotes);
+		if (ownThreads) {
+			std::thread probeThread(&IsolationProbe::Handle, &probe, std::ref(probed), kNotes);
+
+			while (!probe.stopping) {
+				BusyInterfaceWork(busy, numOutputPorts, read, note);
+				++busyWork;
+			}
+			probeThread.join();
+		}
+		else {
+			// the shared run loop, its sources handled in turn
+			while (probe.waits.size() < (size_t)kNotes) {
+				BusyInterfaceWork(busy, numOutputPorts, read, note);
+				++busyWork;
+				probe.HandleSent(probed);
+			}
+		}
+		sender.join();
+		double seconds = SecondsSince(start);
+
+		std::vector<SInt64> &waits = probe.waits;
+		std::sort(waits.begin(), waits.end());
+		printf("isolation %s: %d notes, wait p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us; "
+			   "busy 8x8 %.0f rounds/s\n", ownThreads ? "own threads" : "shared loop", kNotes,
+			   waits[waits.size() / 2] / 1e3, waits[waits.size() * 99 / 100] / 1e3,
+			   waits[waits.size() * 999 / 1000] / 1e3, waits.back() / 1e3, busyWork / seconds);
+	}
+}
+
+// MIDI clock at 24 per quarter note and 120 bpm to a port kept saturated, bursts of up to forty
+// controllers sent every 10 ms while less than a kilobyte waits, paced to a 16 byte buffer and
+// written a transfer a USB frame. Each F8 is sent to the port's queue as it was before the realtime
+// lane, and to the lane, and timed down the cable in simulated time: how far the clocks are from
+// their period apart, and how long each waited.
+static void	BenchClockJitter()
+{
+	const int kMilliseconds = 5000;
+	const MIDITimeStamp kFrameNanos = 1000000;
+	const MIDITimeStamp kClockNanos = 500000000ULL / 24;
+	const Byte clockByte = 0xF8;
+
+	for (int lane = 0; lane < 2; ++lane) {
+		ManualClock clock;
+		OutputScheduler output;
+		MidisportOutputEncoder encoder(2, false, false, false, 16, clock);
+		Byte transfer[32];
+		ByteCount transferLength = 0;
+		MIDITimeStamp start = clock.Now(), nextClock = start, cableFree = start;
+		std::vector<MIDITimeStamp> clocksSent, clocksOut;
+		UInt64 queued = 0, taken = 0;		// the controllers' bytes sent, and taken by the device
+		UInt32 random = 1;
+
+		output.Allocate(2, 4096, false);
+		for (int ms = 0; ms < kMilliseconds; ++ms) {
+			MIDITimeStamp now = start + ms * kFrameNanos;
+
+			clock.Set(now);
+			// the transfer of the last frame taken by the device, its bytes down the cable from now
+			encoder.Written(transfer, transferLength, now);
+			for (ByteCount m = 0; m + MIDIPACKETLEN <= transferLength; m += MIDIPACKETLEN)
+				for (int b = 0; b < (transfer[m + CMDINDEX] & 0x03); ++b) {
+					cableFree = std::max(cableFree, now) + MIDI_BYTE_NANOS;
+					if (transfer[m + b] == clockByte)
+						clocksOut.push_back(cableFree);
+					else
+						++taken;
+				}
+
+			if (ms % 10 == 0 && queued - taken < 1024) {
+				random = random * 1103515245 + 12345;
+				for (UInt32 i = 0; i < (random >> 16) % 41; ++i) {
+					const Byte controller[3] = { 0xB0, (Byte)(i & 0x7F), (Byte)(ms & 0x7F) };
+
+					output.QueueMessages(0, controller, sizeof(controller));
+					queued += sizeof(controller);
+				}
+			}
+			while (nextClock <= now) {
+				if (lane)
+					output.QueuePacket(0, &clockByte, 1);
+				else
+					output.QueueMessages(0, &clockByte, 1);
+				clocksSent.push_back(nextClock);
+				nextClock += kClockNanos;
+			}
+
+			Byte *destBuf[2] = { transfer, NULL };
+			ByteCount bufCount[2] = { 0, 0 };
+			MIDITimeStamp retryTime;
+			encoder.EncodeTransfers(output, destBuf, bufCount, sizeof(transfer), 0, now, retryTime);
+			transferLength = bufCount[0];
+		}
+
+		double maxJitter = 0, totalJitter = 0, totalWait = 0, maxWait = 0;
+		for (size_t i = 0; i < clocksOut.size(); ++i) {
+			double wait = (double)(clocksOut[i] - clocksSent[i]);
+
+			totalWait += wait;
+			maxWait = std::max(maxWait, wait);
+			if (i > 0) {
+				double interval = (double)(clocksOut[i] - clocksOut[i - 1]);
+				double jitter = interval > kClockNanos ? interval - kClockNanos : kClockNanos - interval;
+
+				totalJitter += jitter;
+				maxJitter = std::max(maxJitter, jitter);
+			}
+		}
+		printf("clock jitter, realtime lane %s: %lu clocks of %lu sent, jitter mean %.2f ms, max %.2f ms, "
+			   "wait mean %.2f ms, max %.2f ms\n", lane ? "on" : "off", (unsigned long)clocksOut.size(),
+			   (unsigned long)clocksSent.size(), totalJitter / (clocksOut.size() - 1) / 1e6, maxJitter / 1e6,
+			   totalWait / clocksOut.size() / 1e6, maxWait / 1e6);
+	}
+}
+
+// The eight MIDI outs of an 8x8/S, as the device list has it, kept saturated, each with half a
+// kilobyte waiting. Each USB frame the device takes the oldest transfer of each OUT pipe, which
+// completes at the end of the frame, its callback coming half a frame later. With one transfer in
+// flight a pipe is idle every other frame, waiting for its callback; with more, the next is
+// already queued. How much MIDI the device takes each second, in simulated time.
+static void	BenchSaturatedThroughput()
+{
+	const int kFrames = 4000;
+	const MIDITimeStamp kFrameNanos = 1000000;
+	const MIDITimeStamp kCallbackNanos = 500000;
+	const int writesInFlight[3] = { 1, 2, 4 };
+	DeviceEntry entry;
+	int numOutputPorts;
+
+	if (!ReadDeviceEntry("MIDISPORT 8x8/S", entry)) {
+		printf("throughput: no 8x8/S in the device list\n");
+		return;
+	}
+	for (int w = 0; w < 3; ++w) {
+		InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+
+		info.writesInFlight = (UInt8)writesInFlight[w];
+		EngineFixture f(info, numOutputPorts);
+		int pipes[2] = { f.outPipe1, f.outPipe2 };
+		bool taken[2] = { false, false };			// a transfer of the pipe was taken in the last frame
+		UInt64 queued[8] = { 0 }, written[8] = { 0 }, transfers = 0, total = 0;
+		int note = 0;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int frame = 0; frame < kFrames; ++frame) {
+			MIDITimeStamp now = f.clock.Now();
+			std::vector<Byte> streams[MAX_PORTS];
+
+			for (int p = 0; p < 2; ++p) {
+				if (taken[p])
+					transfers += f.transport.CompleteWrites(pipes[p], 1);
+				taken[p] = f.transport.Queued(pipes[p]) > 0;
+				DecodeOutput(f.transport.Written(pipes[p]), streams);
+				f.transport.ClearWritten(pipes[p]);
+			}
+			for (int port = 0; port < 8; ++port) {
+				written[port] += streams[port].size();
+				total += streams[port].size();
+				while (queued[port] - written[port] < 512) {
+					const Byte noteOn[3] = { (Byte)(0x90 | port), (Byte)(note++ & 0x7F), 0x40 };
+
+					f.engine.Send(port, 0, noteOn, sizeof(noteOn));
+					queued[port] += sizeof(noteOn);
+				}
+			}
+			f.clock.Set(now + kCallbackNanos);
+			f.transport.Deliver();
+			f.clock.Set(now + kFrameNanos);
+		}
+		double seconds = SecondsSince(start);
+		printf("throughput, %d write%s in flight: %.1f KB/s of MIDI, %.2f transfers/frame, %llu overflows, %.1f ms\n",
+			   writesInFlight[w], writesInFlight[w] == 1 ? "" : "s", total * 1e9 / ((double)kFrames * kFrameNanos) / 1e3,
+			   (double)transfers / kFrames, (unsigned long long)f.engine.GetOutput().Overflows(), seconds * 1e3);
+	}
+}
+
+// Interfaces decoding at once, each on a thread of its own, reads interleaving a sysex on one port
+// with running status notes on the other, as two MIDISPORTs could send. Each decoder keeps its own
+// state, so every read is delivered whole whatever the others are doing. Reads decoded each second
+// by all of them together, and any read delivered wrong.
+static void	DecodeReads(EngineFixture *f, const std::vector<Byte> *read, int reads, const std::vector<Byte> *expected,
+						int *wrong)
+{
+	for (int i = 0; i < reads; ++i) {
+		f->transport.Input(f->inPipe, read->data(), read->size());
+		f->transport.Deliver();
+		if (f->sink.Bytes(0) != expected[0] || f->sink.Bytes(1) != expected[1])
+			++*wrong;
+		f->sink.Clear();
+	}
+}
+
+static void	BenchInterfaces()
+{
+	const int kReads = 100000;
+	const int interfaceCounts[4] = { 1, 2, 4, 8 };
+	const Byte mspackets[8][4] = {
+		{ 0x90, 0x3C, 0x40, 0x03 }, { 0xF0, 0x01, 0x02, 0x13 }, { 0x3D, 0x40, 0x00, 0x02 }, { 0x03, 0x04, 0x05, 0x13 },
+		{ 0x3E, 0x40, 0x00, 0x02 }, { 0x06, 0x07, 0xF7, 0x13 }, { 0x80, 0x3C, 0x40, 0x03 }, { 0x91, 0x30, 0x40, 0x13 }
+	};
+	const Byte port0[12] = { 0x90, 0x3C, 0x40, 0x90, 0x3D, 0x40, 0x90, 0x3E, 0x40, 0x80, 0x3C, 0x40 };
+	const Byte port1[12] = { 0xF0, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0xF7, 0x91, 0x30, 0x40 };
+	std::vector<Byte> read(&mspackets[0][0], &mspackets[0][0] + sizeof(mspackets));
+	std::vector<Byte> expected[2] = { std::vector<Byte>(port0, port0 + 12), std::vector<Byte>(port1, port1 + 12) };
+	double oneRate = 0;
+
+	for (int c = 0; c < 4; ++c) {
+		int numInterfaces = interfaceCounts[c];
+		std::vector<EngineFixture *> interfaces;
+		std::vector<std::thread> threads;
+		std::vector<int> wrong(numInterfaces, 0);
+		int totalWrong = 0;
+
+		for (int i = 0; i < numInterfaces; ++i)
+			interfaces.push_back(new EngineFixture);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < numInterfaces; ++i)
+			threads.push_back(std::thread(DecodeReads, interfaces[i], &read, kReads, expected, &wrong[i]));
+		for (int i = 0; i < numInterfaces; ++i) {
+			threads[i].join();
+			totalWrong += wrong[i];
+			delete interfaces[i];
+		}
+		double seconds = SecondsSince(start);
+		double rate = numInterfaces * kReads / seconds;
+
+		if (c == 0)
+			oneRate = rate;
+		printf("interfaces, %d decoding: %d reads each in %.1f ms, %.2fM reads/s, %.2fx one, %d delivered wrong\n",
+			   numInterfaces, kReads, seconds * 1e3, rate / 1e6, rate / oneRate, totalWrong);
+	}
+	printf("interfaces: %u CPUs\n", std::thread::hardware_concurrency());
+}
+
+// Full reads of an 8x8/S, as the device list has it, of note-ons interleaved between its eight MIDI
+// ins, or some of them, a run of mspackets at a time. The MIDIReceived calls each read costs now, one per source with
+// input, against the runs of one port's mspackets, each of which cost one before.
+static void	BenchReceivedCalls()
+{
+	const int kReads = 100000;
+	const struct {
+		int			ports;
+		int			run;
+	} patterns[4] = { { 8, 1 }, { 2, 1 }, { 2, 4 }, { 1, 16 } };
+	DeviceEntry entry;
+	int numOutputPorts;
+
+	if (!ReadDeviceEntry("MIDISPORT 8x8/S", entry)) {
+		printf("received calls: no 8x8/S in the device list\n");
+		return;
+	}
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+
+	for (int r = 0; r < 4; ++r) {
+		EngineFixture f(info, numOutputPorts);
+		std::vector<Byte> read;
+		ItemCount receivedCalls = 0;
+
+		for (int m = 0; m < (int)info.readBufferSize / MIDIPACKETLEN; ++m) {
+			const Byte noteOn[3] = { 0x90, (Byte)m, 0x40 };
+			int port = (m / patterns[r].run) % patterns[r].ports;
+			std::vector<Byte> mspacket = MSPackets(port, std::vector<Byte>(noteOn, noteOn + 3));
+
+			read.insert(read.end(), mspacket.begin(), mspacket.end());
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < kReads; ++i) {
+			f.transport.Input(f.inPipe, read.data(), read.size());
+			f.transport.Deliver();
+			receivedCalls += f.sink.receivedCalls;
+			f.sink.Clear();
+		}
+		double seconds = SecondsSince(start);
+		const InputStatistics &statistics = f.engine.GetInputStatistics();
+		printf("received calls, %d in%s, runs of %d: %.2f MIDIReceived/read, %.2f before, %.0f ns/read\n",
+			   patterns[r].ports, patterns[r].ports == 1 ? "" : "s", patterns[r].run, (double)receivedCalls / kReads,
+			   (double)statistics.inputPortRuns / statistics.readsHandled, seconds / kReads * 1e9);
+	}
+}
+
+// A 64 KB sysex dump into an 8x8/S, as the device list has it, in full reads of its mspackets,
+// decoded with the sysex gathered into chunks of the smallest size allowed, of the default size,
+// and of the default size delivered at the end of each read. Before, every mspacket of the dump was
+// a packet of its own, 341 to the kilobyte. Bytes decoded each second, and packets delivered.
+static void	BenchSysex()
+{
+	const int kDumps = 40;
+	const int kSysexLength = 65536;
+	const struct {
+		int			chunkSize;
+		int			timeout;
+	} settings[3] = { { 16, DEFAULT_SYSEX_TIMEOUT }, { DEFAULT_SYSEX_CHUNK_SIZE, DEFAULT_SYSEX_TIMEOUT }, { DEFAULT_SYSEX_CHUNK_SIZE, 0 } };
+	DeviceEntry entry;
+	int numOutputPorts;
+
+	if (!ReadDeviceEntry("MIDISPORT 8x8/S", entry)) {
+		printf("sysex: no 8x8/S in the device list\n");
+		return;
+	}
+	std::vector<Byte> sysex(kSysexLength), mspackets;
+	sysex[0] = 0xF0;
+	for (int i = 1; i < kSysexLength - 1; ++i)
+		sysex[i] = (Byte)(i & 0x7F);
+	sysex[kSysexLength - 1] = 0xF7;
+	mspackets = MSPackets(0, sysex);
+
+	for (int s = 0; s < 3; ++s) {
+		InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+		ItemCount packets = 0, bytes = 0, receivedCalls = 0;
+
+		info.sysexChunkSize = settings[s].chunkSize;
+		info.sysexTimeout = settings[s].timeout;
+		EngineFixture f(info, numOutputPorts);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int dump = 0; dump < kDumps; ++dump)
+			for (size_t offset = 0; offset < mspackets.size(); offset += info.readBufferSize) {
+				size_t length = std::min((size_t)info.readBufferSize, mspackets.size() - offset);
+
+				f.transport.Input(f.inPipe, mspackets.data() + offset, length);
+				f.transport.Deliver();
+				packets += f.sink.packets.size();
+				receivedCalls += f.sink.receivedCalls;
+				for (size_t i = 0; i < f.sink.packets.size(); ++i)
+					bytes += f.sink.packets[i].data.size();
+				f.sink.Clear();
+			}
+		double seconds = SecondsSince(start);
+		printf("sysex, %d byte chunks%s: %.1f MB/s, %.1f packets/KB, %.1f MIDIReceived/KB, %s\n", settings[s].chunkSize,
+			   settings[s].timeout == 0 ? " delivered each read" : "", (double)kDumps * kSysexLength / seconds / 1e6,
+			   packets * 1024.0 / bytes, receivedCalls * 1024.0 / bytes,
+			   bytes == (ItemCount)kDumps * kSysexLength ? "all delivered" : "bytes lost");
+	}
+}
+
+// A Transport of the 2x2's pipes which allocates nothing, unlike InMemoryTransport, so what the
+// allocations benchmark counts is the engine's. Each pipe keeps its transfers in a fixed ring, and
+// they complete when told to, their callbacks called then. Aborted transfers return with Deliver.
+class FixedTransport : public Transport {
+public:
+	FixedTransport(const Clock &clock) : mClock(clock)
+	{
+		const PipeInfo pipes[kPipes] = { { 0x81, kPipeInterrupt, 32 }, { 0x02, kPipeBulk, 32 }, { 0x04, kPipeBulk, 32 } };
+
+		for (int p = 0; p < kPipes; ++p) {
+			mPipes[p].info = pipes[p];
+			mPipes[p].first = mPipes[p].count = 0;
+			mPipes[p].aborted = false;
+		}
+	}
+
+	virtual int				NumPipes()								{ return kPipes; }
+	virtual bool			GetPipe(int pipe, PipeInfo &info)
+	{
+		if (pipe < 1 || pipe > kPipes)
+			return false;
+		info = mPipes[pipe - 1].info;
+		return true;
+	}
+	virtual TransferResult	Read(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+	{
+		return Queue(pipe, buffer, length, callback, refcon);
+	}
+	virtual TransferResult	Write(int pipe, const Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+	{
+		return Queue(pipe, (Byte *)buffer, length, callback, refcon);
+	}
+	virtual void			Abort(int pipe)							{ mPipes[pipe - 1].aborted = true; }
+	virtual TransferResult	ClearStall(int /*pipe*/)				{ return kTransferSuccess; }
+	virtual TransferResult	VendorRequest(UInt8, UInt16, UInt16, const void *, UInt16)	{ return kTransferSuccess; }
+
+	// the oldest transfer of the pipe completes, with data if it is a read, and its callback is called
+	bool					Complete(int pipe, const Byte *data = NULL, ByteCount length = 0)
+	{
+		Pipe &p = mPipes[pipe - 1];
+
+		if (p.count == 0)
+			return false;
+		Transfer transfer = p.transfers[p.first];
+		p.first = (p.first + 1) % kMaxTransfers;
+		--p.count;
+		if (data != NULL)
+			memcpy(transfer.buffer, data, std::min(length, transfer.length));
+		transfer.callback(transfer.refcon, p.aborted ? kTransferAborted : kTransferSuccess,
+						  data != NULL ? std::min(length, transfer.length) : transfer.length, mClock.Now());
+		return true;
+	}
+	void					Deliver()
+	{
+		for (int pipe = 1; pipe <= kPipes; ++pipe)
+			while (mPipes[pipe - 1].aborted && Complete(pipe))
+				;
+	}
+
+	enum { kPipes = 3, kMaxTransfers = 8 };
+
+private:
+	struct Transfer {
+		Byte *				buffer;
+		ByteCount			length;
+		TransferCallback	callback;
+		void *				refcon;
+	};
+	struct Pipe {
+		PipeInfo			info;
+		Transfer			transfers[kMaxTransfers];
+		int					first;
+		int					count;
+		bool				aborted;
+	};
+
+	TransferResult			Queue(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+	{
+		Pipe &p = mPipes[pipe - 1];
+		Transfer transfer = { buffer, length, callback, refcon };
+
+		if (p.aborted || p.count == kMaxTransfers)
+			return kTransferFailed;
+		p.transfers[(p.first + p.count++) % kMaxTransfers] = transfer;
+		return kTransferSuccess;
+	}
+
+	const Clock &			mClock;
+	Pipe					mPipes[kPipes];
+};
+
+// the packets received, counted and not kept
+class CountingSink : public MIDISink {
+public:
+	CountingSink() : packets(0) { }
+
+	virtual void		Received(int /*port*/, const MIDIPacketList *packets)	{ this->packets += packets->numPackets; }
+
+	ItemCount			packets;
+};
+
+// Note-ons sent and written, and read and delivered, counting the allocations each costs once the
+// engine has started. Before, Send copied each packet to the heap and onto a std::list, as the
+// first line does, the queue only freeing them once written.
+static void	BenchAllocations()
+{
+	const int kEvents = 200000;
+	UInt64 before;
+
+	{
+		std::list<Byte *> queue;
+
+		before = sAllocations.load();
+		for (int i = 0; i < kEvents; ++i) {
+			const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+			Byte *packet = new Byte[sizeof(noteOn)];
+
+			memcpy(packet, noteOn, sizeof(noteOn));
+			queue.push_back(packet);
+			if ((i & 7) == 7)
+				while (!queue.empty()) {
+					delete[] queue.front();
+					queue.pop_front();
+				}
+		}
+		printf("allocations, heap list: %.2f per event sent\n", (double)(sAllocations.load() - before) / kEvents);
+	}
+
+	ManualClock clock;
+	FixedTransport transport(clock);
+	CountingSink sink;
+	MidisportEngine engine(transport, clock, sink, TestInterfaceInfo(), 2);
+	std::vector<Byte> read;
+	ItemCount written = 0;
+
+	engine.Start();
+	before = sAllocations.load();
+	for (int i = 0; i < kEvents; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+
+		engine.Send(i & 1, 0, noteOn, sizeof(noteOn));
+		if ((i & 7) == 7) {
+			while (transport.Complete(2))
+				++written;
+			while (transport.Complete(3))
+				++written;
+		}
+	}
+	printf("allocations, engine: %.4f per event sent and written, %lu transfers written\n",
+		   (double)(sAllocations.load() - before) / kEvents, (unsigned long)written);
+
+	for (int i = 0; i < 8; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)(0x3C + i), 0x40 };
+		std::vector<Byte> mspacket = MSPackets(i & 1, std::vector<Byte>(noteOn, noteOn + 3));
+
+		read.insert(read.end(), mspacket.begin(), mspacket.end());
+	}
+	before = sAllocations.load();
+	for (int i = 0; i < kEvents / 8; ++i)
+		transport.Complete(1, read.data(), read.size());
+	printf("allocations, engine: %.4f per event read and delivered, %lu packets received\n",
+		   (double)(sAllocations.load() - before) / kEvents, (unsigned long)sink.packets);
+	engine.Stop();
+	transport.Deliver();
+}
+
+// a port's queue of held output filled and flushed, timed until the queue is empty
+static void	BenchFlushHeldOutput()
+{
+	const int kFlushes = 2000;
+	EngineFixture f;
+	ItemCount held = 0;
+	double seconds = 0;
+
+	for (int i = 0; i < kFlushes; ++i) {
+		MIDITimeStamp when = f.clock.Now() + 1000000000ULL;
+		UInt64 overflows = f.engine.GetScheduledOutput().Overflows();
+
+		while (f.engine.GetScheduledOutput().Overflows() == overflows) {
+			const Byte noteOn[3] = { 0x90, (Byte)(held & 0x7F), 0x40 };
+
+			f.engine.Send(0, when + (held & 0xFF), noteOn, sizeof(noteOn));
+			++held;
+		}
+		--held;		// the one refused
+		f.WriteAll();
+		f.transport.ClearWritten(f.outPipe1);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		f.engine.Flush(0);
+		if (!f.engine.GetScheduledOutput().IsEmpty())
+			printf("flush: output still held after flush %d\n", i);
+		seconds += SecondsSince(start);
+	}
+	printf("flush: %d flushes of %lu held messages each, %.2f us until empty\n", kFlushes,
+		   (unsigned long)(held / kFlushes), seconds / kFlushes * 1e6);
+}
+
+static const struct {
+	const char *	name;
+	BenchFunction	function;
+} sBenchmarks[] = {
+	{ "input", BenchInput },
+	{ "output", BenchOutput },
+	{ "held", BenchHeldOutput },
+	{ "flush", BenchFlushHeldOutput },
+	{ "packing", BenchPacking },
+	{ "runningstatus", BenchRunningStatus },
+	{ "coalescing", BenchCoalescing },
+	{ "disabled", BenchDisabledSources },
+	{ "contention", BenchSendContention },
+	{ "isolation", BenchInterfaceIsolation },
+	{ "clock", BenchClockJitter },
+	{ "throughput", BenchSaturatedThroughput },
+	{ "interfaces", BenchInterfaces },
+	{ "receivedcalls", BenchReceivedCalls },
+	{ "sysex", BenchSysex },
+	{ "allocations", BenchAllocations },
+};
+
+int		main(int argc, char **argv)
+{
+	for (size_t i = 0; i < sizeof(sBenchmarks) / sizeof(sBenchmarks[0]); ++i) {
+		bool selected = argc < 2;
+
+		for (int arg = 1; arg < argc; ++arg)
+			if (strcmp(argv[arg], sBenchmarks[i].name) == 0)
+				selected = true;
+		if (selected)
+			sBenchmarks[i].function();
+	}
+	return 0;
+}
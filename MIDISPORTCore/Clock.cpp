@@ -0,0 +1,58 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The host's clock.
+//
+
+#include "Clock.h"
+
+#if MIDISPORT_COREMIDI
+#include <CoreAudio/HostTime.h>
+#else
+#include <time.h>
+#endif
+
+HostClock &	HostClock::Shared()
+{
+	static HostClock sHostClock;
+	return sHostClock;
+}
+
+#if MIDISPORT_COREMIDI
+
+MIDITimeStamp	HostClock::Now() const
+{
+	return AudioGetCurrentHostTime();
+}
+
+MIDITimeStamp	HostClock::FromNanos(UInt64 nanos) const
+{
+	return AudioConvertNanosToHostTime(nanos);
+}
+
+UInt64	HostClock::ToNanos(MIDITimeStamp duration) const
+{
+	return AudioConvertHostTimeToNanos(duration);
+}
+
+#else
+
+MIDITimeStamp	HostClock::Now() const
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (MIDITimeStamp)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+MIDITimeStamp	HostClock::FromNanos(UInt64 nanos) const
+{
+	return nanos;
+}
+
+UInt64	HostClock::ToNanos(MIDITimeStamp duration) const
+{
+	return duration;
+}
+
+#endif // MIDISPORT_COREMIDI
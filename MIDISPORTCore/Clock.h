@@ -0,0 +1,50 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The time base of the protocol engine. Time stamps are MIDITimeStamps in the clock's own units,
+// host time on MacOS X, converted from nanoseconds wherever a duration is configured.
+// A ManualClock keeps a time it is told, so the data path can be driven through simulated time.
+//
+
+#ifndef __Clock_h__
+#define __Clock_h__
+
+#include "MIDITypes.h"
+
+class Clock {
+public:
+	virtual ~Clock() { }
+
+	virtual MIDITimeStamp	Now() const = 0;
+	virtual MIDITimeStamp	FromNanos(UInt64 nanos) const = 0;
+								// the duration in clock units
+	virtual UInt64			ToNanos(MIDITimeStamp duration) const = 0;
+};
+
+// host time on MacOS X, CLOCK_MONOTONIC nanoseconds elsewhere
+class HostClock : public Clock {
+public:
+	virtual MIDITimeStamp	Now() const;
+	virtual MIDITimeStamp	FromNanos(UInt64 nanos) const;
+	virtual UInt64			ToNanos(MIDITimeStamp duration) const;
+
+	static HostClock &		Shared();
+};
+
+// nanoseconds, starting from 1 so that 0 can stand for no time
+class ManualClock : public Clock {
+public:
+	ManualClock() : mNow(1) { }
+
+	virtual MIDITimeStamp	Now() const							{ return mNow; }
+	virtual MIDITimeStamp	FromNanos(UInt64 nanos) const		{ return nanos; }
+	virtual UInt64			ToNanos(MIDITimeStamp duration) const	{ return duration; }
+
+	void					Set(MIDITimeStamp now)				{ mNow = now; }
+	void					Advance(UInt64 nanos)				{ mNow += nanos; }
+
+private:
+	MIDITimeStamp			mNow;
+};
+
+#endif // __Clock_h__
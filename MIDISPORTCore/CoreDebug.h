@@ -0,0 +1,26 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// DebugPrintf for the protocol engine. Built into the driver, it prints where the driver's own
+// CADebugPrintf does, elsewhere to stderr. Like CADebugPrintf, it prints nothing unless DEBUG.
+//
+
+#ifndef __CoreDebug_h__
+#define __CoreDebug_h__
+
+#if defined(__has_include)
+#if __has_include("CADebugPrintf.h")
+#define MIDISPORT_CADEBUGPRINTF		1
+#endif
+#endif
+
+#if MIDISPORT_CADEBUGPRINTF
+#include "CADebugPrintf.h"
+#elif DEBUG
+#include <stdio.h>
+#define	DebugPrintf(inFormat, ...)	fprintf(stderr, inFormat "\n", ## __VA_ARGS__)
+#else
+#define	DebugPrintf(inFormat, ...)	((void)0)
+#endif
+
+#endif // __CoreDebug_h__
@@ -0,0 +1,34 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// What a device is given for each key its entry in MIDISPORT_devices.xml leaves out. Shared by
+// HardwareConfiguration, which reads the device list for the driver, MidisportEngine, and the core
+// tests, which run each device as the list has it, so the three can never disagree.
+//
+
+#ifndef __DeviceDefaults_h__
+#define __DeviceDefaults_h__
+
+#define DEFAULT_OUTPUT_PACKETS_PER_PORT		0		// no limit
+#define DEFAULT_OUTPUT_BUFFER_SIZE			0		// bytes, output is not paced to the MIDI cables
+#define MIN_OUTPUT_BUFFER_SIZE				3		// bytes, the MIDI of one mspacket, smaller sizes are raised to it
+#define DEFAULT_WRITES_IN_FLIGHT			2		// transfers per output endpoint
+#define DEFAULT_READS_IN_FLIGHT				2		// transfers on the input endpoint
+#define DEFAULT_COALESCE_OUTPUT				false
+#define DEFAULT_ALL_NOTES_OFF_ON_FLUSH		false
+#define DEFAULT_ALL_SOUND_OFF_ON_FLUSH		false
+#define DEFAULT_SYSEX_CHUNK_SIZE			1024	// bytes
+#define DEFAULT_SYSEX_TIMEOUT				20		// milliseconds
+#define DEFAULT_TIMESTAMP_INPUT_BYTES		true
+#define DEFAULT_RUNNING_STATUS				false
+#define DEFAULT_NOTE_OFF_AS_NOTE_ON			false
+#define DEFAULT_PACK_OUTPUT_BYTES			false
+
+#define DEFAULT_OWN_IO_THREAD				false
+#define DEFAULT_IO_THREAD_PERIOD			1000	// microseconds, one USB frame
+#define DEFAULT_IO_THREAD_COMPUTATION		200		// microseconds
+#define DEFAULT_IO_THREAD_CONSTRAINT		500		// microseconds
+#define DEFAULT_IO_THREAD_PRIORITY			0		// the default priority
+#define DEFAULT_IO_THREAD_CPU				-1		// any
+
+#endif // __DeviceDefaults_h__
@@ -0,0 +1,123 @@
+//
+// MacOS X standalone firmware downloader for the EZUSB device, 
+// as found in MIDIMan MIDISPORT boxes.
+//
+// This is the code for downloading any firmware to pre-renumerated EZUSB devices.
+// This is a rewrite of EZLOADER.C which was supplied example code with the EZUSB device.
+//
+
+#include "EZUSBFirmware.h"
+#include <iostream>
+
+EZUSBFirmware::EZUSBFirmware(ControlTransport &controlDevice) :
+    device(controlDevice)
+{
+}
+
+//
+// Uses the ANCHOR LOAD vendor specific command to either set or release the
+// 8051 reset bit in the EZ-USB chip.
+//
+// Arguments:
+//   resetBit - 1 sets the 8051 reset bit (holds the 8051 in reset)
+//              0 clears the 8051 reset bit (8051 starts running)
+//
+// Returns: kTransferSuccess if we reset correctly.
+//
+TransferResult EZUSBFirmware::Reset8051(unsigned char resetBit)
+{
+#if DEBUG
+    std::cout << "Setting 8051 reset bit to " << int(resetBit) << std::endl;
+#endif
+    return device.VendorRequest(ANCHOR_LOAD_INTERNAL, CPUCS_REG, 0, &resetBit, 1);
+}
+
+TransferResult EZUSBFirmware::DownloadFirmwareToRAM(const std::vector<INTEL_HEX_RECORD> &firmware, bool internalRAM)
+{
+    TransferResult status = kTransferSuccess;
+
+    for(std::vector<INTEL_HEX_RECORD>::const_iterator hexRecord = firmware.begin(); hexRecord != firmware.end() && hexRecord->Type == 0; ++hexRecord) {
+        if ((internalRAM && INTERNAL_RAM_ADDRESS(hexRecord->Address)) || (!internalRAM && !INTERNAL_RAM_ADDRESS(hexRecord->Address))) {
+#if DEBUG
+            std::string RAMname = internalRAM ? "internal" : "external";
+            std::cout << "Downloading " << std::dec << int(hexRecord->Length) <<
+                         " bytes to " << RAMname << " 0x" << std::hex << hexRecord->Address << std::endl;
+#endif
+            status = device.VendorRequest(internalRAM ? ANCHOR_LOAD_INTERNAL : ANCHOR_LOAD_EXTERNAL,
+                                          hexRecord->Address, 0, hexRecord->Data, hexRecord->Length);
+            if (status != kTransferSuccess)
+                return status;
+        }
+    }
+    return status;
+}
+
+//
+//	This function downloads Intel Hex Records to the EZ-USB device.
+//	If any of the hex records are destined for external RAM, then
+//	the caller must have previously downloaded firmware to the device
+//	that knows how to download to external RAM (ie. firmware that
+//	implements the ANCHOR_LOAD_EXTERNAL vendor specific command).
+//
+//  Arguments:
+//  firmware - Vector of INTEL_HEX_RECORD structures.
+//             This array is terminated by an Intel Hex End record (Type = 1).
+//  Returns: true if successful, false otherwise
+//
+bool EZUSBFirmware::DownloadFirmware(const std::vector<INTEL_HEX_RECORD> &firmware)
+{
+    TransferResult status;
+
+    // The download must be performed in two passes.  The first pass loads all of the
+    // external addresses, and the 2nd pass loads to all of the internal addresses.
+    // why? Because downloading to the internal addresses will probably wipe out the firmware
+    // running on the device that knows how to receive external RAM downloads.
+    //
+    // First download all the records that go in external RAM
+    status = DownloadFirmwareToRAM(firmware, false);
+    if (status != kTransferSuccess)
+        return false;
+
+    // Now download all of the records that are in internal RAM.
+    // Before starting the download, stop the 8051.
+    Reset8051(1);
+    status = DownloadFirmwareToRAM(firmware, true);
+    return status == kTransferSuccess;
+}
+
+//
+// Downloads the application firmware to the EZUSB device and starts it.
+//
+bool EZUSBFirmware::StartDevice(const std::vector<INTEL_HEX_RECORD> &loader, const std::vector<INTEL_HEX_RECORD> &applicationFirmware)
+{
+    //-----	First download loader firmware.  The loader firmware 
+    //		implements a vendor-specific command that will allow us 
+    //		to anchor load to external RAM.
+    //
+#if DEBUG
+    std::cout << "Downloading bootstrap loader." << std::endl;
+#endif
+    if (Reset8051(1) != kTransferSuccess)
+        return false;
+
+    if (!DownloadFirmware(loader)) {
+        std::cout << "Failed to download bootstrap loader." << std::endl;
+        return false;
+    }
+    if (Reset8051(0) != kTransferSuccess)
+        return false;
+    
+    //-----	Now download the device firmware.  //
+#if DEBUG
+    std::cout << "Downloading application firmware." << std::endl;
+#endif
+    if (!DownloadFirmware(applicationFirmware)) {
+        std::cout << "Failed to download application firmware." << std::endl;
+        return false;
+    }
+    if (Reset8051(1) != kTransferSuccess)
+        return false;
+    if (Reset8051(0) != kTransferSuccess)
+        return false;
+    return true;
+}
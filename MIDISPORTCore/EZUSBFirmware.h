@@ -0,0 +1,70 @@
+//
+// MacOS X standalone firmware downloader for the EZUSB device, 
+// as found in MIDIMan/M-Audio MIDISPORT boxes.
+//
+// Downloads firmware to a pre-renumerated EZUSB device over its control pipe, whatever USB stack
+// carries the vendor requests. EZUSBLoader finds the device with IOKit and downloads with this.
+//
+// This code includes portions of EZLOADER.H which was supplied example code with the EZUSB device.
+//
+
+#ifndef __EZUSBFirmware_h__
+#define __EZUSBFirmware_h__
+
+#include <vector>
+#include "Transport.h"
+#include "IntelHexFile.h"
+
+//
+// Vendor specific request code for Anchor Upload/Download
+//
+// This one is implemented in the core
+//
+#define ANCHOR_LOAD_INTERNAL  0xA0
+
+//
+// This command is not implemented in the core.  Requires firmware
+//
+#define ANCHOR_LOAD_EXTERNAL  0xA3
+
+//
+// This is the highest internal RAM address for the AN2131Q
+//
+#define MAX_INTERNAL_ADDRESS  0x1B3F
+
+#define INTERNAL_RAM_ADDRESS(address) ((address <= MAX_INTERNAL_ADDRESS) ? 1 : 0)
+
+//
+// EZ-USB Control and Status Register.  Bit 0 controls 8051 reset
+//
+#define CPUCS_REG    0x7F92
+
+class EZUSBFirmware {
+public:
+    EZUSBFirmware(ControlTransport &device);
+
+    //
+    // Sets or releases the 8051 reset bit, 1 holds the 8051 in reset, 0 starts it running.
+    //
+    TransferResult Reset8051(unsigned char resetBit);
+
+    //
+    // Downloads the records of firmware destined for internal or external RAM.
+    //
+    TransferResult DownloadFirmwareToRAM(const std::vector<INTEL_HEX_RECORD> &firmware, bool internalRAM);
+
+    //
+    // Downloads all of firmware, the external RAM records first.
+    //
+    bool DownloadFirmware(const std::vector<INTEL_HEX_RECORD> &firmware);
+
+    //
+    // Downloads the loader, which can load external RAM, then the application firmware, and starts it.
+    //
+    bool StartDevice(const std::vector<INTEL_HEX_RECORD> &loader, const std::vector<INTEL_HEX_RECORD> &applicationFirmware);
+
+private:
+    ControlTransport &device;
+};
+
+#endif // __EZUSBFirmware_h__
@@ -0,0 +1,53 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The epochs of the threads reading objects they find through shared pointers.
+//
+
+#include <unistd.h>
+#include "Epoch.h"
+
+// how long Synchronize sleeps between attempts to advance the epoch
+#define kSynchronizeSleepMicros	100
+
+Epoch::Epoch() :
+	mEpoch(0)
+{
+	mReaders[0] = mReaders[1] = 0;
+}
+
+// A reader counted in an epoch the advancing thread has already moved past leaves it again, and
+// enters the new one, so the count the advancing thread found empty stays empty.
+UInt32	Epoch::Enter()
+{
+	for (;;) {
+		UInt32 epoch = mEpoch.load();
+
+		mReaders[epoch & 1].fetch_add(1);
+		if (mEpoch.load() == epoch)
+			return epoch;
+		mReaders[epoch & 1].fetch_sub(1, std::memory_order_release);
+	}
+}
+
+// The readers of the epoch before the current one are counted with those of the next, so it
+// is only entered once they have all left.
+bool	Epoch::TryAdvance()
+{
+	UInt32 epoch = mEpoch.load();
+
+	if (mReaders[(epoch + 1) & 1].load() != 0)
+		return false;
+	mEpoch.store(epoch + 1);
+	return true;
+}
+
+void	Epoch::Synchronize()
+{
+	UInt32 epoch = Current();
+
+	while (!Passed(epoch)) {
+		if (!TryAdvance())
+			usleep(kSynchronizeSleepMicros);
+	}
+}
@@ -0,0 +1,38 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The epochs of the threads reading objects they find through shared pointers, so an object
+// unlinked from where it is found is only deleted once no thread which found it can still be
+// using it. Readers take no lock, each counts itself in the current epoch while it uses what it
+// found, and one thread alone advances the epoch, once every reader of the epoch before has left.
+// An object unlinked during epoch e can be deleted once the epoch is e + 2.
+//
+
+#ifndef __Epoch_h__
+#define __Epoch_h__
+
+#include <atomic>
+#include "MIDITypes.h"
+
+class Epoch {
+public:
+	Epoch();
+
+	UInt32				Enter();
+							// returns the epoch entered, to be passed to Exit
+	void				Exit(UInt32 epoch)	{ mReaders[epoch & 1].fetch_sub(1, std::memory_order_release); }
+
+	UInt32				Current() const		{ return mEpoch.load(); }
+	bool				Passed(UInt32 epoch) const	{ return Current() - epoch >= 2; }
+							// whether every reader within epoch has left
+	bool				TryAdvance();
+							// advance the epoch unless a reader of the one before is still within it
+	void				Synchronize();
+							// wait for every reader within the current epoch to leave
+
+private:
+	std::atomic<UInt32>	mEpoch;
+	std::atomic<SInt32>	mReaders[2];		// the readers within even and odd epochs
+};
+
+#endif // __Epoch_h__
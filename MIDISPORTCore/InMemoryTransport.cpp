@@ -0,0 +1,211 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// A Transport with no device behind it.
+//
+
+#include <string.h>
+#include "InMemoryTransport.h"
+#include "Clock.h"
+
+InMemoryTransport::InMemoryTransport(const Clock &clock) :
+	mClock(clock),
+	mDisconnected(false)
+{
+}
+
+int		InMemoryTransport::AddPipe(UInt8 endpoint, UInt8 transferType, UInt16 maxPacketSize)
+{
+	Pipe pipe;
+
+	pipe.info.endpoint = endpoint;
+	pipe.info.transferType = transferType;
+	pipe.info.maxPacketSize = maxPacketSize;
+	pipe.halted = false;
+	mPipes.push_back(pipe);
+	return (int)mPipes.size();
+}
+
+int		InMemoryTransport::NumPipes()
+{
+	return (int)mPipes.size();
+}
+
+bool	InMemoryTransport::GetPipe(int pipe, PipeInfo &info)
+{
+	if (!IsPipe(pipe))
+		return false;
+	info = mPipes[pipe - 1].info;
+	return true;
+}
+
+TransferResult	InMemoryTransport::Read(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+{
+	return Queue(pipe, true, buffer, length, callback, refcon);
+}
+
+// The buffer is only read as the write completes, so a caller touching it before its callback
+// writes what it put there since.
+TransferResult	InMemoryTransport::Write(int pipe, const Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+{
+	return Queue(pipe, false, (Byte *)buffer, length, callback, refcon);
+}
+
+TransferResult	InMemoryTransport::Queue(int pipe, bool in, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+{
+	if (mDisconnected)
+		return kTransferNoDevice;
+	if (!IsPipe(pipe) || in != ((mPipes[pipe - 1].info.endpoint & 0x80) != 0))
+		return kTransferFailed;
+
+	Transfer transfer = { buffer, length, callback, refcon };
+	mPipes[pipe - 1].transfers.push_back(transfer);
+	return kTransferSuccess;
+}
+
+void	InMemoryTransport::Abort(int pipe)
+{
+	if (!IsPipe(pipe))
+		return;
+	Pipe &p = mPipes[pipe - 1];
+	while (!p.transfers.empty())
+		Complete(p, kTransferAborted, 0);
+}
+
+// as the host controller does, the transfers queued behind the halt are aborted
+TransferResult	InMemoryTransport::ClearStall(int pipe)
+{
+	if (mDisconnected)
+		return kTransferNoDevice;
+	if (!IsPipe(pipe))
+		return kTransferFailed;
+	Abort(pipe);
+	mPipes[pipe - 1].halted = false;
+	return kTransferSuccess;
+}
+
+TransferResult	InMemoryTransport::VendorRequest(UInt8 request, UInt16 value, UInt16 index, const void *data, UInt16 length)
+{
+	ControlRequest controlRequest;
+
+	if (mDisconnected)
+		return kTransferNoDevice;
+	controlRequest.request = request;
+	controlRequest.value = value;
+	controlRequest.index = index;
+	controlRequest.data.assign((const Byte *)data, (const Byte *)data + length);
+	mControlRequests.push_back(controlRequest);
+	return kTransferSuccess;
+}
+
+// __________________________________________________________________________________________________
+
+// The device sends no more than the read asked for, the rest is lost as it would overrun the buffer.
+bool	InMemoryTransport::Input(int pipe, const Byte *data, ByteCount length)
+{
+	if (!IsPipe(pipe))
+		return false;
+	Pipe &p = mPipes[pipe - 1];
+	if (p.halted || p.transfers.empty())
+		return false;
+
+	const Transfer &transfer = p.transfers.front();
+	if (length > transfer.length)
+		length = transfer.length;
+	memcpy(transfer.buffer, data, length);
+	Complete(p, kTransferSuccess, length);
+	return true;
+}
+
+ItemCount	InMemoryTransport::CompleteWrites(int pipe, ItemCount maxTransfers)
+{
+	ItemCount completed = 0;
+
+	if (!IsPipe(pipe))
+		return 0;
+	Pipe &p = mPipes[pipe - 1];
+	while (!p.halted && !p.transfers.empty() && (maxTransfers == 0 || completed < maxTransfers)) {
+		const Transfer &transfer = p.transfers.front();
+		ByteCount length = transfer.length;
+
+		p.written.insert(p.written.end(), transfer.buffer, transfer.buffer + length);
+		Complete(p, kTransferSuccess, length);
+		++completed;
+	}
+	return completed;
+}
+
+// The device takes the first length bytes, the rest are only written if the transfer is queued again.
+bool	InMemoryTransport::ShortWrite(int pipe, ByteCount length)
+{
+	if (!IsPipe(pipe))
+		return false;
+	Pipe &p = mPipes[pipe - 1];
+	if (p.halted || p.transfers.empty())
+		return false;
+
+	const Transfer &transfer = p.transfers.front();
+	if (length > transfer.length)
+		length = transfer.length;
+	p.written.insert(p.written.end(), transfer.buffer, transfer.buffer + length);
+	Complete(p, kTransferSuccess, length);
+	return true;
+}
+
+void	InMemoryTransport::Stall(int pipe)
+{
+	if (!IsPipe(pipe))
+		return;
+	Pipe &p = mPipes[pipe - 1];
+	p.halted = true;
+	if (!p.transfers.empty())
+		Complete(p, kTransferStalled, 0);
+}
+
+void	InMemoryTransport::Fail(int pipe)
+{
+	if (!IsPipe(pipe))
+		return;
+	Pipe &p = mPipes[pipe - 1];
+	if (!p.transfers.empty())
+		Complete(p, kTransferFailed, 0);
+}
+
+void	InMemoryTransport::Disconnect()
+{
+	mDisconnected = true;
+	for (size_t i = 0; i < mPipes.size(); ++i)
+		while (!mPipes[i].transfers.empty())
+			Complete(mPipes[i], kTransferNoDevice, 0);
+}
+
+// __________________________________________________________________________________________________
+
+ItemCount	InMemoryTransport::Deliver()
+{
+	ItemCount delivered = 0;
+
+	while (!mCompletions.empty()) {
+		Completion completion = mCompletions.front();
+
+		mCompletions.pop_front();
+		completion.callback(completion.refcon, completion.result, completion.bytesTransferred, completion.completed);
+		++delivered;
+	}
+	return delivered;
+}
+
+ItemCount	InMemoryTransport::Queued(int pipe) const
+{
+	return IsPipe(pipe) ? mPipes[pipe - 1].transfers.size() : 0;
+}
+
+// the oldest transfer of the pipe completes, its callback waiting for Deliver
+void	InMemoryTransport::Complete(Pipe &pipe, TransferResult result, ByteCount bytesTransferred)
+{
+	const Transfer &transfer = pipe.transfers.front();
+	Completion completion = { transfer.callback, transfer.refcon, result, bytesTransferred, mClock.Now() };
+
+	mCompletions.push_back(completion);
+	pipe.transfers.pop_front();
+}
@@ -0,0 +1,105 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// A Transport with no device behind it, the device's side driven by its caller. Transfers are
+// queued on their pipes until the caller completes them: Input completes the oldest read with bytes
+// as if the device sent them, CompleteWrites the writes, recording what they carried. Completions
+// are only delivered by Deliver, so the engine is exercised, and timed, without USB, CoreMIDI or
+// threads. Each completion carries the time of the clock when the device's side completed it, not
+// when it was delivered. Errors are injected per pipe, a stalled pipe completing nothing more until
+// its stall is cleared. Both sides are driven from one thread.
+//
+
+#ifndef __InMemoryTransport_h__
+#define __InMemoryTransport_h__
+
+#include <deque>
+#include <vector>
+#include "Transport.h"
+
+class Clock;
+
+class InMemoryTransport : public Transport {
+public:
+	struct ControlRequest {
+		UInt8				request;
+		UInt16				value;
+		UInt16				index;
+		std::vector<Byte>	data;
+	};
+
+	InMemoryTransport(const Clock &clock);
+
+	int						AddPipe(UInt8 endpoint, UInt8 transferType, UInt16 maxPacketSize);
+								// returns the pipe's number
+
+	// Transport
+	virtual int				NumPipes();
+	virtual bool			GetPipe(int pipe, PipeInfo &info);
+	virtual TransferResult	Read(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon);
+	virtual TransferResult	Write(int pipe, const Byte *buffer, ByteCount length, TransferCallback callback, void *refcon);
+	virtual void			Abort(int pipe);
+	virtual TransferResult	ClearStall(int pipe);
+	virtual TransferResult	VendorRequest(UInt8 request, UInt16 value, UInt16 index, const void *data, UInt16 length);
+
+	// the device's side
+	bool					Input(int pipe, const Byte *data, ByteCount length);
+								// complete the oldest read of the pipe with the data, false if no
+								// read is queued or the pipe is stalled
+	ItemCount				CompleteWrites(int pipe, ItemCount maxTransfers = 0);
+								// complete the oldest writes of the pipe, all those queued if
+								// maxTransfers is 0, appending their data to Written(pipe)
+	bool					ShortWrite(int pipe, ByteCount length);
+								// complete the oldest write of the pipe having written only length
+								// bytes of it, false if no write is queued or the pipe is stalled
+	void					Stall(int pipe);
+								// the oldest transfer of the pipe returns stalled, as the endpoint halts
+	void					Fail(int pipe);
+								// the oldest transfer of the pipe returns failed
+	void					Disconnect();
+								// every transfer returns kTransferNoDevice, as does every one queued after
+
+	ItemCount				Deliver();
+								// call the callbacks of the transfers completed, in order, until
+								// none is left, those the callbacks complete included
+	ItemCount				Queued(int pipe) const;
+								// transfers of the pipe not yet completed
+	const std::vector<Byte> &	Written(int pipe) const		{ return mPipes[pipe - 1].written; }
+	void					ClearWritten(int pipe)			{ mPipes[pipe - 1].written.clear(); }
+	const std::vector<ControlRequest> &	ControlRequests() const	{ return mControlRequests; }
+
+private:
+	struct Transfer {
+		Byte *				buffer;
+		ByteCount			length;
+		TransferCallback	callback;
+		void *				refcon;
+	};
+
+	struct Completion {
+		TransferCallback	callback;
+		void *				refcon;
+		TransferResult		result;
+		ByteCount			bytesTransferred;
+		MIDITimeStamp		completed;
+	};
+
+	struct Pipe {
+		PipeInfo				info;
+		std::deque<Transfer>	transfers;
+		bool					halted;
+		std::vector<Byte>		written;
+	};
+
+	bool					IsPipe(int pipe) const	{ return pipe >= 1 && pipe <= (int)mPipes.size(); }
+	TransferResult			Queue(int pipe, bool in, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon);
+	void					Complete(Pipe &pipe, TransferResult result, ByteCount bytesTransferred);
+
+	const Clock &			mClock;
+	std::vector<Pipe>		mPipes;
+	std::deque<Completion>	mCompletions;
+	std::vector<ControlRequest>	mControlRequests;
+	bool					mDisconnected;
+};
+
+#endif // __InMemoryTransport_h__
@@ -19,7 +19,7 @@ bool IntelHexFile::ReadFirmwareFromHexFile(std::string fileName, std::vector<INT
         int calculatedChecksum = 0;
         
         {   // Skip over comment lines.
-            int cursor = 0;
+            size_t cursor = 0;
             while (cursor < hexLine.length() && hexLine[cursor] == ' ')
                 cursor++;
             if (hexLine[cursor] == '#')
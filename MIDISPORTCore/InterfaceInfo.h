@@ -0,0 +1,81 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// How the driver is to use an interface, and counts of the interface's input and of the recovery of
+// its pipes, kept as it runs.
+//
+
+#ifndef __InterfaceInfo_h__
+#define __InterfaceInfo_h__
+
+#include "MIDITypes.h"
+
+struct InterfaceInfo {
+	UInt8				inEndpointType;		// kUSBBulk, etc.
+	UInt8				outEndpointType;
+	UInt32  			readBufferSize;
+	UInt32  			writeBufferSize;
+	UInt8				readsInFlight;		// IN transfers which can be queued on the input pipe at once,
+											// 0 for the default
+	UInt32				writeQueueSize;		// bytes of output which can wait to be written to each port,
+											// 0 for the default
+	UInt8				writesInFlight;		// OUT transfers which can be queued on each output pipe at once,
+											// 0 for the default
+	bool				coalesceOutput;		// controllers, pitch bend and channel pressure waiting to be
+											// written are overwritten by the messages superseding them
+	UInt8				numInputPorts;		// MIDISPORT_SPECIFIC, sizes the input decoder
+	UInt8				outputPacketsPerPort;	// MIDISPORT_SPECIFIC, most mspackets of a port in
+												// one OUT transfer, 0 for no limit
+	UInt32				sysexChunkSize;		// MIDISPORT_SPECIFIC, most sysex bytes gathered into one packet
+	UInt32				sysexTimeout;		// MIDISPORT_SPECIFIC, milliseconds an incomplete sysex is held
+	bool				timestampInputBytes;	// MIDISPORT_SPECIFIC, stamp each message with its estimated
+												// arrival instead of the time the read completed
+	bool				runningStatus;		// MIDISPORT_SPECIFIC, output omits repeated status bytes
+	bool				noteOffAsNoteOn;	// MIDISPORT_SPECIFIC, output note-offs as note-ons of velocity 0
+	bool				packOutputBytes;	// MIDISPORT_SPECIFIC, fill every mspacket across message boundaries
+	UInt32				outputBufferSize;	// MIDISPORT_SPECIFIC, bytes the device buffers for each output
+											// port, output is paced to the MIDI cables if not 0
+	bool				allNotesOffOnFlush;	// a flushed destination is sent All Notes Off on every channel
+	bool				allSoundOffOnFlush;	// and All Sound Off
+};
+
+// counts of the recovery of an interface's pipes from failed transfers
+struct TransferStatistics {
+	UInt64				readErrors;			// reads which failed, not counting those aborted behind them
+	UInt64				writeErrors;		// likewise writes
+	UInt64				stallsCleared;		// halted endpoints cleared in the device
+	UInt64				restarts;			// pipes restarted after an error
+	UInt64				transfersResent;	// OUT transfers written again after failing
+	UInt64				shortWrites;		// OUT transfers the device took only part of, the rest
+											// written again
+	UInt64				fatalErrors;		// pipes stopped for good, the device having gone
+};
+
+// counts of the input handling of an interface
+struct InputStatistics {
+	UInt64				readsHandled;		// USB reads parsed
+	UInt64				receivedCalls;		// MIDIReceived calls made
+	UInt64				inputPortRuns;		// runs of consecutive USB packets from one cable or port,
+											// each of which cost a MIDIReceived call before input was
+											// collected per source for the whole read
+	UInt64				overflowFlushes;	// MIDIReceived calls made early because a packet list filled
+	UInt64				sysexBytes;			// sysex bytes received
+	UInt64				sysexPackets;		// packets those sysex bytes were delivered in
+	UInt64				bytesSkipped;		// bytes of disabled sources, only parsed to stay in sync
+
+	// the two stages of input, the I/O run loop handing each completed read to the decode thread,
+	// which decodes and delivers it. Times are in host time. A MidisportEngine without an
+	// InputHandoff decodes each read in its callback, so it counts no handoff, its wait being from
+	// the read completing to the callback.
+	UInt64				readsCompleted;		// reads handed to the decode thread
+	UInt64				bytesRead;			// bytes those reads received
+	UInt64				handoffTime;		// spent in ReadCallback handing reads over and restarting them
+	UInt64				maxHandoffTime;
+	UInt64				readStarvations;	// times no read was pending, every buffer waiting to be decoded
+	UInt64				decodeWaitTime;		// reads spent completed, waiting for the decode thread
+	UInt64				maxDecodeWaitTime;
+	UInt64				decodeTime;			// spent decoding reads, the MIDIReceived calls included
+	UInt64				maxDecodeTime;
+};
+
+#endif // __InterfaceInfo_h__
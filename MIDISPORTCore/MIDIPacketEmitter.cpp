@@ -0,0 +1,92 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Builds the MIDIPacketList received from a source into preallocated storage, delivering it
+// whenever it fills.
+//
+
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include "CoreDebug.h"
+#include "MIDIPacketEmitter.h"
+#include "MIDISink.h"
+#include "InterfaceInfo.h"
+
+// MIDIPacket.length is 16 bits
+#define kMaxMIDIPacketLength	65535
+
+MIDIPacketEmitter::MIDIPacketEmitter() :
+	mSink(NULL),
+	mPort(0),
+	mPacketList(NULL),
+	mPacket(NULL),
+	mListSize(0),
+	mLastTimeStamp(0),
+	mStatistics(NULL),
+	mEnabled(true)
+{
+}
+
+void	MIDIPacketEmitter::Initialize(	MIDISink *			sink,
+										int					port,
+										Byte *				storage,
+										ByteCount			storageSize,
+										InputStatistics *	statistics )
+{
+	mSink = sink;
+	mPort = port;
+	mPacketList = (MIDIPacketList *)storage;
+	mListSize = storageSize;
+	mStatistics = statistics;
+	mPacket = MIDIPacketListInit(mPacketList);
+}
+
+// the most data a single packet can carry in an empty list
+ByteCount	MIDIPacketEmitter::MaxPacketLength() const
+{
+	ByteCount headerSize = offsetof(MIDIPacketList, packet) + offsetof(MIDIPacket, data);
+	return std::min(mListSize - headerSize, (ByteCount)kMaxMIDIPacketLength);
+}
+
+void	MIDIPacketEmitter::Add(MIDITimeStamp when, ByteCount length, const Byte *data)
+{
+	mLastTimeStamp = when;
+	while (length > 0) {
+		ByteCount chunk = std::min(length, MaxPacketLength());
+		MIDIPacket *pkt = MIDIPacketListAdd(mPacketList, mListSize, mPacket, when, chunk, data);
+
+		if (pkt == NULL) {
+			// the list is full, deliver what we have and continue in an empty list,
+			// which always has room for chunk.
+			if (mStatistics != NULL)
+				++mStatistics->overflowFlushes;
+			Flush();
+			pkt = MIDIPacketListAdd(mPacketList, mListSize, mPacket, when, chunk, data);
+		}
+		mPacket = pkt;
+		data += chunk;
+		length -= chunk;
+	}
+}
+
+void	MIDIPacketEmitter::Append(ByteCount length, const Byte *data)
+{
+	if (!IsEmpty() && mPacket->length + length <= kMaxMIDIPacketLength &&
+		&mPacket->data[mPacket->length + length] <= (Byte *)mPacketList + mListSize) {
+		memcpy(&mPacket->data[mPacket->length], data, length);
+		mPacket->length += length;
+	}
+	else
+		Add(mLastTimeStamp, length, data);
+}
+
+void	MIDIPacketEmitter::Flush()
+{
+	if (!IsEmpty()) {
+		mSink->Received(mPort, mPacketList);
+		if (mStatistics != NULL)
+			++mStatistics->receivedCalls;
+		mPacket = MIDIPacketListInit(mPacketList);
+	}
+}
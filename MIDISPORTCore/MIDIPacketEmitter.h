@@ -0,0 +1,60 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Builds the MIDIPacketList received from a source into preallocated storage. When the storage
+// fills, the packets so far are delivered to the MIDISink and the list is restarted, so no
+// input is lost however dense the read, and no memory is allocated once the interface is running.
+// A source no client is listening to is disabled, its input is not parsed into packets at all.
+//
+
+#ifndef __MIDIPacketEmitter_h__
+#define __MIDIPacketEmitter_h__
+
+#include <atomic>
+#include "MIDITypes.h"
+
+struct InputStatistics;
+class MIDISink;
+
+class MIDIPacketEmitter {
+public:
+	MIDIPacketEmitter();
+
+	void		Initialize(	MIDISink *			sink,
+							int					port,
+							Byte *				storage,
+							ByteCount			storageSize,
+							InputStatistics *	statistics );
+					// storage must be at least large enough for one packet of a few bytes,
+					// longer data is divided across packets.
+
+	void		Add(MIDITimeStamp when, ByteCount length, const Byte *data);
+					// add a packet of data, delivering the packet list first if it is full
+
+	void		Append(ByteCount length, const Byte *data);
+					// concatenate data onto the last packet added (e.g. to end a sysex),
+					// or begin a new packet of the same time if there is no room.
+
+	void		Flush();
+					// deliver any packets to the sink and restart the list
+
+	bool		IsEmpty() const		{ return mPacketList->numPackets == 0; }
+
+	void		SetEnabled(bool enabled)	{ mEnabled.store(enabled, std::memory_order_relaxed); }
+	bool		IsEnabled() const			{ return mEnabled.load(std::memory_order_relaxed); }
+					// set from MIDIDriver::EnableSource, on the MIDIServer's thread
+
+private:
+	ByteCount	MaxPacketLength() const;
+
+	MIDISink *			mSink;
+	int					mPort;				// the port the sink is given the packets of
+	MIDIPacketList *	mPacketList;
+	MIDIPacket *		mPacket;			// the last packet added to mPacketList
+	ByteCount			mListSize;
+	MIDITimeStamp		mLastTimeStamp;
+	InputStatistics *	mStatistics;
+	std::atomic<bool>	mEnabled;			// sources are enabled until told otherwise
+};
+
+#endif // __MIDIPacketEmitter_h__
@@ -0,0 +1,22 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Where the protocol engine delivers the MIDI it decodes from an interface. The driver passes
+// each port's packets to MIDIReceived on the port's source.
+//
+
+#ifndef __MIDISink_h__
+#define __MIDISink_h__
+
+#include "MIDITypes.h"
+
+class MIDISink {
+public:
+	virtual ~MIDISink() { }
+
+	virtual void		Received(int port, const MIDIPacketList *packets) = 0;
+							// packets decoded from the input of the port, the list is only valid
+							// during the call
+};
+
+#endif // __MIDISink_h__
@@ -0,0 +1,92 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The MIDI utilities of the protocol engine, and the packet list functions where CoreMIDI has none.
+//
+
+#include <string.h>
+#include "CoreDebug.h"
+#include "MIDITypes.h"
+
+// __________________________________________________________________________________________________
+// returns number of data bytes which follow the status byte.
+// returns -1 for 0xF0 sysex beginning (indicating a variable number of data bytes
+//		following).
+// returns 0 if an unknown MIDI status byte is received and prints a warning.
+int		MIDIDataBytes(Byte status)
+{
+	if (status >= 0x80 && status < 0xF0)
+		return ((status & 0xE0) == 0xC0) ? 1 : 2;
+
+	switch (status) {
+	case 0xF0:
+		return -1;
+	case 0xF1:		// MTC
+	case 0xF3:		// song select
+		return 1;
+	case 0xF2:		// song pointer
+		return 2;
+	case 0xF6:		// tune request
+	case 0xF7:		// sysex conclude, nothing follows.
+	case 0xF8:		// clock
+	case 0xFA:		// start
+	case 0xFB:		// continue
+	case 0xFC:		// stop
+	case 0xFE:		// active sensing
+	case 0xFF:		// system reset
+		return 0;
+	}
+
+	DebugPrintf("MIDIEventLength: illegal status byte %02X", status);
+	return 0;   // the MIDI spec says we should ignore illegals.
+}
+
+#if !MIDISPORT_COREMIDI
+
+// __________________________________________________________________________________________________
+MIDIPacket *	MIDIPacketListInit(MIDIPacketList *pktlist)
+{
+	pktlist->numPackets = 0;
+	return &pktlist->packet[0];
+}
+
+// Whether a packet beginning with the byte holds whole messages, which can share a packet with
+// others: those beginning with a status byte, but for sysex, its continuations beginning with data
+// bytes included, and realtime bytes, which each keep a packet of their own.
+static bool		IsWholeMessage(Byte first)
+{
+	return first >= 0x80 && first < 0xF8 && first != 0xF0 && first != 0xF7;
+}
+
+// As CoreMIDI's, data of the same time as the current packet is added to it when both are whole
+// messages, otherwise it begins a packet of its own. curPacket is the packet last added, or the one
+// MIDIPacketListInit returned.
+MIDIPacket *	MIDIPacketListAdd(	MIDIPacketList *	pktlist,
+									ByteCount			listSize,
+									MIDIPacket *		curPacket,
+									MIDITimeStamp		time,
+									ByteCount			nData,
+									const Byte *		data )
+{
+	Byte *listEnd = (Byte *)pktlist + listSize;
+
+	if (pktlist->numPackets > 0 && curPacket->timeStamp == time && nData > 0
+	&& IsWholeMessage(curPacket->data[0]) && IsWholeMessage(data[0]) && curPacket->length + nData <= 65535
+	&& &curPacket->data[curPacket->length + nData] <= listEnd) {
+		memcpy(&curPacket->data[curPacket->length], data, nData);
+		curPacket->length += (UInt16)nData;
+		return curPacket;
+	}
+
+	MIDIPacket *packet = (pktlist->numPackets == 0) ? &pktlist->packet[0] : MIDIPacketNext(curPacket);
+
+	if (nData > 65535 || &packet->data[nData] > listEnd)
+		return NULL;
+	packet->timeStamp = time;
+	packet->length = (UInt16)nData;
+	memcpy(packet->data, data, nData);
+	++pktlist->numPackets;
+	return packet;
+}
+
+#endif // !MIDISPORT_COREMIDI
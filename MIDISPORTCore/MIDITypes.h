@@ -0,0 +1,72 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The types the protocol engine shares with CoreMIDI. Where CoreMIDI is available its own are used,
+// so the engine's packet lists go straight to MIDIReceived. Elsewhere they are defined here with
+// the same layout, and the packet list functions the engine needs are implemented in MIDITypes.cpp.
+//
+
+#ifndef __MIDITypes_h__
+#define __MIDITypes_h__
+
+#if defined(__has_include)
+#if __has_include(<CoreMIDI/CoreMIDI.h>)
+#define MIDISPORT_COREMIDI		1
+#endif
+#endif
+
+#if MIDISPORT_COREMIDI
+
+#include <CoreMIDI/CoreMIDI.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t			UInt8;
+typedef int8_t			SInt8;
+typedef uint16_t		UInt16;
+typedef int16_t			SInt16;
+typedef uint32_t		UInt32;
+typedef int32_t			SInt32;
+typedef uint64_t		UInt64;
+typedef int64_t			SInt64;
+typedef UInt8			Byte;
+typedef unsigned long	ByteCount;
+typedef unsigned long	ItemCount;
+typedef UInt64			MIDITimeStamp;
+
+#pragma pack(push, 4)
+struct MIDIPacket {
+	MIDITimeStamp		timeStamp;
+	UInt16				length;
+	Byte				data[256];	// actually length bytes
+};
+
+struct MIDIPacketList {
+	UInt32				numPackets;
+	MIDIPacket			packet[1];	// actually numPackets packets
+};
+#pragma pack(pop)
+
+// packets follow each other on four byte boundaries, as they do on CoreMIDI's ARM platforms
+#define MIDIPacketNext(pkt)	((MIDIPacket *)(((uintptr_t)&(pkt)->data[(pkt)->length] + 3) & ~(uintptr_t)3))
+
+MIDIPacket *	MIDIPacketListInit(MIDIPacketList *pktlist);
+MIDIPacket *	MIDIPacketListAdd(	MIDIPacketList *	pktlist,
+									ByteCount			listSize,
+									MIDIPacket *		curPacket,
+									MIDITimeStamp		time,
+									ByteCount			nData,
+									const Byte *		data );
+					// as CoreMIDI's, returns NULL if the list has no room for the packet
+
+#endif // MIDISPORT_COREMIDI
+
+// utilities
+int		MIDIDataBytes(Byte statusByte);
+			// returns number of data bytes that follow a given status byte
+			// (which can be anything except F0, F7, and realtime status bytes)
+
+#endif // __MIDITypes_h__
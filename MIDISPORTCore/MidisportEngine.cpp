@@ -0,0 +1,660 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The data path of one MIDISPORT interface over a Transport.
+//
+
+#include <string.h>
+#include <algorithm>
+#include "CoreDebug.h"
+#include "DeviceDefaults.h"
+#include "MidisportEngine.h"
+#include "Clock.h"
+#include "MIDISink.h"
+#include "MidisportInputDecoder.h"
+#include "MidisportOutputEncoder.h"
+#include "MIDIPacketEmitter.h"
+
+// size of the MIDIPacketList collecting the input of each port during a read,
+// when it fills it is delivered and restarted.
+#define kSourcePacketListSize	512
+
+// bytes of output which can wait to be written to each port, unless InterfaceInfo says otherwise
+#define kDefaultWriteQueueSize	32768
+
+// the output held until its time stamp, in bytes and packets of each port
+#define kScheduledOutputSize	16384
+#define kMaxScheduledPackets	1024
+
+// held output is queued a USB frame before it is due, to be written in the transfer of that frame
+#define kScheduleLeadNanos		1000000
+
+// the backoff before a pipe is restarted after a failed transfer, doubling with each failure in a row
+#define kFirstRestartNanos		1000000
+#define kMaxRestartNanos		100000000
+
+// __________________________________________________________________________________________________
+
+void	MidisportEngine::ReadPipe::Initialize(MidisportEngine *engine, int pipe, int numBuffers, ByteCount bufferSize)
+{
+	mEngine = engine;
+	mPipe = pipe;
+	delete[] mBuffers;
+	delete[] mBytesReceived;
+	delete[] mCompletionTimes;
+	mBuffers = new Byte[numBuffers * bufferSize];
+	mBytesReceived = new ByteCount[numBuffers];
+	mCompletionTimes = new MIDITimeStamp[numBuffers];
+	mBufferSize = bufferSize;
+	mNumBuffers = numBuffers;
+	mNextStarted = mNextCompleted = mNextReleased = 0;
+	mStarted = 0;
+	mCompleted.store(0);
+	mReleased.store(0);
+}
+
+void	MidisportEngine::ReadPipe::Completed(ByteCount bytesReceived, MIDITimeStamp when)
+{
+	mBytesReceived[mNextCompleted] = bytesReceived;
+	mCompletionTimes[mNextCompleted] = when;
+	Advance(mNextCompleted);
+	// publish the buffer, with what the read left in it, to the decoding thread
+	mCompleted.store(mCompleted.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool	MidisportEngine::ReadPipe::NextCompleted(Byte *&readBuf, ByteCount &bytesReceived, MIDITimeStamp &when) const
+{
+	if (mCompleted.load(std::memory_order_acquire) == mReleased.load(std::memory_order_relaxed))
+		return false;
+	readBuf = mBuffers + mNextReleased * mBufferSize;
+	bytesReceived = mBytesReceived[mNextReleased];
+	when = mCompletionTimes[mNextReleased];
+	return true;
+}
+
+void	MidisportEngine::ReadPipe::Released()
+{
+	Advance(mNextReleased);
+	// sequentially consistent, so either DoRead sees the buffer free or the decoding thread sees it
+	// starved, see MidisportEngine::DoRead
+	mReleased.store(mReleased.load(std::memory_order_relaxed) + 1);
+}
+
+// __________________________________________________________________________________________________
+
+void	MidisportEngine::WritePipe::Initialize(MidisportEngine *engine, int pipe, int numBuffers, ByteCount bufferSize)
+{
+	mEngine = engine;
+	mPipe = pipe;
+	delete[] mBuffers;
+	delete[] mLengths;
+	delete[] mPending;
+	mBuffers = new Byte[numBuffers * bufferSize];
+	mLengths = new ByteCount[numBuffers];
+	mPending = new bool[numBuffers];
+	std::fill(mPending, mPending + numBuffers, false);
+	mBufferSize = bufferSize;
+	mNumBuffers = numBuffers;
+	mNextBuffer = mInFlight = mOutstanding = 0;
+}
+
+// the buffer the i'th oldest in flight is in
+static int	InFlightSlot(int nextBuffer, int inFlight, int numBuffers, int i)
+{
+	// the oldest was started in the buffer those in flight are counted back from
+	int buffer = nextBuffer - inFlight + i;
+
+	return (buffer < 0) ? buffer + numBuffers : buffer;
+}
+
+Byte *	MidisportEngine::WritePipe::OldestBuffer(int i, ByteCount &length) const
+{
+	int buffer = InFlightSlot(mNextBuffer, mInFlight, mNumBuffers, i);
+
+	length = mLengths[buffer];
+	return mBuffers + buffer * mBufferSize;
+}
+
+// Transfers return in the order they were queued, which is the order of their buffers, however
+// many failed before them and are waiting to be written again.
+int		MidisportEngine::WritePipe::Returning() const
+{
+	for (int i = 0; i < mInFlight; ++i)
+		if (mPending[InFlightSlot(mNextBuffer, mInFlight, mNumBuffers, i)])
+			return i;
+	return 0;
+}
+
+void	MidisportEngine::WritePipe::Started(ByteCount length)
+{
+	mLengths[mNextBuffer] = length;
+	mPending[mNextBuffer] = true;
+	if (++mNextBuffer >= mNumBuffers)
+		mNextBuffer = 0;
+	++mInFlight;
+	++mOutstanding;
+}
+
+void	MidisportEngine::WritePipe::Resent(int i)
+{
+	mPending[InFlightSlot(mNextBuffer, mInFlight, mNumBuffers, i)] = true;
+	++mOutstanding;
+}
+
+void	MidisportEngine::WritePipe::KeepUnwritten(int i, ByteCount written)
+{
+	ByteCount length;
+	Byte *buffer = OldestBuffer(i, length);
+	int slot = (int)((buffer - mBuffers) / mBufferSize);
+
+	memmove(buffer, buffer + written, length - written);
+	mLengths[slot] = length - written;
+}
+
+// The buffers older than the one written move up a place, keeping their order, so the one freed
+// is the oldest.
+void	MidisportEngine::WritePipe::Completed(int i)
+{
+	for (; i > 0; --i) {
+		int to = InFlightSlot(mNextBuffer, mInFlight, mNumBuffers, i);
+		int from = InFlightSlot(mNextBuffer, mInFlight, mNumBuffers, i - 1);
+
+		memcpy(mBuffers + to * mBufferSize, mBuffers + from * mBufferSize, mLengths[from]);
+		mLengths[to] = mLengths[from];
+		mPending[to] = mPending[from];
+	}
+	mPending[InFlightSlot(mNextBuffer, mInFlight, mNumBuffers, 0)] = false;
+	--mInFlight;
+	--mOutstanding;
+}
+
+void	MidisportEngine::WritePipe::Failed(int i)
+{
+	mPending[InFlightSlot(mNextBuffer, mInFlight, mNumBuffers, i)] = false;
+	--mOutstanding;
+}
+
+// __________________________________________________________________________________________________
+
+MidisportEngine::MidisportEngine(	Transport &				transport,
+									const Clock &			clock,
+									MIDISink &				sink,
+									const InterfaceInfo &	info,
+									int						numOutputPorts ) :
+	mTransport(transport),
+	mClock(clock),
+	mSink(sink),
+	mInterfaceInfo(info),
+	mNumOutputPorts(numOutputPorts),
+	mStarted(false),
+	mStopping(false),
+	mInputHandoff(NULL),
+	mReadStarved(false),
+	mInputDecoder(NULL),
+	mEmitters(NULL),
+	mPacketListStorage(NULL),
+	mScheduleLead(0),
+	mOutputRetry(0),
+	mOutputEncoder(NULL)
+{
+	if (mInterfaceInfo.numInputPorts == 0)
+		mInterfaceInfo.numInputPorts = numOutputPorts;
+	memset(&mInputStatistics, 0, sizeof(mInputStatistics));
+	memset(&mTransferStatistics, 0, sizeof(mTransferStatistics));
+}
+
+MidisportEngine::~MidisportEngine()
+{
+	if (!IsIdle())
+		DebugPrintf("MidisportEngine deleted with transfers outstanding");
+	delete mInputDecoder;
+	delete mOutputEncoder;
+	delete[] mEmitters;
+	delete[] mPacketListStorage;
+}
+
+bool	MidisportEngine::Start()
+{
+	int inPipe = 0, outPipe1 = 0, outPipe2 = 0;
+
+	for (int pipe = 1; pipe <= mTransport.NumPipes(); ++pipe) {
+		PipeInfo info;
+
+		if (!mTransport.GetPipe(pipe, info))
+			continue;
+		bool in = (info.endpoint & 0x80) != 0;
+		int number = info.endpoint & 0x0F;
+
+		// MIDISPORT_SPECIFIC
+		// The MIDIMan MIDISPORT devices output different ports via different endPoints,
+		// which are fixed. The 8x8 reads from endpoint 2, the others from endpoint 1.
+		if (!in && number == 2)
+			outPipe1 = pipe;
+		else if (!in && number == 4)
+			outPipe2 = pipe;
+		else if (in && number == 1)
+			inPipe = pipe;
+		else if (in && number == 2 && inPipe == 0)
+			inPipe = pipe;
+	}
+	if (inPipe == 0 && outPipe1 == 0 && outPipe2 == 0)
+		return false;
+	DebugPrintf("starting MIDI, outPipe1=%d, outPipe2=%d, inPipe=%d", outPipe1, outPipe2, inPipe);
+
+	if (inPipe != 0)
+		mReadPipe.Initialize(this, inPipe, mInterfaceInfo.readsInFlight != 0 ? mInterfaceInfo.readsInFlight : DEFAULT_READS_IN_FLIGHT,
+							 mInterfaceInfo.readBufferSize);
+	{
+		int writesInFlight = mInterfaceInfo.writesInFlight != 0 ? mInterfaceInfo.writesInFlight : DEFAULT_WRITES_IN_FLIGHT;
+
+		if (outPipe1 != 0)
+			mWritePipe1.Initialize(this, outPipe1, writesInFlight, mInterfaceInfo.writeBufferSize);
+		if (outPipe2 != 0)
+			mWritePipe2.Initialize(this, outPipe2, writesInFlight, mInterfaceInfo.writeBufferSize);
+	}
+
+	// all input packet lists are preallocated, nothing is allocated while reading.
+	// Each has room for a whole sysex chunk besides the other input of a read.
+	mInputDecoder = new MidisportInputDecoder(mInterfaceInfo.numInputPorts, mInterfaceInfo.sysexChunkSize, mInterfaceInfo.sysexTimeout,
+											  mInterfaceInfo.timestampInputBytes, mClock);
+	{
+		ByteCount packetListSize = kSourcePacketListSize + mInterfaceInfo.sysexChunkSize;
+
+		mPacketListStorage = new Byte[mInterfaceInfo.numInputPorts * packetListSize];
+		mEmitters = new MIDIPacketEmitter[mInterfaceInfo.numInputPorts];
+		for (int port = 0; port < mInterfaceInfo.numInputPorts; ++port)
+			mEmitters[port].Initialize(&mSink, port, mPacketListStorage + port * packetListSize, packetListSize, &mInputStatistics);
+	}
+
+	mOutputEncoder = new MidisportOutputEncoder(mNumOutputPorts, mInterfaceInfo.runningStatus, mInterfaceInfo.noteOffAsNoteOn,
+												mInterfaceInfo.packOutputBytes, mInterfaceInfo.outputBufferSize, mClock);
+	mOutput.Allocate(mNumOutputPorts, mInterfaceInfo.writeQueueSize != 0 ? mInterfaceInfo.writeQueueSize : kDefaultWriteQueueSize,
+					 mInterfaceInfo.coalesceOutput);
+	mScheduledOutput.Allocate(mNumOutputPorts, kScheduledOutputSize, kMaxScheduledPackets);
+	mScheduleLead = mClock.FromNanos(kScheduleLeadNanos);
+
+	mStarted = true;
+	if (mInputHandoff == NULL)
+		DoRead();
+	return true;
+}
+
+// The aborted transfers still return, each callback only counting it in.
+void	MidisportEngine::Stop()
+{
+	if (!mStarted || mStopping)
+		return;
+	mStopping = true;
+	if (mReadPipe.IsOpen())
+		mTransport.Abort(mReadPipe.mPipe);
+	if (mWritePipe1.IsOpen())
+		mTransport.Abort(mWritePipe1.mPipe);
+	if (mWritePipe2.IsOpen())
+		mTransport.Abort(mWritePipe2.mPipe);
+}
+
+bool	MidisportEngine::IsIdle() const
+{
+	return mReadPipe.InFlight() == 0 && mWritePipe1.mOutstanding == 0 && mWritePipe2.mOutstanding == 0;
+}
+
+void	MidisportEngine::SetSourceEnabled(int port, bool enabled)
+{
+	if (mEmitters != NULL && port >= 0 && port < mInterfaceInfo.numInputPorts)
+		mEmitters[port].SetEnabled(enabled);
+}
+
+// __________________________________________________________________________________________________
+
+// Packets stamped for later than the next transfer are held until they are due, the rest are queued
+// to be written straight away.
+void	MidisportEngine::Send(int port, MIDITimeStamp when, const Byte *data, ByteCount length)
+{
+	if (!mStarted || port < 0 || port >= mNumOutputPorts)
+		return;
+	MIDITimeStamp now = mClock.Now();
+
+	// held output already due goes ahead of this
+	ReleaseScheduledOutput(now);
+	if (when <= now + mScheduleLead || !mScheduledOutput.Schedule(when, port, data, length))
+		mOutput.QueuePacket(port, data, length);
+	DoWrite();
+}
+
+// However much output is waiting, it is dropped at once, the port's queues being emptied and its
+// held packets released, their space free for the output held next. The message being written is
+// completed, so the MIDI cable is left between messages for the controllers sent to silence the port.
+void	MidisportEngine::Flush(int port)
+{
+	Byte rest[3];
+	ByteCount restLength;
+
+	if (!mStarted || port < 0 || port >= mNumOutputPorts)
+		return;
+	mScheduledOutput.Flush(port);
+	mOutput.Flush(port);
+	restLength = mOutputEncoder->Flush(port, rest);
+	mOutput.QueueMessages(port, rest, restLength);
+	for (Byte channel = 0; channel < 16; ++channel) {
+		if (mInterfaceInfo.allNotesOffOnFlush) {
+			Byte allNotesOff[3] = { (Byte)(0xB0 | channel), 123, 0 };
+			mOutput.QueueMessages(port, allNotesOff, sizeof(allNotesOff));
+		}
+		if (mInterfaceInfo.allSoundOffOnFlush) {
+			Byte allSoundOff[3] = { (Byte)(0xB0 | channel), 120, 0 };
+			mOutput.QueueMessages(port, allSoundOff, sizeof(allSoundOff));
+		}
+	}
+	DoWrite();
+}
+
+void	MidisportEngine::ReleaseScheduledOutput(MIDITimeStamp now)
+{
+	const ScheduledPacket *packet;
+
+	while ((packet = mScheduledOutput.Front()) != NULL && mScheduledOutput.NextTime() <= now + mScheduleLead) {
+		mOutput.QueuePacket(packet->portNum, packet->data, packet->length);
+		mScheduledOutput.PopFront();
+	}
+}
+
+// The sysex held for more of its bytes is delivered here only without an InputHandoff, the decoding
+// thread seeing to it otherwise.
+void	MidisportEngine::Service()
+{
+	MIDITimeStamp now = mClock.Now();
+
+	if (!mStarted || mStopping)
+		return;
+	RestartPipes(now);
+	ReleaseScheduledOutput(now);
+	if (mInputHandoff == NULL)
+		DecodeInput();
+	DoWrite();
+}
+
+// the next held output due, output held back for room in the device, sysex held for more of its
+// bytes or a pipe to restart, whichever is soonest
+MIDITimeStamp	MidisportEngine::NextDeadline() const
+{
+	MIDITimeStamp deadlines[6];
+	MIDITimeStamp deadline = 0;
+
+	if (!mStarted || mStopping)
+		return 0;
+	deadlines[0] = mScheduledOutput.IsEmpty() ? 0 : std::max(mScheduledOutput.NextTime(), mScheduleLead + 1) - mScheduleLead;
+	deadlines[1] = mOutputRetry;
+	deadlines[2] = (mInputHandoff == NULL) ? InputDeadline() : 0;
+	deadlines[3] = mReadPipe.mRecovery.restartTime;
+	deadlines[4] = mWritePipe1.mRecovery.restartTime;
+	deadlines[5] = mWritePipe2.mRecovery.restartTime;
+	for (int i = 0; i < 6; ++i)
+		if (deadlines[i] != 0 && (deadline == 0 || deadlines[i] < deadline))
+			deadline = deadlines[i];
+	return deadline;
+}
+
+// __________________________________________________________________________________________________
+
+// Every free read buffer takes a read, so while the input of one is decoded the device still has
+// another to complete. A buffer is free once its input has been decoded. Should every buffer be
+// waiting for the decoding thread, it has RestartReads called when it releases the next.
+void	MidisportEngine::DoRead()
+{
+	if (!mStarted || mStopping || !mReadPipe.IsOpen() || mReadPipe.mRecovery.recovering)
+		return;		// RestartPipes calls again, unless stopping
+	for (;;) {
+		if (!mReadPipe.CanRead()) {
+			if (mReadPipe.InFlight() == 0)
+				++mInputStatistics.readStarvations;
+			mReadStarved.store(true);
+			// a buffer released before the flag was set is read into now, the decoding thread
+			// having missed it
+			if (!mReadPipe.CanRead() || !mReadStarved.exchange(false))
+				break;
+		}
+		TransferResult result = mTransport.Read(mReadPipe.mPipe, mReadPipe.NextBuffer(), mInterfaceInfo.readBufferSize, ReadCallback, &mReadPipe);
+
+		if (result != kTransferSuccess) {
+			DebugPrintf("Read from pipe %d failed, %d", mReadPipe.mPipe, result);
+			TransferFailed(mReadPipe.mRecovery, mReadPipe.mPipe, mReadPipe.InFlight(), result, mTransferStatistics.readErrors);
+			break;
+		}
+		mReadPipe.Started();
+	}
+}
+
+void	MidisportEngine::RestartReads()
+{
+	DoRead();
+}
+
+// this is the TransferCallback (static method), refcon is the ReadPipe
+// Reads complete in order, so the input is in the oldest buffer in flight. It is decoded at once,
+// or handed to the decoding thread, stamped with when the read completed however long its callback
+// took to come. A failed read is handed over empty, for its buffer to be released.
+void	MidisportEngine::ReadCallback(void *refcon, TransferResult result, ByteCount bytesTransferred, MIDITimeStamp completed)
+{
+	ReadPipe *pipe = (ReadPipe *)refcon;
+	MidisportEngine *self = pipe->mEngine;
+	MIDITimeStamp now = self->mClock.Now();
+	ByteCount bytesReceived = (result == kTransferSuccess) ? bytesTransferred : 0;
+
+	pipe->Completed(bytesReceived, completed);
+	if (self->mStopping)
+		return;
+	++self->mInputStatistics.readsCompleted;
+	self->mInputStatistics.bytesRead += bytesReceived;
+	if (self->mInputHandoff != NULL)
+		self->mInputHandoff->ReadCompleted();
+	else
+		self->DecodeInput();
+	if (result != kTransferSuccess || pipe->mRecovery.recovering) {
+		self->TransferFailed(pipe->mRecovery, pipe->mPipe, pipe->InFlight(), result, self->mTransferStatistics.readErrors);
+		return;
+	}
+	pipe->mRecovery.failures = 0;
+	// chain another read into the free buffers
+	self->DoRead();
+
+	if (self->mInputHandoff != NULL) {
+		MIDITimeStamp handoffTime = self->mClock.Now() - now;
+
+		self->mInputStatistics.handoffTime += handoffTime;
+		self->mInputStatistics.maxHandoffTime = std::max(self->mInputStatistics.maxHandoffTime, handoffTime);
+	}
+}
+
+// Reads are decoded in the order they completed, each buffer released for another read as soon as
+// its input is delivered.
+void	MidisportEngine::DecodeInput()
+{
+	Byte *readBuf;
+	ByteCount bytesReceived;
+	MIDITimeStamp completed, deadline, now;
+
+	if (!mStarted)
+		return;
+	while (mReadPipe.NextCompleted(readBuf, bytesReceived, completed)) {
+		MIDITimeStamp started = mClock.Now();
+		MIDITimeStamp waitTime = (started > completed) ? started - completed : 0;
+
+		if (bytesReceived > 0)
+			mInputDecoder->Decode(mEmitters, completed, readBuf, bytesReceived, mInputStatistics);
+		mReadPipe.Released();
+		// DoRead found no buffer free, restart reading in this one
+		if (mReadStarved.exchange(false) && mInputHandoff != NULL)
+			mInputHandoff->ReadsStarved();
+
+		MIDITimeStamp decodeTime = mClock.Now() - started;
+		mInputStatistics.decodeWaitTime += waitTime;
+		mInputStatistics.maxDecodeWaitTime = std::max(mInputStatistics.maxDecodeWaitTime, waitTime);
+		mInputStatistics.decodeTime += decodeTime;
+		mInputStatistics.maxDecodeTime = std::max(mInputStatistics.maxDecodeTime, decodeTime);
+	}
+	now = mClock.Now();
+	deadline = mInputDecoder->NextDeadline();
+	if (deadline != 0 && deadline <= now)
+		mInputDecoder->DeliverExpired(mEmitters, now, mInputStatistics);
+}
+
+MIDITimeStamp	MidisportEngine::InputDeadline() const
+{
+	return (mInputDecoder != NULL) ? mInputDecoder->NextDeadline() : 0;
+}
+
+// whole function is MIDISPORT_SPECIFIC
+// Each OUT pipe with a free buffer takes a transfer of the output waiting, independently of the
+// other, until the output is all written or every buffer of the pipes it is for is in flight.
+void	MidisportEngine::DoWrite()
+{
+	WritePipe *pipes[2] = { &mWritePipe1, &mWritePipe2 };
+
+	if (!mStarted || mStopping)
+		return;
+	mOutputRetry = 0;
+	while (!mOutput.IsEmpty()) {
+		Byte *writeBuf[2];
+		ByteCount msglen[2] = { 0, 0 };
+		MIDITimeStamp retryTime;
+
+		for (int i = 0; i < 2; ++i)
+			writeBuf[i] = (pipes[i]->IsOpen() && pipes[i]->CanStart()) ? pipes[i]->NextBuffer() : NULL;
+		if (writeBuf[0] == NULL && writeBuf[1] == NULL)
+			break;
+		mOutputEncoder->EncodeTransfers(mOutput, writeBuf, msglen, mInterfaceInfo.writeBufferSize,
+										mInterfaceInfo.outputPacketsPerPort, mClock.Now(), retryTime);
+		if (retryTime != 0 && (mOutputRetry == 0 || retryTime < mOutputRetry))
+			mOutputRetry = retryTime;
+		if (msglen[0] == 0 && msglen[1] == 0)
+			break;		// what is waiting is for a pipe with no free buffer
+		for (int i = 0; i < 2; ++i) {
+			if (msglen[i] == 0)
+				continue;
+			pipes[i]->Started(msglen[i]);
+			TransferResult result = mTransport.Write(pipes[i]->mPipe, writeBuf[i], msglen[i], WriteCallback, pipes[i]);
+			if (result != kTransferSuccess) {
+				DebugPrintf("Write to pipe %d failed, %d", pipes[i]->mPipe, result);
+				pipes[i]->Failed(pipes[i]->mInFlight - 1);		// no callback will come, the transfer is written again
+				TransferFailed(pipes[i]->mRecovery, pipes[i]->mPipe, pipes[i]->mOutstanding, result, mTransferStatistics.writeErrors);
+			}
+		}
+	}
+}
+
+// this is the TransferCallback (static method), refcon is the WritePipe
+// A write the device took only part of recovers the pipe as a failed one does, the rest of it being
+// written again ahead of the transfers queued behind it, which the recovery aborts. A write which
+// succeeds while the pipe recovers is done with like any other, only those which failed or were
+// aborted being written again.
+void	MidisportEngine::WriteCallback(void *refcon, TransferResult result, ByteCount bytesTransferred, MIDITimeStamp completed)
+{
+	WritePipe *pipe = (WritePipe *)refcon;
+	MidisportEngine *self = pipe->mEngine;
+	int returning = pipe->Returning();
+
+	if (self->mStopping) {
+		pipe->Failed(returning);
+		return;
+	}
+	if (result != kTransferSuccess) {
+		// written again with those before it once the pipe is restarted
+		pipe->Failed(returning);
+		self->TransferFailed(pipe->mRecovery, pipe->mPipe, pipe->mOutstanding, result, self->mTransferStatistics.writeErrors);
+		return;
+	}
+
+	ByteCount length;
+	const Byte *buffer = pipe->OldestBuffer(returning, length);
+	// what the device took starts going out its ports, paced from when it did
+	self->mOutputEncoder->Written(buffer, std::min(bytesTransferred, length), completed);
+	if (bytesTransferred < length) {
+		DebugPrintf("short write to pipe %d, %lu of %lu bytes", pipe->mPipe, (unsigned long)bytesTransferred, (unsigned long)length);
+		++self->mTransferStatistics.shortWrites;
+		pipe->KeepUnwritten(returning, bytesTransferred);
+		pipe->Failed(returning);
+		self->TransferFailed(pipe->mRecovery, pipe->mPipe, pipe->mOutstanding, kTransferFailed, self->mTransferStatistics.writeErrors);
+		return;
+	}
+	// the buffer is free for another transfer
+	pipe->Completed(returning);
+	if (pipe->mRecovery.recovering) {
+		self->TransferFailed(pipe->mRecovery, pipe->mPipe, pipe->mOutstanding, result, self->mTransferStatistics.writeErrors);
+		return;
+	}
+	pipe->mRecovery.failures = 0;
+	// chain as many transfers as the output fills
+	self->DoWrite();
+}
+
+// __________________________________________________________________________________________________
+
+// Called as each transfer of a pipe returns with an error, or returns at all while the pipe
+// recovers, outstanding being how many have yet to. The first error clears the pipe's stall,
+// which aborts the transfers queued behind the failed one, and once they have all returned the
+// pipe is restarted after a backoff, by Service.
+// Whatever the error, the device is then taken to have come through it, unless it has gone, which
+// leaves the pipe stopped.
+void	MidisportEngine::TransferFailed(PipeRecovery &recovery, int pipe, int outstanding, TransferResult result, UInt64 &errors)
+{
+	if (recovery.stopped)
+		return;
+	if (result == kTransferNoDevice) {
+		DebugPrintf("transfer on pipe %d failed, the device has gone", pipe);
+		++mTransferStatistics.fatalErrors;
+		recovery.recovering = recovery.stopped = true;
+		return;
+	}
+	if (result != kTransferSuccess && !recovery.recovering) {
+		DebugPrintf("transfer on pipe %d failed, %d, recovering", pipe, result);
+		++errors;
+		recovery.recovering = true;
+		recovery.restartTime = 0;
+		++recovery.failures;
+		if (mTransport.ClearStall(pipe) == kTransferSuccess && result == kTransferStalled)
+			++mTransferStatistics.stallsCleared;
+	}
+	if (recovery.recovering && outstanding == 0 && recovery.restartTime == 0) {
+		UInt64 backoff = std::min((UInt64)kFirstRestartNanos << std::min(recovery.failures - 1, 16), (UInt64)kMaxRestartNanos);
+
+		recovery.restartTime = mClock.Now() + mClock.FromNanos(backoff);
+	}
+}
+
+// The reads are started again, and the transfers which failed, or were aborted behind the one
+// which did, are written again ahead of the output which waited for the pipe.
+void	MidisportEngine::RestartPipes(MIDITimeStamp now)
+{
+	PipeRecovery *recoveries[3] = { &mReadPipe.mRecovery, &mWritePipe1.mRecovery, &mWritePipe2.mRecovery };
+
+	for (int i = 0; i < 3; ++i) {
+		PipeRecovery &recovery = *recoveries[i];
+
+		if (!recovery.recovering || recovery.stopped || recovery.restartTime == 0 || recovery.restartTime > now)
+			continue;
+		recovery.recovering = false;
+		recovery.restartTime = 0;
+		++mTransferStatistics.restarts;
+		if (i == 0)
+			DoRead();
+		else
+			ResendWrites(i == 1 ? mWritePipe1 : mWritePipe2);
+	}
+}
+
+void	MidisportEngine::ResendWrites(WritePipe &pipe)
+{
+	for (int i = 0; i < pipe.mInFlight; ++i) {
+		ByteCount length;
+		Byte *buffer = pipe.OldestBuffer(i, length);
+		TransferResult result = mTransport.Write(pipe.mPipe, buffer, length, WriteCallback, &pipe);
+
+		if (result != kTransferSuccess) {
+			DebugPrintf("Write to pipe %d failed, %d", pipe.mPipe, result);
+			TransferFailed(pipe.mRecovery, pipe.mPipe, pipe.mOutstanding, result, mTransferStatistics.writeErrors);
+			break;
+		}
+		pipe.Resent(i);
+		++mTransferStatistics.transfersResent;
+	}
+}
@@ -0,0 +1,216 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The data path of one MIDISPORT interface over a Transport, as InterfaceState runs it in the driver,
+// without CoreMIDI, IOKit or run loops. Several reads are kept in flight on the IN pipe, each decoded
+// as it completes into packets for the MIDISink. The output sent is held until it is due, queued per
+// port, encoded and written on the two OUT pipes with several transfers in flight on each. A pipe
+// whose transfer fails recovers as the driver's do, and its failed writes are written again.
+// The engine is used only on the thread the transport delivers completions on, which also calls
+// Service once NextDeadline has come. A host sending from other threads hands the packets over
+// first, as the driver does with a SendQueue. The input is decoded in the read callbacks, unless the
+// host gives the engine an InputHandoff, to decode it on a thread of its own as the driver does,
+// so a slow MIDISink never holds up the reads.
+//
+
+#ifndef __MidisportEngine_h__
+#define __MidisportEngine_h__
+
+#include <atomic>
+#include "Transport.h"
+#include "InterfaceInfo.h"
+#include "OutputScheduler.h"
+#include "ScheduledOutput.h"
+
+class Clock;
+class MIDISink;
+class MidisportInputDecoder;
+class MidisportOutputEncoder;
+class MIDIPacketEmitter;
+
+// What a host decoding the input on a thread of its own is told of the reads, see
+// MidisportEngine::SetInputHandoff.
+class InputHandoff {
+public:
+	virtual ~InputHandoff() { }
+
+	virtual void	ReadCompleted() = 0;
+						// on the transport's thread, a read waits for DecodeInput
+	virtual void	ReadsStarved() = 0;
+						// on the decoding thread, a buffer is free again after every read buffer
+						// waited to be decoded, RestartReads is to be called on the transport's thread
+};
+
+class MidisportEngine {
+public:
+	MidisportEngine(Transport &transport, const Clock &clock, MIDISink &sink,
+					const InterfaceInfo &info, int numOutputPorts);
+	~MidisportEngine();
+						// the transfers must all have returned, see IsIdle
+
+	void			SetInputHandoff(InputHandoff *handoff)	{ mInputHandoff = handoff; }
+						// before Start, to decode the input on the host's thread
+	bool			Start();
+						// find the MIDISPORT's pipes and start reading, false if it has none. With an
+						// InputHandoff, reading starts with the first RestartReads instead.
+	void			Stop();
+						// abort the pipes, no transfer is started again
+	bool			IsIdle() const;
+						// no transfer the engine started has yet to return
+
+	void			Send(int port, MIDITimeStamp when, const Byte *data, ByteCount length);
+						// hold a packet for the port until when, or queue it to be written now if
+						// it is due, and write what the pipes can take
+	void			Flush(int port);
+						// drop the output sent to the port and not yet written, held or queued
+	void			SetSourceEnabled(int port, bool enabled);
+						// a disabled port's input is not parsed into packets, on any thread once started
+
+	void			Service();
+						// release the held output come due, write the output held back for room in
+						// the device, deliver incomplete sysex held long enough, and restart pipes
+	MIDITimeStamp	NextDeadline() const;
+						// when Service is next due, 0 if it is not
+
+	// with an InputHandoff
+	void			DecodeInput();
+						// on the decoding thread, decode and deliver the reads completed in order,
+						// releasing their buffers, and the incomplete sysex held long enough
+	MIDITimeStamp	InputDeadline() const;
+						// on the decoding thread, when DecodeInput is next due for the sysex held,
+						// 0 if it is not
+	void			RestartReads();
+						// on the transport's thread, read into the buffers the decoding thread released
+
+	int				NumOutputPorts() const		{ return mNumOutputPorts; }
+	bool			HasInputPipe() const		{ return mReadPipe.IsOpen(); }
+	const InputStatistics &		GetInputStatistics() const		{ return mInputStatistics; }
+	const TransferStatistics &	GetTransferStatistics() const	{ return mTransferStatistics; }
+	const OutputScheduler &		GetOutput() const				{ return mOutput; }
+	const ScheduledOutput &		GetScheduledOutput() const		{ return mScheduledOutput; }
+
+private:
+	// The IN pipe and the read buffers it fills in turn. Reads complete in order and are decoded in
+	// that order, each buffer released for another read once its input is delivered. The transport's
+	// thread counts the reads it starts and completes, the decoding thread those it releases, so
+	// with an InputHandoff the buffers pass between them without either waiting on the other.
+	struct ReadPipe {
+		ReadPipe() : mEngine(NULL), mPipe(0), mBuffers(NULL), mBytesReceived(NULL), mCompletionTimes(NULL),
+					 mBufferSize(0), mNumBuffers(0), mNextStarted(0), mNextCompleted(0), mNextReleased(0),
+					 mStarted(0), mCompleted(0), mReleased(0) { }
+		~ReadPipe()		{ delete[] mBuffers; delete[] mBytesReceived; delete[] mCompletionTimes; }
+
+		void		Initialize(MidisportEngine *engine, int pipe, int numBuffers, ByteCount bufferSize);
+		bool		IsOpen() const			{ return mPipe != 0; }
+
+		// on the transport's thread
+		bool		CanRead() const			{ return mStarted - mReleased.load() < (UInt32)mNumBuffers; }
+		Byte *		NextBuffer() const		{ return mBuffers + mNextStarted * mBufferSize; }
+		void		Started()				{ Advance(mNextStarted); ++mStarted; }
+		void		Completed(ByteCount bytesReceived, MIDITimeStamp when);
+						// the oldest read in flight has completed, its buffer waits to be decoded
+		UInt32		InFlight() const		{ return mStarted - mCompleted.load(std::memory_order_relaxed); }
+
+		// on the decoding thread
+		bool		NextCompleted(Byte *&readBuf, ByteCount &bytesReceived, MIDITimeStamp &when) const;
+						// the oldest completed read not yet released, false if there is none
+		void		Released();
+
+		void		Advance(int &buffer) const	{ if (++buffer >= mNumBuffers) buffer = 0; }
+
+		MidisportEngine *	mEngine;
+		int			mPipe;				// the transport's, 0 if the interface has no such pipe
+		Byte *		mBuffers;
+		ByteCount *	mBytesReceived;		// by the read last completed in each buffer
+		MIDITimeStamp *	mCompletionTimes;	// and when it completed
+		ByteCount	mBufferSize;
+		int			mNumBuffers;
+		int			mNextStarted, mNextCompleted;	// only used on the transport's thread
+		int			mNextReleased;		// only used on the decoding thread
+		UInt32		mStarted;			// reads ever started
+		std::atomic<UInt32>	mCompleted;	// reads ever completed, only written on the transport's thread
+		std::atomic<UInt32>	mReleased;	// reads ever released, only written on the decoding thread
+		PipeRecovery	mRecovery;		// only used on the transport's thread
+	};
+
+	// An OUT pipe and the buffers of its transfers, used in turn. Those not yet written stay in use,
+	// the failed ones included, for they are written again once the pipe is restarted.
+	struct WritePipe {
+		WritePipe() : mEngine(NULL), mPipe(0), mBuffers(NULL), mLengths(NULL), mPending(NULL), mBufferSize(0),
+					  mNumBuffers(0), mNextBuffer(0), mInFlight(0), mOutstanding(0) { }
+		~WritePipe()	{ delete[] mBuffers; delete[] mLengths; delete[] mPending; }
+
+		void		Initialize(MidisportEngine *engine, int pipe, int numBuffers, ByteCount bufferSize);
+		bool		IsOpen() const			{ return mPipe != 0; }
+		bool		CanStart() const		{ return mInFlight < mNumBuffers && !mRecovery.recovering; }
+		Byte *		NextBuffer() const		{ return mBuffers + mNextBuffer * mBufferSize; }
+		Byte *		OldestBuffer(int i, ByteCount &length) const;
+						// the i'th oldest of the buffers in flight
+		int			Returning() const;
+						// which of the buffers in flight, counted as OldestBuffer does, the next
+						// transfer to return is writing: the oldest with a transfer outstanding
+		void		Started(ByteCount length);
+		void		Resent(int i);
+		void		KeepUnwritten(int i, ByteCount written);
+						// the write of the i'th oldest buffer wrote only written bytes, the rest
+						// stay to be written again
+		void		Completed(int i);
+						// the i'th oldest buffer is written and freed, those older than it, whose
+						// transfers failed, stay in flight to be written again
+		void		Failed(int i);
+
+		MidisportEngine *	mEngine;
+		int			mPipe;				// the transport's, 0 if the interface has no such pipe
+		Byte *		mBuffers;
+		ByteCount *	mLengths;
+		bool *		mPending;			// a transfer of the buffer is outstanding
+		ByteCount	mBufferSize;
+		int			mNumBuffers;
+		int			mNextBuffer;
+		int			mInFlight;			// buffers started and not yet written
+		int			mOutstanding;		// transfers whose callbacks have yet to come
+		PipeRecovery	mRecovery;
+	};
+
+	static void		ReadCallback(void *refcon, TransferResult result, ByteCount bytesTransferred, MIDITimeStamp completed);
+	static void		WriteCallback(void *refcon, TransferResult result, ByteCount bytesTransferred, MIDITimeStamp completed);
+
+	void			DoRead();
+	void			DoWrite();
+	void			ResendWrites(WritePipe &pipe);
+	void			ReleaseScheduledOutput(MIDITimeStamp now);
+	void			TransferFailed(PipeRecovery &recovery, int pipe, int outstanding, TransferResult result, UInt64 &errors);
+						// a transfer on the pipe returned result, outstanding transfers have yet to,
+						// errors counts those of the pipe's direction
+	void			RestartPipes(MIDITimeStamp now);
+
+	Transport &		mTransport;
+	const Clock &	mClock;
+	MIDISink &		mSink;
+	InterfaceInfo	mInterfaceInfo;
+	int				mNumOutputPorts;
+	bool			mStarted;
+	bool			mStopping;
+
+	ReadPipe		mReadPipe;
+	WritePipe		mWritePipe1;		// the even ports
+	WritePipe		mWritePipe2;		// the odd ports
+
+	// input state, only used on the decoding thread but for the statistics of the reads
+	InputHandoff *	mInputHandoff;		// NULL to decode in the read callbacks
+	std::atomic<bool>	mReadStarved;	// DoRead found every buffer waiting to be decoded
+	MidisportInputDecoder *	mInputDecoder;
+	MIDIPacketEmitter *		mEmitters;			// one per input port
+	Byte *			mPacketListStorage;
+	InputStatistics	mInputStatistics;
+
+	// output state
+	OutputScheduler	mOutput;
+	ScheduledOutput	mScheduledOutput;
+	MIDITimeStamp	mScheduleLead;		// output is queued this long before it is due
+	MIDITimeStamp	mOutputRetry;		// when output held back for room in the device can be written
+	MidisportOutputEncoder *	mOutputEncoder;
+	TransferStatistics	mTransferStatistics;
+};
+
+#endif // __MidisportEngine_h__
@@ -0,0 +1,17 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The MIDISPORT multiplexed format, in which MIDI is read from and written to the device in mspackets.
+// Each holds up to three MIDI bytes, followed by a cmd byte with the port number in its upper nibble
+// and the count of bytes in its lower two bits.
+//
+
+#ifndef __MidisportFormat_h__
+#define __MidisportFormat_h__
+
+#define MIDIPACKETLEN		4		// number of bytes in a dword packet received and sent to the MIDISPORT
+#define CMDINDEX	        (MIDIPACKETLEN - 1)  // which byte in the packet has the length and port number.
+#define MAX_PORTS           16      // the port number is the upper nibble of the cmd byte.
+#define MIDI_BYTE_NANOS     320000  // 10 bits (with start and stop bits) at 31250 baud.
+
+#endif // __MidisportFormat_h__
@@ -0,0 +1,315 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Decodes the MIDISPORT multiplexed input format into MIDIPacketLists for each input port.
+//
+
+#include <algorithm>
+#include "CoreDebug.h"
+#include "MidisportInputDecoder.h"
+#include "MidisportFormat.h"
+#include "MIDIPacketEmitter.h"
+#include "InterfaceInfo.h"
+#include "Clock.h"
+
+#define MIN_SYSEX_CHUNK_SIZE 16     // smaller chunks would bring back the flood of tiny packets.
+
+MidisportInputDecoder::MidisportInputDecoder(int numberOfInputPorts, int chunkSize, int timeout, bool stampBytes,
+                                             const Clock &clock)
+{
+    numberOfPorts = std::min(numberOfInputPorts, MAX_PORTS);    // the port is a nibble of the cmd byte.
+    portState = new PortState[numberOfPorts];
+    sysexChunkSize = std::max(chunkSize, MIN_SYSEX_CHUNK_SIZE);
+    sysexTimeout = clock.FromNanos((UInt64) std::max(timeout, 0) * 1000000);
+    // One allocation holds the sysex of every port, nothing is allocated while decoding.
+    sysexArena = new Byte[numberOfPorts * sysexChunkSize];
+    timestampBytes = stampBytes;
+    byteDuration = clock.FromNanos(MIDI_BYTE_NANOS);
+    for (int port = 0; port < numberOfPorts; port++)
+        portState[port].sysex = sysexArena + port * sysexChunkSize;
+    Reset();
+}
+
+MidisportInputDecoder::~MidisportInputDecoder()
+{
+    delete[] portState;
+    delete[] sysexArena;
+}
+
+void MidisportInputDecoder::Reset()
+{
+    for (int port = 0; port < numberOfPorts; port++) {
+        portState[port].inSysex = false;
+        portState[port].sysexSkipped = false;
+        portState[port].runningStatus = 0x90;   // we gotta start somewhere...
+        portState[port].remainingBytesInMsg = 0;
+        portState[port].numCompleted = 0;
+        portState[port].sysexLength = 0;
+        portState[port].sysexHeldSince = 0;
+        portState[port].bytesToCome = 0;
+        portState[port].lastArrival = 0;
+    }
+}
+
+// Estimate when the next byte of the port arrived at the MIDISPORT. Bytes of one port arrive serially
+// on its MIDI cable, so working back from when the read completed, the bytes which follow it in the
+// read took at least byteDuration each. The estimate is never earlier than a byte already decoded.
+MIDITimeStamp MidisportInputDecoder::ArrivalTime(PortState *port, MIDITimeStamp when)
+{
+    MIDITimeStamp arrival = when;
+
+    if (timestampBytes) {
+        MIDITimeStamp transmission = --port->bytesToCome * byteDuration;
+
+        arrival = (transmission < when) ? when - transmission : 0;
+        if (arrival < port->lastArrival)
+            arrival = port->lastArrival;
+    }
+    port->lastArrival = arrival;
+    return arrival;
+}
+
+// Hold a sysex byte until the message ends, the port's chunk fills or the bytes have waited too long.
+void MidisportInputDecoder::AddSysex(PortState *port, MIDIPacketEmitter *emitter, MIDITimeStamp when, Byte sysexByte,
+                                     InputStatistics &statistics)
+{
+    if (port->sysexLength == 0)
+        port->sysexHeldSince = when;
+    port->sysex[port->sysexLength++] = sysexByte;
+    statistics.sysexBytes++;
+    if (port->sysexLength == sysexChunkSize)
+        ShipSysex(port, emitter, when, statistics);
+}
+
+// Add the held sysex bytes as a single packet, a continuation of any previous packet of the message.
+void MidisportInputDecoder::ShipSysex(PortState *port, MIDIPacketEmitter *emitter, MIDITimeStamp when,
+                                      InputStatistics &statistics)
+{
+    if (port->sysexLength > 0) {
+        emitter->Add(when, port->sysexLength, port->sysex);
+        statistics.sysexPackets++;
+        port->sysexLength = 0;
+    }
+}
+
+void MidisportInputDecoder::ShipExpiredSysex(MIDIPacketEmitter *emitters, MIDITimeStamp now, InputStatistics &statistics)
+{
+    for (int inputPort = 0; inputPort < numberOfPorts; inputPort++) {
+        PortState *port = &portState[inputPort];
+
+        if (port->sysexLength > 0 && now - port->sysexHeldSince >= sysexTimeout)
+            ShipSysex(port, &emitters[inputPort], port->lastArrival, statistics);
+    }
+}
+
+// Follow the bytes of a port whose source is disabled only as far as it takes to parse its input
+// correctly once it is enabled again: whether it is within sysex, its running status and how much
+// of the current message has arrived. No arrival times are estimated, no packets are built, and
+// any sysex held for the port is dropped, with the rest of its message.
+void MidisportInputDecoder::Skip(PortState *port, const Byte *bytes, int count, InputStatistics &statistics)
+{
+    port->sysexLength = 0;
+    statistics.bytesSkipped += count;
+    for (int byteIndex = 0; byteIndex < count; byteIndex++) {
+        Byte midiByte = bytes[byteIndex];
+
+        if (midiByte >= 0xF8)
+            continue;
+        if (port->inSysex) {
+            if (!(midiByte & 0x80))
+                continue;
+            port->inSysex = false;
+            if (midiByte == 0xF7)
+                continue;
+        }
+        if (midiByte == 0xF0) {
+            port->inSysex = true;
+            port->remainingBytesInMsg = 0;
+            port->numCompleted = 0;
+            continue;
+        }
+        if (midiByte & 0x80) {
+            if (midiByte < 0xF0)
+                port->runningStatus = midiByte;
+            port->remainingBytesInMsg = MIDIDataBytes(midiByte);
+            port->completeMessage[0] = midiByte;
+            port->numCompleted = 1;
+        }
+        else if (port->remainingBytesInMsg > 0) {
+            port->remainingBytesInMsg--;
+            port->completeMessage[port->numCompleted++] = midiByte;
+        }
+        else {
+            port->completeMessage[0] = port->runningStatus;
+            port->completeMessage[1] = midiByte;
+            port->numCompleted = 2;
+            port->remainingBytesInMsg = MIDIDataBytes(port->runningStatus) - 1;
+        }
+        if (port->remainingBytesInMsg <= 0) {   // completed, and dropped
+            port->numCompleted = 0;
+            port->remainingBytesInMsg = 0;
+        }
+    }
+    // a sysex partly skipped is dropped whole, its source never delivering a fragment of it
+    port->sysexSkipped = port->inSysex;
+}
+
+// The MIDI bytes are transmitted from the MIDISPORT in little-endian dword (4 byte) "packets",
+// these are termed mspackets to avoid confusion with the MIDIServices concept of packet.
+// The format of mspackets in received memory order is:
+// d0, d1, d2, cmd, d0, d1, d2, cmd, ...
+// d0 is typically (but not always!) the status MIDI byte, d1, d2 the subsequent message bytes in order.
+// cmd is: 0xxx00yy
+// Where the upper nibble (xxx) indicates the source MIDI in port, 0=MIDI-IN A, 1=MIDI-IN B, 2=MIDI-IN C, etc.
+// The lower nibble (yy) indicates the byte count of valid data in the preceding three bytes.
+// A byte count of 0 indicates a null packet and marks the end of the multiplex input buffer
+// for transmitting less than a full kReadBufSize of data.
+// Sysex arrives three bytes per mspacket, so its bytes are held per port across mspackets
+// and reads to be delivered in large packets, rather than a packet per mspacket.
+// The input of ports whose sources are disabled is only followed to stay in sync with it, which
+// spares the constant MTC of an unused SMPTE port from being parsed and received for nobody.
+void MidisportInputDecoder::Decode(MIDIPacketEmitter *emitters, MIDITimeStamp when, const Byte *readBuf, ByteCount readBufSize,
+                                   InputStatistics &statistics)
+{
+    int prevInputPort = -1;	                         // signifies none
+    const Byte *src = readBuf, *srcend = src + readBufSize;
+    bool enabled[MAX_PORTS];    // sampled once, EnableSource can be called during the read.
+
+    statistics.readsHandled++;
+    for (int inputPort = 0; inputPort < numberOfPorts; inputPort++)
+        enabled[inputPort] = emitters[inputPort].IsEnabled();
+
+    if (timestampBytes) {
+        for ( ; src < srcend && (src[CMDINDEX] & 0x03) != 0; src += MIDIPACKETLEN) {
+            int inputPort = src[CMDINDEX] >> 4;
+
+            if (inputPort < numberOfPorts && enabled[inputPort])
+                portState[inputPort].bytesToCome += src[CMDINDEX] & 0x03;
+        }
+        src = readBuf;
+    }
+
+    for ( ; src < srcend; src += MIDIPACKETLEN) {
+        int bytesInPacket = src[CMDINDEX] & 0x03;   // number of valid bytes in a packet.
+        int inputPort = src[CMDINDEX] >> 4;
+
+        if (bytesInPacket == 0)	      // Indicates the end of the buffer, early out.
+            break;
+
+        DebugPrintf("MidisportInputDecoder::Decode %c %d: %02X %02X %02X %02X  \n", inputPort + 'A', bytesInPacket, src[0], src[1], src[2], src[3]);
+
+        if (inputPort >= numberOfPorts) {
+            DebugPrintf("ignoring mspacket from input port %d beyond the %d input ports", inputPort, numberOfPorts);
+            continue;
+        }
+        PortState *port = &portState[inputPort];
+        MIDIPacketEmitter *emitter = &emitters[inputPort];
+
+        if (!enabled[inputPort]) {
+            Skip(port, src, bytesInPacket, statistics);
+            continue;
+        }
+        // Each run of mspackets from one port would have cost a MIDIReceived call without per port packet lists.
+        if (inputPort != prevInputPort) {
+            statistics.inputPortRuns++;
+            prevInputPort = inputPort;
+        }
+
+        for (int byteIndex = 0; byteIndex < bytesInPacket; byteIndex++) {
+            Byte midiByte = src[byteIndex];
+            MIDITimeStamp arrival = ArrivalTime(port, when);
+
+            // A real-time message can occur anywhere, even within another message, which is
+            // left undisturbed. It is shipped straight away, even within sysex.
+            if (midiByte >= 0xF8) {
+                emitter->Add(arrival, 1, &midiByte);
+                continue;
+            }
+            if (port->inSysex) {
+                if (!(midiByte & 0x80)) {
+                    if (!port->sysexSkipped)
+                        AddSysex(port, emitter, arrival, midiByte, statistics);
+                    continue;
+                }
+                // Any status byte concludes the sysex, only F7 properly.
+                if (midiByte == 0xF7 && !port->sysexSkipped)
+                    AddSysex(port, emitter, arrival, midiByte, statistics);
+                ShipSysex(port, emitter, arrival, statistics);
+                port->inSysex = false;
+                port->sysexSkipped = false;
+                if (midiByte == 0xF7)
+                    continue;
+            }
+
+            if (midiByte == 0xF0) {
+                port->inSysex = true;
+                port->remainingBytesInMsg = 0;
+                port->numCompleted = 0;
+                AddSysex(port, emitter, arrival, midiByte, statistics);
+                continue;
+            }
+            if (midiByte & 0x80) {   // status was present
+                // running status applies to channel (voice and mode) messages only
+                if (midiByte < 0xF0)
+                    port->runningStatus = midiByte;  // remember it, including the MIDI channel...
+
+                port->remainingBytesInMsg = MIDIDataBytes(midiByte);
+                port->numCompleted = 1;
+                // store ready for packetting.
+                port->completeMessage[0] = midiByte;
+                // DebugPrintf("new status %02X, remainingBytesInMsg = %d", midiByte, port->remainingBytesInMsg);
+            }
+            else if (port->remainingBytesInMsg > 0) {   // still within a message
+                port->remainingBytesInMsg--;
+                // store ready for packetting.
+                port->completeMessage[port->numCompleted++] = midiByte;
+                // DebugPrintf("in message remainingBytesInMsg = %d", port->remainingBytesInMsg);
+            }
+            else {  // assume a running status message, assign status from the retained runnning status.
+                Byte status = port->runningStatus;
+                // DebugPrintf("assuming runningStatus %02X", status);
+                port->completeMessage[0] = status;
+                port->completeMessage[1] = midiByte;
+                port->numCompleted = 2;
+                port->remainingBytesInMsg = MIDIDataBytes(status) - 1;
+                // assert(port->remainingBytesInMsg > 0); // since System messages are prevented from being running status.
+            }
+
+            if (port->remainingBytesInMsg <= 0) { // completed
+#if DEBUG
+                DebugPrintf("Shipping a packet: ");
+                for (int i = 0; i < port->numCompleted; i++)
+                    DebugPrintf("%02X ", port->completeMessage[i]);
+#endif
+                emitter->Add(arrival, port->numCompleted, port->completeMessage);
+                port->numCompleted = 0;
+                port->remainingBytesInMsg = 0;
+                DebugPrintf("shipped packet");
+            }
+        }
+    }
+    ShipExpiredSysex(emitters, when, statistics);
+    // Deliver the packets accumulated for each port, one MIDIReceived per source with input.
+    for (int inputPort = 0; inputPort < numberOfPorts; inputPort++)
+        emitters[inputPort].Flush();
+}
+
+void MidisportInputDecoder::DeliverExpired(MIDIPacketEmitter *emitters, MIDITimeStamp now, InputStatistics &statistics)
+{
+    ShipExpiredSysex(emitters, now, statistics);
+    for (int inputPort = 0; inputPort < numberOfPorts; inputPort++)
+        emitters[inputPort].Flush();
+}
+
+MIDITimeStamp MidisportInputDecoder::NextDeadline() const
+{
+    MIDITimeStamp deadline = 0;
+
+    for (int inputPort = 0; inputPort < numberOfPorts; inputPort++) {
+        const PortState *port = &portState[inputPort];
+
+        if (port->sysexLength > 0 && (deadline == 0 || port->sysexHeldSince + sysexTimeout < deadline))
+            deadline = port->sysexHeldSince + sysexTimeout;
+    }
+    return deadline;
+}
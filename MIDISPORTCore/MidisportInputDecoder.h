@@ -0,0 +1,76 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Decodes the MIDISPORT multiplexed input format into MIDIPacketLists for each input port.
+// Each MidisportEngine owns one decoder, so the parse state of a MIDISPORT never leaks into another,
+// and the state is retained across USB reads and switches between input ports.
+//
+
+#ifndef __MidisportInputDecoder_h__
+#define __MidisportInputDecoder_h__
+
+#include "MIDITypes.h"
+
+struct InputStatistics;
+class MIDIPacketEmitter;
+class Clock;
+
+class MidisportInputDecoder {
+public:
+    // Incoming sysex is gathered into packets of up to sysexChunkSize bytes, an incomplete message
+    // being held for up to sysexTimeout milliseconds for more of its bytes to arrive.
+    // With timestampBytes, each message is stamped with when its last byte is estimated to have
+    // arrived at the MIDISPORT, rather than when the USB read completed. Time stamps are those of clock.
+    MidisportInputDecoder(int numberOfInputPorts, int sysexChunkSize, int sysexTimeout, bool timestampBytes,
+                          const Clock &clock);
+    ~MidisportInputDecoder();
+
+    // Parse the mspackets in readBuf into packets added to the emitters (indexed by input port),
+    // when being the time the read completed. Ports whose emitters are disabled get no packets.
+    // Packets are collected per port for the whole buffer, so each source receives at most one
+    // MIDIReceived call per read (unless its packet list fills), regardless of how the ports are interleaved.
+    void Decode(MIDIPacketEmitter *emitters, MIDITimeStamp when, const Byte *readBuf, ByteCount readBufSize,
+                InputStatistics &statistics);
+
+    // Deliver the sysex bytes that have been held for sysexTimeout by the time now.
+    void DeliverExpired(MIDIPacketEmitter *emitters, MIDITimeStamp now, InputStatistics &statistics);
+
+    // The time when held sysex bytes will next need delivering, or 0 if none are held.
+    MIDITimeStamp NextDeadline() const;
+
+    int NumberOfPorts() const { return numberOfPorts; }
+
+private:
+    // The parse state retained for each MIDI input port between mspackets.
+    struct PortState {
+        bool inSysex;
+        bool sysexSkipped;              // the sysex was partly skipped while the port's source was disabled.
+        Byte runningStatus;
+        int remainingBytesInMsg;        // how many bytes remain to be processed in the MIDI message
+        Byte completeMessage[3];        // the bytes of the message ready for packeting.
+        int numCompleted;               // the number of bytes in completeMessage.
+        Byte *sysex;                    // this port's sysexChunkSize bytes of the sysex arena.
+        int sysexLength;                // the number of bytes held in sysex.
+        MIDITimeStamp sysexHeldSince;   // when the first of those bytes arrived.
+        int bytesToCome;                // bytes of the port later in the read than the one being decoded.
+        MIDITimeStamp lastArrival;      // when the last byte decoded arrived, stamps never go back before it.
+    };
+
+    void Reset();
+    void Skip(PortState *port, const Byte *bytes, int count, InputStatistics &statistics);
+    MIDITimeStamp ArrivalTime(PortState *port, MIDITimeStamp when);
+    void AddSysex(PortState *port, MIDIPacketEmitter *emitter, MIDITimeStamp when, Byte sysexByte,
+                  InputStatistics &statistics);
+    void ShipSysex(PortState *port, MIDIPacketEmitter *emitter, MIDITimeStamp when, InputStatistics &statistics);
+    void ShipExpiredSysex(MIDIPacketEmitter *emitters, MIDITimeStamp now, InputStatistics &statistics);
+
+    int numberOfPorts;
+    PortState *portState;
+    int sysexChunkSize;
+    MIDITimeStamp sysexTimeout;         // in clock units.
+    Byte *sysexArena;                   // sysex bytes held, for all ports.
+    bool timestampBytes;
+    MIDITimeStamp byteDuration;         // clock time taken to transmit a byte on a MIDI cable.
+};
+
+#endif // __MidisportInputDecoder_h__
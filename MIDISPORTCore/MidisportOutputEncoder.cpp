@@ -0,0 +1,374 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Encodes the queued output of each port into the MIDISPORT multiplexed output format.
+//
+
+#include <string.h>
+#include "CoreDebug.h"
+#include "MidisportOutputEncoder.h"
+#include "MidisportFormat.h"
+#include "OutputScheduler.h"
+#include "Clock.h"
+
+#define NOTE_OFF_DEFAULT_VELOCITY 0x40  // the release velocity of senders without one, as good as none.
+
+MidisportOutputEncoder::MidisportOutputEncoder(int numberOfOutputPorts, bool useRunningStatus, bool convertNoteOffs, bool packMessages,
+                                               int deviceBufferSize, const Clock &clock)
+{
+    numberOfPorts = numberOfOutputPorts;
+    portState = new PortState[numberOfPorts];
+    runningStatus = useRunningStatus;
+    noteOffAsNoteOn = convertNoteOffs;
+    packBytes = packMessages;
+    // a buffer smaller than an mspacket's bytes would never have room, and the credit would wrap
+    if (deviceBufferSize <= 0)
+        bufferSize = 0;
+    else
+        bufferSize = deviceBufferSize < MIDIPACKETLEN - 1 ? MIDIPACKETLEN - 1 : deviceBufferSize;
+    byteDuration = clock.FromNanos(MIDI_BYTE_NANOS);
+    for (int port = 0; port < numberOfPorts; port++) {
+        portState[port].drained = 0;
+        portState[port].inFlight = 0;
+        portState[port].heldUntil = 0;
+    }
+    Reset();
+}
+
+MidisportOutputEncoder::~MidisportOutputEncoder()
+{
+    delete[] portState;
+}
+
+void MidisportOutputEncoder::Reset()
+{
+    for (int port = 0; port < numberOfPorts; port++) {
+        portState[port].runningStatus = 0;
+        portState[port].messageLength = 0;
+        portState[port].messageSent = 0;
+        portState[port].inSysex = false;
+    }
+}
+
+// Track the running status of the port's MIDI cable as each byte goes out. Channel messages set it,
+// sysex and System Common messages cancel it, System Realtime messages leave it undisturbed.
+// Any status but System Realtime ends a sysex.
+void MidisportOutputEncoder::Sent(PortState *port, Byte midiByte)
+{
+    if (midiByte >= 0xF8 || !(midiByte & 0x80))
+        return;
+    if (midiByte >= 0xF0)
+        port->runningStatus = 0;
+    else
+        port->runningStatus = midiByte;
+    port->inSysex = (midiByte == 0xF0);
+}
+
+// Encode the next MIDI message of the record, or up to three bytes of sysex, into message,
+// advancing the record past it. Returns the number of bytes of message, 0 if the record's data
+// could not be encoded.
+int MidisportOutputEncoder::EncodeMessage(PortState *port, WriteQueueElem *wqe, Byte *message)
+{
+    Byte *src = wqe->data + wqe->bytesSent;
+    Byte *srcend = &wqe->data[wqe->length];
+    int messageLength = 0;
+    Byte c = *src++;
+
+    // DebugPrintf("byte %02X", c);
+    switch (c >> 4) {
+    case 0x0: case 0x1: case 0x2: case 0x3:
+    case 0x4: case 0x5: case 0x6: case 0x7:
+        // DebugPrintf("sysex databyte %02X", c);
+        // data byte, presumably a sysex continuation
+        // write up to 2 more sysex data bytes, if present in the packet
+        message[messageLength++] = c;
+        while (messageLength < 3 && src < srcend)
+            message[messageLength++] = *src++;
+        break;
+    case 0x8:	// note-off
+    case 0x9:	// note-on
+    case 0xA:	// poly pressure
+    case 0xB:	// control change
+    case 0xC:	// program change
+    case 0xD:	// mono pressure
+    case 0xE:	// pitch bend
+        {
+            // DebugPrintf("channel %02X", c);
+            int dataBytes = MIDIDataBytes(c);
+            Byte data[2] = { 0, 0 };
+
+            for (int i = 0; i < dataBytes && src < srcend; i++)
+                data[i] = *src++;
+            if (noteOffAsNoteOn && (c >> 4) == 0x8 && data[1] == NOTE_OFF_DEFAULT_VELOCITY) {
+                c = 0x90 | (c & 0x0F);
+                data[1] = 0;
+            }
+            if (!runningStatus || c != port->runningStatus)
+                message[messageLength++] = c;
+            for (int i = 0; i < dataBytes; i++)
+                message[messageLength++] = data[i];
+        }
+        break;
+    case 0xF:	// system message
+        // DebugPrintf("system %02X", c);
+        switch (c) {
+        case 0xF0:	// sysex start
+            // write up to 2 sysex data bytes, if present in the packet
+            message[messageLength++] = c;
+            while (messageLength < 3 && src < srcend)
+                message[messageLength++] = *src++;
+            break;
+        case 0xF6:	// tune request (0)
+        case 0xF7:	// sysex conclude (0)
+        case 0xF8:	// clock
+        case 0xFA:	// start
+        case 0xFB:	// continue
+        case 0xFC:	// stop
+        case 0xFE:	// active sensing
+        case 0xFF:	// system reset
+            message[messageLength++] = c;   // 1-byte system realtime or system common
+            break;
+        case 0xF1:	// MTC (1)
+        case 0xF3:	// song select (1)
+            message[messageLength++] = c;   // 2-byte system common
+            message[messageLength++] = *src++;
+            break;
+        case 0xF2:	// song pointer (2)
+            message[messageLength++] = c;   // 3-byte system common
+            message[messageLength++] = *src++;
+            message[messageLength++] = *src++;
+            break;
+        default:
+            // DebugPrintf("unknown %02X", c);
+            // unknown MIDI message! advance until we find a status byte
+            while (src < srcend && *src < 0x80)
+                ++src;
+            break;
+        }
+        break;
+    }
+    wqe->bytesSent = src - wqe->data;
+    for (int i = 0; i < messageLength; i++)
+        Sent(port, message[i]);
+    return messageLength;
+}
+
+int MidisportOutputEncoder::Flush(UInt8 portNum, Byte *rest)
+{
+    PortState *port = &portState[portNum];
+    int restLength = 0;
+
+    while (port->messageSent < port->messageLength)
+        rest[restLength++] = port->message[port->messageSent++];
+    port->messageLength = port->messageSent = 0;
+    if (port->inSysex)
+        rest[restLength++] = 0xF7;
+    return restLength;
+}
+
+// The MIDI bytes are transmitted to the MIDISPORT in the same mspackets as are received from it:
+// d0, d1, d2, cmd with cmd holding the output port in the upper nibble and the count of valid bytes
+// in the lower. The bytes of each port are sent out its MIDI cable as they come, so a message can
+// omit the status byte the cable's running status already gives it, and when packing, a message
+// can begin in the mspacket another ends in, or be divided between mspackets.
+ByteCount MidisportOutputEncoder::Encode(UInt8 portNum, WriteQueue &realtimeQueue, WriteQueue &queue, Byte *dest)
+{
+    PortState *port = &portState[portNum];
+    Byte bytes[3];
+    int count = 0;
+    WriteQueueElem *wqe;
+
+    if (!packBytes) {
+        WriteQueue *source = realtimeQueue.IsEmpty() ? &queue : &realtimeQueue;
+
+        if ((wqe = source->Front()) == NULL)
+            return 0;
+        count = EncodeMessage(port, wqe, bytes);
+        if (wqe->bytesSent >= wqe->length)
+            source->PopFront();     // source packet completely sent
+    }
+    else {
+        while (count < 3) {
+            // realtime records are single bytes, which MIDI allows between the bytes of any message
+            if ((wqe = realtimeQueue.Front()) != NULL) {
+                bytes[count++] = wqe->data[0];
+                realtimeQueue.PopFront();
+                continue;
+            }
+            if ((wqe = queue.Front()) == NULL)
+                break;
+            if (port->messageSent == port->messageLength) {
+                port->messageLength = EncodeMessage(port, wqe, port->message);
+                port->messageSent = 0;
+            }
+            while (count < 3 && port->messageSent < port->messageLength)
+                bytes[count++] = port->message[port->messageSent++];
+            // the record stays queued until its last message is in an mspacket, so the port has output
+            if (port->messageSent == port->messageLength && wqe->bytesSent >= wqe->length)
+                queue.PopFront();
+        }
+    }
+    if (count == 0)
+        return 0;
+    // the device has room to keep for them from now until it takes them
+    port->inFlight += count;
+
+    memset(dest, 0, MIDIPACKETLEN);
+    memcpy(dest, bytes, count);
+    dest[CMDINDEX] = (portNum << 4) | count;   // mark length and cable
+    return MIDIPACKETLEN;
+}
+
+// The device takes the transfer no later than it completes, so its ports start sending the bytes no
+// later than drained says, and no port's buffer holds more than is charged against it.
+void MidisportOutputEncoder::Written(const Byte *transfer, ByteCount length, MIDITimeStamp completed)
+{
+    for (ByteCount i = 0; i + MIDIPACKETLEN <= length; i += MIDIPACKETLEN) {
+        Byte cmd = transfer[i + CMDINDEX];
+        int portNum = cmd >> 4;
+        int count = cmd & 0x03;
+        PortState *port;
+
+        if (count == 0)
+            break;              // the null mspacket ending the transfer
+        if (portNum >= numberOfPorts)
+            continue;
+        port = &portState[portNum];
+        port->inFlight = (port->inFlight > count) ? port->inFlight - count : 0;
+        // the device starts sending the bytes once it has sent those before them
+        port->drained = (port->drained > completed ? port->drained : completed) + count * byteDuration;
+    }
+}
+
+// The port's buffer in the device holds what it has not yet sent of the bytes given it, and will
+// hold those in flight to it, which must leave room for a full mspacket. A port which runs out of
+// credit has none until the device has sent half its buffer, so each wake-up writes a transfer's
+// worth rather than an mspacket at a time. The bytes in flight are taken to reach the device now,
+// which is as soon as they could, so the port is never retried before the device has that room.
+bool MidisportOutputEncoder::HasCredit(UInt8 portNum, MIDITimeStamp now)
+{
+    PortState *port = &portState[portNum];
+    MIDITimeStamp drained;
+
+    if (bufferSize == 0)
+        return true;
+    if (now < port->heldUntil)
+        return false;
+    drained = (port->drained > now ? port->drained : now) + port->inFlight * byteDuration;
+    if (drained > now + (bufferSize - (MIDIPACKETLEN - 1)) * byteDuration) {
+        port->heldUntil = drained - (bufferSize / 2) * byteDuration;
+        return false;
+    }
+    return true;
+}
+
+MIDITimeStamp MidisportOutputEncoder::CreditTime(UInt8 portNum)
+{
+    return portState[portNum].heldUntil;
+}
+
+// There is no room for another mspacket in dest, NULL if the endpoint's transfers are all in flight.
+static inline bool IsFull(const Byte *dest, const Byte *destEnd)
+{
+    return dest == NULL || dest > destEnd - MIDIPACKETLEN;
+}
+
+// OutputScheduler holds the MIDI to be transmitted for each port, presumably at least one record.
+// Fill two USB buffers, destBuf[0] and destBuf[1], each with a maximum size of transferSize (dependent on the device),
+// with outgoing data in MIDISPORT-MIDI format. A NULL destBuf is for an endpoint with no free buffer,
+// its count is left 0 and its ports' output waits for the next call.
+// The ports are visited in turn, encoding an mspacket of each, so a port with a long sysex waiting
+// takes no more of a transfer than any other port with output. System Realtime messages are
+// encoded before any other output, between mspackets of a sysex if need be.
+// Each mspacket is encoded by Encode, shortening messages by running status,
+// and with PackOutputBytes in the device list, filling each with three bytes of the port's output.
+// Return the number of bytes written in bufCount.
+// Devices can limit the mspackets for each port in a transfer (OutputPacketsPerPort in the device list),
+// a port which has used its budget is passed over until the next transfer, leaving the space to other ports.
+// With OutputBufferSize in the device list, a port is also passed over while the device has no room to buffer
+// another mspacket for it, the MIDI cable sending 3125 bytes a second, and retryTime is when the write
+// should be retried, once the device has sent half of what it holds. Big sysex then waits in the driver
+// rather than overrunning the device.
+// From the 8x8 Spec:
+// "To ease the load on the MidiSport 8x8 processor, this limitation has been added: the host should send
+// no more than two packets per each MIDI OUT or SMPTE port in a given OUT transfer.  This limitation 
+// still allows MIDI data to be transferred at almost double bandwidth across the USB bus while reducing
+// the MidiSport's internal buffer requirements."
+void MidisportOutputEncoder::EncodeTransfers(OutputScheduler &output, Byte *destBuf[2], ByteCount bufCount[2],
+                                             ByteCount transferSize, int packetsPerPort, MIDITimeStamp now,
+                                             MIDITimeStamp &retryTime)
+{
+    Byte *dest[2] = {destBuf[0], destBuf[1]};
+    Byte *destEnd[2] = {destBuf[0] ? destBuf[0] + transferSize : NULL,
+                        destBuf[1] ? destBuf[1] + transferSize : NULL};
+    int budget = packetsPerPort;
+    int packetsOfPort[MAX_PORTS] = { 0 };  // mspackets encoded for each port in this transfer.
+    bool progress;
+
+    retryTime = 0;
+    // System Realtime goes first, ahead of the output already queued for each port.
+    for (int port = 0; port < output.NumPorts(); port++) {
+        int cableEndpoint = port & 0x01;
+        WriteQueue &realtimeQueue = output.RealtimeQueue(port);
+
+        while (!IsFull(dest[cableEndpoint], destEnd[cableEndpoint]) && !realtimeQueue.IsEmpty()) {
+            if (budget != 0 && packetsOfPort[port] >= budget)
+                break;
+            if (!HasCredit(port, now)) {
+                RetryAt(retryTime, CreditTime(port));
+                break;
+            }
+            dest[cableEndpoint] += Encode(port, realtimeQueue, output.Queue(port), dest[cableEndpoint]);
+            packetsOfPort[port]++;
+        }
+    }
+    do {
+        progress = false;
+        for (int i = 0; i < output.NumPorts(); i++) {
+            int port = output.RoundRobinPort(i);
+            // put Port 1,3,5,7 to destBuf[0], Port 2,4,6,8 to destBuf[1]
+            int cableEndpoint = port & 0x01;
+            WriteQueue &writeQueue = output.Queue(port);
+
+            if (IsFull(dest[cableEndpoint], destEnd[cableEndpoint]))   // this destBuf is completely filled, or busy
+                continue;
+            if (budget != 0 && packetsOfPort[port] >= budget)       // the port has had its share of this transfer
+                continue;
+            if (writeQueue.IsEmpty())
+                continue;
+            if (!HasCredit(port, now)) {                            // the device is still sending what it has
+                RetryAt(retryTime, CreditTime(port));
+                continue;
+            }
+            DebugPrintf("port %d to endpoint %d", port, cableEndpoint);
+            dest[cableEndpoint] += Encode(port, output.RealtimeQueue(port), writeQueue, dest[cableEndpoint]);
+            packetsOfPort[port]++;
+            progress = true;
+        }
+        // we didn't fill the output buffers, is there more source data in the write queues?
+    } while (progress);
+    output.NextTransfer();
+
+#if DEBUG_OUTBUFFER
+    DebugPrintf("MidisportOutputEncoder::EncodeTransfers dest buffer = ");
+    for(int i = 0; destBuf[0] != NULL && i < dest[0] - destBuf[0]; i++)
+        DebugPrintf("%02X ", destBuf[0][i]);
+    DebugPrintf("");
+#endif
+    for (int endpoint = 0; endpoint < 2; endpoint++) {
+        ByteCount bufLength = dest[endpoint] - destBuf[endpoint];
+
+        if (bufLength > 0 && dest[endpoint] < destEnd[endpoint]) {
+            memset(dest[endpoint], 0, MIDIPACKETLEN);  // signal the conclusion with a single null packet
+            bufLength += MIDIPACKETLEN;
+        }
+        bufCount[endpoint] = bufLength;
+    }
+}
+
+// Keep the earliest of the times output was held back until.
+void MidisportOutputEncoder::RetryAt(MIDITimeStamp &retryTime, MIDITimeStamp when)
+{
+    if (retryTime == 0 || when < retryTime)
+        retryTime = when;
+}
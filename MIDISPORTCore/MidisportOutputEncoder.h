@@ -0,0 +1,97 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Encodes the queued output of each port into the MIDISPORT multiplexed output format.
+// Each MidisportEngine owns one encoder, holding what was last sent on the MIDI cable of each of
+// its output ports, so messages can be shortened by running status, and the message partly sent,
+// so the bytes of each port can be packed into mspackets as one continuous stream, and how far the
+// device is behind sending it, so output can be paced to what the device can buffer.
+//
+
+#ifndef __MidisportOutputEncoder_h__
+#define __MidisportOutputEncoder_h__
+
+#include "MIDITypes.h"
+
+struct WriteQueueElem;
+class WriteQueue;
+class OutputScheduler;
+class Clock;
+
+class MidisportOutputEncoder {
+public:
+    // With runningStatus, a channel message with the same status as the last sent to its port is
+    // sent without it. With noteOffAsNoteOn, note-offs with the default release velocity are sent as
+    // note-ons of velocity 0, which share running status with the note-ons around them.
+    // With packBytes, every mspacket is filled with three bytes while the port has them, whatever
+    // messages they belong to, otherwise each mspacket holds one message, or three bytes of sysex.
+    // With a deviceBufferSize, the device is taken to buffer that many bytes for each output port,
+    // sending them out the port's MIDI cable at 31250 baud, and output is only encoded for ports it
+    // has room for. 0 leaves the output unpaced, a size smaller than one mspacket's three bytes is
+    // taken as three. Time stamps are those of clock.
+    MidisportOutputEncoder(int numberOfOutputPorts, bool runningStatus, bool noteOffAsNoteOn, bool packBytes,
+                           int deviceBufferSize, const Clock &clock);
+    ~MidisportOutputEncoder();
+
+    // Encode the next output of the port into the mspacket at dest, the System Realtime bytes waiting
+    // in realtimeQueue ahead of the records of queue. Records are popped once all their bytes are encoded.
+    // The mspacket's bytes are charged against the port's buffer in the device as in flight until the
+    // transfer holding it is Written. Returns the number of bytes written to dest, 0 if nothing could be encoded.
+    ByteCount Encode(UInt8 portNum, WriteQueue &realtimeQueue, WriteQueue &queue, Byte *dest);
+
+    // Fill the transfers of the two OUT endpoints from the output waiting, the even ports' output in
+    // destBuf[0] and the odd ports' in destBuf[1], each of up to transferSize bytes, NULL for an endpoint
+    // with no free buffer. At most packetsPerPort mspackets of each port go in a transfer, 0 for no limit.
+    // bufCount returns the bytes written to each, retryTime when output held back for want of room in the
+    // device can be encoded, 0 if none was held back.
+    void EncodeTransfers(OutputScheduler &output, Byte *destBuf[2], ByteCount bufCount[2], ByteCount transferSize,
+                         int packetsPerPort, MIDITimeStamp now, MIDITimeStamp &retryTime);
+
+    // The device took length bytes of a transfer EncodeTransfers filled at completed, the mspackets'
+    // bytes are no longer in flight but in the buffers of their ports, which start sending them then.
+    void Written(const Byte *transfer, ByteCount length, MIDITimeStamp completed);
+
+    // Whether the device has room for another mspacket of the port at now, the bytes in flight to it included.
+    bool HasCredit(UInt8 portNum, MIDITimeStamp now);
+
+    // When a port HasCredit refused will have credit again, the device having sent half its buffer.
+    MIDITimeStamp CreditTime(UInt8 portNum);
+
+    // Forget the running status and partly sent message of every port, the next channel message
+    // of each is sent in full. The ports' queues must be emptied with it.
+    void Reset();
+
+    // Once the port's queues are emptied, the bytes which must still be sent to leave its MIDI cable
+    // between messages: the rest of a message partly in mspackets, and an EOX ending a sysex cut short.
+    // Returns how many were written to rest, at most three.
+    int Flush(UInt8 portNum, Byte *rest);
+
+    int NumberOfPorts() const { return numberOfPorts; }
+
+private:
+    // What was last sent on the MIDI cable of each output port.
+    struct PortState {
+        Byte runningStatus;     // the status data bytes alone would be taken as, 0 for none.
+        Byte message[3];        // the encoded message being sent, when packed it can span mspackets.
+        int messageLength;
+        int messageSent;        // the bytes of message already in mspackets.
+        bool inSysex;           // the cable is within a sysex message.
+        MIDITimeStamp drained;  // when the device will have sent all the bytes it has taken for the port.
+        int inFlight;           // the port's bytes encoded in transfers the device has yet to take.
+        MIDITimeStamp heldUntil;    // when the port, having run out of credit, has it again.
+    };
+
+    int EncodeMessage(PortState *port, WriteQueueElem *wqe, Byte *message);
+    void Sent(PortState *port, Byte midiByte);
+    static void RetryAt(MIDITimeStamp &retryTime, MIDITimeStamp when);
+
+    int numberOfPorts;
+    PortState *portState;
+    bool runningStatus;
+    bool noteOffAsNoteOn;
+    bool packBytes;
+    int bufferSize;
+    MIDITimeStamp byteDuration;
+};
+
+#endif // __MidisportOutputEncoder_h__
@@ -0,0 +1,251 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The output waiting to be written to an interface, queued independently for each port.
+//
+
+#include <string.h>
+#include "CoreDebug.h"
+#include "OutputScheduler.h"
+
+// Realtime messages are single bytes, sent as soon as there is a transfer.
+#define kRealtimeQueueSize	256
+// the bytes around System Realtime in a packet are gathered back together this many at a time
+#define kGatherSize			256
+
+OutputScheduler::OutputScheduler() :
+	mNumPorts(0),
+	mQueues(NULL),
+	mRealtimeQueues(NULL),
+	mFirstPort(0),
+	mSuperseding(NULL),
+	mCoalesced(0)
+{
+}
+
+OutputScheduler::~OutputScheduler()
+{
+	delete[] mQueues;
+	delete[] mRealtimeQueues;
+	delete[] mSuperseding;
+}
+
+void	OutputScheduler::Allocate(int numPorts, ByteCount queueSize, bool coalesce)
+{
+	delete[] mQueues;
+	delete[] mRealtimeQueues;
+	delete[] mSuperseding;
+	mSuperseding = NULL;
+	if (coalesce) {
+		mSuperseding = new Superseding[numPorts];
+		memset(mSuperseding, 0, numPorts * sizeof(Superseding));
+	}
+	mNumPorts = numPorts;
+	mQueues = new WriteQueue[numPorts];
+	mRealtimeQueues = new WriteQueue[numPorts];
+	for (int port = 0; port < numPorts; ++port) {
+		mQueues[port].Allocate(queueSize);
+		mRealtimeQueues[port].Allocate(kRealtimeQueueSize);
+	}
+	mFirstPort = 0;
+}
+
+ByteCount	OutputScheduler::SupersedingLength(const Byte *message, ByteCount length)
+{
+	ByteCount messageLength;
+
+	switch (message[0] & 0xF0) {
+	case 0xB0:	// control change
+		if (length < 3)
+			return 0;
+		switch (message[1]) {
+		case 6: case 38:			// data entry, of the parameter last selected
+		case 96: case 97:			// data increment and decrement
+		case 98: case 99:			// NRPN select
+		case 100: case 101:			// RPN select
+			return 0;
+		}
+		if (message[1] >= 120)		// channel mode messages act on the notes sounding
+			return 0;
+		messageLength = 3;
+		break;
+	case 0xD0:	// channel pressure
+		messageLength = 2;
+		break;
+	case 0xE0:	// pitch bend
+		messageLength = 3;
+		break;
+	default:
+		return 0;
+	}
+	if (length < messageLength || message[messageLength - 1] >= 0x80)
+		return 0;
+	return messageLength;
+}
+
+UInt32 *	OutputScheduler::Position(Superseding &superseding, const Byte *message)
+{
+	int channel = message[0] & 0x0F;
+
+	switch (message[0] & 0xF0) {
+	case 0xB0:
+		return &superseding.controlChange[channel][message[1]];
+	case 0xD0:
+		return &superseding.channelPressure[channel];
+	default:
+		return &superseding.pitchBend[channel];
+	}
+}
+
+bool	OutputScheduler::Coalesce(int port, const Byte *message, ByteCount length)
+{
+	Superseding &superseding = mSuperseding[port];
+	UInt32 position = *Position(superseding, message);
+
+	// a message of the channel other than these queued since, the superseded one must be sent before
+	if ((SInt32)(position - superseding.barrier[message[0] & 0x0F]) < 0)
+		return false;
+	WriteQueueElem *wqe = mQueues[port].Unsent(position);
+	if (wqe == NULL || wqe->length != length || wqe->data[0] != message[0])
+		return false;
+	if ((message[0] & 0xF0) == 0xB0 && wqe->data[1] != message[1])
+		return false;
+	memcpy(wqe->data, message, length);
+	++mCoalesced;
+	return true;
+}
+
+void	OutputScheduler::Queued(int port, const Byte *data, ByteCount length)
+{
+	if (mSuperseding == NULL)
+		return;
+	Superseding &superseding = mSuperseding[port];
+	UInt32 position = mQueues[port].BackPosition();
+
+	if (SupersedingLength(data, length) == length) {
+		*Position(superseding, data) = position;
+		return;
+	}
+	// packets sent to a driver never use running status, each channel message begins with its status
+	for (const Byte *dataEnd = data + length; data < dataEnd; ++data)
+		if (*data >= 0x80 && *data < 0xF0)
+			superseding.barrier[*data & 0x0F] = position;
+}
+
+// Packets sent to a driver never use running status, so each other message begins with its status.
+// Sysex can be divided anywhere, the encoders treat data bytes as its continuation.
+ByteCount	OutputScheduler::MessagesLength(const Byte *data, ByteCount length, ByteCount limit)
+{
+	if (length <= limit)
+		return length;
+	for (ByteCount back = 1; back <= 2; ++back) {
+		Byte c = data[limit - back];
+		if (c >= 0x80) {
+			if (c != 0xF0 && c < 0xF8 && MIDIDataBytes(c) >= (int)back)
+				return limit - back;	// the message would be divided, end before it
+			break;
+		}
+	}
+	return limit;
+}
+
+// copy the MIDI messages onto the port's queue, dividing them between records as needed.
+void	OutputScheduler::QueueRecords(int port, const Byte *data, ByteCount length)
+{
+	WriteQueue &writeQueue = mQueues[port];
+
+	while (length > 0) {
+		ByteCount recordLength = MessagesLength(data, length, writeQueue.MaxRecordLength());
+		
+		if (!writeQueue.Push(port, data, recordLength)) {
+			DebugPrintf("write queue full, dropped %lu bytes for port %d", (unsigned long) length, port);
+			break;
+		}
+		Queued(port, data, recordLength);
+		data += recordLength;
+		length -= recordLength;
+	}
+}
+
+// When coalescing, each message which can supersede or be superseded is queued in a record of its own,
+// unless it overwrites the one it supersedes.
+void	OutputScheduler::QueueMessages(int port, const Byte *data, ByteCount length)
+{
+	const Byte *dataEnd = data + length;
+
+	if (Coalescing()) {
+		const Byte *message = data;
+
+		while (message < dataEnd) {
+			ByteCount messageLength = SupersedingLength(message, dataEnd - message);
+
+			if (messageLength == 0) {
+				++message;
+				continue;
+			}
+			QueueRecords(port, data, message - data);
+			if (!Coalesce(port, message, messageLength))
+				QueueRecords(port, message, messageLength);
+			message += messageLength;
+			data = message;
+		}
+	}
+	QueueRecords(port, data, dataEnd - data);
+}
+
+// System Realtime jumps ahead of the port's queue, even from within another message, the bytes
+// around it being gathered back together so records only divide messages where QueueMessages does.
+void	OutputScheduler::QueuePacket(int port, const Byte *data, ByteCount length)
+{
+	const Byte *dataEnd = data + length;
+	const Byte *realtime = data;
+	Byte gathered[kGatherSize];
+	ByteCount gatheredLength = 0;
+
+	while (realtime < dataEnd && *realtime < 0xF8)
+		++realtime;
+	if (realtime == dataEnd) {
+		// the usual packet, without System Realtime
+		QueueMessages(port, data, length);
+		return;
+	}
+	for ( ; data < dataEnd; ++data) {
+		if (*data >= 0xF8) {
+			if (!mRealtimeQueues[port].Push(port, data, 1))
+				DebugPrintf("realtime queue full, dropped %02X for port %d", *data, port);
+			continue;
+		}
+		gathered[gatheredLength++] = *data;
+		if (gatheredLength == kGatherSize) {
+			// queue the whole messages gathered, keeping back any divided by the end of the buffer
+			ByteCount messagesLength = MessagesLength(gathered, gatheredLength, kGatherSize - 2);
+			QueueMessages(port, gathered, messagesLength);
+			gatheredLength -= messagesLength;
+			memmove(gathered, gathered + messagesLength, gatheredLength);
+		}
+	}
+	QueueMessages(port, gathered, gatheredLength);
+}
+
+void	OutputScheduler::Flush(int port)
+{
+	mQueues[port].Clear();
+	mRealtimeQueues[port].Clear();
+}
+
+bool	OutputScheduler::IsEmpty()
+{
+	for (int port = 0; port < mNumPorts; ++port)
+		if (!mQueues[port].IsEmpty() || !mRealtimeQueues[port].IsEmpty())
+			return false;
+	return true;
+}
+
+UInt64	OutputScheduler::Overflows() const
+{
+	UInt64 overflows = 0;
+
+	for (int port = 0; port < mNumPorts; ++port)
+		overflows += mQueues[port].Overflows() + mRealtimeQueues[port].Overflows();
+	return overflows;
+}
@@ -0,0 +1,92 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The output waiting to be written to an interface, queued independently for each port, so a long
+// sysex to one port never holds up the messages of another. EncodeTransfers visits the ports in turn,
+// an event from each at a time, starting each transfer from the port after the one first visited
+// by the last transfer, so every port gets an equal share of every transfer.
+// System Realtime messages (clock, start, stop...) are queued apart from the other output of a port,
+// to be sent in the next transfer ahead of it, as MIDI allows them between the bytes of any message.
+// Optionally the queues coalesce: a control change, pitch bend or channel pressure sent while the
+// one it supersedes, of the same port, channel and controller, is still unsent overwrites it in place,
+// so a port given more than its MIDI cable can carry sends the latest values without falling behind.
+// Notes, sysex and every other message are queued untouched, and no message is moved past another
+// of its channel which is not coalesced. Used only on the interface's I/O run loop.
+//
+
+#ifndef __OutputScheduler_h__
+#define __OutputScheduler_h__
+
+#include "WriteQueue.h"
+
+class OutputScheduler {
+public:
+	OutputScheduler();
+	~OutputScheduler();
+
+	void			Allocate(int numPorts, ByteCount queueSize, bool coalesce);
+						// queueSize is the capacity of each port's queue
+
+	int				NumPorts() const			{ return mNumPorts; }
+	WriteQueue &	Queue(int port)				{ return mQueues[port]; }
+						// the MIDI waiting to be written to the port, in the order sent
+	WriteQueue &	RealtimeQueue(int port)		{ return mRealtimeQueues[port]; }
+						// the System Realtime messages waiting, to be written ahead of Queue(port)
+
+	bool			Coalescing() const			{ return mSuperseding != NULL; }
+	static ByteCount	SupersedingLength(const Byte *message, ByteCount length);
+						// the length of the message beginning at message, if it is one which
+						// supersedes earlier ones, otherwise 0
+	bool			Coalesce(int port, const Byte *message, ByteCount length);
+						// overwrite the queued message superseded by this one, returns false,
+						// changing nothing, if none is queued unsent and free to be overwritten
+	void			Queued(int port, const Byte *data, ByteCount length);
+						// called after each record is pushed onto Queue(port), when coalescing
+
+	void			QueuePacket(int port, const Byte *data, ByteCount length);
+						// copy a packet sent to the port onto its queues, its System Realtime onto
+						// RealtimeQueue(port), the rest as QueueMessages does
+	void			QueueMessages(int port, const Byte *data, ByteCount length);
+						// copy the MIDI messages onto Queue(port), dividing them between records
+						// as needed, and coalescing them with those queued when Coalescing
+	static ByteCount	MessagesLength(const Byte *data, ByteCount length, ByteCount limit);
+						// how much of data, up to limit bytes, ends on a message boundary
+
+	void			Flush(int port);
+						// drop the output waiting to be written to the port
+
+	bool			IsEmpty();
+						// true if no port has output waiting
+
+	int				RoundRobinPort(int i) const	{ return (mFirstPort + i) % mNumPorts; }
+						// the port to visit i'th during the transfer being prepared
+	void			NextTransfer()				{ if (++mFirstPort >= mNumPorts) mFirstPort = 0; }
+						// called once a transfer is prepared
+
+	UInt64			Overflows() const;
+						// the pushes refused by all the queues
+	UInt64			Coalesced() const			{ return mCoalesced; }
+						// the messages overwritten before being written
+
+private:
+	// Where the latest superseding messages of a port were pushed, each in a record of its own,
+	// and the last record with another message of each channel, which they are not to pass.
+	struct Superseding {
+		UInt32		controlChange[16][128];
+		UInt32		pitchBend[16];
+		UInt32		channelPressure[16];
+		UInt32		barrier[16];
+	};
+
+	static UInt32 *	Position(Superseding &superseding, const Byte *message);
+	void			QueueRecords(int port, const Byte *data, ByteCount length);
+
+	int				mNumPorts;
+	WriteQueue *	mQueues;
+	WriteQueue *	mRealtimeQueues;
+	int				mFirstPort;
+	Superseding *	mSuperseding;		// for each port, NULL if not coalescing
+	UInt64			mCoalesced;
+};
+
+#endif // __OutputScheduler_h__
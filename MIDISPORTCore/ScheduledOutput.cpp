@@ -0,0 +1,181 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The output sent ahead of its time stamp, held in a preallocated arena until it is due.
+//
+
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include "ScheduledOutput.h"
+
+// Packets are kept 4 byte aligned, so the space left at the end of the arena, when a packet will
+// not fit there, is always large enough to mark as skipped.
+#define kRecordAlignment	4
+
+enum {
+	kReleased = 1,			// flags of a packet popped, its space can be reclaimed
+	kSkipToStart = 2		// flags of a record marking the rest of the arena as unused
+};
+
+static inline UInt32	RecordSize(ByteCount length)
+{
+	return (UInt32)((offsetof(ScheduledPacket, data) + length + kRecordAlignment - 1) & ~(kRecordAlignment - 1));
+}
+
+ScheduledOutput::ScheduledOutput() :
+	mPorts(NULL),
+	mNumPorts(0),
+	mArenas(NULL),
+	mHeaps(NULL),
+	mCapacity(0),
+	mMaxPackets(0),
+	mFront(-1),
+	mSequence(0),
+	mOverflows(0)
+{
+}
+
+ScheduledOutput::~ScheduledOutput()
+{
+	delete[] mPorts;
+	delete[] mArenas;
+	delete[] mHeaps;
+}
+
+void	ScheduledOutput::Allocate(int numPorts, ByteCount capacity, ItemCount maxPackets)
+{
+	// a power of two, so the free running head and tail wrap with the arena
+	mCapacity = kRecordAlignment;
+	while (mCapacity < capacity)
+		mCapacity <<= 1;
+	delete[] mPorts;
+	delete[] mArenas;
+	delete[] mHeaps;
+	mPorts = new PortArena[numPorts];
+	mArenas = new Byte[numPorts * mCapacity];
+	mHeaps = new HeapEntry[numPorts * maxPackets];
+	mNumPorts = numPorts;
+	mMaxPackets = maxPackets;
+	for (int i = 0; i < numPorts; ++i) {
+		mPorts[i].arena = mArenas + i * mCapacity;
+		mPorts[i].heap = mHeaps + i * maxPackets;
+		mPorts[i].numPackets = 0;
+		mPorts[i].head = mPorts[i].tail = 0;
+	}
+	mFront = -1;
+}
+
+ByteCount	ScheduledOutput::MaxPacketLength() const
+{
+	// packets of up to a quarter of the arena keep it from being exhausted by one packet
+	return std::min(mCapacity / 4 - offsetof(ScheduledPacket, data), (ByteCount)UINT16_MAX);
+}
+
+bool	ScheduledOutput::Schedule(MIDITimeStamp when, UInt8 portNum, const Byte *data, ByteCount length)
+{
+	if (portNum >= mNumPorts) {
+		++mOverflows;
+		return false;
+	}
+	PortArena &port = mPorts[portNum];
+	UInt32 recordSize = RecordSize(length);
+	UInt32 toEnd = mCapacity - (port.head & (mCapacity - 1));
+	UInt32 skip = (toEnd < recordSize) ? toEnd : 0;
+
+	if (length > MaxPacketLength() || port.numPackets >= mMaxPackets || (port.head - port.tail) + skip + recordSize > mCapacity) {
+		++mOverflows;
+		return false;
+	}
+	if (skip != 0) {
+		At(port, port.head)->flags = kSkipToStart;
+		port.head += skip;
+	}
+	ScheduledPacket *packet = At(port, port.head);
+	packet->flags = 0;
+	packet->portNum = portNum;
+	packet->length = (UInt16)length;
+	memcpy(packet->data, data, length);
+
+	// sift the new entry up from the bottom of the heap
+	HeapEntry entry = { when, mSequence++, port.head };
+	ItemCount child = port.numPackets++;
+	while (child > 0) {
+		ItemCount parent = (child - 1) / 2;
+		if (!Earlier(entry, port.heap[parent]))
+			break;
+		port.heap[child] = port.heap[parent];
+		child = parent;
+	}
+	port.heap[child] = entry;
+	port.head += recordSize;
+	// only the new packet can have become the earliest
+	if (child == 0 && (mFront < 0 || Earlier(entry, mPorts[mFront].heap[0])))
+		mFront = portNum;
+	return true;
+}
+
+// Nothing held for the port is looked at, its arena is empty once the tail is moved to the head.
+void	ScheduledOutput::Flush(UInt8 portNum)
+{
+	if (portNum >= mNumPorts || mPorts[portNum].numPackets == 0)
+		return;
+	PortArena &port = mPorts[portNum];
+
+	port.numPackets = 0;
+	port.tail = port.head;
+	if (mFront == portNum)
+		FindFront();
+}
+
+void	ScheduledOutput::PopFront()
+{
+	if (mFront < 0)
+		return;
+	PortArena &port = mPorts[mFront];
+
+	At(port, port.heap[0].position)->flags = kReleased;
+	if (--port.numPackets > 0)
+		SiftDown(port, 0, port.heap[port.numPackets]);
+	Reclaim(port);
+	FindFront();
+}
+
+void	ScheduledOutput::SiftDown(PortArena &port, ItemCount parent, HeapEntry entry)
+{
+	for (;;) {
+		ItemCount child = 2 * parent + 1;
+		if (child >= port.numPackets)
+			break;
+		if (child + 1 < port.numPackets && Earlier(port.heap[child + 1], port.heap[child]))
+			++child;
+		if (!Earlier(port.heap[child], entry))
+			break;
+		port.heap[parent] = port.heap[child];
+		parent = child;
+	}
+	port.heap[parent] = entry;
+}
+
+// the released packets at the tail of the port's arena
+void	ScheduledOutput::Reclaim(PortArena &port)
+{
+	while (port.tail != port.head) {
+		ScheduledPacket *packet = At(port, port.tail);
+		if (packet->flags & kSkipToStart)
+			port.tail += mCapacity - (port.tail & (mCapacity - 1));
+		else if (packet->flags & kReleased)
+			port.tail += RecordSize(packet->length);
+		else
+			break;
+	}
+}
+
+// a look at the top of each port's heap, there being no more of them than a MIDISPORT has ports
+void	ScheduledOutput::FindFront()
+{
+	mFront = -1;
+	for (int i = 0; i < mNumPorts; ++i)
+		if (mPorts[i].numPackets > 0 && (mFront < 0 || Earlier(mPorts[i].heap[0], mPorts[mFront].heap[0])))
+			mFront = i;
+}
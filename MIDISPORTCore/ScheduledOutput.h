@@ -0,0 +1,99 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The output sent ahead of its time stamp, held until it is due. HandleSent copies each packet into
+// the arena of its port, allocated when the interface starts, indexed by the port's heap ordered by
+// time stamp, then by the order sent, so holding output never allocates memory. The earliest packet
+// is the earliest at the tops of the ports' heaps. Each arena is reclaimed in the order its packets
+// were held, a packet held long keeps the space after it from reuse until it is released. A flush
+// empties its port's arena and heap at once, however much is held, and a port holding all it can
+// leaves the others room.
+// Used only on the interface's I/O run loop.
+//
+
+#ifndef __ScheduledOutput_h__
+#define __ScheduledOutput_h__
+
+#include "MIDITypes.h"
+
+// A packet held in the arena, its data follows it contiguously.
+struct ScheduledPacket {
+	UInt8				flags;		// private to ScheduledOutput
+	UInt8				portNum;
+	UInt16				length;		// bytes of data
+	Byte				data[4];	// actually length bytes
+};
+
+class ScheduledOutput {
+public:
+	ScheduledOutput();
+	~ScheduledOutput();
+
+	void				Allocate(int numPorts, ByteCount capacity, ItemCount maxPackets);
+							// the capacity and packets of each port's arena, the capacity rounded
+							// up to a power of two
+
+	bool				Schedule(MIDITimeStamp when, UInt8 portNum, const Byte *data, ByteCount length);
+							// copy the packet to be released at when, returns false, holding
+							// nothing, if it does not fit in the space remaining to its port.
+
+	MIDITimeStamp		NextTime() const		{ return mFront >= 0 ? mPorts[mFront].heap[0].time : 0; }
+							// the time stamp of the earliest packet held, 0 if none is
+	const ScheduledPacket *	Front() const		{ return mFront >= 0 ? At(mPorts[mFront], mPorts[mFront].heap[0].position) : NULL; }
+							// the earliest packet held, NULL if none is
+	void				PopFront();
+							// release the earliest packet, once its data is queued to be written
+
+	void				Flush(UInt8 portNum);
+							// drop the packets held for the port, and reclaim their space, in time
+							// independent of how many are held
+
+	bool				IsEmpty() const			{ return mFront < 0; }
+	ByteCount			MaxPacketLength() const;
+							// the most data one packet can hold, longer packets are not held
+	UInt64				Overflows() const		{ return mOverflows; }
+							// the number of packets refused for want of space
+
+private:
+	struct HeapEntry {
+		MIDITimeStamp	time;
+		UInt32			sequence;	// the order held, between equal time stamps
+		UInt32			position;	// of the ScheduledPacket in the port's arena
+	};
+
+	// the packets held for one port
+	struct PortArena {
+		Byte *			arena;
+		UInt32			head;			// arena bytes ever used
+		UInt32			tail;			// arena bytes ever reclaimed
+		HeapEntry *		heap;
+		ItemCount		numPackets;
+	};
+
+	static bool			Earlier(const HeapEntry &a, const HeapEntry &b)
+	{
+		return a.time < b.time || (a.time == b.time && (SInt32)(a.sequence - b.sequence) < 0);
+	}
+	ScheduledPacket *	At(const PortArena &port, UInt32 position) const
+	{
+		return (ScheduledPacket *)(port.arena + (position & (mCapacity - 1)));
+	}
+	void				SiftDown(PortArena &port, ItemCount parent, HeapEntry entry);
+							// place the entry in the port's heap from parent down
+	void				Reclaim(PortArena &port);
+							// advance the port's tail past the packets released
+	void				FindFront();
+							// the port whose heap holds the earliest packet
+
+	PortArena *			mPorts;
+	int					mNumPorts;
+	Byte *				mArenas;
+	HeapEntry *			mHeaps;
+	ByteCount			mCapacity;		// of each port's arena
+	ItemCount			mMaxPackets;	// of each port's heap
+	int					mFront;			// the port of the earliest packet, -1 if none is held
+	UInt32				mSequence;
+	UInt64				mOverflows;
+};
+
+#endif // __ScheduledOutput_h__
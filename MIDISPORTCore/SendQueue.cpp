@@ -0,0 +1,151 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The packets sent to an interface on its way to the I/O run loop, in a preallocated byte ring.
+//
+
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include "SendQueue.h"
+
+// Records are kept aligned for their time stamps, so the space left at the end of the ring, when
+// a record will not fit there, is always large enough to mark as skipped.
+#define kRecordAlignment	8
+
+enum {
+	kUnwritten = 0,			// state of a record reserved and not yet written, or of unused space
+	kWritten = 1,			// state of a record the popping thread can read
+	kSkipToStart = 2		// state of a record marking the rest of the ring as unused
+};
+
+static inline UInt32	RecordSize(ByteCount length)
+{
+	return (UInt32)((offsetof(SentPacket, data) + length + kRecordAlignment - 1) & ~(kRecordAlignment - 1));
+}
+
+SendQueue::SendQueue() :
+	mBuffer(NULL),
+	mCapacity(0),
+	mHead(0),
+	mTail(0),
+	mOverflows(0)
+{
+}
+
+SendQueue::~SendQueue()
+{
+	delete[] mBuffer;
+}
+
+void	SendQueue::Allocate(ByteCount capacity)
+{
+	// a power of two, so the free running head and tail wrap with the ring
+	mCapacity = kRecordAlignment;
+	while (mCapacity < capacity)
+		mCapacity <<= 1;
+	delete[] mBuffer;
+	mBuffer = new Byte[mCapacity];
+	// every record starts out unwritten, PopFront clears the space it releases for reuse
+	memset(mBuffer, 0, mCapacity);
+	mHead = mTail = 0;
+}
+
+ByteCount	SendQueue::MaxRecordLength() const
+{
+	// records of up to a quarter of the ring keep it from being exhausted by one packet
+	return std::min(mCapacity / 4 - offsetof(SentPacket, data), (ByteCount)UINT16_MAX);
+}
+
+// Each pushing thread claims the space for its record by advancing the head past it, then writes
+// the record, which the popping thread waits for, in order, until its state is written.
+SentPacket *	SendQueue::Reserve(ByteCount length)
+{
+	UInt32 recordSize = RecordSize(length);
+	UInt32 head = mHead.load(std::memory_order_relaxed);
+	UInt32 skip;
+
+	if (mCapacity == 0 || length > MaxRecordLength()) {
+		mOverflows.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	do {
+		UInt32 tail = mTail.load(std::memory_order_acquire);
+		UInt32 toEnd = mCapacity - (head & (mCapacity - 1));
+
+		skip = (toEnd < recordSize) ? toEnd : 0;
+		if ((head - tail) + skip + recordSize > mCapacity) {
+			mOverflows.fetch_add(1, std::memory_order_relaxed);
+			return NULL;
+		}
+	} while (!mHead.compare_exchange_weak(head, head + skip + recordSize, std::memory_order_acquire, std::memory_order_relaxed));
+	if (skip != 0) {
+		At(head)->state.store(kSkipToStart, std::memory_order_release);
+		head += skip;
+	}
+	return At(head);
+}
+
+bool	SendQueue::Push(UInt8 portNum, MIDITimeStamp timeStamp, const Byte *data, ByteCount length)
+{
+	SentPacket *packet = Reserve(length);
+
+	if (packet == NULL)
+		return false;
+	packet->portNum = portNum;
+	packet->flush = false;
+	packet->length = (UInt16)length;
+	packet->timeStamp = timeStamp;
+	memcpy(packet->data, data, length);
+	// publish the record to the consumer
+	packet->state.store(kWritten, std::memory_order_release);
+	return true;
+}
+
+bool	SendQueue::PushFlush(UInt8 portNum)
+{
+	SentPacket *packet = Reserve(0);
+
+	if (packet == NULL)
+		return false;
+	packet->portNum = portNum;
+	packet->flush = true;
+	packet->length = 0;
+	packet->timeStamp = 0;
+	packet->state.store(kWritten, std::memory_order_release);
+	return true;
+}
+
+const SentPacket *	SendQueue::Front()
+{
+	UInt32 tail = mTail.load(std::memory_order_relaxed);
+	UInt32 head = mHead.load(std::memory_order_acquire);
+
+	if (tail == head)
+		return NULL;
+	SentPacket *packet = At(tail);
+	UInt32 state = packet->state.load(std::memory_order_acquire);
+	if (state == kSkipToStart) {
+		UInt32 toEnd = mCapacity - (tail & (mCapacity - 1));
+		memset(mBuffer + (tail & (mCapacity - 1)), 0, toEnd);
+		tail += toEnd;
+		mTail.store(tail, std::memory_order_release);
+		if (tail == head)
+			return NULL;
+		packet = At(tail);
+		state = packet->state.load(std::memory_order_acquire);
+	}
+	return state == kWritten ? packet : NULL;
+}
+
+void	SendQueue::PopFront()
+{
+	const SentPacket *packet = Front();
+
+	if (packet != NULL) {
+		UInt32 tail = mTail.load(std::memory_order_relaxed);
+		UInt32 recordSize = RecordSize(packet->length);
+		memset(mBuffer + (tail & (mCapacity - 1)), 0, recordSize);
+		mTail.store(tail + recordSize, std::memory_order_release);
+	}
+}
@@ -0,0 +1,65 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The packets sent to an interface, handed from the threads CoreMIDI calls Send and Flush on to
+// the I/O run loop, which alone queues, encodes and writes output. Any number of threads can push
+// at once, each reserving its record in a byte ring allocated when the interface starts, so pushing
+// never waits on another thread or allocates memory. Only the I/O run loop pops.
+//
+
+#ifndef __SendQueue_h__
+#define __SendQueue_h__
+
+#include <atomic>
+#include "MIDITypes.h"
+
+// A record of the queue, its data follows it contiguously in the ring.
+struct SentPacket {
+	std::atomic<UInt32>	state;		// private to SendQueue
+	UInt8				portNum;
+	bool				flush;		// the port's output is to be dropped, the record has no data
+	UInt16				length;		// bytes of data
+	MIDITimeStamp		timeStamp;
+	Byte				data[8];	// actually length bytes
+};
+
+class SendQueue {
+public:
+	SendQueue();
+	~SendQueue();
+
+	void				Allocate(ByteCount capacity);
+							// capacity is rounded up to a power of two
+
+	bool				Push(UInt8 portNum, MIDITimeStamp timeStamp, const Byte *data, ByteCount length);
+							// copy the packet onto the end of the queue as one record, returns false,
+							// queueing nothing, if it does not fit in the space remaining
+	bool				PushFlush(UInt8 portNum);
+							// queue a record asking for the port's output to be dropped
+
+	const SentPacket *	Front();
+							// the oldest record, NULL if the queue is empty or the oldest is still
+							// being written by the thread pushing it
+	void				PopFront();
+							// release the oldest record
+
+	ByteCount			MaxRecordLength() const;
+							// the most data one record can hold, longer packets must be divided
+	UInt64				Overflows() const		{ return mOverflows.load(std::memory_order_relaxed); }
+							// the number of pushes refused for want of space
+
+private:
+	SentPacket *		Reserve(ByteCount length);
+	SentPacket *		At(UInt32 position) const
+	{
+		return (SentPacket *)(mBuffer + (position & (mCapacity - 1)));
+	}
+
+	Byte *				mBuffer;
+	ByteCount			mCapacity;
+	std::atomic<UInt32>	mHead;		// bytes ever reserved by pushes
+	std::atomic<UInt32>	mTail;		// bytes ever popped, only written by Front and PopFront
+	std::atomic<UInt64>	mOverflows;
+};
+
+#endif // __SendQueue_h__
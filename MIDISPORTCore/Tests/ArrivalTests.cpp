@@ -0,0 +1,269 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Input stamped with when each message arrived at the MIDISPORT, estimated back from when the read
+// completed a byte each 320 µs, checked against a simulated device told when each message was sent
+// down its cable: never stamped before it arrived nor after its read completed, and within a
+// message's time of its arrival while the cable is kept busy. And input kept from being lost by the
+// reads left in flight while the callbacks are held up.
+//
+
+#include <algorithm>
+#include "TestHarness.h"
+#include "TestSupport.h"
+
+#define kPollNanos		4000000			// the device's reads complete every 4 ms
+#define kStart			1000000000		// when the first message starts down its cable
+
+// a note-on, and when its last byte arrived at the device, its read completed and it was stamped
+struct SentMessage {
+	int				port;
+	Byte			bytes[3];
+	MIDITimeStamp	arrived;
+	MIDITimeStamp	completed;
+	MIDITimeStamp	stamped;
+};
+
+// count note-ons down the port's cable, each gap(i) nanoseconds after the one before it ends
+static void	SendDownCable(std::vector<SentMessage> &sent, int port, int count, UInt64 (*gap)(int))
+{
+	MIDITimeStamp cable = kStart;
+
+	for (int i = 0; i < count; ++i) {
+		SentMessage message = { port, { (Byte)(0x90 | port), (Byte)(i & 0x7F), 0x40 }, 0, 0, 0 };
+
+		cable += gap(i) + 3 * MIDI_BYTE_NANOS;
+		message.arrived = cable;
+		sent.push_back(message);
+	}
+}
+
+static bool	ArrivedEarlier(const SentMessage &a, const SentMessage &b)
+{
+	return a.arrived < b.arrived;
+}
+
+// Each read of the device completes at a poll, with the messages which arrived since the last, in
+// the order they did. Then the stamp of each message is taken from what the engine received.
+static void	ReadAndStamp(std::vector<SentMessage> &sent, bool timestampInputBytes)
+{
+	InterfaceInfo info = TestInterfaceInfo();
+
+	info.timestampInputBytes = timestampInputBytes;
+	EngineFixture f(info);
+	std::stable_sort(sent.begin(), sent.end(), ArrivedEarlier);
+	for (size_t next = 0; next < sent.size(); ) {
+		MIDITimeStamp poll = f.clock.Now() + kPollNanos;
+		std::vector<Byte> read;
+
+		poll -= poll % kPollNanos;
+		for ( ; next < sent.size() && sent[next].arrived <= poll; ++next) {
+			std::vector<Byte> mspackets = MSPackets(sent[next].port, std::vector<Byte>(sent[next].bytes, sent[next].bytes + 3));
+
+			read.insert(read.end(), mspackets.begin(), mspackets.end());
+			sent[next].completed = poll;
+		}
+		f.clock.Set(poll);
+		CHECK(read.size() <= info.readBufferSize);
+		if (!read.empty())
+			f.Input(read);
+	}
+
+	// the messages of each port received in the order sent, several to a packet if stamped alike
+	std::vector<size_t> ofPort[MAX_PORTS];
+	size_t received[MAX_PORTS] = { 0 };
+	for (size_t m = 0; m < sent.size(); ++m)
+		ofPort[sent[m].port].push_back(m);
+	for (size_t i = 0; i < f.sink.packets.size(); ++i) {
+		const ReceivedPacket &packet = f.sink.packets[i];
+
+		for (size_t b = 0; b + 3 <= packet.data.size(); b += 3) {
+			CHECK(received[packet.port] < ofPort[packet.port].size());
+			if (received[packet.port] < ofPort[packet.port].size()) {
+				SentMessage &message = sent[ofPort[packet.port][received[packet.port]++]];
+
+				CHECK(std::equal(message.bytes, message.bytes + 3, packet.data.begin() + b));
+				message.stamped = packet.timeStamp;
+			}
+		}
+	}
+	for (size_t m = 0; m < sent.size(); ++m)
+		CHECK(sent[m].stamped != 0);
+}
+
+static UInt64	NoGap(int /*i*/)
+{
+	return 0;
+}
+
+// a pause of up to 5 ms before some of the messages, the same every run
+static UInt64	SomeGaps(int i)
+{
+	UInt32 r = (UInt32)i * 2654435761U;
+
+	return (r >> 28) < 6 ? (r >> 8) % 5000000 : 0;
+}
+
+static UInt64	LongGaps(int i)
+{
+	return 700000 + SomeGaps(i + 1);
+}
+
+TEST(Arrival, BusyCableStampedWithinAMessageOfArrival)
+{
+	std::vector<SentMessage> stamped, unstamped;
+	UInt64 stampedError = 0, unstampedError = 0;
+
+	SendDownCable(stamped, 0, 400, NoGap);
+	unstamped = stamped;
+	ReadAndStamp(stamped, true);
+	ReadAndStamp(unstamped, false);
+	for (size_t m = 0; m < stamped.size(); ++m) {
+		CHECK(stamped[m].stamped >= stamped[m].arrived);
+		CHECK(stamped[m].stamped < stamped[m].arrived + 3 * MIDI_BYTE_NANOS);
+		CHECK_EQUAL(unstamped[m].completed, unstamped[m].stamped);
+		stampedError += stamped[m].stamped - stamped[m].arrived;
+		unstampedError += unstamped[m].stamped - unstamped[m].arrived;
+	}
+	// stamped with its read, a message is off by half the poll on average
+	CHECK(unstampedError / stamped.size() > kPollNanos / 3);
+	CHECK(stampedError * 4 < unstampedError);
+}
+
+TEST(Arrival, NeverStampedBeforeArrivalOrAfterCompletion)
+{
+	std::vector<SentMessage> sent;
+	MIDITimeStamp lastStamped[MAX_PORTS] = { 0 };
+
+	SendDownCable(sent, 0, 300, SomeGaps);
+	SendDownCable(sent, 1, 200, LongGaps);
+	ReadAndStamp(sent, true);
+	for (size_t m = 0; m < sent.size(); ++m) {
+		CHECK(sent[m].stamped >= sent[m].arrived);
+		CHECK(sent[m].stamped <= sent[m].completed);
+		// and each port's stamps in the order its messages arrived
+		CHECK(sent[m].stamped >= lastStamped[sent[m].port]);
+		lastStamped[sent[m].port] = sent[m].stamped;
+	}
+}
+
+// An 8x8/S taking note-ons on all eight MIDI ins at the full rate of their cables, into a FIFO of an
+// IN transfer's worth of mspackets, and completing a read with what it holds at each USB frame while
+// one is pending. For 3 ms in every 100 the I/O run loop is held up by a slow client, so no
+// callback comes and no read is started again: what arrives meanwhile waits in the reads still
+// pending, or in the FIFO, or is lost once that is full. The messages each port delivers are
+// counted, along with those lost and how long the rest waited to be delivered.
+struct ReadsInFlightRun {
+	int				sent;
+	int				delivered;
+	int				lost;
+	int				reordered;
+	MIDITimeStamp	maxDelay;
+};
+
+static ReadsInFlightRun	RunReadsInFlight(int readsInFlight)
+{
+	const int kFrames = 2000;
+	const MIDITimeStamp kFrameNanos = 1000000;
+	const MIDITimeStamp kMessageNanos = 3 * MIDI_BYTE_NANOS;
+	DeviceEntry entry;
+	int numOutputPorts;
+	ReadsInFlightRun run = { 0, 0, 0, 0, 0 };
+
+	CHECK(ReadDeviceEntry("MIDISPORT 8x8/S", entry));
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+
+	info.readsInFlight = (UInt8)readsInFlight;
+	EngineFixture f(info, numOutputPorts);
+	const size_t fifoSize = info.readBufferSize / MIDIPACKETLEN;
+	std::vector<std::pair<int, int> > fifo;		// each mspacket's port and message number
+	std::vector<MIDITimeStamp> arrivals[8];		// of each port's messages, by number
+	int nextReceived[8] = { 0 };
+	MIDITimeStamp start = f.clock.Now();
+
+	for (int frame = 1; frame <= kFrames + 20; ++frame) {
+		MIDITimeStamp now = start + frame * kFrameNanos;
+		bool stalled = frame <= kFrames && frame % 100 < 3;
+
+		// each port's messages arriving by now, the cables staggered a little
+		for (;;) {
+			int port = -1;
+			MIDITimeStamp earliest = now + 1;
+
+			for (int p = 0; p < 8; ++p) {
+				MIDITimeStamp arrival = start + (arrivals[p].size() + 1) * kMessageNanos + p * 40000;
+
+				if (frame <= kFrames && arrival <= now && arrival < earliest) {
+					earliest = arrival;
+					port = p;
+				}
+			}
+			if (port < 0)
+				break;
+			arrivals[port].push_back(earliest);
+			++run.sent;
+			if (fifo.size() < fifoSize)
+				fifo.push_back(std::make_pair(port, (int)arrivals[port].size() - 1));
+			else
+				++run.lost;
+		}
+
+		f.clock.Set(now);
+		if (!fifo.empty() && f.transport.Queued(f.inPipe) > 0) {
+			std::vector<Byte> read;
+
+			for (size_t m = 0; m < fifo.size(); ++m) {
+				int port = fifo[m].first, n = fifo[m].second;
+				const Byte noteOn[3] = { (Byte)(0x90 | port), (Byte)(n & 0x7F), (Byte)(1 + (n >> 7)) };
+				std::vector<Byte> mspacket = MSPackets(port, std::vector<Byte>(noteOn, noteOn + 3));
+
+				read.insert(read.end(), mspacket.begin(), mspacket.end());
+			}
+			f.transport.Input(f.inPipe, read.data(), read.size());
+			fifo.clear();
+		}
+		if (stalled)
+			continue;
+		f.sink.Clear();
+		f.Run();
+		for (size_t i = 0; i < f.sink.packets.size(); ++i) {
+			const ReceivedPacket &packet = f.sink.packets[i];
+
+			for (size_t b = 0; b + 3 <= packet.data.size(); b += 3) {
+				int port = packet.port;
+				int n = packet.data[b + 1] + ((packet.data[b + 2] - 1) << 7);
+
+				if (n < nextReceived[port])
+					++run.reordered;
+				nextReceived[port] = n + 1;
+				++run.delivered;
+				run.maxDelay = std::max(run.maxDelay, now - arrivals[port][n]);
+			}
+		}
+	}
+	return run;
+}
+
+TEST(Arrival, ReadsInFlightAbsorbStalledCallbacks)
+{
+	ReadsInFlightRun one = RunReadsInFlight(1);
+	ReadsInFlightRun two = RunReadsInFlight(2);
+	ReadsInFlightRun several = RunReadsInFlight(4);
+
+	// about eight messages a millisecond, nothing lost nor reordered with several reads pending
+	CHECK(several.sent > 8 * 2000);
+	CHECK_EQUAL(0, several.lost);
+	CHECK_EQUAL(several.sent, several.delivered);
+	CHECK_EQUAL(0, several.reordered);
+	// held no longer than the stall and the frame it arrived in
+	CHECK(several.maxDelay <= 4 * 1000000);
+
+	// with fewer, the FIFO overflows within each stall, the more the fewer, but what is delivered
+	// is in order
+	CHECK(one.lost > two.lost);
+	CHECK(two.lost > 0);
+	CHECK_EQUAL(one.sent, one.delivered + one.lost);
+	CHECK_EQUAL(two.sent, two.delivered + two.lost);
+	CHECK_EQUAL(0, one.reordered);
+	CHECK_EQUAL(0, two.reordered);
+}
@@ -0,0 +1,147 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The mspackets of each port in an OUT transfer kept within the budget of the device, as
+// MIDISPORT_devices.xml gives it, with every port saturated: no transfer carries more of a port
+// than its budget, realtime included, and the transfers stay as full as the budget lets them.
+//
+
+#include "TestHarness.h"
+#include "TestSupport.h"
+#include "MidisportOutputEncoder.h"
+#include "OutputScheduler.h"
+
+#define kTransfers		2000
+#define kFrameNanos		1000000		// a transfer of each endpoint every USB frame
+#define kOutputBufferSize	16		// bytes a port, as a paced device might buffer
+
+// an OUT transfer of each endpoint a frame, as the encoder fills them from ports kept busy
+class BudgetRun {
+public:
+	BudgetRun(const InterfaceInfo &info, int numOutputPorts) :
+		mInfo(info),
+		mEncoder(numOutputPorts, info.runningStatus, info.noteOffAsNoteOn, info.packOutputBytes,
+				 info.outputBufferSize, mClock),
+		overBudget(0),
+		mspackets(0)
+	{
+		mOutput.Allocate(numOutputPorts, 4096, false);
+		for (int port = 0; port < MAX_PORTS; ++port)
+			queued[port] = bytes[port] = 0;
+	}
+
+	// Every port is kept with output waiting, note-ons and, every eighth transfer, a clock byte, then
+	// a transfer of each endpoint is encoded.
+	void		Transfer(int transfer)
+	{
+		Byte buffers[2][64];
+		Byte *destBuf[2] = { buffers[0], buffers[1] };
+		ByteCount bufCount[2];
+		MIDITimeStamp retryTime;
+
+		for (int port = 0; port < mOutput.NumPorts(); ++port) {
+			const Byte clock = 0xF8;
+
+			if ((transfer & 7) == 0) {
+				mOutput.QueuePacket(port, &clock, 1);
+				++queued[port];
+			}
+			// more than the port could take in two transfers always waiting
+			if (queued[port] - bytes[port] < 12) {
+				const Byte noteOns[12] = { 0x90, 0x3C, 0x40, 0x90, 0x3E, 0x40, 0x90, 0x40, 0x40, 0x90, 0x41, 0x40 };
+
+				mOutput.QueueMessages(port, noteOns, sizeof(noteOns));
+				queued[port] += sizeof(noteOns);
+			}
+		}
+		mEncoder.EncodeTransfers(mOutput, destBuf, bufCount, mInfo.writeBufferSize, mInfo.outputPacketsPerPort,
+								 mClock.Now(), retryTime);
+
+		for (int endpoint = 0; endpoint < 2; ++endpoint) {
+			int packetsOfPort[MAX_PORTS] = { 0 };
+
+			CHECK(bufCount[endpoint] <= mInfo.writeBufferSize);
+			for (ByteCount i = 0; i + MIDIPACKETLEN <= bufCount[endpoint]; i += MIDIPACKETLEN) {
+				Byte cmd = buffers[endpoint][i + CMDINDEX];
+
+				if (cmd == 0)
+					break;
+				CHECK_EQUAL(endpoint, (cmd >> 4) & 1);
+				if (++packetsOfPort[cmd >> 4] > mInfo.outputPacketsPerPort)
+					++overBudget;
+				bytes[cmd >> 4] += cmd & 0x03;
+				++mspackets;
+			}
+			// the device takes the transfer in the frame it is written
+			mEncoder.Written(buffers[endpoint], bufCount[endpoint], mClock.Now());
+		}
+		mClock.Advance(kFrameNanos);
+	}
+
+	ManualClock				mClock;
+	InterfaceInfo			mInfo;
+	OutputScheduler			mOutput;
+	MidisportOutputEncoder	mEncoder;
+	int						overBudget;
+	ItemCount				mspackets;
+	UInt64					queued[MAX_PORTS];
+	UInt64					bytes[MAX_PORTS];		// of each port, written to the transfers
+};
+
+TEST(Budget, DeviceListGivesEightByEightBudget)
+{
+	DeviceEntry entry;
+	int numOutputPorts;
+
+	CHECK(ReadDeviceEntry("MIDISPORT 8x8/S", entry));
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+	CHECK_EQUAL(0x1031, DeviceInteger(entry, "WarmFirmwareProductID", 0));
+	CHECK_EQUAL(9, numOutputPorts);
+	CHECK_EQUAL(2, info.outputPacketsPerPort);
+	CHECK_EQUAL(32, info.writeBufferSize);
+	CHECK_EQUAL(0, info.outputBufferSize);		// unpaced until the device's buffers are measured
+	CHECK(!ReadDeviceEntry("MIDISPORT 9x9", entry));
+}
+
+// Unpaced, the five ports of the even endpoint share its eight mspackets, the four of the odd one
+// have two each, so every transfer is full.
+TEST(Budget, SaturatedPortsFillTransfersWithinBudget)
+{
+	DeviceEntry entry;
+	int numOutputPorts;
+
+	CHECK(ReadDeviceEntry("MIDISPORT 8x8/S", entry));
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+	info.outputBufferSize = 0;
+	BudgetRun run(info, numOutputPorts);
+
+	for (int transfer = 0; transfer < kTransfers; ++transfer)
+		run.Transfer(transfer);
+	CHECK_EQUAL(0, run.overBudget);
+	CHECK_EQUAL(kTransfers * 2 * (info.writeBufferSize / MIDIPACKETLEN), run.mspackets);
+	for (int port = 0; port < numOutputPorts; ++port)
+		CHECK(run.bytes[port] > 0);
+}
+
+// Paced to the MIDI cables, the budget still leaves every cable busy.
+TEST(Budget, PacedPortsKeepCablesBusyWithinBudget)
+{
+	DeviceEntry entry;
+	int numOutputPorts;
+
+	CHECK(ReadDeviceEntry("MIDISPORT 8x8/S", entry));
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+	info.outputBufferSize = kOutputBufferSize;
+	BudgetRun run(info, numOutputPorts);
+
+	for (int transfer = 0; transfer < kTransfers; ++transfer)
+		run.Transfer(transfer);
+	CHECK_EQUAL(0, run.overBudget);
+
+	// within a buffer of what each cable could have sent in the time
+	UInt64 cableBytes = (UInt64)kTransfers * kFrameNanos / MIDI_BYTE_NANOS;
+	for (int port = 0; port < numOutputPorts; ++port) {
+		CHECK(run.bytes[port] >= cableBytes * 95 / 100);
+		CHECK(run.bytes[port] <= cableBytes + info.outputBufferSize);
+	}
+}
@@ -0,0 +1,170 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The output queues coalescing: a control change, pitch bend or channel pressure overwrites the
+// unsent one it supersedes, but never passes another message of its channel, never takes the place
+// of one popped or partly sent, and the controllers whose values count, RPN and NRPN selection, data
+// entry and channel mode messages, are never coalesced at all.
+//
+
+#include "TestHarness.h"
+#include "TestSupport.h"
+#include "OutputScheduler.h"
+
+// the records of the port's queue, popped in order
+static std::vector<std::vector<Byte> >	PopRecords(OutputScheduler &output, int port)
+{
+	std::vector<std::vector<Byte> > records;
+	WriteQueueElem *wqe;
+
+	while ((wqe = output.Queue(port).Front()) != NULL) {
+		records.push_back(std::vector<Byte>(wqe->data, wqe->data + wqe->length));
+		output.Queue(port).PopFront();
+	}
+	return records;
+}
+
+static void	QueueMessage(OutputScheduler &output, int port, Byte status, Byte data1, Byte data2)
+{
+	const Byte message[3] = { status, data1, data2 };
+
+	output.QueueMessages(port, message, (status & 0xF0) == 0xD0 ? 2 : 3);
+}
+
+static std::vector<Byte>	Message(Byte status, Byte data1, Byte data2)
+{
+	const Byte message[3] = { status, data1, data2 };
+
+	return std::vector<Byte>(message, message + ((status & 0xF0) == 0xD0 ? 2 : 3));
+}
+
+TEST(Coalesce, LatestValueSupersedes)
+{
+	OutputScheduler output;
+
+	output.Allocate(2, 1024, true);
+	for (Byte value = 0; value < 10; ++value) {
+		QueueMessage(output, 0, 0xB0, 7, value);
+		QueueMessage(output, 0, 0xE0, 0, value);
+		QueueMessage(output, 0, 0xD0, value, 0);
+		QueueMessage(output, 0, 0xB0, 10, value);
+	}
+	// each port coalesces apart
+	QueueMessage(output, 1, 0xB0, 7, 0x7F);
+	CHECK_EQUAL(4 * 9, output.Coalesced());
+
+	std::vector<std::vector<Byte> > records = PopRecords(output, 0);
+	CHECK_EQUAL(4, records.size());
+	CHECK(records[0] == Message(0xB0, 7, 9));
+	CHECK(records[1] == Message(0xE0, 0, 9));
+	CHECK(records[2] == Message(0xD0, 9, 0));
+	CHECK(records[3] == Message(0xB0, 10, 9));
+	records = PopRecords(output, 1);
+	CHECK_EQUAL(1, records.size());
+	CHECK(records[0] == Message(0xB0, 7, 0x7F));
+}
+
+// A note of the channel queued after a controller is a barrier, the controller's next value is
+// queued after the note rather than taking the earlier place. Other channels pass it.
+TEST(Coalesce, OtherMessagesOfTheChannelAreBarriers)
+{
+	OutputScheduler output;
+
+	output.Allocate(1, 1024, true);
+	QueueMessage(output, 0, 0xB0, 7, 1);
+	QueueMessage(output, 0, 0xB1, 7, 1);
+	QueueMessage(output, 0, 0x90, 0x3C, 0x40);
+	QueueMessage(output, 0, 0xB0, 7, 2);
+	QueueMessage(output, 0, 0xB1, 7, 2);
+	QueueMessage(output, 0, 0xB0, 7, 3);
+	CHECK_EQUAL(2, output.Coalesced());
+
+	std::vector<std::vector<Byte> > records = PopRecords(output, 0);
+	CHECK_EQUAL(4, records.size());
+	CHECK(records[0] == Message(0xB0, 7, 1));
+	CHECK(records[1] == Message(0xB1, 7, 2));
+	CHECK(records[2] == Message(0x90, 0x3C, 0x40));
+	CHECK(records[3] == Message(0xB0, 7, 3));
+}
+
+// RPN and NRPN selection, data entry, increment and decrement, and the channel mode messages mean
+// something in sequence, every one is queued.
+TEST(Coalesce, ParameterAndModeControllersNeverCoalesce)
+{
+	const Byte excluded[] = { 6, 38, 96, 97, 98, 99, 100, 101, 120, 121, 123, 127 };
+	OutputScheduler output;
+
+	output.Allocate(1, 4096, true);
+	for (size_t i = 0; i < sizeof(excluded); ++i) {
+		const Byte message[3] = { 0xB0, excluded[i], 0 };
+
+		CHECK_EQUAL(0, OutputScheduler::SupersedingLength(message, sizeof(message)));
+		QueueMessage(output, 0, 0xB0, excluded[i], 1);
+		QueueMessage(output, 0, 0xB0, excluded[i], 2);
+	}
+	// an RPN set twice, its data entry each time
+	for (Byte value = 0; value < 2; ++value) {
+		QueueMessage(output, 0, 0xB0, 101, 0);
+		QueueMessage(output, 0, 0xB0, 100, 0);
+		QueueMessage(output, 0, 0xB0, 6, value);
+		QueueMessage(output, 0, 0xB0, 38, 0);
+	}
+	CHECK_EQUAL(0, output.Coalesced());
+	CHECK_EQUAL(2 * sizeof(excluded) + 8, PopRecords(output, 0).size());
+}
+
+// Once the superseded record is popped, or any of it sent, the next value is queued after it.
+TEST(Coalesce, SentRecordIsNotOverwritten)
+{
+	OutputScheduler output;
+	WriteQueueElem *wqe;
+
+	output.Allocate(1, 1024, true);
+	QueueMessage(output, 0, 0xB0, 7, 1);
+	CHECK(PopRecords(output, 0).size() == 1);
+	QueueMessage(output, 0, 0xB0, 7, 2);
+	CHECK_EQUAL(0, output.Coalesced());
+
+	// partly in an mspacket
+	wqe = output.Queue(0).Front();
+	CHECK(wqe != NULL);
+	wqe->bytesSent = 1;
+	QueueMessage(output, 0, 0xB0, 7, 3);
+	CHECK_EQUAL(0, output.Coalesced());
+	QueueMessage(output, 0, 0xB0, 7, 4);
+	CHECK_EQUAL(1, output.Coalesced());
+
+	std::vector<std::vector<Byte> > records = PopRecords(output, 0);
+	CHECK_EQUAL(2, records.size());
+	CHECK(records[0] == Message(0xB0, 7, 2));
+	CHECK(records[1] == Message(0xB0, 7, 4));
+}
+
+// A sweep sent faster than the transfers are taken reaches the cable shortened, ending on its last
+// value, the notes around it all sent.
+TEST(Coalesce, EngineSendsLatestValueOfSweep)
+{
+	InterfaceInfo info = TestInterfaceInfo();
+	std::vector<Byte> streams[MAX_PORTS];
+	const Byte noteOn[3] = { 0x90, 0x3C, 0x40 };
+	const Byte noteOff[3] = { 0x80, 0x3C, 0x40 };
+
+	info.coalesceOutput = true;
+	EngineFixture f(info);
+	f.engine.Send(0, 0, noteOn, sizeof(noteOn));
+	for (int value = 0; value < 128; ++value) {
+		const Byte modWheel[3] = { 0xB0, 1, (Byte)value };
+
+		f.engine.Send(0, 0, modWheel, sizeof(modWheel));
+	}
+	f.engine.Send(0, 0, noteOff, sizeof(noteOff));
+	f.WriteAll();
+
+	DecodeOutput(f.transport.Written(f.outPipe1), streams);
+	CHECK(streams[0].size() >= 9 && streams[0].size() < 3 * 130);
+	CHECK(std::vector<Byte>(streams[0].begin(), streams[0].begin() + 3) == std::vector<Byte>(noteOn, noteOn + 3));
+	if (streams[0].size() >= 6) {
+		CHECK(std::vector<Byte>(streams[0].end() - 6, streams[0].end() - 3) == Message(0xB0, 1, 127));
+		CHECK(std::vector<Byte>(streams[0].end() - 3, streams[0].end()) == std::vector<Byte>(noteOff, noteOff + 3));
+	}
+}
@@ -0,0 +1,208 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The packet lists of MIDIPacketEmitter filled, delivered and continued: no byte lost or out of
+// order however a read fills them, each list delivered within its storage, and, once running,
+// nothing allocated however hard the reads of a MIDISPORT 8x8/S push them.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include "TestHarness.h"
+#include "TestSupport.h"
+#include "MIDIPacketEmitter.h"
+#include "MidisportInputDecoder.h"
+
+// Every allocation the tests make is counted, so a test can tell it made none. The replacements
+// serve the whole test program, as replacements of operator new must.
+static std::atomic<UInt64>	gAllocations(0);
+
+void *	operator new(size_t size)
+{
+	void *p;
+
+	gAllocations.fetch_add(1, std::memory_order_relaxed);
+	while ((p = malloc(size != 0 ? size : 1)) == NULL) {
+		std::new_handler handler = std::get_new_handler();
+
+		if (handler == NULL)
+			throw std::bad_alloc();
+		handler();
+	}
+	return p;
+}
+
+void *	operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	gAllocations.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size != 0 ? size : 1);
+}
+
+void	operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void	operator delete(void *p, size_t /*size*/) noexcept
+{
+	free(p);
+}
+
+#define kSourcePacketListSize	512		// as MidisportEngine sizes each port's list, with a sysex chunk
+
+// A sink checking what it receives against the bytes expected of each port, realtime apart from
+// the rest, without allocating: the lists it is given must fit in the emitters' storage.
+class CheckingSink : public MIDISink {
+public:
+	CheckingSink(ByteCount listSize) : mListSize(listSize), mismatches(0), oversized(0), packets(0), calls(0)
+	{
+		for (int port = 0; port < MAX_PORTS; ++port)
+			realtimeReceived[port] = restReceived[port] = 0;
+	}
+
+	virtual void	Received(int port, const MIDIPacketList *list)
+	{
+		const MIDIPacket *packet = &list->packet[0];
+
+		++calls;
+		for (UInt32 i = 0; i < list->numPackets; ++i, packet = MIDIPacketNext(packet)) {
+			for (UInt16 b = 0; b < packet->length; ++b) {
+				Byte midiByte = packet->data[b];
+				const std::vector<Byte> &expected = (midiByte >= 0xF8) ? realtime[port] : rest[port];
+				size_t &received = (midiByte >= 0xF8) ? realtimeReceived[port] : restReceived[port];
+
+				if (received >= expected.size() || expected[received] != midiByte)
+					++mismatches;
+				++received;
+			}
+			++packets;
+		}
+		if ((const Byte *)packet > (const Byte *)list + mListSize + 3)
+			++oversized;
+	}
+
+	std::vector<Byte>	realtime[MAX_PORTS], rest[MAX_PORTS];	// expected
+	size_t				realtimeReceived[MAX_PORTS], restReceived[MAX_PORTS];
+
+private:
+	ByteCount			mListSize;
+
+public:
+	int					mismatches, oversized;
+	UInt64				packets, calls;
+};
+
+TEST(Emitter, FullListFlushedAndContinued)
+{
+	Byte storage[64];
+	CheckingSink sink(sizeof(storage));
+	InputStatistics statistics;
+	MIDIPacketEmitter emitter;
+	Byte sysexEnd[30];
+
+	memset(&statistics, 0, sizeof(statistics));
+	for (size_t i = 0; i < sizeof(sysexEnd); ++i)
+		sysexEnd[i] = (Byte)i;
+	sysexEnd[sizeof(sysexEnd) - 1] = 0xF7;
+	emitter.Initialize(&sink, 0, storage, sizeof(storage), &statistics);
+	for (int i = 0; i < 21; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)i, 0x40 };
+
+		emitter.Add(1000 + i, sizeof(noteOn), noteOn);
+		sink.rest[0].insert(sink.rest[0].end(), noteOn, noteOn + sizeof(noteOn));
+	}
+	// a list of 64 bytes holds three packets of a note-on each
+	CHECK_EQUAL(6, statistics.overflowFlushes);
+	CHECK_EQUAL(6, sink.calls);
+
+	// the end of a sysex with no room after the last packet begins a packet of its own, in a new list
+	emitter.Append(sizeof(sysexEnd), sysexEnd);
+	sink.rest[0].insert(sink.rest[0].end(), sysexEnd, sysexEnd + sizeof(sysexEnd));
+	CHECK_EQUAL(7, statistics.overflowFlushes);
+	emitter.Flush();
+	CHECK_EQUAL(sink.rest[0].size(), sink.restReceived[0]);
+	CHECK_EQUAL(0, sink.mismatches);
+	CHECK_EQUAL(0, sink.oversized);
+	CHECK_EQUAL(22, sink.packets);
+	CHECK(emitter.IsEmpty());
+}
+
+#define kSysexReads		21		// the reads of a sysex, 1008 bytes of it, short of a full chunk
+#define kCycleReads		(kSysexReads + 3)
+
+// The reads of one port of an 8x8/S, each of 16 mspackets, in a cycle: a sysex's reads; then the
+// densest a read can be, 45 realtime bytes, each a packet, with the EOX which ships the sysex after
+// them, overflowing the list; a read of note-ons, and one of nothing but realtime.
+static void	MakeRead(int port, int cycleRead, ByteCount readSize, std::vector<Byte> &reads, CheckingSink &sink)
+{
+	const ByteCount mspackets = readSize / MIDIPACKETLEN;
+
+	for (ByteCount m = 0; m < mspackets; ++m) {
+		Byte mspacket[MIDIPACKETLEN] = { 0xF8, 0xF8, 0xF8, (Byte)((port << 4) | 3) };
+		bool realtime = cycleRead == kSysexReads + 2 || (cycleRead == kSysexReads && m < mspackets - 1);
+
+		if (!realtime) {
+			for (int b = 0; b < 3; ++b)
+				mspacket[b] = (Byte)((cycleRead * 48 + m * 3 + b) & 0x7F);
+			if (cycleRead == 0 && m == 0)
+				mspacket[0] = 0xF0;
+			else if (cycleRead == kSysexReads)
+				mspacket[2] = 0xF7;
+			else if (cycleRead == kSysexReads + 1)
+				mspacket[0] = 0x90;
+		}
+		(realtime ? sink.realtime[port] : sink.rest[port]).insert((realtime ? sink.realtime[port] : sink.rest[port]).end(),
+																  mspacket, mspacket + 3);
+		reads.insert(reads.end(), mspacket, mspacket + MIDIPACKETLEN);
+	}
+}
+
+TEST(Emitter, EightByEightWorstCaseReadsAllocateNothing)
+{
+	DeviceEntry entry;
+	int numOutputPorts;
+	ManualClock clock;
+	InputStatistics statistics;
+	std::vector<Byte> reads;
+
+	CHECK(ReadDeviceEntry("MIDISPORT 8x8/S", entry));
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+	const int numPorts = info.numInputPorts;
+	const int numReads = numPorts * kCycleReads * 80;
+	const ByteCount listSize = kSourcePacketListSize + info.sysexChunkSize;
+	CheckingSink sink(listSize);
+	MidisportInputDecoder decoder(numPorts, info.sysexChunkSize, info.sysexTimeout, info.timestampInputBytes, clock);
+	std::vector<Byte> storage(numPorts * listSize);
+	std::vector<MIDIPacketEmitter> emitters(numPorts);
+
+	CHECK_EQUAL(64, info.readBufferSize);
+	memset(&statistics, 0, sizeof(statistics));
+	for (int port = 0; port < numPorts; ++port)
+		emitters[port].Initialize(&sink, port, &storage[port * listSize], listSize, &statistics);
+	// the reads made up beforehand, the ports taking turns
+	for (int read = 0; read < numReads; ++read)
+		MakeRead(read % numPorts, (read / numPorts) % kCycleReads, info.readBufferSize, reads, sink);
+
+	// once every list has been filled, the reads allocate nothing
+	UInt64 allocations = 0;
+	for (int read = 0; read < numReads; ++read) {
+		if (read == numPorts * kCycleReads)
+			allocations = gAllocations.load(std::memory_order_relaxed);
+		// faster than the sysex timeout, so each sysex is held until its EOX
+		clock.Advance(50000);
+		decoder.Decode(&emitters[0], clock.Now(), &reads[read * info.readBufferSize], info.readBufferSize, statistics);
+	}
+	CHECK_EQUAL(allocations, gAllocations.load(std::memory_order_relaxed));
+
+	for (int port = 0; port < numPorts; ++port) {
+		CHECK_EQUAL(sink.realtime[port].size(), sink.realtimeReceived[port]);
+		CHECK_EQUAL(sink.rest[port].size(), sink.restReceived[port]);
+	}
+	CHECK_EQUAL(0, sink.mismatches);
+	CHECK_EQUAL(0, sink.oversized);
+	// the read ending each sysex filled its port's list once
+	CHECK_EQUAL((UInt64)numReads / kCycleReads, statistics.overflowFlushes);
+	CHECK_EQUAL((UInt64)numReads / kCycleReads, statistics.sysexPackets);
+}
@@ -0,0 +1,268 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The data path of MidisportEngine: output encoded onto the pipe of its port, input decoded to the
+// sink, output held until it is due, a stalled pipe recovered and a disconnected one stopped.
+//
+
+#include "TestHarness.h"
+#include "TestSupport.h"
+
+static const Byte	kNoteOn[3] = { 0x90, 0x3C, 0x40 };
+static const Byte	kNoteOff[3] = { 0x80, 0x3C, 0x40 };
+static const Byte	kNoteOn2[3] = { 0x90, 0x3E, 0x40 };
+static const Byte	kVolume[3] = { 0xB1, 0x07, 0x64 };
+
+static std::vector<Byte>	Bytes(const Byte *data, ByteCount length)
+{
+	return std::vector<Byte>(data, data + length);
+}
+
+TEST(Engine, EncodesEachPortOnItsPipe)
+{
+	EngineFixture f;
+	const Byte expected1[8] = { 0x90, 0x3C, 0x40, 0x03, 0, 0, 0, 0 };
+	const Byte expected2[8] = { 0xB1, 0x07, 0x64, 0x13, 0, 0, 0, 0 };
+
+	f.engine.Send(0, 0, kNoteOn, sizeof(kNoteOn));
+	f.engine.Send(1, 0, kVolume, sizeof(kVolume));
+	CHECK_EQUAL(1, f.transport.Queued(f.outPipe1));
+	CHECK_EQUAL(1, f.transport.Queued(f.outPipe2));
+	f.WriteAll();
+	CHECK(f.transport.Written(f.outPipe1) == Bytes(expected1, sizeof(expected1)));
+	CHECK(f.transport.Written(f.outPipe2) == Bytes(expected2, sizeof(expected2)));
+}
+
+TEST(Engine, DecodesEachPortToItsSource)
+{
+	EngineFixture f;
+	std::vector<Byte> read = MSPackets(0, Bytes(kNoteOn, sizeof(kNoteOn)));
+	std::vector<Byte> port1 = MSPackets(1, Bytes(kNoteOff, sizeof(kNoteOff)));
+
+	read.insert(read.end(), port1.begin(), port1.end());
+	f.clock.Set(5000000);
+	f.Input(read);
+	CHECK(f.sink.Bytes(0) == Bytes(kNoteOn, sizeof(kNoteOn)));
+	CHECK(f.sink.Bytes(1) == Bytes(kNoteOff, sizeof(kNoteOff)));
+	CHECK_EQUAL(2, f.sink.receivedCalls);
+	CHECK_EQUAL(2, f.sink.packets.size());
+	CHECK_EQUAL(5000000, f.sink.packets[0].timeStamp);
+	// the read is started again
+	CHECK_EQUAL(2, f.transport.Queued(f.inPipe));
+	CHECK_EQUAL(1, f.engine.GetInputStatistics().readsCompleted);
+}
+
+TEST(Engine, StampsInputWithCompletionTime)
+{
+	EngineFixture f;
+
+	// the callback comes three milliseconds after the read completed
+	f.clock.Set(5000000);
+	f.transport.Input(f.inPipe, MSPackets(0, Bytes(kNoteOn, sizeof(kNoteOn))).data(), MIDIPACKETLEN);
+	f.clock.Advance(3000000);
+	f.Run();
+	CHECK_EQUAL(1, f.sink.packets.size());
+	CHECK_EQUAL(5000000, f.sink.packets[0].timeStamp);
+	CHECK_EQUAL(3000000, f.engine.GetInputStatistics().decodeWaitTime);
+}
+
+TEST(Engine, HoldsOutputUntilDue)
+{
+	EngineFixture f;
+	MIDITimeStamp when = f.clock.Now() + 10000000;
+	MIDITimeStamp due = when - 1000000;		// a USB frame ahead
+
+	f.engine.Send(0, when, kNoteOn, sizeof(kNoteOn));
+	f.engine.Send(0, 0, kNoteOn2, sizeof(kNoteOn2));
+	f.WriteAll();
+	CHECK_EQUAL(due, f.engine.NextDeadline());
+
+	std::vector<Byte> streams[MAX_PORTS];
+	DecodeOutput(f.transport.Written(f.outPipe1), streams);
+	CHECK(streams[0] == Bytes(kNoteOn2, sizeof(kNoteOn2)));
+
+	f.AdvanceTo(due - 1);
+	CHECK_EQUAL(0, f.transport.Queued(f.outPipe1));
+	f.AdvanceTo(due);
+	CHECK_EQUAL(1, f.transport.Queued(f.outPipe1));
+	CHECK_EQUAL(0, f.engine.NextDeadline());
+}
+
+TEST(Engine, RecoversStalledPipeAndResendsInOrder)
+{
+	EngineFixture f;
+	std::vector<Byte> expected;
+
+	expected.insert(expected.end(), kNoteOn, kNoteOn + 3);
+	expected.insert(expected.end(), kNoteOff, kNoteOff + 3);
+	expected.insert(expected.end(), kNoteOn2, kNoteOn2 + 3);
+	f.engine.Send(0, 0, kNoteOn, sizeof(kNoteOn));
+	f.engine.Send(0, 0, kNoteOff, sizeof(kNoteOff));
+	f.engine.Send(0, 0, kNoteOn2, sizeof(kNoteOn2));
+	CHECK_EQUAL(2, f.transport.Queued(f.outPipe1));		// the third waits for a buffer
+
+	// the first write stalls, the one queued behind it is aborted as the stall is cleared
+	MIDITimeStamp stalled = f.clock.Now();
+	f.transport.Stall(f.outPipe1);
+	f.Run();
+	const TransferStatistics &statistics = f.engine.GetTransferStatistics();
+	CHECK_EQUAL(1, statistics.writeErrors);
+	CHECK_EQUAL(1, statistics.stallsCleared);
+	CHECK_EQUAL(0, f.transport.Queued(f.outPipe1));
+	CHECK_EQUAL(stalled + 1000000, f.engine.NextDeadline());
+
+	f.AdvanceTo(stalled + 1000000);
+	CHECK_EQUAL(1, statistics.restarts);
+	CHECK_EQUAL(2, statistics.transfersResent);
+	f.WriteAll();
+
+	std::vector<Byte> streams[MAX_PORTS];
+	DecodeOutput(f.transport.Written(f.outPipe1), streams);
+	CHECK(streams[0] == expected);
+	CHECK(f.engine.IsIdle() == false);		// the reads are still in flight
+	CHECK_EQUAL(0, f.engine.NextDeadline());
+}
+
+TEST(Engine, WritesRestOfShortWriteAgain)
+{
+	EngineFixture f;
+	const Byte twoNotes[6] = { 0x90, 0x3C, 0x40, 0x90, 0x3E, 0x40 };
+	std::vector<Byte> expected(twoNotes, twoNotes + 6);
+
+	expected.insert(expected.end(), kNoteOff, kNoteOff + 3);
+	f.engine.Send(0, 0, twoNotes, sizeof(twoNotes));
+	f.engine.Send(0, 0, kNoteOff, sizeof(kNoteOff));
+	CHECK_EQUAL(2, f.transport.Queued(f.outPipe1));
+
+	// the device takes the first mspacket of three, the write behind is aborted
+	MIDITimeStamp shortened = f.clock.Now();
+	f.transport.ShortWrite(f.outPipe1, MIDIPACKETLEN);
+	f.Run();
+	const TransferStatistics &statistics = f.engine.GetTransferStatistics();
+	CHECK_EQUAL(1, statistics.shortWrites);
+	CHECK_EQUAL(1, statistics.writeErrors);
+	CHECK_EQUAL(0, f.transport.Queued(f.outPipe1));
+
+	f.AdvanceTo(shortened + 1000000);
+	CHECK_EQUAL(2, statistics.transfersResent);
+	f.WriteAll();
+
+	std::vector<Byte> streams[MAX_PORTS];
+	DecodeOutput(f.transport.Written(f.outPipe1), streams);
+	CHECK(streams[0] == expected);
+	// the rest is the second mspacket and the null one ending the transfer
+	CHECK_EQUAL(MIDIPACKETLEN + 2 * MIDIPACKETLEN + 2 * MIDIPACKETLEN, f.transport.Written(f.outPipe1).size());
+}
+
+TEST(Engine, StopsEveryPipeOnDisconnect)
+{
+	EngineFixture f;
+
+	f.engine.Send(0, 0, kNoteOn, sizeof(kNoteOn));
+	f.transport.Disconnect();
+	f.Run();
+	// the read pipe and the pipe written to, each once however many transfers it had
+	CHECK_EQUAL(2, f.engine.GetTransferStatistics().fatalErrors);
+	CHECK(f.engine.IsIdle());
+
+	// output for the other pipe finds the device gone as it is written, and nothing is retried
+	f.engine.Send(1, 0, kVolume, sizeof(kVolume));
+	f.Run();
+	CHECK_EQUAL(3, f.engine.GetTransferStatistics().fatalErrors);
+	CHECK_EQUAL(0, f.engine.GetTransferStatistics().restarts);
+	CHECK_EQUAL(0, f.engine.NextDeadline());
+	CHECK(f.engine.IsIdle());
+}
+
+// what the engine tells the host of the reads, counted where a host would wake its decoding thread
+class CountingHandoff : public InputHandoff {
+public:
+	CountingHandoff() : readsCompleted(0), readsStarved(0) { }
+
+	virtual void	ReadCompleted()		{ ++readsCompleted; }
+	virtual void	ReadsStarved()		{ ++readsStarved; }
+
+	int				readsCompleted;
+	int				readsStarved;
+};
+
+TEST(Engine, HandsReadsToDecodingThread)
+{
+	ManualClock clock;
+	InMemoryTransport transport(clock);
+	RecordingSink sink;
+	MidisportEngine engine(transport, clock, sink, TestInterfaceInfo(), 2);
+	CountingHandoff handoff;
+	int inPipe = transport.AddPipe(0x81, kPipeInterrupt, 32);
+	std::vector<Byte> expected;
+
+	transport.AddPipe(0x02, kPipeBulk, 32);
+	transport.AddPipe(0x04, kPipeBulk, 32);
+	engine.SetInputHandoff(&handoff);
+	CHECK(engine.Start());
+	// reading starts once the host has a thread to decode it
+	CHECK_EQUAL(0, transport.Queued(inPipe));
+	engine.RestartReads();
+	CHECK_EQUAL(2, transport.Queued(inPipe));
+
+	// both reads complete before either is decoded, leaving no buffer to read into
+	transport.Input(inPipe, MSPackets(0, Bytes(kNoteOn, sizeof(kNoteOn))).data(), MIDIPACKETLEN);
+	transport.Input(inPipe, MSPackets(0, Bytes(kNoteOff, sizeof(kNoteOff))).data(), MIDIPACKETLEN);
+	transport.Deliver();
+	CHECK_EQUAL(2, handoff.readsCompleted);
+	CHECK_EQUAL(0, transport.Queued(inPipe));
+	CHECK(sink.packets.empty());
+	CHECK_EQUAL(1, engine.GetInputStatistics().readStarvations);
+
+	// decoded in the order they completed, the first buffer released has reading restarted
+	expected.insert(expected.end(), kNoteOn, kNoteOn + 3);
+	expected.insert(expected.end(), kNoteOff, kNoteOff + 3);
+	engine.DecodeInput();
+	CHECK(sink.Bytes(0) == expected);
+	CHECK_EQUAL(1, handoff.readsStarved);
+	engine.RestartReads();
+	CHECK_EQUAL(2, transport.Queued(inPipe));
+
+	engine.Stop();
+	transport.Deliver();
+	CHECK(engine.IsIdle());
+}
+
+// The input of a disabled source is followed but never delivered, the other source unaffected. A
+// message begun and a running status set while it was disabled are completed once it is enabled
+// again, a sysex partly skipped is dropped whole, its tail never delivered without its F0.
+TEST(Engine, DisabledSourceDeliversNothingAndStaysInSync)
+{
+	EngineFixture f;
+	std::vector<Byte> read, port1, expected;
+	const Byte skipped[] = { 0x91, 0x3E, 0x40, 0xF8, 0x3F };	// a note-on of another channel and a clock, then a note begun
+	const Byte resumed[] = { 0x40, 0x41, 0x42 };				// the note ended, and another with the running status
+	const Byte sysexHead[] = { 0xF0, 0x7E, 0x01, 0x02 };
+	const Byte sysexTail[] = { 0x03, 0xF7, 0x92, 0x30, 0x31 };
+
+	f.Input(MSPackets(0, Bytes(kNoteOn, sizeof(kNoteOn))));
+	f.engine.SetSourceEnabled(0, false);
+	read = MSPackets(0, Bytes(skipped, sizeof(skipped)));
+	port1 = MSPackets(1, Bytes(kVolume, sizeof(kVolume)));
+	read.insert(read.end(), port1.begin(), port1.end());
+	f.Input(read);
+	CHECK(f.sink.Bytes(0) == Bytes(kNoteOn, sizeof(kNoteOn)));
+	CHECK(f.sink.Bytes(1) == Bytes(kVolume, sizeof(kVolume)));
+	CHECK_EQUAL(sizeof(skipped), f.engine.GetInputStatistics().bytesSkipped);
+
+	f.engine.SetSourceEnabled(0, true);
+	f.Input(MSPackets(0, Bytes(resumed, sizeof(resumed))));
+	const Byte notes[] = { 0x90, 0x3C, 0x40, 0x91, 0x3F, 0x40, 0x91, 0x41, 0x42 };
+	CHECK(f.sink.Bytes(0) == Bytes(notes, sizeof(notes)));
+
+	// disabled within a sysex, enabled before its end
+	f.sink.Clear();
+	f.engine.SetSourceEnabled(0, false);
+	f.Input(MSPackets(0, Bytes(sysexHead, sizeof(sysexHead))));
+	f.engine.SetSourceEnabled(0, true);
+	f.Input(MSPackets(0, Bytes(sysexTail, sizeof(sysexTail))));
+	f.AdvanceTo(f.clock.Now() + 1000000000);
+	expected.assign(sysexTail + 2, sysexTail + sizeof(sysexTail));
+	CHECK(f.sink.Bytes(0) == expected);
+	CHECK(f.sink.Bytes(1).empty());
+}
@@ -0,0 +1,186 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Stalls, failures and aborts injected into the transfers of MidisportEngine's pipes: each pipe
+// recovered after a backoff of a millisecond doubling to a tenth of a second, and what was written
+// by the transfers which failed written again, in the order it was sent, and only once.
+//
+
+#include <algorithm>
+#include "TestHarness.h"
+#include "TestSupport.h"
+
+static const UInt64	kFirstBackoff = 1000000;
+static const UInt64	kMaxBackoff = 100000000;
+
+static std::vector<Byte>	NoteOn(int i)
+{
+	const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+
+	return std::vector<Byte>(noteOn, noteOn + 3);
+}
+
+TEST(Faults, BacksOffDoublingToCap)
+{
+	EngineFixture f;
+	const TransferStatistics &statistics = f.engine.GetTransferStatistics();
+	UInt64 backoff = kFirstBackoff;
+
+	for (int failures = 1; failures <= 12; ++failures) {
+		MIDITimeStamp failed = f.clock.Now();
+
+		// the read fails, the one queued behind it is aborted as the stall is cleared
+		CHECK_EQUAL(2, f.transport.Queued(f.inPipe));
+		f.transport.Fail(f.inPipe);
+		f.Run();
+		CHECK_EQUAL(0, f.transport.Queued(f.inPipe));
+		CHECK_EQUAL(failed + backoff, f.engine.NextDeadline());
+
+		f.AdvanceTo(failed + backoff - 1);
+		CHECK_EQUAL(0, f.transport.Queued(f.inPipe));
+		f.AdvanceTo(failed + backoff);
+		CHECK_EQUAL(failures, statistics.restarts);
+		CHECK_EQUAL(failures, statistics.readErrors);
+		backoff = std::min(backoff * 2, kMaxBackoff);
+	}
+	CHECK_EQUAL(0, statistics.stallsCleared);
+	CHECK_EQUAL(0, statistics.fatalErrors);
+
+	// a read completing resets the backoff
+	f.Input(MSPackets(0, NoteOn(0)));
+	CHECK(f.sink.Bytes(0) == NoteOn(0));
+	MIDITimeStamp failed = f.clock.Now();
+	f.transport.Fail(f.inPipe);
+	f.Run();
+	CHECK_EQUAL(failed + kFirstBackoff, f.engine.NextDeadline());
+}
+
+TEST(Faults, StallFailureAndAbortResendInOrder)
+{
+	EngineFixture f;
+	const TransferStatistics &statistics = f.engine.GetTransferStatistics();
+	std::vector<Byte> expected[2];
+
+	for (int i = 0; i < 60; ++i) {
+		std::vector<Byte> noteOn = NoteOn(i);
+
+		f.engine.Send(i & 1, 0, noteOn.data(), noteOn.size());
+		expected[i & 1].insert(expected[i & 1].end(), noteOn.begin(), noteOn.end());
+	}
+	CHECK_EQUAL(2, f.transport.Queued(f.outPipe1));
+
+	// the pipe stalls after its first transfer is written, then the next fails, and the restarted
+	// one is aborted
+	MIDITimeStamp faulted = f.clock.Now();
+	CHECK_EQUAL(1, f.transport.CompleteWrites(f.outPipe1, 1));
+	f.Run();
+	f.transport.Stall(f.outPipe1);
+	f.Run();
+	CHECK_EQUAL(1, statistics.stallsCleared);
+	CHECK_EQUAL(faulted + kFirstBackoff, f.engine.NextDeadline());
+
+	// the other pipe goes on writing while this one recovers
+	f.transport.CompleteWrites(f.outPipe2);
+	f.Run();
+	CHECK_EQUAL(2, f.transport.Queued(f.outPipe2));
+
+	f.AdvanceTo(faulted + kFirstBackoff);
+	CHECK_EQUAL(2, f.transport.Queued(f.outPipe1));
+	f.transport.Fail(f.outPipe1);
+	f.Run();
+	CHECK_EQUAL(f.clock.Now() + 2 * kFirstBackoff, f.engine.NextDeadline());
+
+	f.AdvanceTo(f.clock.Now() + 2 * kFirstBackoff);
+	CHECK_EQUAL(2, f.transport.Queued(f.outPipe1));
+	f.transport.Abort(f.outPipe1);
+	f.Run();
+	CHECK_EQUAL(f.clock.Now() + 4 * kFirstBackoff, f.engine.NextDeadline());
+	f.AdvanceTo(f.clock.Now() + 4 * kFirstBackoff);
+
+	CHECK_EQUAL(3, statistics.writeErrors);
+	CHECK_EQUAL(1, statistics.stallsCleared);
+	CHECK_EQUAL(3, statistics.restarts);
+	CHECK_EQUAL(6, statistics.transfersResent);
+	CHECK_EQUAL(0, statistics.fatalErrors);
+
+	f.WriteAll();
+	std::vector<Byte> streams[MAX_PORTS];
+	DecodeOutput(f.transport.Written(f.outPipe1), streams);
+	DecodeOutput(f.transport.Written(f.outPipe2), streams);
+	CHECK(streams[0] == expected[0]);
+	CHECK(streams[1] == expected[1]);
+	CHECK_EQUAL(0, f.engine.NextDeadline());
+
+	// written without fault, the pipe backs off from the first step again
+	f.engine.Send(0, 0, expected[0].data(), 3);
+	MIDITimeStamp failed = f.clock.Now();
+	f.transport.Fail(f.outPipe1);
+	f.Run();
+	CHECK_EQUAL(failed + kFirstBackoff, f.engine.NextDeadline());
+}
+
+// The transfer queued behind a failed one got through before the stall was cleared: it is freed as
+// any written transfer is, and only the failed one is written again, after it.
+TEST(Faults, SuccessWhileRecoveringIsNotResent)
+{
+	EngineFixture f;
+	const TransferStatistics &statistics = f.engine.GetTransferStatistics();
+	std::vector<std::vector<Byte> > sent;
+
+	for (int i = 0; i < 30; ++i) {
+		std::vector<Byte> noteOn = NoteOn(i);
+
+		f.engine.Send(0, 0, noteOn.data(), noteOn.size());
+		sent.push_back(noteOn);
+	}
+	CHECK_EQUAL(2, f.transport.Queued(f.outPipe1));
+
+	MIDITimeStamp failed = f.clock.Now();
+	f.transport.Fail(f.outPipe1);
+	CHECK_EQUAL(1, f.transport.CompleteWrites(f.outPipe1, 1));
+	size_t gotThrough = f.transport.Written(f.outPipe1).size();
+	f.Run();
+	CHECK_EQUAL(0, f.transport.Queued(f.outPipe1));
+	CHECK_EQUAL(failed + kFirstBackoff, f.engine.NextDeadline());
+
+	f.AdvanceTo(failed + kFirstBackoff);
+	CHECK_EQUAL(1, statistics.writeErrors);
+	CHECK_EQUAL(1, statistics.restarts);
+	CHECK_EQUAL(1, statistics.transfersResent);
+	f.WriteAll();
+	CHECK(f.transport.Written(f.outPipe1).size() > gotThrough);
+
+	// every message written once, the failed transfer's after the one which got through
+	std::vector<Byte> streams[MAX_PORTS];
+	std::vector<std::vector<Byte> > written;
+	DecodeOutput(f.transport.Written(f.outPipe1), streams);
+	for (size_t i = 0; i + 3 <= streams[0].size(); i += 3)
+		written.push_back(std::vector<Byte>(streams[0].begin() + i, streams[0].begin() + i + 3));
+	CHECK_EQUAL(0, streams[0].size() % 3);
+	std::sort(written.begin(), written.end());
+	CHECK(written == sent);
+	CHECK_EQUAL(0, f.transport.Queued(f.outPipe1));
+	CHECK_EQUAL(0, f.engine.NextDeadline());
+}
+
+TEST(Faults, DisconnectEndsRecovery)
+{
+	EngineFixture f;
+	const TransferStatistics &statistics = f.engine.GetTransferStatistics();
+	std::vector<Byte> noteOn = NoteOn(0);
+
+	f.engine.Send(0, 0, noteOn.data(), noteOn.size());
+	f.transport.Fail(f.outPipe1);
+	f.Run();
+	CHECK(f.engine.NextDeadline() != 0);
+
+	// the device goes during the backoff, the restart finds it gone and nothing is tried again
+	f.transport.Disconnect();
+	f.Run();
+	f.AdvanceTo(f.clock.Now() + kMaxBackoff);
+	CHECK_EQUAL(1, statistics.restarts);
+	CHECK_EQUAL(0, statistics.transfersResent);
+	CHECK_EQUAL(2, statistics.fatalErrors);
+	CHECK_EQUAL(0, f.engine.NextDeadline());
+	CHECK(f.engine.IsIdle());
+}
@@ -0,0 +1,131 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Reads handed to a decoding thread slower than the device: every read decoded in the order it
+// completed, none lost while the device waits for a buffer, and the statistics of the handoff
+// counting the starvations and the waits the test itself works out.
+//
+
+#include <algorithm>
+#include "TestHarness.h"
+#include "TestSupport.h"
+
+#define kReadsInFlight		4
+#define kReads				400
+#define kDecodePeriod		6000000		// the decoding thread wakes every 6 ms
+#define kReceivedCost		500000		// and takes half a millisecond over each Received
+
+// a sink taking its time over what it receives, in the time of the clock
+class SlowSink : public RecordingSink {
+public:
+	SlowSink(ManualClock &clock) : mClock(clock) { }
+
+	virtual void	Received(int port, const MIDIPacketList *packets)
+	{
+		RecordingSink::Received(port, packets);
+		mClock.Advance(kReceivedCost);
+	}
+
+private:
+	ManualClock &	mClock;
+};
+
+// what a host's decoding thread is told, waiting to be acted on when it wakes
+class PendingHandoff : public InputHandoff {
+public:
+	PendingHandoff() : readsCompleted(0), readsStarved(0) { }
+
+	virtual void	ReadCompleted()		{ ++readsCompleted; }
+	virtual void	ReadsStarved()		{ ++readsStarved; }
+
+	int				readsCompleted;
+	int				readsStarved;
+};
+
+TEST(Handoff, SlowSinkLosesAndReordersNothing)
+{
+	ManualClock clock;
+	InMemoryTransport transport(clock);
+	SlowSink sink(clock);
+	InterfaceInfo info = TestInterfaceInfo();
+	PendingHandoff handoff;
+	std::vector<MIDITimeStamp> completed;
+	std::vector<Byte> expected;
+	UInt64 starvations = 0, waitTime = 0, maxWaitTime = 0;
+	int decodePasses = 0, deviceWaits = 0, undecoded = 0;
+
+	info.readsInFlight = kReadsInFlight;
+	MidisportEngine engine(transport, clock, sink, info, 2);
+	int inPipe = transport.AddPipe(0x81, kPipeInterrupt, 32);
+	transport.AddPipe(0x02, kPipeBulk, 32);
+	transport.AddPipe(0x04, kPipeBulk, 32);
+	engine.SetInputHandoff(&handoff);
+	CHECK(engine.Start());
+	engine.RestartReads();
+
+	// the device has a message a millisecond to send, waiting while no read is queued
+	for (MIDITimeStamp tick = clock.Now(); (int)completed.size() < kReads || undecoded > 0; tick += 1000000) {
+		clock.Set(std::max(clock.Now(), tick));
+		if ((int)completed.size() < kReads) {
+			int i = (int)completed.size();
+			const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), (Byte)(1 + (i >> 7)) };
+			std::vector<Byte> read = MSPackets(0, std::vector<Byte>(noteOn, noteOn + 3));
+
+			if (transport.Input(inPipe, read.data(), read.size())) {
+				completed.push_back(clock.Now());
+				expected.insert(expected.end(), noteOn, noteOn + 3);
+				if (++undecoded == kReadsInFlight)
+					++starvations;
+			}
+			else
+				++deviceWaits;
+			transport.Deliver();
+		}
+
+		// the decoding thread, woken, decodes what has completed, then restarts the reads
+		if ((tick / kDecodePeriod) != ((tick + 1000000) / kDecodePeriod) && handoff.readsCompleted > 0) {
+			MIDITimeStamp started = clock.Now();
+			size_t first = completed.size() - undecoded;
+			int readsStarved = handoff.readsStarved;
+
+			for (size_t i = first; i < completed.size(); ++i) {
+				UInt64 wait = started + (i - first) * kReceivedCost - completed[i];
+
+				waitTime += wait;
+				maxWaitTime = std::max(maxWaitTime, wait);
+			}
+			handoff.readsCompleted = 0;
+			engine.DecodeInput();
+			CHECK_EQUAL(started + undecoded * kReceivedCost, clock.Now());
+			undecoded = 0;
+			++decodePasses;
+			// every buffer was taken, the first released has reading started again
+			CHECK_EQUAL(readsStarved + 1, handoff.readsStarved);
+			engine.RestartReads();
+			CHECK_EQUAL(kReadsInFlight, transport.Queued(inPipe));
+		}
+	}
+
+	// nothing lost or reordered, each stamped with when its read completed
+	CHECK(sink.Bytes(0) == expected);
+	CHECK_EQUAL(kReads, sink.packets.size());
+	for (size_t i = 0; i < sink.packets.size() && i < completed.size(); ++i)
+		CHECK_EQUAL(completed[i], sink.packets[i].timeStamp);
+
+	// the decoding thread fell behind, so the device waited
+	const InputStatistics &statistics = engine.GetInputStatistics();
+	CHECK(deviceWaits > 0);
+	CHECK(starvations > 0);
+	CHECK_EQUAL(starvations, statistics.readStarvations);
+	CHECK_EQUAL(kReads, statistics.readsCompleted);
+	CHECK_EQUAL(kReads * MIDIPACKETLEN, statistics.bytesRead);
+	CHECK_EQUAL(waitTime, statistics.decodeWaitTime);
+	CHECK_EQUAL(maxWaitTime, statistics.maxDecodeWaitTime);
+	CHECK_EQUAL((UInt64)kReads * kReceivedCost, statistics.decodeTime);
+	CHECK_EQUAL(kReceivedCost, statistics.maxDecodeTime);
+	CHECK_EQUAL(decodePasses, handoff.readsStarved);
+
+	engine.Stop();
+	transport.Deliver();
+	CHECK(engine.IsIdle());
+}
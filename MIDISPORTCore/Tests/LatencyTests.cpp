@@ -0,0 +1,113 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// A port's output written while another port of the interface is busy with a sysex far longer than
+// the test: each note-on of the quiet port goes in the first transfer encoded after it is queued,
+// whichever endpoint it shares with the sysex, while the sysex goes on in order at the rate of its
+// MIDI cable.
+//
+
+#include <algorithm>
+#include "TestHarness.h"
+#include "TestSupport.h"
+#include "MidisportOutputEncoder.h"
+#include "OutputScheduler.h"
+
+#define kFrameNanos			1000000			// a transfer of each endpoint every USB frame
+#define kFrames				2000
+#define kNotePeriod			7				// a note-on to the quiet port every 7 frames
+#define kSysexLength		(100 * 1024)
+#define kQueueSize			(128 * 1024)
+
+// The sysex queued to busyPort and note-ons queued to quietPort as the frames go by, the transfers
+// encoded from them each frame and taken by the device in it. Returns the most frames a note-on
+// waited for the transfer it went in, sysexWritten the bytes of the sysex written meanwhile.
+static int	RunBusyPort(int busyPort, int quietPort, std::vector<Byte> &sysexWritten)
+{
+	DeviceEntry entry;
+	int numOutputPorts, maxLatency = 0;
+	ManualClock clock;
+	OutputScheduler output;
+	std::vector<Byte> sysex(kSysexLength), notesSent, streams[MAX_PORTS];
+	std::vector<MIDITimeStamp> noteQueued;
+	size_t notesWritten = 0;
+
+	CHECK(ReadDeviceEntry("MIDISPORT 4x4", entry));
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+	MidisportOutputEncoder encoder(numOutputPorts, info.runningStatus, info.noteOffAsNoteOn, info.packOutputBytes,
+								   info.outputBufferSize, clock);
+
+	output.Allocate(numOutputPorts, kQueueSize, false);
+	sysex[0] = 0xF0;
+	for (size_t i = 1; i < sysex.size() - 1; ++i)
+		sysex[i] = (Byte)(i & 0x7F);
+	sysex[sysex.size() - 1] = 0xF7;
+	for (size_t i = 0; i < sysex.size(); i += info.sysexChunkSize)
+		output.QueueMessages(busyPort, &sysex[i], std::min((size_t)info.sysexChunkSize, sysex.size() - i));
+
+	for (int frame = 0; frame < kFrames; ++frame) {
+		Byte buffers[2][64];
+		Byte *destBuf[2] = { buffers[0], buffers[1] };
+		ByteCount bufCount[2];
+		MIDITimeStamp retryTime;
+
+		if (frame % kNotePeriod == 0) {
+			const Byte noteOn[3] = { (Byte)(0x90 | quietPort), (Byte)(frame & 0x7F), 0x40 };
+
+			output.QueueMessages(quietPort, noteOn, sizeof(noteOn));
+			notesSent.insert(notesSent.end(), noteOn, noteOn + sizeof(noteOn));
+			noteQueued.push_back(clock.Now());
+		}
+		CHECK(!output.Queue(busyPort).IsEmpty());
+		encoder.EncodeTransfers(output, destBuf, bufCount, info.writeBufferSize, info.outputPacketsPerPort,
+								clock.Now(), retryTime);
+		for (int endpoint = 0; endpoint < 2; ++endpoint) {
+			DecodeOutput(std::vector<Byte>(buffers[endpoint], buffers[endpoint] + bufCount[endpoint]), streams);
+			encoder.Written(buffers[endpoint], bufCount[endpoint], clock.Now());
+		}
+
+		// each note-on written is a note-on the quiet port waited for
+		for (; notesWritten < noteQueued.size() && (notesWritten + 1) * 3 <= streams[quietPort].size(); ++notesWritten) {
+			int latency = (int)((clock.Now() - noteQueued[notesWritten]) / kFrameNanos);
+
+			maxLatency = std::max(maxLatency, latency);
+		}
+		clock.Advance(kFrameNanos);
+	}
+	CHECK_EQUAL(noteQueued.size(), notesWritten);
+	CHECK(streams[quietPort] == notesSent);
+	sysexWritten = streams[busyPort];
+	return maxLatency;
+}
+
+// the sysex written so far is the start of the sysex, and about what its cable could send
+static void	CheckSysexWritten(const std::vector<Byte> &sysexWritten)
+{
+	const UInt64 cableBytes = (UInt64)kFrames * kFrameNanos / MIDI_BYTE_NANOS;
+
+	CHECK(sysexWritten.size() >= cableBytes * 95 / 100);
+	CHECK(sysexWritten.size() < kSysexLength);
+	CHECK_EQUAL(0xF0, sysexWritten[0]);
+	for (size_t i = 1; i < sysexWritten.size(); ++i)
+		if (sysexWritten[i] != (Byte)(i & 0x7F)) {
+			CHECK_EQUAL((Byte)(i & 0x7F), sysexWritten[i]);
+			break;
+		}
+}
+
+// Ports 0 and 2 are both written to the even endpoint.
+TEST(Latency, QuietPortOnSysexEndpointWaitsNoFrame)
+{
+	std::vector<Byte> sysexWritten;
+
+	CHECK_EQUAL(0, RunBusyPort(0, 2, sysexWritten));
+	CheckSysexWritten(sysexWritten);
+}
+
+TEST(Latency, QuietPortOnOtherEndpointWaitsNoFrame)
+{
+	std::vector<Byte> sysexWritten;
+
+	CHECK_EQUAL(0, RunBusyPort(0, 1, sysexWritten));
+	CheckSysexWritten(sysexWritten);
+}
@@ -0,0 +1,111 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The packet list functions implemented where CoreMIDI has none: only whole messages of the same
+// time share a packet, sysex, its continuations and realtime bytes each keep a packet of their own.
+//
+
+#include "TestHarness.h"
+#include "MIDITypes.h"
+
+#if !MIDISPORT_COREMIDI
+
+// a list with room to spare, its packets added one after another as the emitters add them
+class PacketList {
+public:
+	PacketList() : mList((MIDIPacketList *)mStorage), mPacket(MIDIPacketListInit(mList)) { }
+
+	bool	Add(MIDITimeStamp time, const Byte *data, ByteCount length)
+	{
+		MIDIPacket *packet = MIDIPacketListAdd(mList, sizeof(mStorage), mPacket, time, length, data);
+
+		if (packet != NULL)
+			mPacket = packet;
+		return packet != NULL;
+	}
+	UInt32				NumPackets() const		{ return mList->numPackets; }
+	const MIDIPacket *	Packet(UInt32 i) const
+	{
+		const MIDIPacket *packet = &mList->packet[0];
+
+		while (i-- > 0)
+			packet = MIDIPacketNext(packet);
+		return packet;
+	}
+
+private:
+	Byte				mStorage[1024];
+	MIDIPacketList *	mList;
+	MIDIPacket *		mPacket;
+};
+
+static const Byte	kNoteOn[3] = { 0x90, 0x3C, 0x40 };
+static const Byte	kVolume[3] = { 0xB0, 0x07, 0x64 };
+static const Byte	kSysex[4] = { 0xF0, 0x41, 0x10, 0xF7 };
+static const Byte	kSysexStart[3] = { 0xF0, 0x41, 0x10 };
+static const Byte	kSysexRest[2] = { 0x12, 0xF7 };
+static const Byte	kClock[1] = { 0xF8 };
+
+TEST(MIDITypes, MergesWholeMessagesOfTheSameTime)
+{
+	PacketList list;
+
+	CHECK(list.Add(100, kNoteOn, sizeof(kNoteOn)));
+	CHECK(list.Add(100, kVolume, sizeof(kVolume)));
+	CHECK_EQUAL(1, list.NumPackets());
+	CHECK_EQUAL(6, list.Packet(0)->length);
+	CHECK(list.Add(101, kNoteOn, sizeof(kNoteOn)));
+	CHECK_EQUAL(2, list.NumPackets());
+}
+
+TEST(MIDITypes, KeepsDataBytesApart)
+{
+	PacketList list;
+
+	// a sysex continuation begins with data bytes, which are no message of their own
+	CHECK(list.Add(100, kNoteOn, sizeof(kNoteOn)));
+	CHECK(list.Add(100, kSysexRest, sizeof(kSysexRest)));
+	CHECK_EQUAL(2, list.NumPackets());
+	CHECK_EQUAL(3, list.Packet(0)->length);
+	CHECK_EQUAL(0x12, list.Packet(1)->data[0]);
+}
+
+TEST(MIDITypes, NeverMergesSysex)
+{
+	PacketList list;
+
+	CHECK(list.Add(100, kSysex, sizeof(kSysex)));
+	CHECK(list.Add(100, kNoteOn, sizeof(kNoteOn)));
+	CHECK(list.Add(100, kSysexStart, sizeof(kSysexStart)));
+	CHECK(list.Add(100, kSysexRest, sizeof(kSysexRest)));
+	CHECK_EQUAL(4, list.NumPackets());
+	CHECK_EQUAL(0xF0, list.Packet(2)->data[0]);
+	CHECK_EQUAL(2, list.Packet(3)->length);
+}
+
+TEST(MIDITypes, NeverMergesRealtime)
+{
+	PacketList list;
+
+	CHECK(list.Add(100, kClock, sizeof(kClock)));
+	CHECK(list.Add(100, kNoteOn, sizeof(kNoteOn)));
+	CHECK(list.Add(100, kClock, sizeof(kClock)));
+	CHECK(list.Add(100, kClock, sizeof(kClock)));
+	CHECK_EQUAL(4, list.NumPackets());
+	CHECK_EQUAL(1, list.Packet(0)->length);
+	CHECK_EQUAL(3, list.Packet(1)->length);
+	CHECK_EQUAL(1, list.Packet(3)->length);
+}
+
+TEST(MIDITypes, RefusesWhatDoesNotFit)
+{
+	Byte storage[64];
+	Byte data[64] = { 0x90 };
+	MIDIPacketList *list = (MIDIPacketList *)storage;
+	MIDIPacket *packet = MIDIPacketListInit(list);
+
+	CHECK(MIDIPacketListAdd(list, sizeof(storage), packet, 100, sizeof(data), data) == NULL);
+	CHECK_EQUAL(0, list->numPackets);
+}
+
+#endif // !MIDISPORT_COREMIDI
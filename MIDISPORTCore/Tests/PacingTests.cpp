@@ -0,0 +1,203 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Output paced to what the device can send down its MIDI cables, a byte each 320 µs: written to a
+// simulated device whose port buffers count every byte given a port with no room for it, none
+// overrun, while the cables are kept busy. The buffers are those of an 8x8/S taken to hold
+// kOutputBufferSize bytes a port, MIDISPORT_devices.xml leaving the devices unpaced until their
+// own sizes are measured.
+//
+
+#include <algorithm>
+#include "TestHarness.h"
+#include "TestSupport.h"
+#include "MidisportOutputEncoder.h"
+#include "OutputScheduler.h"
+
+#define kFrameNanos		1000000		// the device takes a transfer of each endpoint every USB frame
+#define kSysexLength	1000
+#define kOutputBufferSize	16		// bytes a port, a buffer small enough for pacing to matter
+
+// The buffers of the device's ports, taking the mspackets of the transfers it completes and sending
+// each port's bytes down its cable a byte at a time.
+class SimulatedDevice {
+public:
+	SimulatedDevice(ByteCount bufferSize) : overruns(0), mBufferSize(bufferSize)
+	{
+		for (int port = 0; port < MAX_PORTS; ++port)
+			mSentUntil[port] = 0;
+	}
+
+	// the transfers written to the pipe since it was last cleared, taken at now
+	void		Take(InMemoryTransport &transport, int pipe, MIDITimeStamp now, std::vector<Byte> streams[MAX_PORTS])
+	{
+		const std::vector<Byte> &written = transport.Written(pipe);
+
+		for (size_t i = 0; i + MIDIPACKETLEN <= written.size(); i += MIDIPACKETLEN) {
+			int port = written[i + CMDINDEX] >> 4;
+			int count = written[i + CMDINDEX] & 0x03;
+			MIDITimeStamp start = std::max(mSentUntil[port], now);
+
+			// what the port has yet to send, and these bytes, must fit in its buffer
+			if (start + count * MIDI_BYTE_NANOS > now + mBufferSize * MIDI_BYTE_NANOS)
+				++overruns;
+			mSentUntil[port] = start + count * MIDI_BYTE_NANOS;
+		}
+		DecodeOutput(written, streams);
+		transport.ClearWritten(pipe);
+	}
+
+	// when the port's cable has sent everything given it
+	MIDITimeStamp	SentUntil(int port) const	{ return mSentUntil[port]; }
+
+	int				overruns;
+
+private:
+	ByteCount		mBufferSize;
+	MIDITimeStamp	mSentUntil[MAX_PORTS];
+};
+
+// A sysex to the first port, and a run of note-ons to each of the others sharing its endpoint,
+// written to the device a transfer of each endpoint a frame until all of it is sent.
+static void	RunDevice(const InterfaceInfo &info, int numOutputPorts, SimulatedDevice &device, MIDITimeStamp &finished)
+{
+	EngineFixture f(info, numOutputPorts);
+	std::vector<Byte> sent[MAX_PORTS], streams[MAX_PORTS];
+	Byte sysex[kSysexLength];
+
+	sysex[0] = 0xF0;
+	for (int i = 1; i < kSysexLength - 1; ++i)
+		sysex[i] = (Byte)(i & 0x7F);
+	sysex[kSysexLength - 1] = 0xF7;
+	f.engine.Send(0, 0, sysex, sizeof(sysex));
+	sent[0].assign(sysex, sysex + sizeof(sysex));
+	for (int port = 2; port < numOutputPorts; port += 2)
+		for (int i = 0; i < 40; ++i) {
+			const Byte noteOn[3] = { (Byte)(0x90 | port), (Byte)i, 0x40 };
+
+			f.engine.Send(port, 0, noteOn, sizeof(noteOn));
+			sent[port].insert(sent[port].end(), noteOn, noteOn + sizeof(noteOn));
+		}
+
+	MIDITimeStamp start = f.clock.Now();
+	for (int frame = 1; frame < 2000; ++frame) {
+		f.AdvanceTo(start + (MIDITimeStamp)frame * kFrameNanos);
+		f.transport.CompleteWrites(f.outPipe1, 1);
+		f.transport.CompleteWrites(f.outPipe2, 1);
+		device.Take(f.transport, f.outPipe1, f.clock.Now(), streams);
+		device.Take(f.transport, f.outPipe2, f.clock.Now(), streams);
+		f.Run();
+		if (streams[0].size() == sent[0].size() && f.transport.Queued(f.outPipe1) == 0)
+			break;
+	}
+	for (int port = 0; port < numOutputPorts; ++port)
+		CHECK(streams[port] == sent[port]);
+	finished = device.SentUntil(0) - start;
+}
+
+TEST(Pacing, SimulatedDeviceNeverOverruns)
+{
+	DeviceEntry entry;
+	int numOutputPorts;
+	MIDITimeStamp finished;
+
+	CHECK(ReadDeviceEntry("MIDISPORT 8x8/S", entry));
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+	SimulatedDevice device(kOutputBufferSize);
+
+	info.outputBufferSize = kOutputBufferSize;
+	RunDevice(info, numOutputPorts, device, finished);
+	CHECK_EQUAL(0, device.overruns);
+	// the sysex's cable kept busy, idle for no more than a frame or two as the credit returns
+	CHECK(finished >= (MIDITimeStamp)kSysexLength * MIDI_BYTE_NANOS);
+	CHECK(finished <= (MIDITimeStamp)kSysexLength * MIDI_BYTE_NANOS * 105 / 100);
+}
+
+// Unpaced, the same output overruns the device, so the simulation would see it.
+TEST(Pacing, UnpacedOutputOverruns)
+{
+	DeviceEntry entry;
+	int numOutputPorts;
+	MIDITimeStamp finished;
+
+	CHECK(ReadDeviceEntry("MIDISPORT 8x8/S", entry));
+	InterfaceInfo info = DeviceInterfaceInfo(entry, numOutputPorts);
+	SimulatedDevice device(kOutputBufferSize);
+
+	info.outputBufferSize = 0;
+	RunDevice(info, numOutputPorts, device, finished);
+	CHECK(device.overruns > 0);
+}
+
+// A buffer smaller than an mspacket is taken as one mspacket's bytes, the credit not wrapping
+// to let the whole queue through at once.
+TEST(Pacing, TinyBufferSendsOneMSPacketAtATime)
+{
+	ManualClock clock;
+	OutputScheduler output;
+	MidisportOutputEncoder encoder(1, false, false, true, 1, clock);
+	Byte buffer[64];
+	Byte *destBuf[2] = { buffer, NULL };
+	ByteCount bufCount[2];
+	MIDITimeStamp retryTime, now = clock.Now();
+	Byte sysex[64];
+
+	output.Allocate(1, 1024, false);
+	sysex[0] = 0xF0;
+	for (size_t i = 1; i < sizeof(sysex); ++i)
+		sysex[i] = (Byte)i;
+	output.QueueMessages(0, sysex, sizeof(sysex));
+
+	// one mspacket, and the null one ending the transfer
+	encoder.EncodeTransfers(output, destBuf, bufCount, sizeof(buffer), 0, now, retryTime);
+	CHECK_EQUAL(2 * MIDIPACKETLEN, bufCount[0]);
+	CHECK(!encoder.HasCredit(0, now));
+	CHECK(retryTime > now);
+
+	// once the device has sent it, the next goes
+	encoder.Written(buffer, bufCount[0], now);
+	now += (MIDIPACKETLEN - 1) * MIDI_BYTE_NANOS;
+	CHECK(encoder.HasCredit(0, now));
+	encoder.EncodeTransfers(output, destBuf, bufCount, sizeof(buffer), 0, now, retryTime);
+	CHECK_EQUAL(2 * MIDIPACKETLEN, bufCount[0]);
+}
+
+// A port out of credit has it again once the device has sent half its buffer, and EncodeTransfers
+// asks to be retried then.
+TEST(Pacing, CreditReturnsAtHalfBuffer)
+{
+	ManualClock clock;
+	OutputScheduler output;
+	MidisportOutputEncoder encoder(1, false, false, true, 16, clock);
+	Byte buffer[64];
+	Byte *destBuf[2] = { buffer, NULL };
+	ByteCount bufCount[2];
+	MIDITimeStamp retryTime, now = clock.Now();
+	Byte sysex[64];
+
+	output.Allocate(1, 1024, false);
+	sysex[0] = 0xF0;
+	for (size_t i = 1; i < sizeof(sysex); ++i)
+		sysex[i] = (Byte)i;
+	output.QueueMessages(0, sysex, sizeof(sysex));
+
+	// the buffer filled to within an mspacket, five of them, taken to reach the device at once
+	encoder.EncodeTransfers(output, destBuf, bufCount, sizeof(buffer), 0, now, retryTime);
+	CHECK_EQUAL(6 * MIDIPACKETLEN, bufCount[0]);
+	CHECK(!encoder.HasCredit(0, now));
+	CHECK_EQUAL(now + (15 - 8) * MIDI_BYTE_NANOS, encoder.CreditTime(0));
+	CHECK_EQUAL(encoder.CreditTime(0), retryTime);
+
+	// taken three milliseconds later, they are sent from then, and the port waits for them
+	MIDITimeStamp completed = now + 3000000;
+	encoder.Written(buffer, bufCount[0], completed);
+	CHECK(!encoder.HasCredit(0, retryTime));
+	CHECK_EQUAL(completed + (15 - 8) * MIDI_BYTE_NANOS, encoder.CreditTime(0));
+	retryTime = encoder.CreditTime(0);
+	CHECK(!encoder.HasCredit(0, retryTime - 1));
+	CHECK(encoder.HasCredit(0, retryTime));
+
+	MIDITimeStamp credited = retryTime;
+	encoder.EncodeTransfers(output, destBuf, bufCount, sizeof(buffer), 0, credited, retryTime);
+	CHECK(bufCount[0] > MIDIPACKETLEN);
+}
@@ -0,0 +1,211 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Output encoded by one engine's MidisportOutputEncoder, read back in by another's
+// MidisportInputDecoder, as a MIDISPORT looped back from its outputs to its inputs would: each
+// port's messages delivered whole and in the order sent, however they were packed into mspackets,
+// with the System Realtime bytes which fell within them delivered on their own.
+//
+
+#include <algorithm>
+#include "TestHarness.h"
+#include "TestSupport.h"
+
+// the mspackets written to the pipe, without the null ones ending each transfer
+static std::vector<Byte>	Mspackets(const std::vector<Byte> &written)
+{
+	std::vector<Byte> mspackets;
+
+	for (size_t i = 0; i + MIDIPACKETLEN <= written.size(); i += MIDIPACKETLEN)
+		if (written[i + CMDINDEX] != 0)
+			mspackets.insert(mspackets.end(), &written[i], &written[i] + MIDIPACKETLEN);
+	return mspackets;
+}
+
+// what the sender wrote to both its pipes, read by the receiver in reads as long as it asks for
+static void	LoopBack(EngineFixture &sender, EngineFixture &receiver)
+{
+	const int pipes[2] = { sender.outPipe1, sender.outPipe2 };
+
+	sender.WriteAll();
+	for (int i = 0; i < 2; ++i) {
+		std::vector<Byte> mspackets = Mspackets(sender.transport.Written(pipes[i]));
+
+		for (size_t read = 0; read < mspackets.size(); read += 32)
+			receiver.Input(std::vector<Byte>(mspackets.begin() + read, mspackets.begin() + std::min(read + 32, mspackets.size())));
+	}
+}
+
+// the bytes apart, System Realtime from the rest
+static void	SplitRealtime(const std::vector<Byte> &bytes, std::vector<Byte> &realtime, std::vector<Byte> &rest)
+{
+	for (size_t i = 0; i < bytes.size(); ++i)
+		(bytes[i] >= 0xF8 ? realtime : rest).push_back(bytes[i]);
+}
+
+// Sent and received, each port has the same messages in the same order, the same realtime bytes in
+// the same order, and every packet received is whole, beginning with its status.
+static void	CheckRoundTrip(const std::vector<Byte> sent[2], const RecordingSink &sink)
+{
+	for (int port = 0; port < 2; ++port) {
+		std::vector<Byte> sentRealtime, sentRest, receivedRealtime, receivedRest;
+
+		SplitRealtime(sent[port], sentRealtime, sentRest);
+		SplitRealtime(sink.Bytes(port), receivedRealtime, receivedRest);
+		CHECK(receivedRest == sentRest);
+		CHECK(receivedRealtime == sentRealtime);
+	}
+	for (size_t i = 0; i < sink.packets.size(); ++i) {
+		const std::vector<Byte> &data = sink.packets[i].data;
+
+		CHECK(!data.empty());
+		if (!data.empty() && data[0] >= 0xF8)
+			CHECK_EQUAL(1, data.size());
+		else if (!data.empty() && data[0] != 0xF0)
+			CHECK(data[0] >= 0x80 || (i > 0 && sink.packets[i - 1].data[0] == 0xF0));	// or sysex continued
+	}
+}
+
+static void	Send(EngineFixture &f, std::vector<Byte> sent[2], int port, const Byte *data, ByteCount length)
+{
+	f.engine.Send(port, 0, data, length);
+	sent[port].insert(sent[port].end(), data, data + length);
+}
+
+// Messages of every length, a program change's two bytes and a clock's one, take whole mspackets
+// only when the bytes of the messages after them fill the rest.
+TEST(RoundTrip, PacksAcrossMessageBoundaries)
+{
+	for (int options = 0; options < 4; ++options) {
+		InterfaceInfo info = TestInterfaceInfo();
+		std::vector<Byte> sent[2];
+
+		info.packOutputBytes = (options & 1) != 0;
+		info.runningStatus = (options & 2) != 0;
+		EngineFixture sender(info), receiver;
+		for (int i = 0; i < 40; ++i) {
+			const Byte programChange[2] = { 0xC0, (Byte)i };
+			const Byte noteOn[3] = { 0x91, (Byte)i, 0x40 };
+			const Byte sysex[7] = { 0xF0, 0x7E, 0x7F, 0x06, 0x01, (Byte)i, 0xF7 };
+			const Byte songSelect[2] = { 0xF3, (Byte)i };
+			const Byte clock[1] = { 0xF8 };
+
+			Send(sender, sent, i & 1, programChange, sizeof(programChange));
+			Send(sender, sent, i & 1, noteOn, sizeof(noteOn));
+			Send(sender, sent, i & 1, sysex, sizeof(sysex));
+			Send(sender, sent, i & 1, songSelect, sizeof(songSelect));
+			Send(sender, sent, i & 1, clock, sizeof(clock));
+		}
+		LoopBack(sender, receiver);
+		CheckRoundTrip(sent, receiver.sink);
+
+		// Packed, every mspacket carries three bytes but the first, written before the rest was
+		// queued, and the last. Otherwise only the sysex fills them.
+		const int pipes[2] = { sender.outPipe1, sender.outPipe2 };
+		for (int port = 0; port < 2; ++port) {
+			std::vector<Byte> mspackets = Mspackets(sender.transport.Written(pipes[port]));
+			ItemCount partial = 0;
+
+			for (size_t m = 0; m < mspackets.size(); m += MIDIPACKETLEN)
+				if ((mspackets[m + CMDINDEX] & 0x03) != 3)
+					++partial;
+			if (info.packOutputBytes) {
+				CHECK(partial <= 2);
+				CHECK(mspackets.size() / MIDIPACKETLEN <= sent[port].size() / 3 + 1);
+			}
+			else
+				CHECK_EQUAL(4 * 20, partial);
+		}
+	}
+}
+
+// System Realtime sent within a channel message or a sysex is written ahead of, or between, the bytes
+// of the message, which is received whole around it.
+TEST(RoundTrip, RealtimeWithinMessages)
+{
+	for (int packed = 0; packed < 2; ++packed) {
+		InterfaceInfo info = TestInterfaceInfo();
+		std::vector<Byte> sent[2];
+
+		info.packOutputBytes = packed != 0;
+		EngineFixture sender(info), receiver;
+		for (int i = 0; i < 20; ++i) {
+			const Byte noteOn[5] = { 0x90, 0xF8, (Byte)i, 0xFE, 0x40 };
+			const Byte sysex[9] = { 0xF0, 0x7D, 0x01, 0xF8, 0x02, 0x03, 0xFA, (Byte)i, 0xF7 };
+			const Byte pitchBend[4] = { 0xE2, 0x00, 0xF8, 0x40 };
+
+			Send(sender, sent, 0, noteOn, sizeof(noteOn));
+			Send(sender, sent, 0, sysex, sizeof(sysex));
+			Send(sender, sent, 1, pitchBend, sizeof(pitchBend));
+			// written as it is sent, for the realtime queues hold only a few dozen bytes
+			sender.WriteAll();
+		}
+		LoopBack(sender, receiver);
+		CheckRoundTrip(sent, receiver.sink);
+	}
+}
+
+// Flushed while its sysex is partly written, a port has the sysex ended with an EOX, so the message
+// sent next is received whole rather than taken as more of the sysex.
+TEST(RoundTrip, FlushEndsPartialSysex)
+{
+	for (int packed = 0; packed < 2; ++packed) {
+		InterfaceInfo info = TestInterfaceInfo();
+		Byte sysex[200];
+		const Byte noteOn[3] = { 0x90, 0x3C, 0x40 };
+
+		info.packOutputBytes = packed != 0;
+		EngineFixture sender(info), receiver;
+		sysex[0] = 0xF0;
+		for (size_t i = 1; i < sizeof(sysex); ++i)
+			sysex[i] = (Byte)(i & 0x7F);
+		sender.engine.Send(0, 0, sysex, sizeof(sysex));
+		// the first transfers are in flight, the rest of the sysex still queued
+		sender.engine.Flush(0);
+		sender.engine.Send(0, 0, noteOn, sizeof(noteOn));
+		LoopBack(sender, receiver);
+
+		std::vector<Byte> received = receiver.sink.Bytes(0);
+		CHECK(received.size() > 3 + 2 && received.size() < sizeof(sysex));
+		if (received.size() > 3 + 2) {
+			size_t sysexLength = received.size() - 3;
+
+			CHECK(std::vector<Byte>(received.begin(), received.begin() + sysexLength - 1) ==
+				  std::vector<Byte>(sysex, sysex + sysexLength - 1));
+			CHECK_EQUAL(0xF7, received[sysexLength - 1]);
+			CHECK(std::vector<Byte>(received.begin() + sysexLength, received.end()) == std::vector<Byte>(noteOn, noteOn + 3));
+			CHECK(receiver.sink.packets.back().data == std::vector<Byte>(noteOn, noteOn + 3));
+		}
+	}
+}
+
+// With note-offs sent as note-ons, a note-off of the default release velocity goes down the cable
+// as 9n kk 00, sharing the running status of the note-ons around it, and is received as such. A
+// note-off of any other velocity is left alone, its velocity being more than a release.
+TEST(RoundTrip, DefaultVelocityNoteOffsSentAsNoteOns)
+{
+	for (int packed = 0; packed < 2; ++packed) {
+		InterfaceInfo info = TestInterfaceInfo();
+		const Byte noteOn[3] = { 0x90, 0x3C, 0x64 };
+		const Byte noteOff[3] = { 0x80, 0x3C, 0x40 };
+		const Byte nextNoteOn[3] = { 0x90, 0x3E, 0x64 };
+		const Byte slowNoteOff[3] = { 0x80, 0x3E, 0x20 };
+		const Byte wire[] = { 0x90, 0x3C, 0x64, 0x3C, 0x00, 0x3E, 0x64, 0x80, 0x3E, 0x20 };
+		const Byte expected[] = { 0x90, 0x3C, 0x64, 0x90, 0x3C, 0x00, 0x90, 0x3E, 0x64, 0x80, 0x3E, 0x20 };
+
+		info.packOutputBytes = packed != 0;
+		info.runningStatus = true;
+		info.noteOffAsNoteOn = true;
+		EngineFixture sender(info), receiver;
+		sender.engine.Send(0, 0, noteOn, sizeof(noteOn));
+		sender.engine.Send(0, 0, noteOff, sizeof(noteOff));
+		sender.engine.Send(0, 0, nextNoteOn, sizeof(nextNoteOn));
+		sender.engine.Send(0, 0, slowNoteOff, sizeof(slowNoteOff));
+		LoopBack(sender, receiver);
+
+		std::vector<Byte> streams[MAX_PORTS];
+		DecodeOutput(sender.transport.Written(sender.outPipe1), streams);
+		CHECK(streams[0] == std::vector<Byte>(wire, wire + sizeof(wire)));
+		CHECK(receiver.sink.Bytes(0) == std::vector<Byte>(expected, expected + sizeof(expected)));
+	}
+}
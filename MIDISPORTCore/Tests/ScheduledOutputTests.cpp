@@ -0,0 +1,232 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The output held until it is due: released in time stamp order, no sooner than the schedule lead
+// before it, for the device to take within a USB frame of its time stamp, and a port's packets
+// dropped by a flush at once, their space reclaimed however long the packets were to be held. Each
+// port holds its packets apart, one holding all it can leaving the others room.
+//
+
+#include "TestHarness.h"
+#include "TestSupport.h"
+
+static const Byte	kNoteOn[3] = { 0x90, 0x3C, 0x40 };
+
+// hold packets of the port until the arena refuses one, returns how many were held
+static int	Fill(ScheduledOutput &held, UInt8 portNum, MIDITimeStamp when)
+{
+	int numHeld = 0;
+
+	while (held.Schedule(when + numHeld, portNum, kNoteOn, sizeof(kNoteOn)))
+		++numHeld;
+	return numHeld;
+}
+
+TEST(ScheduledOutput, ReleasesInTimeStampOrder)
+{
+	ScheduledOutput held;
+	const MIDITimeStamp times[5] = { 3000, 1000, 2000, 1000, 500 };
+	const Byte expected[5] = { 4, 1, 3, 2, 0 };		// equal time stamps in the order held
+
+	held.Allocate(1, 256, 16);
+	for (Byte i = 0; i < 5; ++i)
+		CHECK(held.Schedule(times[i], 0, &i, 1));
+	for (int i = 0; i < 5; ++i) {
+		CHECK(held.Front() != NULL);
+		CHECK_EQUAL(expected[i], held.Front()->data[0]);
+		held.PopFront();
+	}
+	CHECK(held.IsEmpty());
+	CHECK(held.Front() == NULL);
+}
+
+TEST(ScheduledOutput, FlushReclaimsArenaAtOnce)
+{
+	ScheduledOutput held;
+	int numHeld;
+
+	held.Allocate(2, 256, 64);
+	numHeld = Fill(held, 0, 1000000000);
+	CHECK(numHeld > 1);
+	CHECK_EQUAL(1, held.Overflows());
+
+	// none of them due, all of the port's arena is free again
+	held.Flush(0);
+	CHECK(held.IsEmpty());
+	CHECK_EQUAL(0, held.NextTime());
+	CHECK_EQUAL(numHeld, Fill(held, 0, 1000));
+	CHECK_EQUAL(2, held.Overflows());
+}
+
+// A port holding all it can refuses no packet of another port, and the earliest of both is released
+// first.
+TEST(ScheduledOutput, FullPortLeavesOthersRoom)
+{
+	ScheduledOutput held;
+	int numHeld;
+
+	held.Allocate(2, 256, 64);
+	numHeld = Fill(held, 0, 2000);
+	CHECK_EQUAL(numHeld, Fill(held, 1, 1000));
+	CHECK_EQUAL(2, held.Overflows());
+	CHECK_EQUAL(1000, held.NextTime());
+	CHECK_EQUAL(1, held.Front()->portNum);
+
+	// port 1's packets all released ahead of port 0's
+	for (int i = 0; i < numHeld; ++i) {
+		CHECK_EQUAL(1, held.Front()->portNum);
+		held.PopFront();
+	}
+	CHECK_EQUAL(2000, held.NextTime());
+	CHECK_EQUAL(0, held.Front()->portNum);
+}
+
+TEST(ScheduledOutput, FlushKeepsOtherPortsInOrder)
+{
+	ScheduledOutput held;
+	std::vector<Byte> released;
+	int numHeld;
+
+	held.Allocate(3, 1024, 64);
+	for (Byte i = 0; i < 32; ++i) {
+		// port 0 held longest, port 1 interleaved in the arena and out of time order
+		MIDITimeStamp when = (i & 1) ? 1000 + (i * 7919) % 32 : 5000 - i;
+
+		CHECK(held.Schedule(when, i & 1, &i, 1));
+	}
+	held.Flush(0);
+	while (held.Front() != NULL) {
+		CHECK_EQUAL(1, held.Front()->portNum);
+		released.push_back(held.Front()->data[0]);
+		held.PopFront();
+	}
+	CHECK_EQUAL(16, released.size());
+	for (size_t i = 1; i < released.size(); ++i)
+		CHECK((released[i - 1] * 7919) % 32 < (released[i] * 7919) % 32);
+
+	// the space of both ports was reclaimed, port 0's by the flush, port 1's as it was released
+	for (UInt8 port = 0; port < 2; ++port) {
+		numHeld = 0;
+		while (held.Schedule(1000, port, kNoteOn, sizeof(kNoteOn)))
+			++numHeld;
+		CHECK_EQUAL(64, numHeld);
+	}
+}
+
+// A port's whole queue of held output, flushed, is gone without the clock advancing, so as much can
+// be held again straight away.
+TEST(ScheduledOutput, EngineFlushEmptiesFullQueueAtOnce)
+{
+	EngineFixture f;
+	MIDITimeStamp start = f.clock.Now();
+	int numHeld = 0;
+
+	while (f.engine.GetScheduledOutput().Overflows() == 0) {
+		f.engine.Send(0, start + 1000000000ULL + numHeld, kNoteOn, sizeof(kNoteOn));
+		++numHeld;
+	}
+	--numHeld;
+	f.WriteAll();
+	f.transport.ClearWritten(f.outPipe1);
+	CHECK(numHeld > 100);
+	CHECK(f.engine.NextDeadline() > start);
+
+	f.engine.Flush(0);
+	f.WriteAll();
+	CHECK_EQUAL(start, f.clock.Now());
+	CHECK(f.engine.GetScheduledOutput().IsEmpty());
+	CHECK_EQUAL(0, f.engine.NextDeadline());
+	CHECK(f.transport.Written(f.outPipe1).empty());
+
+	// the port holds as much again, none of it written early
+	for (int i = 0; i < numHeld; ++i)
+		f.engine.Send(0, start + 2000000000ULL, kNoteOn, sizeof(kNoteOn));
+	f.WriteAll();
+	CHECK_EQUAL(1, f.engine.GetScheduledOutput().Overflows());
+	CHECK(f.transport.Written(f.outPipe1).empty());
+}
+
+#define kFrameNanos			1000000		// the device takes the transfers written each USB frame
+#define kScheduleLead		1000000		// held output is released this far ahead of its time stamp
+#define kMaxWakeLate		300000		// the I/O thread wakes up to this late for a deadline
+#define kHeldPackets		400
+
+// a held note-on, when it was released to be written and when the device took it
+struct HeldNote {
+	int				port;
+	MIDITimeStamp	when;
+	MIDITimeStamp	released;
+	MIDITimeStamp	taken;
+};
+
+// how late the I/O thread wakes for its wake-th deadline, the same every run
+static UInt64	WakeLate(UInt32 wake)
+{
+	return ((wake * 2654435761U) >> 8) % kMaxWakeLate;
+}
+
+// Packets held to time stamps over two seconds, sent out of order, are released by an I/O thread
+// woken late for each deadline, and taken by the device a frame at a time: none is released before
+// the schedule lead, and the device takes each within a USB frame of its time stamp.
+TEST(ScheduledOutput, HeldOutputTakenWithinAFrame)
+{
+	EngineFixture f;
+	std::vector<HeldNote> notes(kHeldPackets);
+	const int pipes[2] = { f.outPipe1, f.outPipe2 };
+	MIDITimeStamp start = f.clock.Now(), frame = start - start % kFrameNanos + kFrameNanos;
+	size_t released = 0;
+	UInt32 wakes = 0;
+
+	// time stamps apart and in order, each 2 to 8 ms after the one before
+	for (int i = 0; i < kHeldPackets; ++i) {
+		HeldNote note = { i & 1, start + 5000000 * (i + 1) + WakeLate(i + 1000) * 10, 0, 0 };
+
+		notes[i] = note;
+	}
+	for (int i = 0; i < kHeldPackets; ++i) {
+		int n = (i * 7919) % kHeldPackets;
+		const Byte noteOn[3] = { (Byte)(0x90 | notes[n].port), (Byte)(n & 0x7F), (Byte)(1 + (n >> 7)) };
+
+		f.engine.Send(notes[n].port, notes[n].when, noteOn, sizeof(noteOn));
+	}
+	CHECK_EQUAL(0, f.engine.GetScheduledOutput().Overflows());
+	CHECK_EQUAL(notes[0].when - kScheduleLead, f.engine.NextDeadline());
+
+	while (released < notes.size() || f.transport.Queued(f.outPipe1) + f.transport.Queued(f.outPipe2) != 0) {
+		MIDITimeStamp deadline = f.engine.NextDeadline();
+		MIDITimeStamp wake = (deadline != 0) ? deadline + WakeLate(wakes) : 0;
+
+		if (wake != 0 && wake < frame) {
+			f.clock.Set(wake);
+			++wakes;
+		}
+		else {
+			// the transfers written during the frame go to the device at its end
+			f.clock.Set(frame);
+			frame += kFrameNanos;
+			for (int i = 0; i < 2; ++i) {
+				std::vector<Byte> streams[MAX_PORTS];
+
+				f.transport.CompleteWrites(pipes[i]);
+				DecodeOutput(f.transport.Written(pipes[i]), streams);
+				for (size_t b = 0; b + 3 <= streams[i].size(); b += 3)
+					notes[streams[i][b + 1] + ((streams[i][b + 2] - 1) << 7)].taken = f.clock.Now();
+				f.transport.ClearWritten(pipes[i]);
+			}
+		}
+		f.Run();
+
+		// released in time stamp order, those before the next held have been
+		const ScheduledOutput &held = f.engine.GetScheduledOutput();
+		for ( ; released < notes.size() && (held.IsEmpty() || notes[released].when < held.NextTime()); ++released)
+			notes[released].released = f.clock.Now();
+	}
+
+	for (size_t n = 0; n < notes.size(); ++n) {
+		CHECK(notes[n].released >= notes[n].when - kScheduleLead);
+		CHECK(notes[n].released < notes[n].when - kScheduleLead + kMaxWakeLate);
+		CHECK(notes[n].taken + kFrameNanos >= notes[n].when);
+		CHECK(notes[n].taken <= notes[n].when + kFrameNanos);
+	}
+	CHECK(f.engine.GetScheduledOutput().IsEmpty());
+}
@@ -0,0 +1,125 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The SendQueue pushed onto by several threads at once while one pops, its ring small enough to
+// wrap and fill over and over: every packet a producer pushed is popped once, whole, and in the
+// order that producer pushed it. Run it under a thread sanitizer to find a record read before its
+// producer published it.
+//
+
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "TestHarness.h"
+#include "SendQueue.h"
+
+#define kProducers			4
+#define kPacketsEach		50000
+#define kSendQueueSize		512
+
+// The packet a producer pushes as its n'th: its number and n, then bytes of n up to a length of
+// five to forty, so records of every size wrap the ring.
+static ByteCount	MakePacket(int producer, UInt32 n, Byte *data)
+{
+	ByteCount length = 5 + n % 36;
+
+	data[0] = (Byte)producer;
+	data[1] = (Byte)n;
+	data[2] = (Byte)(n >> 8);
+	data[3] = (Byte)(n >> 16);
+	data[4] = (Byte)(n >> 24);
+	for (ByteCount i = 5; i < length; ++i)
+		data[i] = (Byte)(n + i);
+	return length;
+}
+
+static void	Produce(SendQueue *queue, int producer, std::atomic<UInt64> *refused)
+{
+	Byte data[64];
+
+	for (UInt32 n = 0; n < kPacketsEach; ++n) {
+		ByteCount length = MakePacket(producer, n, data);
+
+		// a full ring refuses the push, which the producer tries again
+		if (n % 97 == 96) {
+			while (!queue->PushFlush((UInt8)producer)) {
+				refused->fetch_add(1, std::memory_order_relaxed);
+				std::this_thread::yield();
+			}
+		}
+		while (!queue->Push((UInt8)producer, n, data, length)) {
+			refused->fetch_add(1, std::memory_order_relaxed);
+			std::this_thread::yield();
+		}
+	}
+}
+
+TEST(SendQueue, ProducersNeitherLoseNorReorder)
+{
+	SendQueue queue;
+	std::atomic<UInt64> refused(0);
+	std::vector<std::thread> producers;
+	UInt32 next[kProducers] = { 0 }, flushes[kProducers] = { 0 };
+	int popped = 0, corrupt = 0, reordered = 0;
+	Byte expected[64];
+
+	queue.Allocate(kSendQueueSize);
+	for (int producer = 0; producer < kProducers; ++producer)
+		producers.push_back(std::thread(Produce, &queue, producer, &refused));
+
+	while (popped < kProducers * kPacketsEach) {
+		const SentPacket *packet = queue.Front();
+
+		if (packet == NULL) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (packet->portNum >= kProducers) {
+			++corrupt;
+		}
+		else if (packet->flush) {
+			++flushes[packet->portNum];
+		}
+		else {
+			int producer = packet->portNum;
+			UInt32 n = (UInt32)packet->timeStamp;
+			ByteCount length = MakePacket(producer, n, expected);
+
+			if (n != next[producer])
+				++reordered;
+			next[producer] = n + 1;
+			if (packet->length != length || memcmp(packet->data, expected, length) != 0)
+				++corrupt;
+			++popped;
+		}
+		queue.PopFront();
+	}
+	for (size_t i = 0; i < producers.size(); ++i)
+		producers[i].join();
+
+	CHECK_EQUAL(0, corrupt);
+	CHECK_EQUAL(0, reordered);
+	for (int producer = 0; producer < kProducers; ++producer) {
+		CHECK_EQUAL(kPacketsEach, next[producer]);
+		CHECK_EQUAL(kPacketsEach / 97, flushes[producer]);
+	}
+	CHECK(queue.Front() == NULL);
+	// the ring was full often enough for the test to mean something
+	CHECK(refused.load() > 0);
+	CHECK_EQUAL(refused.load(), queue.Overflows());
+}
+
+// A packet too long for a record is refused, whatever room the ring has.
+TEST(SendQueue, RefusesPacketLongerThanRecord)
+{
+	SendQueue queue;
+	std::vector<Byte> data(kSendQueueSize, 0x40);
+
+	queue.Allocate(kSendQueueSize);
+	CHECK(!queue.Push(0, 0, data.data(), queue.MaxRecordLength() + 1));
+	CHECK_EQUAL(1, queue.Overflows());
+	CHECK(queue.Push(0, 0, data.data(), queue.MaxRecordLength()));
+	CHECK(queue.Front() != NULL);
+	CHECK_EQUAL(queue.MaxRecordLength(), queue.Front()->length);
+}
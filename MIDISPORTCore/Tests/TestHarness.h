@@ -0,0 +1,47 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The tests of the protocol engine, run without a device over InMemoryTransport and ManualClock.
+// Each TEST registers itself in a suite, the suites named on the command line are run, all of them
+// if none is. A failed CHECK fails its test and reports where, the test going on to its end.
+//
+
+#ifndef __TestHarness_h__
+#define __TestHarness_h__
+
+#include <stdio.h>
+
+typedef void (*TestFunction)();
+
+struct TestRegistration {
+	TestRegistration(const char *suite, const char *name, TestFunction function);
+
+	const char *		suite;
+	const char *		name;
+	TestFunction		function;
+	TestRegistration *	next;
+};
+
+void	TestFailed(const char *file, int line, const char *what);
+			// fail the test being run
+
+#define TEST(suite, name) \
+	static void suite##_##name(); \
+	static TestRegistration suite##_##name##_registration(#suite, #name, suite##_##name); \
+	static void suite##_##name()
+
+#define CHECK(condition) \
+	do { if (!(condition)) TestFailed(__FILE__, __LINE__, #condition); } while (0)
+
+// the values are printed as unsigned long long, so only integers and enums are compared
+#define CHECK_EQUAL(expected, actual) \
+	do { \
+		unsigned long long e_ = (unsigned long long)(expected), a_ = (unsigned long long)(actual); \
+		if (e_ != a_) { \
+			char what_[256]; \
+			snprintf(what_, sizeof(what_), "%s == %s, expected %llu, got %llu", #expected, #actual, e_, a_); \
+			TestFailed(__FILE__, __LINE__, what_); \
+		} \
+	} while (0)
+
+#endif // __TestHarness_h__
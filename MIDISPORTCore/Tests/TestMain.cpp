@@ -0,0 +1,67 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Runs the tests of the suites named on the command line, or every test.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "TestHarness.h"
+
+static TestRegistration *	sTests = NULL;		// in the reverse order registered
+static int					sFailures = 0;		// of the test being run
+
+TestRegistration::TestRegistration(const char *suite_, const char *name_, TestFunction function_) :
+	suite(suite_),
+	name(name_),
+	function(function_),
+	next(sTests)
+{
+	sTests = this;
+}
+
+void	TestFailed(const char *file, int line, const char *what)
+{
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+	++sFailures;
+}
+
+static bool	Selected(const TestRegistration *test, int argc, char **argv)
+{
+	if (argc < 2)
+		return true;
+	for (int i = 1; i < argc; ++i)
+		if (strcmp(argv[i], test->suite) == 0)
+			return true;
+	return false;
+}
+
+int		main(int argc, char **argv)
+{
+	TestRegistration *tests = NULL;
+	int run = 0, failed = 0;
+
+	// run in the order registered, within a file the order written
+	while (sTests != NULL) {
+		TestRegistration *test = sTests;
+
+		sTests = test->next;
+		test->next = tests;
+		tests = test;
+	}
+	for (TestRegistration *test = tests; test != NULL; test = test->next) {
+		if (!Selected(test, argc, argv))
+			continue;
+		sFailures = 0;
+		test->function();
+		++run;
+		if (sFailures != 0) {
+			++failed;
+			printf("FAILED %s.%s\n", test->suite, test->name);
+		}
+		else
+			printf("passed %s.%s\n", test->suite, test->name);
+	}
+	printf("%d tests, %d failed\n", run, failed);
+	return (run == 0 || failed != 0) ? 1 : 0;
+}
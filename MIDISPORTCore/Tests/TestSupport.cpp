@@ -0,0 +1,207 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// What the tests share.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include "DeviceDefaults.h"
+#include "TestSupport.h"
+
+void	RecordingSink::Received(int port, const MIDIPacketList *packets)
+{
+	const MIDIPacket *packet = &packets->packet[0];
+
+	for (UInt32 i = 0; i < packets->numPackets; ++i) {
+		ReceivedPacket received;
+
+		received.port = port;
+		received.timeStamp = packet->timeStamp;
+		received.data.assign(packet->data, packet->data + packet->length);
+		this->packets.push_back(received);
+		packet = MIDIPacketNext(packet);
+	}
+	++receivedCalls;
+}
+
+std::vector<Byte>	RecordingSink::Bytes(int port) const
+{
+	std::vector<Byte> bytes;
+
+	for (size_t i = 0; i < packets.size(); ++i)
+		if (packets[i].port == port)
+			bytes.insert(bytes.end(), packets[i].data.begin(), packets[i].data.end());
+	return bytes;
+}
+
+// __________________________________________________________________________________________________
+
+InterfaceInfo	TestInterfaceInfo()
+{
+	InterfaceInfo info;
+
+	memset(&info, 0, sizeof(info));
+	info.inEndpointType = kPipeInterrupt;
+	info.outEndpointType = kPipeBulk;
+	info.readBufferSize = 32;
+	info.writeBufferSize = 32;
+	info.numInputPorts = 2;
+	info.sysexChunkSize = 256;
+	info.sysexTimeout = 100;
+	return info;
+}
+
+// Enough of a property list reader for the flat dicts of the device list, each key followed by an
+// integer, a string, or true or false.
+bool	ReadDeviceEntry(const char *deviceName, DeviceEntry &entry)
+{
+	std::ifstream file(MIDISPORT_DEVICES_XML);
+	std::stringstream contents;
+	std::regex keyValue("<key>(\\w+)</key>\\s*(?:<(integer|string)>([^<]*)</\\2>|<(true|false)/>)");
+	std::string xml;
+
+	contents << file.rdbuf();
+	xml = contents.str();
+	// the dicts of the Devices array
+	for (size_t start = xml.find("<dict>", xml.find("<array>")); start != std::string::npos; start = xml.find("<dict>", start + 1)) {
+		std::string dict = xml.substr(start, xml.find("</dict>", start) - start);
+
+		entry.clear();
+		for (std::sregex_iterator it(dict.begin(), dict.end(), keyValue); it != std::sregex_iterator(); ++it)
+			entry[(*it)[1]] = (*it)[4].matched ? (*it)[4].str() : (*it)[3].str();
+		if (entry["DeviceName"] == deviceName)
+			return true;
+	}
+	entry.clear();
+	return false;
+}
+
+int		DeviceInteger(const DeviceEntry &entry, const char *key, int defaultValue)
+{
+	DeviceEntry::const_iterator it = entry.find(key);
+
+	return (it != entry.end()) ? (int)strtol(it->second.c_str(), NULL, 0) : defaultValue;
+}
+
+static bool	DeviceBoolean(const DeviceEntry &entry, const char *key, bool defaultValue)
+{
+	DeviceEntry::const_iterator it = entry.find(key);
+
+	return (it != entry.end()) ? it->second == "true" : defaultValue;
+}
+
+InterfaceInfo	DeviceInterfaceInfo(const DeviceEntry &entry, int &numOutputPorts)
+{
+	InterfaceInfo info;
+	int numPorts = DeviceInteger(entry, "NumberOfPorts", 0);
+
+	memset(&info, 0, sizeof(info));
+	info.inEndpointType = kPipeInterrupt;
+	info.outEndpointType = kPipeBulk;
+	info.readBufferSize = DeviceInteger(entry, "ReadBufferSize", 0);
+	info.writeBufferSize = DeviceInteger(entry, "WriteBufferSize", 0);
+	info.numInputPorts = (UInt8)DeviceInteger(entry, "NumberOfInputPorts", numPorts);
+	numOutputPorts = DeviceInteger(entry, "NumberOfOutputPorts", numPorts);
+	info.outputPacketsPerPort = (UInt8)DeviceInteger(entry, "OutputPacketsPerPort", DEFAULT_OUTPUT_PACKETS_PER_PORT);
+	info.writesInFlight = (UInt8)DeviceInteger(entry, "WritesInFlight", DEFAULT_WRITES_IN_FLIGHT);
+	info.readsInFlight = (UInt8)DeviceInteger(entry, "ReadsInFlight", DEFAULT_READS_IN_FLIGHT);
+	info.coalesceOutput = DeviceBoolean(entry, "CoalesceOutput", DEFAULT_COALESCE_OUTPUT);
+	info.sysexChunkSize = DeviceInteger(entry, "SysexChunkSize", DEFAULT_SYSEX_CHUNK_SIZE);
+	info.sysexTimeout = DeviceInteger(entry, "SysexTimeout", DEFAULT_SYSEX_TIMEOUT);
+	info.timestampInputBytes = DeviceBoolean(entry, "TimestampInputBytes", DEFAULT_TIMESTAMP_INPUT_BYTES);
+	info.runningStatus = DeviceBoolean(entry, "RunningStatus", DEFAULT_RUNNING_STATUS);
+	info.noteOffAsNoteOn = DeviceBoolean(entry, "NoteOffAsNoteOn", DEFAULT_NOTE_OFF_AS_NOTE_ON);
+	info.packOutputBytes = DeviceBoolean(entry, "PackOutputBytes", DEFAULT_PACK_OUTPUT_BYTES);
+	info.outputBufferSize = DeviceInteger(entry, "OutputBufferSize", DEFAULT_OUTPUT_BUFFER_SIZE);
+	if (info.outputBufferSize != 0 && info.outputBufferSize < MIN_OUTPUT_BUFFER_SIZE)
+		info.outputBufferSize = MIN_OUTPUT_BUFFER_SIZE;
+	info.allNotesOffOnFlush = DeviceBoolean(entry, "AllNotesOffOnFlush", DEFAULT_ALL_NOTES_OFF_ON_FLUSH);
+	info.allSoundOffOnFlush = DeviceBoolean(entry, "AllSoundOffOnFlush", DEFAULT_ALL_SOUND_OFF_ON_FLUSH);
+	return info;
+}
+
+EngineFixture::EngineFixture(const InterfaceInfo &info, int numOutputPorts) :
+	transport(clock),
+	engine(transport, clock, sink, info, numOutputPorts)
+{
+	inPipe = transport.AddPipe(0x81, kPipeInterrupt, 32);
+	outPipe1 = transport.AddPipe(0x02, kPipeBulk, 32);
+	outPipe2 = transport.AddPipe(0x04, kPipeBulk, 32);
+	engine.Start();
+}
+
+// the transfers aborted return before the engine goes
+EngineFixture::~EngineFixture()
+{
+	engine.Stop();
+	transport.Deliver();
+}
+
+void	EngineFixture::Input(const std::vector<Byte> &mspackets)
+{
+	transport.Input(inPipe, mspackets.data(), mspackets.size());
+	Run();
+}
+
+void	EngineFixture::Run()
+{
+	for (;;) {
+		MIDITimeStamp deadline = engine.NextDeadline();
+
+		if (transport.Deliver() != 0)
+			continue;
+		if (deadline == 0 || deadline > clock.Now())
+			break;
+		engine.Service();
+	}
+}
+
+void	EngineFixture::AdvanceTo(MIDITimeStamp when)
+{
+	MIDITimeStamp deadline;
+
+	Run();
+	while ((deadline = engine.NextDeadline()) != 0 && deadline < when) {
+		clock.Set(deadline);
+		Run();
+	}
+	clock.Set(when);
+	Run();
+}
+
+void	EngineFixture::WriteAll()
+{
+	while (transport.CompleteWrites(outPipe1) + transport.CompleteWrites(outPipe2) != 0)
+		Run();
+}
+
+// __________________________________________________________________________________________________
+
+std::vector<Byte>	MSPackets(int port, const std::vector<Byte> &midi)
+{
+	std::vector<Byte> mspackets;
+
+	for (size_t i = 0; i < midi.size(); i += 3) {
+		size_t count = std::min(midi.size() - i, (size_t)3);
+		Byte mspacket[MIDIPACKETLEN] = { 0, 0, 0, (Byte)((port << 4) | count) };
+
+		memcpy(mspacket, &midi[i], count);
+		mspackets.insert(mspackets.end(), mspacket, mspacket + MIDIPACKETLEN);
+	}
+	return mspackets;
+}
+
+void	DecodeOutput(const std::vector<Byte> &written, std::vector<Byte> streams[MAX_PORTS])
+{
+	for (size_t i = 0; i + MIDIPACKETLEN <= written.size(); i += MIDIPACKETLEN) {
+		const Byte *mspacket = &written[i];
+		int count = mspacket[CMDINDEX] & 0x03;
+
+		streams[mspacket[CMDINDEX] >> 4].insert(streams[mspacket[CMDINDEX] >> 4].end(), mspacket, mspacket + count);
+	}
+}
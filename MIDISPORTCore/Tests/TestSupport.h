@@ -0,0 +1,86 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// What the tests share: a MIDISink recording what it receives, a MidisportEngine running a 2x2 over
+// an InMemoryTransport in the time of a ManualClock, and the MIDISPORT format written both ways.
+//
+
+#ifndef __TestSupport_h__
+#define __TestSupport_h__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Clock.h"
+#include "InMemoryTransport.h"
+#include "InterfaceInfo.h"
+#include "MIDISink.h"
+#include "MidisportEngine.h"
+#include "MidisportFormat.h"
+
+// a packet received, copied out of its list
+struct ReceivedPacket {
+	int					port;
+	MIDITimeStamp		timeStamp;
+	std::vector<Byte>	data;
+};
+
+class RecordingSink : public MIDISink {
+public:
+	RecordingSink() : receivedCalls(0) { }
+
+	virtual void		Received(int port, const MIDIPacketList *packets);
+
+	std::vector<Byte>	Bytes(int port) const;
+							// the bytes received from the port, in order
+	void				Clear()		{ packets.clear(); receivedCalls = 0; }
+
+	std::vector<ReceivedPacket>	packets;
+	ItemCount			receivedCalls;
+};
+
+// How a MIDISPORT 2x2 is run, as MIDISPORT_devices.xml has it but for 32 byte transfers.
+InterfaceInfo	TestInterfaceInfo();
+
+// The keys of a device's entry in MIDISPORT_devices.xml and their values as written, <true/> and
+// <false/> as "true" and "false".
+typedef std::map<std::string, std::string>	DeviceEntry;
+
+bool			ReadDeviceEntry(const char *deviceName, DeviceEntry &entry);
+					// false if the device list has no entry of that DeviceName
+InterfaceInfo	DeviceInterfaceInfo(const DeviceEntry &entry, int &numOutputPorts);
+					// how MIDISPORT::GetInterfaceInfo runs the device, the keys missing taking
+					// the defaults of DeviceDefaults.h, as HardwareConfiguration gives them
+int				DeviceInteger(const DeviceEntry &entry, const char *key, int defaultValue);
+
+// The engine of an interface with the pipes of a MIDISPORT 2x2: the IN pipe on endpoint 1, the even
+// ports' OUT pipe on endpoint 2 and the odd ports' on endpoint 4.
+class EngineFixture {
+public:
+	EngineFixture(const InterfaceInfo &info = TestInterfaceInfo(), int numOutputPorts = 2);
+	~EngineFixture();
+
+	void				Input(const std::vector<Byte> &mspackets);
+							// complete the oldest read with the mspackets and deliver it
+	void				Run();
+							// deliver the transfers completed, and Service the engine while it is
+							// due, until neither has anything left to do
+	void				AdvanceTo(MIDITimeStamp when);
+							// Run at each deadline of the engine up to when, then at when
+	void				WriteAll();
+							// complete every write, those the completions chain included
+
+	ManualClock			clock;
+	InMemoryTransport	transport;
+	RecordingSink		sink;
+	MidisportEngine		engine;
+	int					inPipe, outPipe1, outPipe2;
+};
+
+std::vector<Byte>	MSPackets(int port, const std::vector<Byte> &midi);
+						// the MIDI of the port in mspackets of three bytes, the last partly filled
+void				DecodeOutput(const std::vector<Byte> &written, std::vector<Byte> streams[MAX_PORTS]);
+						// append the bytes written for each port to its stream, skipping the null
+						// mspackets ending the transfers
+
+#endif // __TestSupport_h__
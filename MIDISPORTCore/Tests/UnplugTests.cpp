@@ -0,0 +1,194 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// An interface unplugged and plugged in again thousands of times while other threads send to it,
+// reclaimed as the hosts reclaim theirs: unlinked from its slot, its engine stopped, and deleted
+// once the epoch has passed every Send which found it and its transfers have all returned. Run it
+// under a thread sanitizer, or an address sanitizer, to find what a reclaim too early would break.
+//
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "TestHarness.h"
+#include "TestSupport.h"
+#include "Epoch.h"
+#include "SendQueue.h"
+
+#define kCycles				3000
+#define kSenders			2
+#define kSendQueueSize		4096
+
+// An interface as the hosts run one, its engine only run by the I/O thread, the senders only
+// pushing onto its SendQueue.
+class PluggedInterface {
+public:
+	PluggedInterface(const Clock &clock, RecordingSink &sink) :
+		transport(clock),
+		engine(transport, clock, sink, TestInterfaceInfo(), 2),
+		users(0)
+	{
+		inPipe = transport.AddPipe(0x81, kPipeInterrupt, 32);
+		outPipe1 = transport.AddPipe(0x02, kPipeBulk, 32);
+		outPipe2 = transport.AddPipe(0x04, kPipeBulk, 32);
+		sendQueue.Allocate(kSendQueueSize);
+	}
+
+	// on the I/O thread, what was sent handed to the engine in the order it was sent
+	void		HandleSent()
+	{
+		const SentPacket *packet;
+
+		while ((packet = sendQueue.Front()) != NULL) {
+			if (packet->flush)
+				engine.Flush(packet->portNum);
+			else
+				engine.Send(packet->portNum, packet->timeStamp, packet->data, packet->length);
+			sendQueue.PopFront();
+		}
+	}
+
+	InMemoryTransport	transport;
+	MidisportEngine		engine;
+	SendQueue			sendQueue;
+	int					inPipe, outPipe1, outPipe2;
+	std::atomic<int>	users;		// the senders using the interface, which must be none as it goes
+};
+
+// The slot the senders find the interface in, and the interfaces unplugged from it, waiting to be
+// reclaimed by the I/O thread.
+class UnplugHost {
+public:
+	struct Retired {
+		PluggedInterface *	intf;
+		UInt32				epoch;		// when it was unlinked from the slot
+	};
+
+	UnplugHost() : slot(NULL), stopping(false), sends(0), flushes(0), reclaimedInUse(0), reclaimedBusy(0) { }
+
+	// on a sender's thread, as the hosts' Send and Flush
+	void		Sender(int sender)
+	{
+		for (UInt32 i = 0; !stopping.load(std::memory_order_relaxed); ++i) {
+			UInt32 entered = epoch.Enter();
+			PluggedInterface *intf = slot.load(std::memory_order_acquire);
+
+			if (intf != NULL) {
+				intf->users.fetch_add(1);
+				if ((i & 15) == 15) {
+					if (intf->sendQueue.PushFlush((UInt8)sender))
+						flushes.fetch_add(1, std::memory_order_relaxed);
+				}
+				else {
+					const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+
+					if (intf->sendQueue.Push((UInt8)sender, 0, noteOn, sizeof(noteOn)))
+						sends.fetch_add(1, std::memory_order_relaxed);
+				}
+				intf->users.fetch_sub(1);
+			}
+			epoch.Exit(entered);
+			if (intf == NULL || (i & 63) == 63)
+				std::this_thread::yield();
+		}
+	}
+
+	// on the I/O thread, every fourth device left plugged in, so only the aborts return its transfers
+	void		Unplug(int cycle)
+	{
+		PluggedInterface *intf = slot.load(std::memory_order_relaxed);
+
+		slot.store(NULL, std::memory_order_release);
+		if (cycle % 4 != 3)
+			intf->transport.Disconnect();
+		intf->engine.Stop();
+
+		Retired retired = { intf, epoch.Current() };
+		this->retired.push_back(retired);
+	}
+
+	// on the I/O thread, as MidisportHost::ReclaimInterfaces
+	void		Reclaim()
+	{
+		for (int i = 0; i < 2; ++i)
+			epoch.TryAdvance();
+		for (std::vector<Retired>::iterator it = retired.begin(); it != retired.end(); ) {
+			PluggedInterface *intf = it->intf;
+
+			intf->transport.Deliver();
+			if (epoch.Passed(it->epoch) && intf->engine.IsIdle()) {
+				if (intf->users.load() != 0)
+					++reclaimedInUse;
+				if (intf->transport.Queued(intf->inPipe) + intf->transport.Queued(intf->outPipe1) + intf->transport.Queued(intf->outPipe2) != 0)
+					++reclaimedBusy;
+				delete intf;
+				it = retired.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+	Epoch								epoch;
+	std::atomic<PluggedInterface *>		slot;
+	std::vector<Retired>				retired;	// only used on the I/O thread
+	std::atomic<bool>					stopping;
+	std::atomic<UInt64>					sends, flushes;
+	int									reclaimedInUse, reclaimedBusy;
+};
+
+static void	SenderThread(UnplugHost *host, int sender)
+{
+	host->Sender(sender);
+}
+
+TEST(Unplug, ReclaimsOnlyOnceUnusedUnderTraffic)
+{
+	ManualClock clock;
+	RecordingSink sink;
+	UnplugHost host;
+	std::vector<std::thread> senders;
+	std::vector<Byte> read = MSPackets(0, std::vector<Byte>(3, 0x40));
+
+	read[0] = 0x90;
+	for (int i = 0; i < kSenders; ++i)
+		senders.push_back(std::thread(SenderThread, &host, i));
+
+	for (int cycle = 0; cycle < kCycles; ++cycle) {
+		PluggedInterface *intf = new PluggedInterface(clock, sink);
+
+		CHECK(intf->engine.Start());
+		host.slot.store(intf, std::memory_order_release);
+
+		// plugged in for a few passes of the I/O thread, reading and writing
+		for (int pass = 0; pass <= cycle % 4; ++pass) {
+			intf->HandleSent();
+			intf->transport.Input(intf->inPipe, read.data(), read.size());
+			intf->transport.CompleteWrites(intf->outPipe1, 1);
+			intf->transport.CompleteWrites(intf->outPipe2, 1);
+			intf->transport.ClearWritten(intf->outPipe1);
+			intf->transport.ClearWritten(intf->outPipe2);
+			intf->transport.Deliver();
+			clock.Advance(1000000);
+			if (intf->engine.NextDeadline() != 0 && intf->engine.NextDeadline() <= clock.Now())
+				intf->engine.Service();
+			host.Reclaim();
+			sink.Clear();
+			std::this_thread::yield();
+		}
+		host.Unplug(cycle);
+		host.Reclaim();
+	}
+
+	host.stopping.store(true);
+	for (size_t i = 0; i < senders.size(); ++i)
+		senders[i].join();
+	for (int i = 0; i < 100 && !host.retired.empty(); ++i)
+		host.Reclaim();
+
+	CHECK(host.retired.empty());
+	CHECK_EQUAL(0, host.reclaimedInUse);
+	CHECK_EQUAL(0, host.reclaimedBusy);
+	CHECK(host.sends.load() > 0);
+	CHECK(host.flushes.load() > 0);
+}
@@ -0,0 +1,82 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The USB transfers the protocol engine makes of an interface. Transfers are asynchronous: Read and
+// Write return once the transfer is queued, its callback being called later, never from within
+// them, on the thread the transport delivers completions on. The engine is used only on that thread.
+// A transfer which could not be queued gets no callback. The transfers of a pipe complete in the
+// order they were queued, and the buffer of each must stay untouched until its callback, the
+// transport being free to transfer straight from it. Each callback is given the time its transfer
+// completed, as near as the transport can tell, in the time of the engine's Clock, which the
+// transport shares: the callback can come well after, with its thread busy or the transport
+// holding completions back, and input is stamped with the time the read completed.
+//
+
+#ifndef __Transport_h__
+#define __Transport_h__
+
+#include "MIDITypes.h"
+
+// what became of a transfer
+enum TransferResult {
+	kTransferSuccess = 0,
+	kTransferAborted,		// the pipe was aborted
+	kTransferStalled,		// the device halted the endpoint
+	kTransferFailed,		// the transfer failed, the pipe may well succeed again
+	kTransferNoDevice		// the device has gone
+};
+
+// the USB endpoint transfer types
+enum {
+	kPipeControl = 0,
+	kPipeIsochronous,
+	kPipeBulk,
+	kPipeInterrupt
+};
+
+struct PipeInfo {
+	UInt8				endpoint;		// the endpoint address, 0x80 set for IN
+	UInt8				transferType;
+	UInt16				maxPacketSize;
+};
+
+// The recovery of a pipe from a failed transfer, see MidisportEngine::TransferFailed. No transfer
+// is started on the pipe while it recovers, the output waiting for it stays queued.
+struct PipeRecovery {
+	PipeRecovery() : recovering(false), stopped(false), restartTime(0), failures(0) { }
+
+	bool				recovering;
+	bool				stopped;			// the device has gone, the pipe is never restarted
+	MIDITimeStamp		restartTime;		// when to restart the pipe, 0 until its transfers have returned
+	int					failures;			// in a row, the backoff before a restart doubles with each
+};
+
+typedef void (*TransferCallback)(void *refcon, TransferResult result, ByteCount bytesTransferred, MIDITimeStamp completed);
+
+// The device's control pipe, all the EZ-USB firmware download needs.
+class ControlTransport {
+public:
+	virtual ~ControlTransport() { }
+
+	virtual TransferResult	VendorRequest(UInt8 request, UInt16 value, UInt16 index, const void *data, UInt16 length) = 0;
+								// send a vendor request with its data to the device, returns once
+								// the device has taken it
+};
+
+// The pipes of the interface, numbered from 1 as IOKit numbers them.
+class Transport : public ControlTransport {
+public:
+	virtual int				NumPipes() = 0;
+	virtual bool			GetPipe(int pipe, PipeInfo &info) = 0;
+
+	virtual TransferResult	Read(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon) = 0;
+	virtual TransferResult	Write(int pipe, const Byte *buffer, ByteCount length, TransferCallback callback, void *refcon) = 0;
+								// queue a transfer, returning kTransferSuccess if its callback will come
+
+	virtual void			Abort(int pipe) = 0;
+								// the transfers queued on the pipe return with kTransferAborted
+	virtual TransferResult	ClearStall(int pipe) = 0;
+								// clear the halt of the pipe's endpoint, in the device as well as the host
+};
+
+#endif // __Transport_h__
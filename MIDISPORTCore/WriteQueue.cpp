@@ -0,0 +1,126 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The MIDI waiting to be written to an interface, in a preallocated byte ring.
+//
+
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include "WriteQueue.h"
+
+// Records are kept 4 byte aligned, so the space left at the end of the ring, when a record will
+// not fit there, is always large enough to mark as skipped.
+#define kRecordAlignment	4
+
+enum {
+	kSkipToStart = 1		// flags of a record marking the rest of the ring as unused
+};
+
+static inline UInt32	RecordSize(ByteCount length)
+{
+	return (UInt32)((offsetof(WriteQueueElem, data) + length + kRecordAlignment - 1) & ~(kRecordAlignment - 1));
+}
+
+WriteQueue::WriteQueue() :
+	mBuffer(NULL),
+	mCapacity(0),
+	mHead(0),
+	mTail(0),
+	mBack(0),
+	mOverflows(0)
+{
+}
+
+WriteQueue::~WriteQueue()
+{
+	delete[] mBuffer;
+}
+
+void	WriteQueue::Allocate(ByteCount capacity)
+{
+	// a power of two, so the free running head and tail wrap with the ring
+	mCapacity = kRecordAlignment;
+	while (mCapacity < capacity)
+		mCapacity <<= 1;
+	delete[] mBuffer;
+	mBuffer = new Byte[mCapacity];
+	mHead = mTail = 0;
+	mBack = 0;
+}
+
+ByteCount	WriteQueue::MaxRecordLength() const
+{
+	// records of up to a quarter of the ring keep it from being exhausted by one packet
+	return std::min(mCapacity / 4 - offsetof(WriteQueueElem, data), (ByteCount)UINT16_MAX);
+}
+
+bool	WriteQueue::Push(UInt8 portNum, const Byte *data, ByteCount length)
+{
+	UInt32 head = mHead.load(std::memory_order_relaxed);
+	UInt32 tail = mTail.load(std::memory_order_acquire);
+	UInt32 recordSize = RecordSize(length);
+	UInt32 toEnd = mCapacity - (head & (mCapacity - 1));
+	UInt32 skip = (toEnd < recordSize) ? toEnd : 0;
+
+	if (length > MaxRecordLength() || (head - tail) + skip + recordSize > mCapacity) {
+		++mOverflows;
+		return false;
+	}
+	if (skip != 0) {
+		At(head)->flags = kSkipToStart;
+		head += skip;
+	}
+	WriteQueueElem *wqe = At(head);
+	wqe->flags = 0;
+	wqe->portNum = portNum;
+	wqe->length = (UInt16)length;
+	wqe->bytesSent = 0;
+	memcpy(wqe->data, data, length);
+	mBack = head;
+	// publish the record to the consumer
+	mHead.store(head + recordSize, std::memory_order_release);
+	return true;
+}
+
+WriteQueueElem *	WriteQueue::Unsent(UInt32 position)
+{
+	UInt32 tail = mTail.load(std::memory_order_acquire);
+	UInt32 head = mHead.load(std::memory_order_relaxed);
+
+	// positions run free, the record is still queued if it lies between the tail and the head
+	if ((SInt32)(position - tail) < 0 || (SInt32)(head - position) <= 0)
+		return NULL;
+	WriteQueueElem *wqe = At(position);
+	return wqe->bytesSent == 0 ? wqe : NULL;
+}
+
+WriteQueueElem *	WriteQueue::Front()
+{
+	UInt32 tail = mTail.load(std::memory_order_relaxed);
+	UInt32 head = mHead.load(std::memory_order_acquire);
+
+	if (tail == head)
+		return NULL;
+	if (At(tail)->flags & kSkipToStart) {
+		tail += mCapacity - (tail & (mCapacity - 1));
+		mTail.store(tail, std::memory_order_release);
+		if (tail == head)
+			return NULL;
+	}
+	return At(tail);
+}
+
+void	WriteQueue::PopFront()
+{
+	WriteQueueElem *wqe = Front();
+
+	if (wqe != NULL)
+		mTail.store(mTail.load(std::memory_order_relaxed) + RecordSize(wqe->length), std::memory_order_release);
+}
+
+void	WriteQueue::Clear()
+{
+	// the records are released at once by moving the tail to the head, however many there are
+	mTail.store(mHead.load(std::memory_order_acquire), std::memory_order_release);
+}
@@ -0,0 +1,72 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The MIDI waiting to be written to an interface. HandleSent copies each packet into a byte ring
+// allocated when the interface starts, and the output encoders read it from there, so queueing
+// and writing output never allocates memory. One thread can push while another pops.
+//
+
+#ifndef __WriteQueue_h__
+#define __WriteQueue_h__
+
+#include <atomic>
+#include "MIDITypes.h"
+
+// A record of the queue, its data follows it contiguously in the ring.
+struct WriteQueueElem {
+	UInt8				flags;		// private to WriteQueue
+	UInt8				portNum;
+	UInt16				length;		// bytes of data
+	UInt16				bytesSent;	// this much of the data has been sent
+	Byte				data[2];	// actually length bytes
+};
+
+class WriteQueue {
+public:
+	WriteQueue();
+	~WriteQueue();
+
+	void				Allocate(ByteCount capacity);
+							// capacity is rounded up to a power of two
+
+	bool				Push(UInt8 portNum, const Byte *data, ByteCount length);
+							// copy data onto the end of the queue as one record, returns false,
+							// queueing nothing, if it does not fit in the space remaining.
+	UInt32				BackPosition() const	{ return mBack; }
+							// where the record last pushed is, for Unsent
+
+	WriteQueueElem *	Unsent(UInt32 position);
+							// the record pushed at position, NULL if it has been popped or any of
+							// its data sent. It can be rewritten in place, with the popping thread
+							// excluded meanwhile.
+
+	WriteQueueElem *	Front();
+							// the oldest record, NULL if the queue is empty
+
+	void				PopFront();
+							// release the oldest record, once all its data is sent
+	void				Clear();
+							// release every record, whether sent or not, by the popping thread
+
+	bool				IsEmpty()				{ return Front() == NULL; }
+	ByteCount			Capacity() const		{ return mCapacity; }
+	ByteCount			MaxRecordLength() const;
+							// the most data one record can hold, longer data must be divided
+	UInt64				Overflows() const		{ return mOverflows; }
+							// the number of pushes refused for want of space
+
+private:
+	WriteQueueElem *	At(UInt32 position) const
+	{
+		return (WriteQueueElem *)(mBuffer + (position & (mCapacity - 1)));
+	}
+
+	Byte *				mBuffer;
+	ByteCount			mCapacity;
+	std::atomic<UInt32>	mHead;		// bytes ever pushed, only written by Push
+	std::atomic<UInt32>	mTail;		// bytes ever popped, only written by Front and PopFront
+	UInt32				mBack;		// position of the record last pushed
+	UInt64				mOverflows;
+};
+
+#endif // __WriteQueue_h__
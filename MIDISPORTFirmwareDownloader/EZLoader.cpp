@@ -95,96 +95,40 @@ EZUSBLoader::EZUSBLoader(UInt16 newUSBVendor, DeviceList newDeviceList, bool lea
 //}
 
 //
-// Uses the ANCHOR LOAD vendor specific command to either set or release the
-// 8051 reset bit in the EZ-USB chip.
-//
-// Arguments:
-//   device - pointer to the device object for this instance of an Ezusb Device
-//   resetBit - 1 sets the 8051 reset bit (holds the 8051 in reset)
-//              0 clears the 8051 reset bit (8051 starts running)
-//
-// Returns: kIOReturnSuccess if we reset correctly.
-//
-IOReturn EZUSBLoader::Reset8051(IOUSBDeviceInterface **device, unsigned char resetBit)
-{
-    IOReturn status;
-    IOUSBDevRequest resetRequest;
-    
-#if DEBUG
-    std::cout << "Setting 8051 reset bit to " << int(resetBit) << std::endl;
-#endif
-    resetRequest.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBVendor, kUSBDevice);
-    resetRequest.bRequest = ANCHOR_LOAD_INTERNAL;
-    resetRequest.wValue = CPUCS_REG;
-    resetRequest.wIndex = 0;
-    resetRequest.wLength = 1;
-    resetRequest.pData = (void *) &resetBit;
-    status = (*device)->DeviceRequest(device, &resetRequest);
-    return status;
-}
-
-IOReturn EZUSBLoader::DownloadFirmwareToRAM(IOUSBDeviceInterface **device,
-                                            std::vector<INTEL_HEX_RECORD> firmware,
-                                            bool internalRAM)
-{
-    IOReturn status = kIOReturnSuccess;
-    UInt8 bmreqType = USBmakebmRequestType(kUSBOut, kUSBVendor, kUSBDevice);
-
-    for(std::vector<INTEL_HEX_RECORD>::iterator hexRecord = firmware.begin(); hexRecord != firmware.end() && hexRecord->Type == 0; ++hexRecord) {
-        if ((internalRAM && INTERNAL_RAM_ADDRESS(hexRecord->Address)) || (!internalRAM && !INTERNAL_RAM_ADDRESS(hexRecord->Address))) {
-            IOUSBDevRequest loadRequest;
-            
-#if DEBUG
-            std::string RAMname = internalRAM ? "internal" : "external";
-            std::cout << "Downloading " << std::dec << int(hexRecord->Length) <<
-                         " bytes to " << RAMname << " 0x" << std::hex << hexRecord->Address << std::endl;
-#endif
-            loadRequest.bmRequestType = bmreqType;
-            loadRequest.bRequest = internalRAM ? ANCHOR_LOAD_INTERNAL : ANCHOR_LOAD_EXTERNAL;
-            loadRequest.wValue = hexRecord->Address;
-            loadRequest.wIndex = 0;
-            loadRequest.wLength = hexRecord->Length;
-            loadRequest.pData = (void *) hexRecord->Data;
-            status = (*device)->DeviceRequest(device, &loadRequest);
-            if (status != kIOReturnSuccess)
-                return status;
+// The control pipe of the EZUSB device, carrying EZUSBFirmware's vendor requests as IOKit device requests.
+//
+class DeviceRequestTransport : public ControlTransport {
+public:
+    DeviceRequestTransport(IOUSBDeviceInterface **ezUSBDevice) : device(ezUSBDevice) { }
+
+    virtual TransferResult VendorRequest(UInt8 request, UInt16 value, UInt16 index, const void *data, UInt16 length)
+    {
+        IOUSBDevRequest vendorRequest;
+        IOReturn status;
+
+        vendorRequest.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBVendor, kUSBDevice);
+        vendorRequest.bRequest = request;
+        vendorRequest.wValue = value;
+        vendorRequest.wIndex = index;
+        vendorRequest.wLength = length;
+        vendorRequest.pData = (void *) data;
+        status = (*device)->DeviceRequest(device, &vendorRequest);
+        switch (status) {
+        case kIOReturnSuccess:
+            return kTransferSuccess;
+        case kIOUSBPipeStalled:
+            return kTransferStalled;
+        case kIOReturnNoDevice:
+        case kIOReturnNotAttached:
+            return kTransferNoDevice;
+        default:
+            return kTransferFailed;
         }
     }
-    return status;
-}
-//
-//	This function downloads Intel Hex Records to the EZ-USB device.
-//	If any of the hex records are destined for external RAM, then
-//	the caller must have previously downloaded firmware to the device
-//	that knows how to download to external RAM (ie. firmware that
-//	implements the ANCHOR_LOAD_EXTERNAL vendor specific command).
-//
-//  Arguments:
-//	device   - Pointer to the IOUSBDeviceInterface instance of an Ezusb Device
-//  firmware - Vector of INTEL_HEX_RECORD structures.
-//             This array is terminated by an Intel Hex End record (Type = 1).
-//  Returns: true if successful, false otherwise
-//
-bool EZUSBLoader::DownloadFirmware(IOUSBDeviceInterface **device, std::vector<INTEL_HEX_RECORD> firmware)
-{
-    IOReturn status;
-
-    // The download must be performed in two passes.  The first pass loads all of the
-    // external addresses, and the 2nd pass loads to all of the internal addresses.
-    // why? Because downloading to the internal addresses will probably wipe out the firmware
-    // running on the device that knows how to receive external RAM downloads.
-    //
-    // First download all the records that go in external RAM
-    status = EZUSBLoader::DownloadFirmwareToRAM(device, firmware, false);
-    if (status != kIOReturnSuccess)
-        return false;
 
-    // Now download all of the records that are in internal RAM.
-    // Before starting the download, stop the 8051.
-    Reset8051(device, 1);
-    status = EZUSBLoader::DownloadFirmwareToRAM(device, firmware, true);
-    return status == kIOReturnSuccess;
-}
+private:
+    IOUSBDeviceInterface **device;
+};
 
 //
 // Initializes a given instance of the EZUSB Device on the USB
@@ -196,34 +140,10 @@ bool EZUSBLoader::StartDevice(std::vector<INTEL_HEX_RECORD> applicationFirmware)
     std::cout << "enter EZUSBLoader::StartDevice" << std::endl;
 #endif
 
-    //-----	First download loader firmware.  The loader firmware 
-    //		implements a vendor-specific command that will allow us 
-    //		to anchor load to external RAM.
-    //
-#if DEBUG
-    std::cout << "Downloading bootstrap loader." << std::endl;
-#endif
-    if (Reset8051(ezUSBDevice, 1) != kIOReturnSuccess)
-        return false;
+    DeviceRequestTransport controlPipe(ezUSBDevice);
+    EZUSBFirmware firmware(controlPipe);
 
-    if (!DownloadFirmware(ezUSBDevice, loader)) {
-        std::cout << "Failed to download bootstrap loader." << std::endl;
-        return false;
-    }
-    if (Reset8051(ezUSBDevice, 0) != kIOReturnSuccess)
-        return false;
-    
-    //-----	Now download the device firmware.  //
-#if DEBUG
-    std::cout << "Downloading application firmware." << std::endl;
-#endif
-    if (!DownloadFirmware(ezUSBDevice, applicationFirmware)) {
-        std::cout << "Failed to download application firmware." << std::endl;
-        return false;
-    }
-    if (Reset8051(ezUSBDevice, 1) != kIOReturnSuccess)
-        return false;
-    if (Reset8051(ezUSBDevice, 0) != kIOReturnSuccess)
+    if (!firmware.StartDevice(loader, applicationFirmware))
         return false;
 #if DEBUG
     std::cout << "Exit EZUSBLoader::StartDevice." << std::endl;
@@ -11,37 +11,10 @@
 #include "USBUtils.h"
 #include "HardwareConfiguration.h"
 #include "IntelHexFile.h"
-
-//
-// Vendor specific request code for Anchor Upload/Download
-//
-// This one is implemented in the core
-//
-#define ANCHOR_LOAD_INTERNAL  0xA0
-
-//
-// This command is not implemented in the core.  Requires firmware
-//
-#define ANCHOR_LOAD_EXTERNAL  0xA3
-
-//
-// This is the highest internal RAM address for the AN2131Q
-//
-#define MAX_INTERNAL_ADDRESS  0x1B3F
-
-#define INTERNAL_RAM_ADDRESS(address) ((address <= MAX_INTERNAL_ADDRESS) ? 1 : 0)
-
-//
-// EZ-USB Control and Status Register.  Bit 0 controls 8051 reset
-//
-#define CPUCS_REG    0x7F92
+#include "EZUSBFirmware.h"
 
 class EZUSBLoader : public USBDeviceManager {
 protected:
-    IOReturn Reset8051(IOUSBDeviceInterface **device, unsigned char resetBit);
-    IOReturn DownloadFirmwareToRAM(IOUSBDeviceInterface **device, std::vector<INTEL_HEX_RECORD> firmware, bool internalRAM);
-    bool DownloadFirmware(IOUSBDeviceInterface **device, std::vector<INTEL_HEX_RECORD> hexRecord);
-
     // instance variables
     IOUSBDeviceInterface **ezUSBDevice;
     // These hex records that contain the application loader.
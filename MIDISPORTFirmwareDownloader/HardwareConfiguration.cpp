@@ -3,6 +3,7 @@
 //
 
 #include "HardwareConfiguration.h"
+#include "DeviceDefaults.h"               // the values of the keys a device's entry leaves out.
 #define MAX_PATH_LEN 256
 
 HardwareConfiguration::HardwareConfiguration(const char *configFilePath)
@@ -151,6 +152,187 @@ bool HardwareConfiguration::deviceListFromDictionary(CFDictionaryRef deviceConfi
             return false;
         }
     }
+    // The limit the device puts on the packets for each port in an OUT transfer.
+    deviceFirmware.outputPacketsPerPort = DEFAULT_OUTPUT_PACKETS_PER_PORT;
+    CFTypeRef outputPacketsPerPort;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("OutputPacketsPerPort"), &outputPacketsPerPort)) {
+        if (CFGetTypeID(outputPacketsPerPort) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) outputPacketsPerPort, kCFNumberIntType, &deviceFirmware.outputPacketsPerPort)) {
+                return false;
+            }
+        }
+    }
+    // The bytes the device can buffer for each output port, output is paced to the MIDI cables if given.
+    deviceFirmware.outputBufferSize = DEFAULT_OUTPUT_BUFFER_SIZE;
+    CFTypeRef outputBufferSize;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("OutputBufferSize"), &outputBufferSize)) {
+        if (CFGetTypeID(outputBufferSize) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) outputBufferSize, kCFNumberIntType, &deviceFirmware.outputBufferSize)) {
+                return false;
+            }
+            if (deviceFirmware.outputBufferSize < 0) {
+                return false;
+            }
+            // A buffer must hold at least an mspacket's bytes for the device to be sent any.
+            if (deviceFirmware.outputBufferSize != 0 && deviceFirmware.outputBufferSize < MIN_OUTPUT_BUFFER_SIZE) {
+                deviceFirmware.outputBufferSize = MIN_OUTPUT_BUFFER_SIZE;
+            }
+        }
+    }
+    // How many OUT transfers each output endpoint can have queued, so it is never idle between them.
+    deviceFirmware.writesInFlight = DEFAULT_WRITES_IN_FLIGHT;
+    CFTypeRef writesInFlight;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("WritesInFlight"), &writesInFlight)) {
+        if (CFGetTypeID(writesInFlight) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) writesInFlight, kCFNumberIntType, &deviceFirmware.writesInFlight)) {
+                return false;
+            }
+        }
+    }
+    // How many IN transfers the input endpoint can have queued, so it has one while the input of another is parsed.
+    deviceFirmware.readsInFlight = DEFAULT_READS_IN_FLIGHT;
+    CFTypeRef readsInFlight;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("ReadsInFlight"), &readsInFlight)) {
+        if (CFGetTypeID(readsInFlight) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) readsInFlight, kCFNumberIntType, &deviceFirmware.readsInFlight)) {
+                return false;
+            }
+        }
+    }
+    // Whether controllers, pitch bend and channel pressure still waiting to be written are overwritten by later values.
+    deviceFirmware.coalesceOutput = DEFAULT_COALESCE_OUTPUT;
+    CFTypeRef coalesceOutput;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("CoalesceOutput"), &coalesceOutput)) {
+        if (CFGetTypeID(coalesceOutput) == CFBooleanGetTypeID()) {
+            deviceFirmware.coalesceOutput = CFBooleanGetValue((CFBooleanRef) coalesceOutput);
+        }
+    }
+    // Whether a flushed output port is sent All Notes Off on every channel, silencing notes whose note-offs were dropped.
+    deviceFirmware.allNotesOffOnFlush = DEFAULT_ALL_NOTES_OFF_ON_FLUSH;
+    CFTypeRef allNotesOffOnFlush;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("AllNotesOffOnFlush"), &allNotesOffOnFlush)) {
+        if (CFGetTypeID(allNotesOffOnFlush) == CFBooleanGetTypeID()) {
+            deviceFirmware.allNotesOffOnFlush = CFBooleanGetValue((CFBooleanRef) allNotesOffOnFlush);
+        }
+    }
+    // Whether a flushed output port is sent All Sound Off on every channel, cutting off release tails too.
+    deviceFirmware.allSoundOffOnFlush = DEFAULT_ALL_SOUND_OFF_ON_FLUSH;
+    CFTypeRef allSoundOffOnFlush;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("AllSoundOffOnFlush"), &allSoundOffOnFlush)) {
+        if (CFGetTypeID(allSoundOffOnFlush) == CFBooleanGetTypeID()) {
+            deviceFirmware.allSoundOffOnFlush = CFBooleanGetValue((CFBooleanRef) allSoundOffOnFlush);
+        }
+    }
+    // The size of the packets incoming sysex messages are gathered into.
+    deviceFirmware.sysexChunkSize = DEFAULT_SYSEX_CHUNK_SIZE;
+    CFTypeRef sysexChunkSize;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("SysexChunkSize"), &sysexChunkSize)) {
+        if (CFGetTypeID(sysexChunkSize) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) sysexChunkSize, kCFNumberIntType, &deviceFirmware.sysexChunkSize)) {
+                return false;
+            }
+        }
+    }
+    // How long an incomplete sysex message can be held back, 0 delivers its bytes at the end of each USB read.
+    deviceFirmware.sysexTimeout = DEFAULT_SYSEX_TIMEOUT;
+    CFTypeRef sysexTimeout;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("SysexTimeout"), &sysexTimeout)) {
+        if (CFGetTypeID(sysexTimeout) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) sysexTimeout, kCFNumberIntType, &deviceFirmware.sysexTimeout)) {
+                return false;
+            }
+        }
+    }
+    // Whether input messages are stamped with their estimated arrival on the MIDI cable.
+    deviceFirmware.timestampInputBytes = DEFAULT_TIMESTAMP_INPUT_BYTES;
+    CFTypeRef timestampInputBytes;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("TimestampInputBytes"), &timestampInputBytes)) {
+        if (CFGetTypeID(timestampInputBytes) == CFBooleanGetTypeID()) {
+            deviceFirmware.timestampInputBytes = CFBooleanGetValue((CFBooleanRef) timestampInputBytes);
+        }
+    }
+    // Whether output uses running status, to send dense channel messages in fewer bytes on the MIDI cable.
+    deviceFirmware.runningStatus = DEFAULT_RUNNING_STATUS;
+    CFTypeRef runningStatus;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("RunningStatus"), &runningStatus)) {
+        if (CFGetTypeID(runningStatus) == CFBooleanGetTypeID()) {
+            deviceFirmware.runningStatus = CFBooleanGetValue((CFBooleanRef) runningStatus);
+        }
+    }
+    // Whether note-offs are sent as note-ons of velocity 0, so notes starting and ending share running status.
+    deviceFirmware.noteOffAsNoteOn = DEFAULT_NOTE_OFF_AS_NOTE_ON;
+    CFTypeRef noteOffAsNoteOn;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("NoteOffAsNoteOn"), &noteOffAsNoteOn)) {
+        if (CFGetTypeID(noteOffAsNoteOn) == CFBooleanGetTypeID()) {
+            deviceFirmware.noteOffAsNoteOn = CFBooleanGetValue((CFBooleanRef) noteOffAsNoteOn);
+        }
+    }
+    // Whether the output of each port is packed into mspackets as a byte stream, rather than a message per mspacket.
+    deviceFirmware.packOutputBytes = DEFAULT_PACK_OUTPUT_BYTES;
+    CFTypeRef packOutputBytes;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("PackOutputBytes"), &packOutputBytes)) {
+        if (CFGetTypeID(packOutputBytes) == CFBooleanGetTypeID()) {
+            deviceFirmware.packOutputBytes = CFBooleanGetValue((CFBooleanRef) packOutputBytes);
+        }
+    }
+    // Whether the interface runs on an I/O thread of its own, so a busy device never delays the transfers of another.
+    deviceFirmware.ownIOThread = DEFAULT_OWN_IO_THREAD;
+    CFTypeRef ownIOThread;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("OwnIOThread"), &ownIOThread)) {
+        if (CFGetTypeID(ownIOThread) == CFBooleanGetTypeID()) {
+            deviceFirmware.ownIOThread = CFBooleanGetValue((CFBooleanRef) ownIOThread);
+        }
+    }
+    // The period of the I/O thread's time constraint, 0 schedules it by IOThreadPriority instead.
+    deviceFirmware.ioThreadPeriod = DEFAULT_IO_THREAD_PERIOD;
+    CFTypeRef ioThreadPeriod;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("IOThreadPeriod"), &ioThreadPeriod)) {
+        if (CFGetTypeID(ioThreadPeriod) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) ioThreadPeriod, kCFNumberIntType, &deviceFirmware.ioThreadPeriod)) {
+                return false;
+            }
+        }
+    }
+    // The processing the I/O thread is given in each period.
+    deviceFirmware.ioThreadComputation = DEFAULT_IO_THREAD_COMPUTATION;
+    CFTypeRef ioThreadComputation;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("IOThreadComputation"), &ioThreadComputation)) {
+        if (CFGetTypeID(ioThreadComputation) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) ioThreadComputation, kCFNumberIntType, &deviceFirmware.ioThreadComputation)) {
+                return false;
+            }
+        }
+    }
+    // How soon after the start of a period the I/O thread's processing must be done.
+    deviceFirmware.ioThreadConstraint = DEFAULT_IO_THREAD_CONSTRAINT;
+    CFTypeRef ioThreadConstraint;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("IOThreadConstraint"), &ioThreadConstraint)) {
+        if (CFGetTypeID(ioThreadConstraint) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) ioThreadConstraint, kCFNumberIntType, &deviceFirmware.ioThreadConstraint)) {
+                return false;
+            }
+        }
+    }
+    // The SCHED_FIFO priority of an I/O thread without a time constraint, 0 leaves it at the default.
+    deviceFirmware.ioThreadPriority = DEFAULT_IO_THREAD_PRIORITY;
+    CFTypeRef ioThreadPriority;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("IOThreadPriority"), &ioThreadPriority)) {
+        if (CFGetTypeID(ioThreadPriority) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) ioThreadPriority, kCFNumberIntType, &deviceFirmware.ioThreadPriority)) {
+                return false;
+            }
+        }
+    }
+    // The CPU the I/O thread is kept to where the system allows, -1 lets it run on any.
+    deviceFirmware.ioThreadCPU = DEFAULT_IO_THREAD_CPU;
+    CFTypeRef ioThreadCPU;
+    if (CFDictionaryGetValueIfPresent((CFDictionaryRef) deviceConfig, CFSTR("IOThreadCPU"), &ioThreadCPU)) {
+        if (CFGetTypeID(ioThreadCPU) == CFNumberGetTypeID()) {
+            if (!CFNumberGetValue((CFNumberRef) ioThreadCPU, kCFNumberIntType, &deviceFirmware.ioThreadCPU)) {
+                return false;
+            }
+        }
+    }
     return true;
 }
 
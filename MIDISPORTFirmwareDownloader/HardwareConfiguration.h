@@ -22,6 +22,25 @@ struct DeviceFirmware {
     int numberOfOutputPorts;                // The number of output MIDI ports.
     int readBufSize;                        // The number of bytes in the device read buffer.
     int writeBufSize;                       // The number of bytes in the device write buffer.
+    int outputPacketsPerPort;               // The most mspackets for one port in an OUT transfer, 0 for no limit.
+    int outputBufferSize;                   // The bytes the device buffers for each output port, 0 to not pace output to the MIDI cables.
+    int writesInFlight;                     // The OUT transfers which can be queued on each output endpoint at once.
+    int readsInFlight;                      // The IN transfers which can be queued on the input endpoint at once.
+    bool coalesceOutput;                    // Overwrite output controllers, pitch bend and channel pressure not yet written with the values superseding them.
+    bool allNotesOffOnFlush;                // Send All Notes Off on every channel of an output port when its queued output is flushed.
+    bool allSoundOffOnFlush;                // Send All Sound Off on every channel of an output port when its queued output is flushed.
+    int sysexChunkSize;                     // The most bytes of an incoming sysex message gathered into one packet.
+    int sysexTimeout;                       // Milliseconds an incomplete sysex message is held before its bytes are delivered.
+    bool timestampInputBytes;               // Estimate when each message arrived from its position in the USB read, rather than stamping all with the read's completion.
+    bool runningStatus;                     // Omit the status byte of an output channel message repeating the last status sent to its port.
+    bool noteOffAsNoteOn;                   // Send note-offs with the default release velocity as note-ons of velocity 0, lengthening running status.
+    bool packOutputBytes;                   // Fill every output mspacket with three bytes of the port's output, regardless of message boundaries.
+    bool ownIOThread;                       // Run the interface's transfers on an I/O thread of its own, rather than the I/O run loop shared by every interface.
+    int ioThreadPeriod;                     // Microseconds between the I/O thread's wakeups in its time constraint, 0 for no time constraint.
+    int ioThreadComputation;                // Microseconds of processing the I/O thread needs in each period.
+    int ioThreadConstraint;                 // Microseconds from the start of a period within which that processing must be done.
+    int ioThreadPriority;                   // Without a time constraint, the SCHED_FIFO priority of the I/O thread, 0 for the default priority.
+    int ioThreadCPU;                        // The CPU the I/O thread is kept to, where the system allows, -1 for any.
     std::string firmwareFileName;           // Path to the Intel hex file of the firmware. NULL indicates no firmware needs to be downloaded.
 };
 
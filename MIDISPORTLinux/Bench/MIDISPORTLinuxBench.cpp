@@ -0,0 +1,163 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Benchmarks of the Linux backend, MidisportHost run over MockLibUSB, so what is timed is the
+// host's event thread, its handoffs and the engine, without a device. Each prints a line of its
+// rate or latency. The benchmarks named on the command line are run, all of them if none is.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <algorithm>
+#include <chrono>
+#include "MockHostSupport.h"
+
+typedef void (*BenchFunction)(libusb_context *ctx);
+
+static double	SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the p'th quantile of the samples, in microseconds
+static double	Quantile(std::vector<double> samples, double p)
+{
+	if (samples.empty())
+		return 0;
+	std::sort(samples.begin(), samples.end());
+	return samples[(size_t)(p * (samples.size() - 1))] * 1e6;
+}
+
+// reads full of note-ons replayed as fast as the host takes them, decoded and delivered
+static void	BenchInput(libusb_context *ctx)
+{
+	const int kReads = 100000;
+	RecordingHost host(ctx);
+	libusb_device *dev = PlugMidisport2x2(ctx);
+	MockUSBRecording recording;
+	std::vector<Byte> read;
+
+	for (int i = 0; i < 8; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)(0x3C + i), 0x40 };
+		std::vector<Byte> mspacket = Mspackets(i & 1, std::vector<Byte>(noteOn, noteOn + 3));
+
+		read.insert(read.end(), mspacket.begin(), mspacket.end());
+	}
+	for (int i = 0; i < kReads; ++i)
+		recording.AddTransfer(0, 0x81, read.data(), read.size());
+	if (!host.Start() || !WaitFor([&] { return host.added == 1; }))
+		return;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	MockUSBReplay(dev, recording, 0);
+	WaitFor([&] { return host.messages == (UInt64)kReads * 8; }, 60000);
+	double seconds = SecondsSince(start);
+	printf("input: %llu messages of %d reads in %.1f ms, %.2fM messages/s\n", (unsigned long long)host.messages.load(),
+		   kReads, seconds * 1e3, host.messages / seconds / 1e6);
+	MockUSBUnplug(dev);
+}
+
+// messages to both ports sent from this thread, written as fast as the host writes them
+static void	BenchOutput(libusb_context *ctx)
+{
+	const int kMessages = 200000;
+	RecordingHost host(ctx);
+	libusb_device *dev = PlugMidisport2x2(ctx);
+	std::vector<Byte> written;
+	size_t mspackets = 0;
+	int full = 0;
+
+	if (!host.Start() || !WaitFor([&] { return host.added == 1; }))
+		return;
+
+	// the mspackets carrying MIDI, not those ending the transfers
+	auto take = [&] {
+		for (UInt8 endpoint = 0x02; endpoint <= 0x04; endpoint += 2) {
+			written.clear();
+			MockUSBTakeWritten(dev, endpoint, written);
+			for (size_t i = 3; i < written.size(); i += 4)
+				if ((written[i] & 0x03) != 0)
+					++mspackets;
+		}
+	};
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < kMessages; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)(i & 0x7F), 0x40 };
+
+		// the send queue full, the event thread is left to catch up
+		while (!host.Send(0, i & 1, 0, noteOn, sizeof(noteOn))) {
+			++full;
+			take();
+			sched_yield();
+		}
+	}
+	// until every message is written, or those the write queues dropped are all that is left
+	std::chrono::steady_clock::time_point lastWritten = std::chrono::steady_clock::now();
+	size_t previous = mspackets;
+	WaitFor([&] {
+		take();
+		if (mspackets != previous) {
+			previous = mspackets;
+			lastWritten = std::chrono::steady_clock::now();
+		}
+		return mspackets >= (size_t)kMessages || SecondsSince(lastWritten) > 0.1;
+	}, 60000);
+	double seconds = std::chrono::duration<double>(lastWritten - start).count();
+	printf("output: %zu of %d messages written in %.1f ms, send queue full %d times, %.2fM messages/s\n",
+		   mspackets, kMessages, seconds * 1e3, full, mspackets / seconds / 1e6);
+	MockUSBUnplug(dev);
+}
+
+// a message sent while the host is idle, until the device has it
+static void	BenchOutputLatency(libusb_context *ctx)
+{
+	const int kMessages = 2000;
+	const Byte noteOn[3] = { 0x90, 0x3C, 0x40 };
+	RecordingHost host(ctx);
+	libusb_device *dev = PlugMidisport2x2(ctx);
+	std::vector<double> latencies;
+	std::vector<Byte> written;
+
+	if (!host.Start() || !WaitFor([&] { return host.added == 1; }))
+		return;
+	for (int i = 0; i < kMessages; ++i) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		host.Send(0, 0, 0, noteOn, sizeof(noteOn));
+		if (!WaitFor([&] { return MockUSBTakeWritten(dev, 0x02, written) != 0; }))
+			break;
+		latencies.push_back(SecondsSince(start));
+	}
+	printf("output latency: %zu messages, Send to written in %.1f us median, %.1f us p99, %.1f us max\n",
+		   latencies.size(), Quantile(latencies, 0.5), Quantile(latencies, 0.99), Quantile(latencies, 1));
+	MockUSBUnplug(dev);
+}
+
+static const struct {
+	const char *	name;
+	BenchFunction	function;
+} sBenchmarks[] = {
+	{ "input", BenchInput },
+	{ "output", BenchOutput },
+	{ "latency", BenchOutputLatency },
+};
+
+int		main(int argc, char **argv)
+{
+	libusb_context *ctx;
+
+	if (libusb_init(&ctx) != 0)
+		return 1;
+	for (size_t i = 0; i < sizeof(sBenchmarks) / sizeof(sBenchmarks[0]); ++i) {
+		bool selected = argc < 2;
+
+		for (int arg = 1; arg < argc; ++arg)
+			if (strcmp(argv[arg], sBenchmarks[i].name) == 0)
+				selected = true;
+		if (selected)
+			sBenchmarks[i].function(ctx);
+	}
+	libusb_exit(ctx);
+	return 0;
+}
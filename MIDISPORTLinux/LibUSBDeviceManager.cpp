@@ -0,0 +1,115 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Locating USB devices through libusb.
+//
+
+#include "CoreDebug.h"
+#include "LibUSBDeviceManager.h"
+
+LibUSBDeviceManager::LibUSBDeviceManager(libusb_context *context, bool plugAndPlay) :
+	mContext(context),
+	mHotplugRegistered(false),
+	mHotplugHandle(0)
+{
+	if (plugAndPlay && libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		int err = libusb_hotplug_register_callback(mContext,
+				(libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+				(libusb_hotplug_flag)LIBUSB_HOTPLUG_NO_FLAGS, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+				LIBUSB_HOTPLUG_MATCH_ANY, HotplugCallback, this, &mHotplugHandle);
+
+		if (err == LIBUSB_SUCCESS)
+			mHotplugRegistered = true;
+		else
+			DebugPrintf("libusb_hotplug_register_callback failed, %s", libusb_error_name(err));
+	}
+}
+
+LibUSBDeviceManager::~LibUSBDeviceManager()
+{
+	if (mHotplugRegistered)
+		libusb_hotplug_deregister_callback(mContext, mHotplugHandle);
+	while (!mPlugEvents.empty()) {
+		libusb_unref_device(mPlugEvents.front().device);
+		mPlugEvents.pop_front();
+	}
+}
+
+// A device plugged in while the devices are scanned is found by both, the subclass matching it
+// again is to refuse it once it has it.
+void	LibUSBDeviceManager::ScanDevices()
+{
+	libusb_device **devices;
+	ssize_t numDevices = libusb_get_device_list(mContext, &devices);
+
+	if (numDevices < 0) {
+		DebugPrintf("libusb_get_device_list failed, %s", libusb_error_name((int)numDevices));
+		return;
+	}
+	for (ssize_t i = 0; i < numDevices; ++i)
+		DeviceAdded(devices[i]);
+	libusb_free_device_list(devices, 1);
+}
+
+void	LibUSBDeviceManager::DeviceAdded(libusb_device *device)
+{
+	libusb_device_descriptor desc;
+	libusb_device_handle *handle;
+	UInt8 interfaceNumber = 0, altSetting = 0;
+	int err;
+
+	if (libusb_get_device_descriptor(device, &desc) != LIBUSB_SUCCESS)
+		return;
+	if (!MatchDevice(device, desc.idVendor, desc.idProduct))
+		return;
+	err = libusb_open(device, &handle);
+	if (err != LIBUSB_SUCCESS) {
+		DebugPrintf("libusb_open of device 0x%04x:0x%04x failed, %s", desc.idVendor, desc.idProduct, libusb_error_name(err));
+		return;
+	}
+	GetInterfaceToUse(handle, interfaceNumber, altSetting);
+
+	// a kernel driver bound to the interface, snd-usb-audio's for one, gives it up while it is claimed
+	libusb_set_auto_detach_kernel_driver(handle, 1);
+	err = libusb_claim_interface(handle, interfaceNumber);
+	if (err != LIBUSB_SUCCESS) {
+		DebugPrintf("libusb_claim_interface %d failed, %s", interfaceNumber, libusb_error_name(err));
+		libusb_close(handle);
+		return;
+	}
+	if (altSetting != 0 && (err = libusb_set_interface_alt_setting(handle, interfaceNumber, altSetting)) != LIBUSB_SUCCESS) {
+		DebugPrintf("libusb_set_interface_alt_setting %d failed, %s", altSetting, libusb_error_name(err));
+		libusb_release_interface(handle, interfaceNumber);
+		libusb_close(handle);
+		return;
+	}
+	if (!FoundInterface(device, handle, desc.idVendor, desc.idProduct, interfaceNumber, altSetting)) {
+		libusb_release_interface(handle, interfaceNumber);
+		libusb_close(handle);
+	}
+}
+
+void	LibUSBDeviceManager::HandlePlugEvents()
+{
+	while (!mPlugEvents.empty()) {
+		PlugEvent plugEvent = mPlugEvents.front();
+
+		mPlugEvents.pop_front();
+		if (plugEvent.event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+			DeviceAdded(plugEvent.device);
+		else
+			DeviceRemoved(plugEvent.device);
+		libusb_unref_device(plugEvent.device);
+	}
+}
+
+// this is the libusb_hotplug_callback_fn (static method), within libusb's event handling
+int		LibUSBDeviceManager::HotplugCallback(libusb_context * /*context*/, libusb_device *device,
+											 libusb_hotplug_event event, void *userData)
+{
+	LibUSBDeviceManager *self = (LibUSBDeviceManager *)userData;
+	PlugEvent plugEvent = { libusb_ref_device(device), event };
+
+	self->mPlugEvents.push_back(plugEvent);
+	return 0;		// stay registered
+}
@@ -0,0 +1,71 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// USBDeviceManager's part on Linux: locating USB devices through libusb, opening those matched and
+// claiming the interface wanted, and following devices plugged in and unplugged. libusb reports
+// hot-plug from within its event handling, where a device cannot be opened, so the devices come
+// and go in HandlePlugEvents, called on the event thread once the events are handled.
+//
+
+#ifndef __LibUSBDeviceManager_h__
+#define __LibUSBDeviceManager_h__
+
+#include <deque>
+#include <libusb.h>
+#include "MIDITypes.h"
+
+class LibUSBDeviceManager {
+public:
+	LibUSBDeviceManager(libusb_context *context, bool plugAndPlay);
+						// plugAndPlay follows devices plugged in and unplugged, where libusb can
+	virtual ~LibUSBDeviceManager();
+
+	void			ScanDevices();
+						// open the devices matched among those plugged in
+	void			HandlePlugEvents();
+						// open the devices plugged in since, and report those unplugged, on the
+						// thread handling libusb's events, outside of the event handling
+
+protected:
+	virtual bool	MatchDevice(		libusb_device *			device,
+										UInt16					devVendor,
+										UInt16					devProduct ) = 0;
+						// If this returns true, the device is opened and its interfaces are scanned.
+
+	virtual void	GetInterfaceToUse(	libusb_device_handle *	device,
+										UInt8 &					outInterfaceNumber,
+										UInt8 &					outAltSetting ) = 0;
+						// the interface number and alternate setting to claim once the device is opened
+
+	virtual bool	FoundInterface(		libusb_device *			device,
+										libusb_device_handle *	handle,
+										UInt16					devVendor,
+										UInt16					devProduct,
+										UInt8					interfaceNumber,
+										UInt8					altSetting ) = 0;
+						// Called once the interface is claimed. It should return true to keep the
+						// device open and the interface claimed; otherwise, they are released and
+						// closed. If true is returned, it is the subclass's responsibility to later
+						// release the interface and close the device.
+
+	virtual void	DeviceRemoved(libusb_device * /*device*/) { }
+						// called when a device is unplugged, if plug and play is enabled.
+
+	libusb_context *	mContext;
+
+private:
+	struct PlugEvent {
+		libusb_device *			device;		// referenced until the event is handled
+		libusb_hotplug_event	event;
+	};
+
+	void			DeviceAdded(libusb_device *device);
+	static int LIBUSB_CALL	HotplugCallback(libusb_context *context, libusb_device *device,
+											libusb_hotplug_event event, void *userData);
+
+	bool							mHotplugRegistered;
+	libusb_hotplug_callback_handle	mHotplugHandle;
+	std::deque<PlugEvent>			mPlugEvents;		// only used on the event thread
+};
+
+#endif // __LibUSBDeviceManager_h__
@@ -0,0 +1,241 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The Transport of a claimed interface on Linux, over libusb's asynchronous transfers.
+//
+
+#include <algorithm>
+#include "CoreDebug.h"
+#include "Clock.h"
+#include "LibUSBTransport.h"
+
+// how long a vendor request may take, in milliseconds
+#define kControlTimeout		1000
+
+LibUSBTransport::LibUSBTransport(libusb_device_handle *handle, UInt8 interfaceNumber, UInt8 altSetting, const Clock &clock) :
+	mHandle(handle),
+	mInterfaceNumber(interfaceNumber),
+	mAltSetting(altSetting),
+	mClock(clock)
+{
+}
+
+LibUSBTransport::~LibUSBTransport()
+{
+	if (!IsIdle())
+		DebugPrintf("LibUSBTransport deleted with transfers in flight");
+	for (size_t i = 0; i < mPipes.size(); ++i) {
+		Pipe &pipe = mPipes[i];
+
+		for (size_t r = 0; r < pipe.free.size(); ++r) {
+			libusb_free_transfer(pipe.free[r]->transfer);
+			delete pipe.free[r];
+		}
+	}
+}
+
+bool	LibUSBTransport::Open()
+{
+	libusb_config_descriptor *config;
+	int err = libusb_get_active_config_descriptor(libusb_get_device(mHandle), &config);
+
+	if (err != LIBUSB_SUCCESS) {
+		DebugPrintf("libusb_get_active_config_descriptor failed, %s", libusb_error_name(err));
+		return false;
+	}
+	for (int i = 0; i < config->bNumInterfaces; ++i) {
+		const libusb_interface &interface = config->interface[i];
+
+		for (int alt = 0; alt < interface.num_altsetting; ++alt) {
+			const libusb_interface_descriptor &desc = interface.altsetting[alt];
+
+			if (desc.bInterfaceNumber != mInterfaceNumber || desc.bAlternateSetting != mAltSetting)
+				continue;
+			for (int e = 0; e < desc.bNumEndpoints; ++e) {
+				Pipe pipe;
+
+				pipe.info.endpoint = desc.endpoint[e].bEndpointAddress;
+				pipe.info.transferType = desc.endpoint[e].bmAttributes & LIBUSB_TRANSFER_TYPE_MASK;
+				pipe.info.maxPacketSize = desc.endpoint[e].wMaxPacketSize;
+				pipe.clearHalt = false;
+				mPipes.push_back(pipe);
+			}
+		}
+	}
+	libusb_free_config_descriptor(config);
+	return !mPipes.empty();
+}
+
+int		LibUSBTransport::NumPipes()
+{
+	return (int)mPipes.size();
+}
+
+bool	LibUSBTransport::GetPipe(int pipe, PipeInfo &info)
+{
+	Pipe *p = FindPipe(pipe);
+
+	if (p == NULL)
+		return false;
+	info = p->info;
+	return true;
+}
+
+TransferResult	LibUSBTransport::Read(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+{
+	return Submit(pipe, true, buffer, length, callback, refcon);
+}
+
+TransferResult	LibUSBTransport::Write(int pipe, const Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+{
+	return Submit(pipe, false, (Byte *)buffer, length, callback, refcon);
+}
+
+// The transfer is filled with the caller's buffer, which libusb transfers straight from or into.
+TransferResult	LibUSBTransport::Submit(int pipe, bool in, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon)
+{
+	Pipe *p = FindPipe(pipe);
+	Request *request;
+	int err;
+
+	if (p == NULL || in != ((p->info.endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN))
+		return kTransferFailed;
+	if (p->free.empty()) {
+		request = new Request;
+		request->transfer = libusb_alloc_transfer(0);
+		request->transport = this;
+		request->pipe = pipe;
+		if (request->transfer == NULL) {
+			delete request;
+			return kTransferFailed;
+		}
+	}
+	else {
+		request = p->free.back();
+		p->free.pop_back();
+	}
+	request->callback = callback;
+	request->refcon = refcon;
+	if (p->info.transferType == LIBUSB_TRANSFER_TYPE_INTERRUPT)
+		libusb_fill_interrupt_transfer(request->transfer, mHandle, p->info.endpoint, buffer, (int)length,
+									   TransferCompleted, request, 0);
+	else
+		libusb_fill_bulk_transfer(request->transfer, mHandle, p->info.endpoint, buffer, (int)length,
+								  TransferCompleted, request, 0);
+
+	err = libusb_submit_transfer(request->transfer);
+	if (err != LIBUSB_SUCCESS) {
+		DebugPrintf("libusb_submit_transfer to endpoint 0x%02x failed, %s", p->info.endpoint, libusb_error_name(err));
+		p->free.push_back(request);
+		return ResultOfError(err);
+	}
+	p->inFlight.push_back(request);
+	return kTransferSuccess;
+}
+
+// this is the libusb_transfer_cb_fn (static method), user_data is the Request
+// The request is free again before the callback, which may well queue another transfer on the pipe.
+void	LibUSBTransport::TransferCompleted(libusb_transfer *transfer)
+{
+	Request *request = (Request *)transfer->user_data;
+	MIDITimeStamp completed = request->transport->mClock.Now();
+	Pipe *p = request->transport->FindPipe(request->pipe);
+	std::vector<Request *>::iterator it = std::find(p->inFlight.begin(), p->inFlight.end(), request);
+
+	if (it != p->inFlight.end())
+		p->inFlight.erase(it);
+	p->free.push_back(request);
+	request->callback(request->refcon, ResultOfStatus(transfer->status), transfer->actual_length, completed);
+}
+
+// The transfers return cancelled from libusb's event handling, later, never from within Abort.
+void	LibUSBTransport::Abort(int pipe)
+{
+	Pipe *p = FindPipe(pipe);
+
+	if (p == NULL)
+		return;
+	for (size_t i = 0; i < p->inFlight.size(); ++i)
+		libusb_cancel_transfer(p->inFlight[i]->transfer);
+}
+
+// libusb_clear_halt waits for the device, which event handling cannot, so the transfers queued
+// behind the halt are aborted, as IOKit does, and the halt is cleared by ClearHalts once they have
+// returned, before the engine can restart the pipe.
+TransferResult	LibUSBTransport::ClearStall(int pipe)
+{
+	Pipe *p = FindPipe(pipe);
+
+	if (p == NULL)
+		return kTransferFailed;
+	p->clearHalt = true;
+	Abort(pipe);
+	return kTransferSuccess;
+}
+
+void	LibUSBTransport::ClearHalts()
+{
+	for (size_t i = 0; i < mPipes.size(); ++i) {
+		Pipe &pipe = mPipes[i];
+
+		if (!pipe.clearHalt || !pipe.inFlight.empty())
+			continue;
+		pipe.clearHalt = false;
+
+		int err = libusb_clear_halt(mHandle, pipe.info.endpoint);
+		if (err != LIBUSB_SUCCESS)
+			DebugPrintf("libusb_clear_halt of endpoint 0x%02x failed, %s", pipe.info.endpoint, libusb_error_name(err));
+	}
+}
+
+bool	LibUSBTransport::IsIdle() const
+{
+	for (size_t i = 0; i < mPipes.size(); ++i)
+		if (!mPipes[i].inFlight.empty())
+			return false;
+	return true;
+}
+
+TransferResult	LibUSBTransport::VendorRequest(UInt8 request, UInt16 value, UInt16 index, const void *data, UInt16 length)
+{
+	int err = libusb_control_transfer(mHandle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+									  request, value, index, (unsigned char *)data, length, kControlTimeout);
+
+	if (err < 0) {
+		DebugPrintf("vendor request 0x%02x failed, %s", request, libusb_error_name(err));
+		return ResultOfError(err);
+	}
+	return kTransferSuccess;
+}
+
+// __________________________________________________________________________________________________
+
+TransferResult	LibUSBTransport::ResultOfStatus(int status)
+{
+	switch (status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		return kTransferSuccess;
+	case LIBUSB_TRANSFER_CANCELLED:
+		return kTransferAborted;
+	case LIBUSB_TRANSFER_STALL:
+		return kTransferStalled;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return kTransferNoDevice;
+	default:		// error, timed out, overflow
+		return kTransferFailed;
+	}
+}
+
+TransferResult	LibUSBTransport::ResultOfError(int error)
+{
+	switch (error) {
+	case LIBUSB_SUCCESS:
+		return kTransferSuccess;
+	case LIBUSB_ERROR_PIPE:
+		return kTransferStalled;
+	case LIBUSB_ERROR_NO_DEVICE:
+		return kTransferNoDevice;
+	default:
+		return kTransferFailed;
+	}
+}
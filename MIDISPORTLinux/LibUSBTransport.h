@@ -0,0 +1,79 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The Transport of a claimed interface on Linux, over libusb's asynchronous transfers. The pipes
+// are the endpoints of the interface's alternate setting, numbered from 1 in the order of its
+// descriptor, as IOKit numbers them. Each transfer goes straight from or into the engine's buffer,
+// without a copy, and its libusb_transfer is kept on the pipe to be used again, so none is
+// allocated once as many as the engine queues are. The callbacks come from libusb's event
+// handling, on the event thread of the MidisportHost, stamped with the time of the clock as they
+// come, libusb telling no earlier time of completion. Used only on that thread.
+//
+
+#ifndef __LibUSBTransport_h__
+#define __LibUSBTransport_h__
+
+#include <vector>
+#include <libusb.h>
+#include "Transport.h"
+
+class Clock;
+
+class LibUSBTransport : public Transport {
+public:
+	LibUSBTransport(libusb_device_handle *handle, UInt8 interfaceNumber, UInt8 altSetting, const Clock &clock);
+	virtual ~LibUSBTransport();
+							// the transfers must all have returned, see IsIdle
+
+	bool					Open();
+							// find the interface's endpoints, false if it has none
+
+	// Transport
+	virtual int				NumPipes();
+	virtual bool			GetPipe(int pipe, PipeInfo &info);
+	virtual TransferResult	Read(int pipe, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon);
+	virtual TransferResult	Write(int pipe, const Byte *buffer, ByteCount length, TransferCallback callback, void *refcon);
+	virtual void			Abort(int pipe);
+	virtual TransferResult	ClearStall(int pipe);
+	virtual TransferResult	VendorRequest(UInt8 request, UInt16 value, UInt16 index, const void *data, UInt16 length);
+								// synchronous, never from within event handling
+
+	void					ClearHalts();
+							// clear the halts ClearStall asked for, in the device as well as the host, of
+							// the pipes whose transfers have all returned, outside of event handling
+	bool					IsIdle() const;
+							// no transfer is in flight
+
+	static TransferResult	ResultOfStatus(int status);
+	static TransferResult	ResultOfError(int error);
+
+private:
+	// A transfer and what to call as it returns, its user_data.
+	struct Request {
+		libusb_transfer *	transfer;
+		LibUSBTransport *	transport;
+		int					pipe;
+		TransferCallback	callback;
+		void *				refcon;
+	};
+
+	struct Pipe {
+		PipeInfo				info;
+		std::vector<Request *>	free;
+		std::vector<Request *>	inFlight;		// in the order submitted
+		bool					clearHalt;		// ClearStall asked for the halt to be cleared
+	};
+
+	static void LIBUSB_CALL	TransferCompleted(libusb_transfer *transfer);
+
+	TransferResult			Submit(int pipe, bool in, Byte *buffer, ByteCount length, TransferCallback callback, void *refcon);
+	Pipe *					FindPipe(int pipe)	{ return (pipe >= 1 && pipe <= (int)mPipes.size()) ? &mPipes[pipe - 1] : NULL; }
+
+	libusb_device_handle *	mHandle;
+	UInt8					mInterfaceNumber;
+	UInt8					mAltSetting;
+	const Clock &			mClock;
+	std::vector<Pipe>		mPipes;
+};
+
+#endif // __LibUSBTransport_h__
@@ -0,0 +1,457 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The MIDISPORT interfaces of a libusb context, run on an event thread.
+//
+
+#include <mutex>
+#include <string.h>
+#include <sys/time.h>
+#include "CoreDebug.h"
+#include "Clock.h"
+#include "MIDISink.h"
+#include "MidisportEngine.h"
+#include "OutputScheduler.h"
+#include "SendQueue.h"
+#include "LibUSBTransport.h"
+#include "MidisportHost.h"
+
+#define kSendQueueSize			65536
+#define kMaxEventWaitNanos		100000000ULL	// events are waited for no longer than this
+#define kStopTimeoutMillis		1000			// for the transfers of the interfaces to return
+												// as they are stopped
+
+// __________________________________________________________________________________________________
+// An interface found, as the driver's InterfaceState. Only the event thread runs its engine,
+// other threads only push onto its SendQueue and flag the sources to enable.
+class MidisportHost::Interface : public MIDISink {
+public:
+	Interface(MidisportHost *host, int device, libusb_device *dev, libusb_device_handle *handle,
+			  UInt8 interfaceNumber, UInt8 altSetting, const InterfaceInfo &info, int numOutputPorts) :
+		mHost(host),
+		mDevice(device),
+		mDev(libusb_ref_device(dev)),
+		mHandle(handle),
+		mInterfaceNumber(interfaceNumber),
+		mRunning(false),
+		mTransport(handle, interfaceNumber, altSetting, HostClock::Shared()),
+		mEngine(mTransport, HostClock::Shared(), *this, info, numOutputPorts),
+		mSourcesEnabled(~0U),
+		mSourcesWanted(~0U)
+	{
+		mSendQueue.Allocate(kSendQueueSize);
+		memset(&mInputStatistics, 0, sizeof(mInputStatistics));
+		memset(&mTransferStatistics, 0, sizeof(mTransferStatistics));
+	}
+
+	~Interface()
+	{
+		if (mRunning) {
+			libusb_release_interface(mHandle, mInterfaceNumber);
+			libusb_close(mHandle);
+		}
+		libusb_unref_device(mDev);
+	}
+
+	// Until it is running, the interface is released and the device closed by the manager.
+	bool		Start()
+	{
+		mRunning = mTransport.Open() && mEngine.Start();
+		return mRunning;
+	}
+
+	// MIDISink, on the event thread
+	virtual void	Received(int port, const MIDIPacketList *packets)
+	{
+		mHost->Received(mDevice, port, packets);
+	}
+
+	// must only be called on the event thread
+	// What was sent is handed to the engine in the order it was sent, flushes included.
+	void		HandleSent()
+	{
+		const SentPacket *packet;
+		UInt32 wanted = mSourcesWanted.load(std::memory_order_acquire);
+
+		if (wanted != mSourcesEnabled) {
+			for (int port = 0; port < 32; ++port)
+				if (((wanted ^ mSourcesEnabled) >> port) & 1)
+					mEngine.SetSourceEnabled(port, (wanted >> port) & 1);
+			mSourcesEnabled = wanted;
+		}
+		while ((packet = mSendQueue.Front()) != NULL) {
+			if (packet->flush)
+				mEngine.Flush(packet->portNum);
+			else
+				mEngine.Send(packet->portNum, packet->timeStamp, packet->data, packet->length);
+			mSendQueue.PopFront();
+		}
+	}
+
+	// must only be called on the event thread
+	void		UpdateStatistics()
+	{
+		std::lock_guard<std::mutex> lock(mStatisticsMutex);
+
+		mInputStatistics = mEngine.GetInputStatistics();
+		mTransferStatistics = mEngine.GetTransferStatistics();
+	}
+
+	void		GetStatistics(InputStatistics &input, TransferStatistics &transfers)
+	{
+		std::lock_guard<std::mutex> lock(mStatisticsMutex);
+
+		input = mInputStatistics;
+		transfers = mTransferStatistics;
+	}
+
+	bool		IsIdle() const		{ return mEngine.IsIdle() && mTransport.IsIdle(); }
+
+	MidisportHost *			mHost;
+	int						mDevice;
+	libusb_device *			mDev;
+	libusb_device_handle *	mHandle;
+	UInt8					mInterfaceNumber;
+	bool					mRunning;			// the interface is claimed until deleted
+	LibUSBTransport			mTransport;
+	MidisportEngine			mEngine;
+	SendQueue				mSendQueue;
+	UInt32					mSourcesEnabled;	// the engine's, only used on the event thread
+	std::atomic<UInt32>		mSourcesWanted;		// set on any thread, a bit per port
+
+	std::mutex				mStatisticsMutex;
+	InputStatistics			mInputStatistics;
+	TransferStatistics		mTransferStatistics;
+};
+
+// __________________________________________________________________________________________________
+
+MidisportHost::MidisportHost(libusb_context *context, bool plugAndPlay) :
+	LibUSBDeviceManager(context, plugAndPlay),
+	mStarted(false),
+	mStopping(false),
+	mWakeSignalled(false)
+{
+	for (int i = 0; i < kMaxInterfaces; ++i)
+		mSlots[i].store(NULL, std::memory_order_relaxed);
+}
+
+MidisportHost::~MidisportHost()
+{
+	Stop();
+}
+
+bool	MidisportHost::Start()
+{
+	if (mStarted)
+		return true;
+	mStopping.store(false, std::memory_order_release);
+	ScanDevices();
+	if (pthread_create(&mThread, NULL, ThreadEntry, this) != 0) {
+		DebugPrintf("MidisportHost could not create its event thread");
+		return false;
+	}
+	mStarted = true;
+	return true;
+}
+
+// Once the event thread has exited, events are handled here until the interfaces stopped have
+// no transfer in flight, for a transfer must have returned before it is freed.
+void	MidisportHost::Stop()
+{
+	struct timeval poll = { 0, 10000 };
+	UInt64 until;
+
+	if (mStarted) {
+		mStopping.store(true, std::memory_order_release);
+		libusb_interrupt_event_handler(mContext);
+		pthread_join(mThread, NULL);
+		mStarted = false;
+	}
+	for (int i = 0; i < kMaxInterfaces; ++i)
+		RetireInterface(i);
+
+	until = HostClock::Shared().ToNanos(HostClock::Shared().Now()) + kStopTimeoutMillis * 1000000ULL;
+	while (!mRetired.empty()) {
+		ReclaimInterfaces();
+		if (mRetired.empty())
+			break;
+		if (HostClock::Shared().ToNanos(HostClock::Shared().Now()) >= until) {
+			DebugPrintf("MidisportHost stopped with %d interfaces still transferring", (int)mRetired.size());
+			break;
+		}
+		libusb_handle_events_timeout_completed(mContext, &poll, NULL);
+	}
+}
+
+// __________________________________________________________________________________________________
+// Called on any thread, an interface unplugged during the call is only reclaimed once it returns.
+
+bool	MidisportHost::Send(int device, int port, MIDITimeStamp when, const Byte *data, ByteCount length)
+{
+	bool found = false, sent = false;
+
+	if (device < 0 || device >= kMaxInterfaces)
+		return false;
+
+	UInt32 epoch = mEpoch.Enter();
+	Interface *intf = mSlots[device].load(std::memory_order_acquire);
+	if (intf != NULL && port >= 0 && port < intf->mEngine.NumOutputPorts()) {
+		found = sent = true;
+		while (length > 0) {
+			ByteCount recordLength = OutputScheduler::MessagesLength(data, length, intf->mSendQueue.MaxRecordLength());
+
+			if (!intf->mSendQueue.Push(port, when, data, recordLength)) {
+				DebugPrintf("send queue full, dropped %lu bytes for port %d", (unsigned long) length, port);
+				sent = false;
+				break;
+			}
+			data += recordLength;
+			length -= recordLength;
+		}
+	}
+	mEpoch.Exit(epoch);
+
+	// what was queued before the queue filled is written
+	if (found)
+		Wake();
+	return sent;
+}
+
+bool	MidisportHost::Flush(int device, int port)
+{
+	bool flushed = false;
+
+	if (device < 0 || device >= kMaxInterfaces)
+		return false;
+
+	UInt32 epoch = mEpoch.Enter();
+	Interface *intf = mSlots[device].load(std::memory_order_acquire);
+	if (intf != NULL && port >= 0 && port < intf->mEngine.NumOutputPorts()) {
+		flushed = intf->mSendQueue.PushFlush(port);
+		if (!flushed)
+			DebugPrintf("send queue full, flush of port %d dropped", port);
+	}
+	mEpoch.Exit(epoch);
+
+	if (flushed)
+		Wake();
+	return flushed;
+}
+
+bool	MidisportHost::SetSourceEnabled(int device, int port, bool enabled)
+{
+	if (device < 0 || device >= kMaxInterfaces || port < 0 || port >= 32)
+		return false;
+
+	UInt32 epoch = mEpoch.Enter();
+	Interface *intf = mSlots[device].load(std::memory_order_acquire);
+	if (intf != NULL) {
+		if (enabled)
+			intf->mSourcesWanted.fetch_or(1U << port, std::memory_order_acq_rel);
+		else
+			intf->mSourcesWanted.fetch_and(~(1U << port), std::memory_order_acq_rel);
+	}
+	mEpoch.Exit(epoch);
+
+	if (intf != NULL)
+		Wake();
+	return intf != NULL;
+}
+
+bool	MidisportHost::GetStatistics(int device, InputStatistics &input, TransferStatistics &transfers)
+{
+	if (device < 0 || device >= kMaxInterfaces)
+		return false;
+
+	UInt32 epoch = mEpoch.Enter();
+	Interface *intf = mSlots[device].load(std::memory_order_acquire);
+	if (intf != NULL)
+		intf->GetStatistics(input, transfers);
+	mEpoch.Exit(epoch);
+	return intf != NULL;
+}
+
+// Only the first of the threads to find the event thread not yet signalled interrupts its
+// event handling, the rest find their records taken on the same pass.
+void	MidisportHost::Wake()
+{
+	if (!mWakeSignalled.exchange(true, std::memory_order_acq_rel))
+		libusb_interrupt_event_handler(mContext);
+}
+
+// __________________________________________________________________________________________________
+// LibUSBDeviceManager, on the event thread or the thread calling Start
+
+// A device already running, found again by the scan and hot-plug both, is not matched twice.
+bool	MidisportHost::MatchDevice(libusb_device *device, UInt16 devVendor, UInt16 devProduct)
+{
+	InterfaceInfo info;
+	int numOutputPorts;
+
+	for (int i = 0; i < kMaxInterfaces; ++i) {
+		Interface *intf = mSlots[i].load(std::memory_order_relaxed);
+
+		if (intf != NULL && intf->mDev == device)
+			return false;
+	}
+	memset(&info, 0, sizeof(info));
+	return GetInterfaceInfo(devVendor, devProduct, info, numOutputPorts);
+}
+
+void	MidisportHost::GetInterfaceToUse(libusb_device_handle * /*device*/, UInt8 &outInterfaceNumber, UInt8 &outAltSetting)
+{
+	outInterfaceNumber = 0;		// the interface with the MIDISPORT's endpoints
+	outAltSetting = 0;
+}
+
+bool	MidisportHost::FoundInterface(libusb_device *device, libusb_device_handle *handle,
+									  UInt16 devVendor, UInt16 devProduct,
+									  UInt8 interfaceNumber, UInt8 altSetting)
+{
+	InterfaceInfo info;
+	int numOutputPorts = 0;
+	int slot;
+
+	for (slot = 0; slot < kMaxInterfaces; ++slot)
+		if (mSlots[slot].load(std::memory_order_relaxed) == NULL)
+			break;
+	if (slot == kMaxInterfaces) {
+		DebugPrintf("MidisportHost has no slot left for device 0x%04x:0x%04x", devVendor, devProduct);
+		return false;
+	}
+	memset(&info, 0, sizeof(info));
+	if (!GetInterfaceInfo(devVendor, devProduct, info, numOutputPorts))
+		return false;
+
+	Interface *intf = new Interface(this, slot, device, handle, interfaceNumber, altSetting, info, numOutputPorts);
+	if (!intf->Start()) {
+		// no transfer was started
+		DebugPrintf("MidisportHost could not start device 0x%04x:0x%04x", devVendor, devProduct);
+		delete intf;
+		return false;
+	}
+	mSlots[slot].store(intf, std::memory_order_release);
+	InterfaceAdded(slot, devVendor, devProduct);
+	return true;
+}
+
+void	MidisportHost::DeviceRemoved(libusb_device *device)
+{
+	for (int i = 0; i < kMaxInterfaces; ++i) {
+		Interface *intf = mSlots[i].load(std::memory_order_relaxed);
+
+		if (intf != NULL && intf->mDev == device)
+			RetireInterface(i);
+	}
+}
+
+// __________________________________________________________________________________________________
+
+// this is the pthread start routine (static method) of the event thread
+void *	MidisportHost::ThreadEntry(void *arg)
+{
+	MidisportHost *self = (MidisportHost *)arg;
+	self->Run();
+	return NULL;
+}
+
+// Each pass handles the transfers completed and the devices plugged in or out, hands over what was
+// sent, services the engines come due, and reclaims the interfaces unplugged.
+void	MidisportHost::Run()
+{
+	while (!mStopping.load(std::memory_order_acquire)) {
+		struct timeval timeout = EventTimeout();
+		int err = libusb_handle_events_timeout_completed(mContext, &timeout, NULL);
+
+		if (err != LIBUSB_SUCCESS && err != LIBUSB_ERROR_INTERRUPTED)
+			DebugPrintf("libusb_handle_events failed, %s", libusb_error_name(err));
+		HandlePlugEvents();
+		ServiceInterfaces();
+		if (!mRetired.empty())
+			ReclaimInterfaces();
+	}
+}
+
+// must only be called on the event thread
+void	MidisportHost::ServiceInterfaces()
+{
+	MIDITimeStamp now = HostClock::Shared().Now();
+
+	// records pushed from here on wake the thread again
+	mWakeSignalled.exchange(false, std::memory_order_acq_rel);
+	for (int i = 0; i < kMaxInterfaces; ++i) {
+		Interface *intf = mSlots[i].load(std::memory_order_relaxed);
+
+		if (intf == NULL)
+			continue;
+		intf->HandleSent();
+		intf->mTransport.ClearHalts();
+
+		MIDITimeStamp deadline = intf->mEngine.NextDeadline();
+		if (deadline != 0 && deadline <= now)
+			intf->mEngine.Service();
+		intf->UpdateStatistics();
+	}
+}
+
+// how long to wait for events, until the soonest of the engines' deadlines
+struct timeval	MidisportHost::EventTimeout() const
+{
+	const HostClock &clock = HostClock::Shared();
+	MIDITimeStamp now = clock.Now();
+	UInt64 waitNanos = kMaxEventWaitNanos;
+	struct timeval timeout;
+
+	for (int i = 0; i < kMaxInterfaces; ++i) {
+		Interface *intf = mSlots[i].load(std::memory_order_relaxed);
+		MIDITimeStamp deadline;
+
+		if (intf == NULL || (deadline = intf->mEngine.NextDeadline()) == 0)
+			continue;
+		if (deadline <= now) {
+			waitNanos = 0;
+			break;
+		}
+		if (clock.ToNanos(deadline - now) < waitNanos)
+			waitNanos = clock.ToNanos(deadline - now);
+	}
+	timeout.tv_sec = waitNanos / 1000000000ULL;
+	timeout.tv_usec = (waitNanos % 1000000000ULL) / 1000;
+	return timeout;
+}
+
+// must only be called on the event thread, or once it has exited
+// The interface is unlinked from its slot, so no Send finds it, and its engine stopped. It is
+// deleted once every Send which found it has returned, and its transfers have too.
+void	MidisportHost::RetireInterface(int device)
+{
+	Interface *intf = mSlots[device].load(std::memory_order_relaxed);
+
+	if (intf == NULL)
+		return;
+	mSlots[device].store(NULL, std::memory_order_release);
+	intf->mEngine.Stop();
+
+	RetiredInterface retired = { intf, mEpoch.Current() };
+	mRetired.push_back(retired);
+	InterfaceRemoved(device);
+}
+
+// must only be called on the event thread, or once it has exited
+void	MidisportHost::ReclaimInterfaces()
+{
+	// twice, so without a Send under way an interface goes on the pass it is retired
+	for (int i = 0; i < 2; ++i)
+		mEpoch.TryAdvance();
+	for (std::vector<RetiredInterface>::iterator it = mRetired.begin(); it != mRetired.end(); ) {
+		Interface *intf = it->intf;
+
+		if (mEpoch.Passed(it->epoch) && intf->IsIdle()) {
+			delete intf;
+			it = mRetired.erase(it);
+		}
+		else
+			++it;
+	}
+}
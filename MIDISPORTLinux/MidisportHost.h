@@ -0,0 +1,100 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The MIDISPORT interfaces of a libusb context, each run by a MidisportEngine over a
+// LibUSBTransport, as USBMIDIDriverBase runs its InterfaceStates. One event thread handles
+// libusb's events, so every transfer completes, and every engine runs, on that thread. Output is
+// sent from any thread through each interface's SendQueue, and the event thread is woken to write
+// it. Interfaces are numbered by the slots they are found in, a number is only used again once
+// the interface unplugged from it has been reclaimed.
+//
+
+#ifndef __MidisportHost_h__
+#define __MidisportHost_h__
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+#include "LibUSBDeviceManager.h"
+#include "InterfaceInfo.h"
+#include "Epoch.h"
+
+class MidisportHost : public LibUSBDeviceManager {
+public:
+	enum { kMaxInterfaces = 16 };
+
+	MidisportHost(libusb_context *context, bool plugAndPlay = true);
+	virtual ~MidisportHost();
+						// stops the host
+
+	bool				Start();
+							// open the interfaces plugged in and start the event thread, false if
+							// the thread could not be created
+	void				Stop();
+							// stop the event thread, then the interfaces, once their transfers
+							// have returned
+
+	// These may be called on any thread, they return false if there is no such interface.
+	bool				Send(int device, int port, MIDITimeStamp when, const Byte *data, ByteCount length);
+							// packets too long for one record of the queue are divided between
+							// messages, or within a sysex
+	bool				Flush(int device, int port);
+	bool				SetSourceEnabled(int device, int port, bool enabled);
+
+	bool				GetStatistics(int device, InputStatistics &input, TransferStatistics &transfers);
+							// copied on the event thread, stale by as much as one pass of it
+
+protected:
+	virtual bool		GetInterfaceInfo(	UInt16				devVendor,
+											UInt16				devProduct,
+											InterfaceInfo &		info,
+											int &				numOutputPorts ) = 0;
+							// how to run the device, false if it is not a MIDISPORT to be run
+	virtual void		Received(int device, int port, const MIDIPacketList *packets) = 0;
+							// called on the event thread, the list is only valid during the call
+	virtual void		InterfaceAdded(int /*device*/, UInt16 /*devVendor*/, UInt16 /*devProduct*/) { }
+							// called on the event thread once the interface is running
+	virtual void		InterfaceRemoved(int /*device*/) { }
+							// called on the event thread as the device is unplugged, or stopped
+
+	// LibUSBDeviceManager
+	virtual bool		MatchDevice(		libusb_device *			device,
+											UInt16					devVendor,
+											UInt16					devProduct );
+	virtual void		GetInterfaceToUse(	libusb_device_handle *	device,
+											UInt8 &					outInterfaceNumber,
+											UInt8 &					outAltSetting );
+	virtual bool		FoundInterface(		libusb_device *			device,
+											libusb_device_handle *	handle,
+											UInt16					devVendor,
+											UInt16					devProduct,
+											UInt8					interfaceNumber,
+											UInt8					altSetting );
+	virtual void		DeviceRemoved(libusb_device *device);
+
+private:
+	class Interface;
+
+	struct RetiredInterface {
+		Interface *		intf;
+		UInt32			epoch;		// when it was unlinked from its slot
+	};
+
+	static void *		ThreadEntry(void *arg);
+	void				Run();
+	void				ServiceInterfaces();
+	void				RetireInterface(int device);
+	void				ReclaimInterfaces();
+	void				Wake();
+	struct timeval		EventTimeout() const;
+
+	Epoch							mEpoch;
+	std::atomic<Interface *>		mSlots[kMaxInterfaces];
+	std::vector<RetiredInterface>	mRetired;		// only used on the event thread
+	pthread_t						mThread;
+	bool							mStarted;
+	std::atomic<bool>				mStopping;
+	std::atomic<bool>				mWakeSignalled;		// the event thread was woken and has yet to look
+};
+
+#endif // __MidisportHost_h__
@@ -0,0 +1,840 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// A libusb context whose devices replay recorded endpoint traffic.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "MockLibUSB.h"
+
+// A transfer as libusb allocates it, with what the mock keeps of it.
+struct MockTransfer {
+	libusb_transfer		transfer;		// first, libusb_transfer pointers are cast to MockTransfer
+	bool				inFlight;
+};
+
+struct MockEndpoint {
+	libusb_endpoint_descriptor		descriptor;
+	bool							halted;
+	std::deque<libusb_transfer *>	pending;		// submitted, in order
+	std::vector<Byte>				written;		// OUT, not yet taken
+	size_t							next;			// IN, the first record not yet replayed could be from here on
+};
+
+struct libusb_device {
+	libusb_context *			ctx;
+	int							refs;
+	UInt16						vendor;
+	UInt16						product;
+	UInt8						address;
+	UInt8						interfaceNumber;
+	bool						plugged;
+	std::vector<MockEndpoint>	endpoints;
+
+	std::vector<MockUSBRecord>	records;
+	double						speed;
+	UInt64						replayStart;
+	size_t						unplugRecord;		// records.size() if none is recorded
+	UInt64						haltsCleared;
+};
+
+struct libusb_device_handle {
+	libusb_device *				dev;
+};
+
+struct MockHotplugCallback {
+	libusb_hotplug_callback_handle	handle;
+	int							events;
+	int							vendor;
+	int							product;
+	libusb_hotplug_callback_fn	fn;
+	void *						userData;
+};
+
+struct MockHotplugEvent {
+	libusb_device *				dev;		// referenced until the event is delivered
+	libusb_hotplug_event		event;
+};
+
+struct libusb_context {
+	std::mutex					lock;
+	std::condition_variable		wake;
+	std::vector<libusb_device *>	devices;		// every device added, deleted by libusb_exit
+	std::deque<libusb_transfer *>	completed;		// waiting for their callbacks, in order
+	std::deque<MockHotplugEvent>	plugEvents;
+	std::vector<MockHotplugCallback>	hotplugCallbacks;
+	libusb_hotplug_callback_handle	nextHotplugHandle;
+	bool						interrupted;
+	UInt8						nextAddress;
+};
+
+// the configuration descriptor of a device's one interface, freed as a whole
+struct MockConfig {
+	libusb_config_descriptor	config;		// first, config descriptor pointers are cast to MockConfig
+	libusb_interface			interface;
+	libusb_interface_descriptor	altsetting;
+	std::vector<libusb_endpoint_descriptor>	endpoints;
+};
+
+static UInt64	NowNanos()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (UInt64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// __________________________________________________________________________________________________
+// the replay, all called with the context locked
+
+static MockEndpoint *	FindEndpoint(libusb_device *dev, UInt8 address)
+{
+	for (size_t i = 0; i < dev->endpoints.size(); ++i)
+		if (dev->endpoints[i].descriptor.bEndpointAddress == address)
+			return &dev->endpoints[i];
+	return NULL;
+}
+
+// the index of the endpoint's next record to replay, records.size() if none is left
+static size_t	NextRecord(libusb_device *dev, MockEndpoint &ep)
+{
+	while (ep.next < dev->records.size() && dev->records[ep.next].endpoint != ep.descriptor.bEndpointAddress)
+		++ep.next;
+	return ep.next;
+}
+
+static UInt64	DueTime(libusb_device *dev, const MockUSBRecord &record)
+{
+	if (dev->speed <= 0)
+		return dev->replayStart;
+	return dev->replayStart + (UInt64)(record.time / dev->speed);
+}
+
+static void		Complete(libusb_context *ctx, libusb_transfer *transfer, libusb_transfer_status status, int actualLength)
+{
+	transfer->status = status;
+	transfer->actual_length = actualLength;
+	ctx->completed.push_back(transfer);
+}
+
+static void		Unplug(libusb_device *dev)
+{
+	libusb_context *ctx = dev->ctx;
+
+	if (!dev->plugged)
+		return;
+	dev->plugged = false;
+	for (size_t i = 0; i < dev->endpoints.size(); ++i) {
+		MockEndpoint &ep = dev->endpoints[i];
+
+		while (!ep.pending.empty()) {
+			Complete(ctx, ep.pending.front(), LIBUSB_TRANSFER_NO_DEVICE, 0);
+			ep.pending.pop_front();
+		}
+	}
+	++dev->refs;
+	MockHotplugEvent event = { dev, LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT };
+	ctx->plugEvents.push_back(event);
+}
+
+// Reads complete with the records come due, in the order recorded on each endpoint, and the
+// writes all complete. An unplug recorded waits for the records before it to be replayed.
+static void		Replay(libusb_device *dev, UInt64 now)
+{
+	libusb_context *ctx = dev->ctx;
+	bool beforeUnplug = true;
+
+	for (size_t i = 0; i < dev->endpoints.size() && dev->plugged; ++i) {
+		MockEndpoint &ep = dev->endpoints[i];
+
+		if ((ep.descriptor.bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_OUT) {
+			while (!ep.halted && !ep.pending.empty()) {
+				libusb_transfer *transfer = ep.pending.front();
+
+				ep.written.insert(ep.written.end(), transfer->buffer, transfer->buffer + transfer->length);
+				Complete(ctx, transfer, LIBUSB_TRANSFER_COMPLETED, transfer->length);
+				ep.pending.pop_front();
+			}
+			continue;
+		}
+		while (!ep.halted && !ep.pending.empty()) {
+			size_t index = NextRecord(dev, ep);
+
+			if (index >= dev->unplugRecord || now < DueTime(dev, dev->records[index]))
+				break;
+
+			const MockUSBRecord &record = dev->records[index];
+			libusb_transfer *transfer = ep.pending.front();
+			int length = (int)std::min(record.data.size(), (size_t)transfer->length);
+			libusb_transfer_status status = (libusb_transfer_status)record.status;
+
+			if (length > 0)
+				memcpy(transfer->buffer, record.data.data(), length);
+			if (status == LIBUSB_TRANSFER_COMPLETED && record.data.size() > (size_t)transfer->length)
+				status = LIBUSB_TRANSFER_OVERFLOW;
+			if (status == LIBUSB_TRANSFER_STALL)
+				ep.halted = true;
+			Complete(ctx, transfer, status, length);
+			ep.pending.pop_front();
+			++ep.next;
+		}
+		if (NextRecord(dev, ep) < dev->unplugRecord)
+			beforeUnplug = false;
+	}
+	if (dev->plugged && dev->unplugRecord < dev->records.size() && beforeUnplug
+	&& now >= DueTime(dev, dev->records[dev->unplugRecord]))
+		Unplug(dev);
+}
+
+// when a record is next due for a read waiting for it, or an unplug, 0 if none is
+static UInt64	NextDue(libusb_context *ctx)
+{
+	UInt64 due = 0;
+
+	for (size_t d = 0; d < ctx->devices.size(); ++d) {
+		libusb_device *dev = ctx->devices[d];
+
+		if (!dev->plugged || dev->records.empty())
+			continue;
+		bool beforeUnplug = true;
+
+		for (size_t i = 0; i < dev->endpoints.size(); ++i) {
+			MockEndpoint &ep = dev->endpoints[i];
+			if ((ep.descriptor.bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_OUT)
+				continue;
+			size_t index = NextRecord(dev, ep);
+
+			if (index < dev->unplugRecord)
+				beforeUnplug = false;
+			if (ep.halted || ep.pending.empty() || index >= dev->unplugRecord)
+				continue;
+			UInt64 time = DueTime(dev, dev->records[index]);
+			if (due == 0 || time < due)
+				due = time;
+		}
+		// an unplug waiting for the records before it is due once they are replayed
+		if (dev->unplugRecord < dev->records.size() && beforeUnplug) {
+			UInt64 time = DueTime(dev, dev->records[dev->unplugRecord]);
+			if (due == 0 || time < due)
+				due = time;
+		}
+	}
+	return due;
+}
+
+// __________________________________________________________________________________________________
+
+int		libusb_init(libusb_context **ctx)
+{
+	libusb_context *context = new libusb_context;
+
+	context->nextHotplugHandle = 1;
+	context->interrupted = false;
+	context->nextAddress = 1;
+	*ctx = context;
+	return LIBUSB_SUCCESS;
+}
+
+void	libusb_exit(libusb_context *ctx)
+{
+	for (size_t i = 0; i < ctx->devices.size(); ++i)
+		delete ctx->devices[i];
+	delete ctx;
+}
+
+int		libusb_has_capability(uint32_t capability)
+{
+	return capability == LIBUSB_CAP_HAS_CAPABILITY || capability == LIBUSB_CAP_HAS_HOTPLUG
+		|| capability == LIBUSB_CAP_SUPPORTS_DETACH_KERNEL_DRIVER;
+}
+
+const char *	libusb_error_name(int errcode)
+{
+	switch (errcode) {
+	case LIBUSB_SUCCESS:				return "LIBUSB_SUCCESS";
+	case LIBUSB_ERROR_IO:				return "LIBUSB_ERROR_IO";
+	case LIBUSB_ERROR_INVALID_PARAM:	return "LIBUSB_ERROR_INVALID_PARAM";
+	case LIBUSB_ERROR_ACCESS:			return "LIBUSB_ERROR_ACCESS";
+	case LIBUSB_ERROR_NO_DEVICE:		return "LIBUSB_ERROR_NO_DEVICE";
+	case LIBUSB_ERROR_NOT_FOUND:		return "LIBUSB_ERROR_NOT_FOUND";
+	case LIBUSB_ERROR_BUSY:				return "LIBUSB_ERROR_BUSY";
+	case LIBUSB_ERROR_TIMEOUT:			return "LIBUSB_ERROR_TIMEOUT";
+	case LIBUSB_ERROR_OVERFLOW:			return "LIBUSB_ERROR_OVERFLOW";
+	case LIBUSB_ERROR_PIPE:				return "LIBUSB_ERROR_PIPE";
+	case LIBUSB_ERROR_INTERRUPTED:		return "LIBUSB_ERROR_INTERRUPTED";
+	case LIBUSB_ERROR_NO_MEM:			return "LIBUSB_ERROR_NO_MEM";
+	case LIBUSB_ERROR_NOT_SUPPORTED:	return "LIBUSB_ERROR_NOT_SUPPORTED";
+	default:							return "LIBUSB_ERROR_OTHER";
+	}
+}
+
+ssize_t	libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+	std::lock_guard<std::mutex> locked(ctx->lock);
+	libusb_device **devices = (libusb_device **)calloc(ctx->devices.size() + 1, sizeof(libusb_device *));
+	ssize_t count = 0;
+
+	for (size_t i = 0; i < ctx->devices.size(); ++i) {
+		if (ctx->devices[i]->plugged) {
+			++ctx->devices[i]->refs;
+			devices[count++] = ctx->devices[i];
+		}
+	}
+	*list = devices;
+	return count;
+}
+
+void	libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+	if (list == NULL)
+		return;
+	if (unref_devices)
+		for (libusb_device **dev = list; *dev != NULL; ++dev)
+			libusb_unref_device(*dev);
+	free(list);
+}
+
+// devices are only deleted by libusb_exit, the references are counted to be checked
+libusb_device *	libusb_ref_device(libusb_device *dev)
+{
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+	++dev->refs;
+	return dev;
+}
+
+void	libusb_unref_device(libusb_device *dev)
+{
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+	if (--dev->refs < 0)
+		fprintf(stderr, "MockLibUSB: device %d unreferenced once too often\n", dev->address);
+}
+
+uint8_t	libusb_get_bus_number(libusb_device * /*dev*/)
+{
+	return 1;
+}
+
+uint8_t	libusb_get_device_address(libusb_device *dev)
+{
+	return dev->address;
+}
+
+int		libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->bLength = 18;
+	desc->bDescriptorType = 1;
+	desc->bcdUSB = 0x0110;
+	desc->bDeviceClass = 0xFF;
+	desc->bMaxPacketSize0 = 64;
+	desc->idVendor = dev->vendor;
+	desc->idProduct = dev->product;
+	desc->bNumConfigurations = 1;
+	return LIBUSB_SUCCESS;
+}
+
+int		libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config_descriptor **config)
+{
+	MockConfig *mock = new MockConfig;
+
+	memset(&mock->config, 0, sizeof(mock->config));
+	memset(&mock->altsetting, 0, sizeof(mock->altsetting));
+	for (size_t i = 0; i < dev->endpoints.size(); ++i)
+		mock->endpoints.push_back(dev->endpoints[i].descriptor);
+	mock->altsetting.bLength = 9;
+	mock->altsetting.bDescriptorType = 4;
+	mock->altsetting.bInterfaceNumber = dev->interfaceNumber;
+	mock->altsetting.bNumEndpoints = (uint8_t)mock->endpoints.size();
+	mock->altsetting.bInterfaceClass = 0xFF;
+	mock->altsetting.endpoint = mock->endpoints.data();
+	mock->interface.altsetting = &mock->altsetting;
+	mock->interface.num_altsetting = 1;
+	mock->config.bLength = 9;
+	mock->config.bDescriptorType = 2;
+	mock->config.bNumInterfaces = 1;
+	mock->config.bConfigurationValue = 1;
+	mock->config.interface = &mock->interface;
+	*config = &mock->config;
+	return LIBUSB_SUCCESS;
+}
+
+void	libusb_free_config_descriptor(struct libusb_config_descriptor *config)
+{
+	delete (MockConfig *)config;
+}
+
+// __________________________________________________________________________________________________
+
+int		libusb_open(libusb_device *dev, libusb_device_handle **dev_handle)
+{
+	{
+		std::lock_guard<std::mutex> locked(dev->ctx->lock);
+		if (!dev->plugged)
+			return LIBUSB_ERROR_NO_DEVICE;
+	}
+	libusb_device_handle *handle = new libusb_device_handle;
+	handle->dev = libusb_ref_device(dev);
+	*dev_handle = handle;
+	return LIBUSB_SUCCESS;
+}
+
+void	libusb_close(libusb_device_handle *dev_handle)
+{
+	libusb_unref_device(dev_handle->dev);
+	delete dev_handle;
+}
+
+libusb_device *	libusb_get_device(libusb_device_handle *dev_handle)
+{
+	return dev_handle->dev;
+}
+
+int		libusb_set_auto_detach_kernel_driver(libusb_device_handle * /*dev_handle*/, int /*enable*/)
+{
+	return LIBUSB_SUCCESS;
+}
+
+int		libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+	libusb_device *dev = dev_handle->dev;
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+
+	if (!dev->plugged)
+		return LIBUSB_ERROR_NO_DEVICE;
+	return interface_number == dev->interfaceNumber ? LIBUSB_SUCCESS : LIBUSB_ERROR_NOT_FOUND;
+}
+
+int		libusb_release_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+	libusb_device *dev = dev_handle->dev;
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+
+	if (!dev->plugged)
+		return LIBUSB_ERROR_NO_DEVICE;
+	return interface_number == dev->interfaceNumber ? LIBUSB_SUCCESS : LIBUSB_ERROR_NOT_FOUND;
+}
+
+int		libusb_set_interface_alt_setting(libusb_device_handle *dev_handle, int interface_number, int alternate_setting)
+{
+	return alternate_setting == 0 ? libusb_claim_interface(dev_handle, interface_number) : LIBUSB_ERROR_NOT_FOUND;
+}
+
+int		libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint)
+{
+	libusb_device *dev = dev_handle->dev;
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+	MockEndpoint *ep = FindEndpoint(dev, endpoint);
+
+	if (!dev->plugged)
+		return LIBUSB_ERROR_NO_DEVICE;
+	if (ep == NULL)
+		return LIBUSB_ERROR_NOT_FOUND;
+	ep->halted = false;
+	++dev->haltsCleared;
+	dev->ctx->wake.notify_all();
+	return LIBUSB_SUCCESS;
+}
+
+// the device takes every request it is sent
+int		libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t /*request_type*/, uint8_t /*bRequest*/,
+								uint16_t /*wValue*/, uint16_t /*wIndex*/, unsigned char * /*data*/, uint16_t wLength,
+								unsigned int /*timeout*/)
+{
+	libusb_device *dev = dev_handle->dev;
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+
+	return dev->plugged ? (int)wLength : (int)LIBUSB_ERROR_NO_DEVICE;
+}
+
+// __________________________________________________________________________________________________
+
+struct libusb_transfer *	libusb_alloc_transfer(int /*iso_packets*/)
+{
+	MockTransfer *mock = new MockTransfer;
+
+	memset(&mock->transfer, 0, sizeof(mock->transfer));
+	mock->inFlight = false;
+	return &mock->transfer;
+}
+
+void	libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	if (transfer != NULL && ((MockTransfer *)transfer)->inFlight)
+		fprintf(stderr, "MockLibUSB: transfer freed while in flight\n");
+	delete (MockTransfer *)transfer;
+}
+
+int		libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	libusb_device *dev = transfer->dev_handle->dev;
+	libusb_context *ctx = dev->ctx;
+	std::lock_guard<std::mutex> locked(ctx->lock);
+	MockEndpoint *ep = FindEndpoint(dev, transfer->endpoint);
+
+	if (!dev->plugged)
+		return LIBUSB_ERROR_NO_DEVICE;
+	if (ep == NULL || (ep->descriptor.bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != transfer->type)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if (((MockTransfer *)transfer)->inFlight)
+		return LIBUSB_ERROR_BUSY;
+	((MockTransfer *)transfer)->inFlight = true;
+	ep->pending.push_back(transfer);
+	ctx->wake.notify_all();
+	return LIBUSB_SUCCESS;
+}
+
+int		libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	libusb_device *dev = transfer->dev_handle->dev;
+	libusb_context *ctx = dev->ctx;
+	std::lock_guard<std::mutex> locked(ctx->lock);
+	MockEndpoint *ep = FindEndpoint(dev, transfer->endpoint);
+
+	if (ep == NULL)
+		return LIBUSB_ERROR_NOT_FOUND;
+	std::deque<libusb_transfer *>::iterator it = std::find(ep->pending.begin(), ep->pending.end(), transfer);
+	if (it == ep->pending.end())
+		return LIBUSB_ERROR_NOT_FOUND;
+	ep->pending.erase(it);
+	Complete(ctx, transfer, LIBUSB_TRANSFER_CANCELLED, 0);
+	ctx->wake.notify_all();
+	return LIBUSB_SUCCESS;
+}
+
+// Waits until a transfer completes, the device list changes, the handler is interrupted or the
+// timeout passes, then calls the callbacks, outside the context's lock.
+int		libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed)
+{
+	std::deque<libusb_transfer *> transfers;
+	std::deque<MockHotplugEvent> plugEvents;
+	std::vector<MockHotplugCallback> callbacks;
+	{
+		std::unique_lock<std::mutex> locked(ctx->lock);
+		UInt64 deadline = NowNanos() + (UInt64)tv->tv_sec * 1000000000ULL + (UInt64)tv->tv_usec * 1000;
+
+		for (;;) {
+			UInt64 now = NowNanos();
+
+			for (size_t i = 0; i < ctx->devices.size(); ++i)
+				Replay(ctx->devices[i], now);
+			if (!ctx->completed.empty() || !ctx->plugEvents.empty() || ctx->interrupted || now >= deadline)
+				break;
+
+			UInt64 wakeTime = NextDue(ctx);
+			if (wakeTime == 0 || wakeTime > deadline)
+				wakeTime = deadline;
+			if (wakeTime > now)
+				ctx->wake.wait_for(locked, std::chrono::nanoseconds(wakeTime - now));
+		}
+		ctx->interrupted = false;
+		transfers.swap(ctx->completed);
+		plugEvents.swap(ctx->plugEvents);
+		callbacks = ctx->hotplugCallbacks;
+		for (size_t i = 0; i < transfers.size(); ++i)
+			((MockTransfer *)transfers[i])->inFlight = false;
+	}
+
+	for (size_t i = 0; i < plugEvents.size(); ++i) {
+		MockHotplugEvent &event = plugEvents[i];
+
+		for (size_t c = 0; c < callbacks.size(); ++c) {
+			MockHotplugCallback &callback = callbacks[c];
+
+			if ((callback.events & event.event) == 0
+			|| (callback.vendor != LIBUSB_HOTPLUG_MATCH_ANY && callback.vendor != event.dev->vendor)
+			|| (callback.product != LIBUSB_HOTPLUG_MATCH_ANY && callback.product != event.dev->product))
+				continue;
+			if (callback.fn(ctx, event.dev, event.event, callback.userData) != 0)
+				libusb_hotplug_deregister_callback(ctx, callback.handle);
+		}
+		libusb_unref_device(event.dev);
+	}
+	for (size_t i = 0; i < transfers.size(); ++i)
+		transfers[i]->callback(transfers[i]);
+	if (completed != NULL && !transfers.empty())
+		*completed = 1;
+	return LIBUSB_SUCCESS;
+}
+
+void	libusb_interrupt_event_handler(libusb_context *ctx)
+{
+	std::lock_guard<std::mutex> locked(ctx->lock);
+	ctx->interrupted = true;
+	ctx->wake.notify_all();
+}
+
+int		libusb_hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id,
+										 int product_id, int /*dev_class*/, libusb_hotplug_callback_fn cb_fn,
+										 void *user_data, libusb_hotplug_callback_handle *callback_handle)
+{
+	std::lock_guard<std::mutex> locked(ctx->lock);
+	MockHotplugCallback callback = { ctx->nextHotplugHandle++, events, vendor_id, product_id, cb_fn, user_data };
+
+	if (flags & LIBUSB_HOTPLUG_ENUMERATE)
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	ctx->hotplugCallbacks.push_back(callback);
+	if (callback_handle != NULL)
+		*callback_handle = callback.handle;
+	return LIBUSB_SUCCESS;
+}
+
+void	libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle)
+{
+	std::lock_guard<std::mutex> locked(ctx->lock);
+
+	for (size_t i = 0; i < ctx->hotplugCallbacks.size(); ++i) {
+		if (ctx->hotplugCallbacks[i].handle == callback_handle) {
+			ctx->hotplugCallbacks.erase(ctx->hotplugCallbacks.begin() + i);
+			break;
+		}
+	}
+}
+
+// __________________________________________________________________________________________________
+// the devices
+
+libusb_device *	MockUSBAddDevice(libusb_context *ctx, UInt16 vendor, UInt16 product, UInt8 interfaceNumber,
+								 const libusb_endpoint_descriptor *endpoints, int numEndpoints)
+{
+	libusb_device *dev = new libusb_device;
+	std::lock_guard<std::mutex> locked(ctx->lock);
+
+	dev->ctx = ctx;
+	dev->refs = 1;		// the context's
+	dev->vendor = vendor;
+	dev->product = product;
+	dev->address = ctx->nextAddress++;
+	dev->interfaceNumber = interfaceNumber;
+	dev->plugged = true;
+	for (int i = 0; i < numEndpoints; ++i) {
+		MockEndpoint ep;
+
+		ep.descriptor = endpoints[i];
+		ep.halted = false;
+		ep.next = 0;
+		dev->endpoints.push_back(ep);
+	}
+	dev->speed = 0;
+	dev->replayStart = 0;
+	dev->unplugRecord = dev->records.size();
+	dev->haltsCleared = 0;
+	ctx->devices.push_back(dev);
+
+	++dev->refs;
+	MockHotplugEvent event = { dev, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED };
+	ctx->plugEvents.push_back(event);
+	ctx->wake.notify_all();
+	return dev;
+}
+
+// The records are copied, and those replayed before freed, outside the context's lock, so that
+// events are not held up by a long recording.
+void	MockUSBReplay(libusb_device *dev, const MockUSBRecording &recording, double speed)
+{
+	std::vector<MockUSBRecord> records(recording.Records());
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+
+	dev->records.swap(records);
+	dev->speed = speed;
+	dev->replayStart = NowNanos();
+	dev->unplugRecord = dev->records.size();
+	for (size_t i = 0; i < dev->records.size(); ++i) {
+		if (dev->records[i].endpoint == 0) {
+			dev->unplugRecord = i;
+			break;
+		}
+	}
+	for (size_t i = 0; i < dev->endpoints.size(); ++i)
+		dev->endpoints[i].next = 0;
+	dev->ctx->wake.notify_all();
+}
+
+bool	MockUSBReplayFinished(libusb_device *dev)
+{
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+
+	if (dev->unplugRecord < dev->records.size())
+		return !dev->plugged;
+	for (size_t i = 0; i < dev->endpoints.size(); ++i) {
+		MockEndpoint &ep = dev->endpoints[i];
+
+		if ((ep.descriptor.bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN
+		&& NextRecord(dev, ep) < dev->records.size())
+			return false;
+	}
+	return true;
+}
+
+void	MockUSBUnplug(libusb_device *dev)
+{
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+
+	Unplug(dev);
+	dev->ctx->wake.notify_all();
+}
+
+ByteCount	MockUSBTakeWritten(libusb_device *dev, UInt8 endpoint, std::vector<Byte> &written)
+{
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+	MockEndpoint *ep = FindEndpoint(dev, endpoint);
+
+	if (ep == NULL)
+		return 0;
+	ByteCount length = ep->written.size();
+	written.insert(written.end(), ep->written.begin(), ep->written.end());
+	ep->written.clear();
+	return length;
+}
+
+UInt64	MockUSBHaltsCleared(libusb_device *dev)
+{
+	std::lock_guard<std::mutex> locked(dev->ctx->lock);
+	return dev->haltsCleared;
+}
+
+// __________________________________________________________________________________________________
+// the recordings
+
+static void		AddRecord(std::vector<MockUSBRecord> &records, const MockUSBRecord &record)
+{
+	// records out of order are placed after those of the same time
+	std::vector<MockUSBRecord>::iterator it = records.end();
+
+	while (it != records.begin() && (it - 1)->time > record.time)
+		--it;
+	records.insert(it, record);
+}
+
+void	MockUSBRecording::AddTransfer(UInt64 time, UInt8 endpoint, const Byte *data, ByteCount length)
+{
+	MockUSBRecord record;
+
+	record.time = time;
+	record.endpoint = endpoint;
+	record.status = LIBUSB_TRANSFER_COMPLETED;
+	record.data.assign(data, data + length);
+	AddRecord(mRecords, record);
+}
+
+void	MockUSBRecording::AddStall(UInt64 time, UInt8 endpoint)
+{
+	MockUSBRecord record;
+
+	record.time = time;
+	record.endpoint = endpoint;
+	record.status = LIBUSB_TRANSFER_STALL;
+	AddRecord(mRecords, record);
+}
+
+void	MockUSBRecording::AddUnplug(UInt64 time)
+{
+	MockUSBRecord record;
+
+	record.time = time;
+	record.endpoint = 0;
+	record.status = LIBUSB_TRANSFER_NO_DEVICE;
+	AddRecord(mRecords, record);
+}
+
+// A usbmon text line is
+//	URB-tag timestamp event address status[:interval...] length [= data words | < | >]
+// with the timestamp in microseconds, the event S for submission or C for completion, the address
+// type and direction, bus, device and endpoint, such as Bi:1:004:1, and the data captured in hex
+// words of up to four bytes. IN data is captured as the transfer completes, OUT data as it is
+// submitted. The 32 bit timestamp wraps, every 71 minutes or so.
+bool	MockUSBRecording::LoadUsbmon(const char *path, int deviceAddress)
+{
+	FILE *file = fopen(path, "r");
+	char line[4096];
+	UInt64 first = 0, last = 0, wraps = 0;
+	bool started = false, unplugged = false;
+
+	if (file == NULL)
+		return false;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *tokens[64];
+		int numTokens = 0;
+		char *save = NULL;
+
+		for (char *token = strtok_r(line, " \t\r\n", &save); token != NULL && numTokens < 64;
+			 token = strtok_r(NULL, " \t\r\n", &save))
+			tokens[numTokens++] = token;
+		if (numTokens < 6)
+			continue;
+
+		const char *address = tokens[3];
+		int bus, device, endpoint;
+		if ((address[0] != 'B' && address[0] != 'I') || (address[1] != 'i' && address[1] != 'o')
+		|| sscanf(address + 2, ":%d:%d:%d", &bus, &device, &endpoint) != 3)
+			continue;
+		if (deviceAddress >= 0 && device != deviceAddress)
+			continue;
+		bool in = address[1] == 'i';
+		char event = tokens[2][0];
+		int status = atoi(tokens[4]);
+		if ((in && event != 'C') || (!in && event != 'S'))
+			continue;
+
+		std::vector<Byte> data;
+		if (numTokens > 6 && strcmp(tokens[6], "=") == 0) {
+			for (int i = 7; i < numTokens; ++i)
+				for (const char *hex = tokens[i]; hex[0] != '\0' && hex[1] != '\0'; hex += 2) {
+					char pair[3] = { hex[0], hex[1], '\0' };
+					data.push_back((Byte)strtoul(pair, NULL, 16));
+				}
+		}
+
+		UInt64 timestamp = strtoull(tokens[1], NULL, 10);
+		if (started && timestamp + wraps < last)
+			wraps += 1ULL << 32;
+		timestamp += wraps;
+		if (!started) {
+			first = timestamp;
+			started = true;
+		}
+		last = timestamp;
+		UInt64 time = (timestamp - first) * 1000;
+
+		if (!in)
+			AddTransfer(time, (UInt8)endpoint, data.data(), data.size());
+		else if (status == 0)
+			AddTransfer(time, (UInt8)(0x80 | endpoint), data.data(), data.size());
+		else if (status == -32)		// EPIPE
+			AddStall(time, (UInt8)(0x80 | endpoint));
+		else if ((status == -19 || status == -108) && !unplugged) {		// ENODEV, ESHUTDOWN
+			AddUnplug(time);
+			unplugged = true;
+		}
+		// the rest, unlinked and the like, were not the device's doing
+	}
+	fclose(file);
+	return started;
+}
+
+std::vector<Byte>	MockUSBRecording::Written(UInt8 endpoint) const
+{
+	std::vector<Byte> written;
+
+	for (size_t i = 0; i < mRecords.size(); ++i)
+		if (mRecords[i].endpoint == endpoint)
+			written.insert(written.end(), mRecords[i].data.begin(), mRecords[i].data.end());
+	return written;
+}
+
+ByteCount	MockUSBRecording::InputBytes() const
+{
+	ByteCount bytes = 0;
+
+	for (size_t i = 0; i < mRecords.size(); ++i)
+		if ((mRecords[i].endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN)
+			bytes += mRecords[i].data.size();
+	return bytes;
+}
@@ -0,0 +1,65 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The devices of a mock libusb context, and the recorded traffic they replay. A device is plugged
+// in with the endpoints of the one interface it has, and replays a recording of its endpoints:
+// each read queued on an IN endpoint completes with the next bytes recorded from it once their time
+// has come, a recorded stall halts the endpoint until the halt is cleared, and a recorded unplug
+// fails every transfer and is reported to the hot-plug callbacks. Writes complete as soon as
+// events are handled, the device keeping what they carried, to be compared with the writes
+// recorded. Recordings are made programmatically, or loaded from usbmon's text capture of a real
+// device. Every function may be called on any thread, the completions and hot-plug callbacks come
+// on the thread handling events, as they do with libusb.
+//
+
+#ifndef __MockLibUSB_h__
+#define __MockLibUSB_h__
+
+#include <vector>
+#include <libusb.h>
+#include "MIDITypes.h"
+
+// A transfer recorded on an endpoint. IN transfers are replayed, OUT transfers are what the host
+// was recorded writing. endpoint 0 with status LIBUSB_TRANSFER_NO_DEVICE is the device unplugged.
+struct MockUSBRecord {
+	UInt64				time;			// nanoseconds from the start of the recording
+	UInt8				endpoint;		// the endpoint address, 0x80 set for IN
+	int					status;			// a libusb_transfer_status
+	std::vector<Byte>	data;
+};
+
+class MockUSBRecording {
+public:
+	void				AddTransfer(UInt64 time, UInt8 endpoint, const Byte *data, ByteCount length);
+	void				AddStall(UInt64 time, UInt8 endpoint);
+	void				AddUnplug(UInt64 time);
+
+	bool				LoadUsbmon(const char *path, int deviceAddress = -1);
+							// the completed bulk and interrupt IN transfers, stalls and disconnection,
+							// and the OUT transfers submitted, of the device at the address, any if -1,
+							// in usbmon's text format (/sys/kernel/debug/usb/usbmon/<bus>u). usbmon
+							// captures no more than 32 bytes of each transfer by default.
+
+	const std::vector<MockUSBRecord> &	Records() const		{ return mRecords; }
+	std::vector<Byte>	Written(UInt8 endpoint) const;
+							// the bytes the host was recorded writing to the OUT endpoint
+	ByteCount			InputBytes() const;
+
+private:
+	std::vector<MockUSBRecord>	mRecords;		// in order of time
+};
+
+libusb_device *	MockUSBAddDevice(libusb_context *ctx, UInt16 vendor, UInt16 product, UInt8 interfaceNumber,
+								 const libusb_endpoint_descriptor *endpoints, int numEndpoints);
+					// plug in a device with one interface, reported to the hot-plug callbacks
+void			MockUSBReplay(libusb_device *dev, const MockUSBRecording &recording, double speed);
+					// start replaying the recording, at the pace recorded if speed is 1, faster or
+					// slower in proportion, every record as soon as a read takes it if speed is 0
+bool			MockUSBReplayFinished(libusb_device *dev);
+					// every record has been replayed
+void			MockUSBUnplug(libusb_device *dev);
+ByteCount		MockUSBTakeWritten(libusb_device *dev, UInt8 endpoint, std::vector<Byte> &written);
+					// append the bytes written to the OUT endpoint since last taken, returns how many
+UInt64			MockUSBHaltsCleared(libusb_device *dev);
+
+#endif // __MockLibUSB_h__
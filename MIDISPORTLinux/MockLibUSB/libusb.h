@@ -0,0 +1,255 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// The part of the libusb-1.0 API the Linux backend uses, implemented by MockLibUSB.cpp with no
+// USB underneath, so the backend builds and runs unchanged against devices whose endpoint traffic
+// is replayed from a recording, see MockLibUSB.h. The names, values and signatures are those of
+// libusb's own header, only the layout of the opaque types differs.
+//
+
+#ifndef __MockLibUSB_libusb_h__
+#define __MockLibUSB_libusb_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#define LIBUSB_API_VERSION		0x01000109
+#define LIBUSB_CALL
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+enum libusb_error {
+	LIBUSB_SUCCESS = 0,
+	LIBUSB_ERROR_IO = -1,
+	LIBUSB_ERROR_INVALID_PARAM = -2,
+	LIBUSB_ERROR_ACCESS = -3,
+	LIBUSB_ERROR_NO_DEVICE = -4,
+	LIBUSB_ERROR_NOT_FOUND = -5,
+	LIBUSB_ERROR_BUSY = -6,
+	LIBUSB_ERROR_TIMEOUT = -7,
+	LIBUSB_ERROR_OVERFLOW = -8,
+	LIBUSB_ERROR_PIPE = -9,
+	LIBUSB_ERROR_INTERRUPTED = -10,
+	LIBUSB_ERROR_NO_MEM = -11,
+	LIBUSB_ERROR_NOT_SUPPORTED = -12,
+	LIBUSB_ERROR_OTHER = -99
+};
+
+enum libusb_transfer_status {
+	LIBUSB_TRANSFER_COMPLETED,
+	LIBUSB_TRANSFER_ERROR,
+	LIBUSB_TRANSFER_TIMED_OUT,
+	LIBUSB_TRANSFER_CANCELLED,
+	LIBUSB_TRANSFER_STALL,
+	LIBUSB_TRANSFER_NO_DEVICE,
+	LIBUSB_TRANSFER_OVERFLOW
+};
+
+enum libusb_transfer_type {
+	LIBUSB_TRANSFER_TYPE_CONTROL = 0,
+	LIBUSB_TRANSFER_TYPE_ISOCHRONOUS = 1,
+	LIBUSB_TRANSFER_TYPE_BULK = 2,
+	LIBUSB_TRANSFER_TYPE_INTERRUPT = 3
+};
+
+enum libusb_endpoint_direction {
+	LIBUSB_ENDPOINT_OUT = 0x00,
+	LIBUSB_ENDPOINT_IN = 0x80
+};
+
+#define LIBUSB_ENDPOINT_ADDRESS_MASK	0x0f
+#define LIBUSB_ENDPOINT_DIR_MASK		0x80
+#define LIBUSB_TRANSFER_TYPE_MASK		0x03
+
+enum libusb_request_type {
+	LIBUSB_REQUEST_TYPE_STANDARD = (0x00 << 5),
+	LIBUSB_REQUEST_TYPE_CLASS = (0x01 << 5),
+	LIBUSB_REQUEST_TYPE_VENDOR = (0x02 << 5),
+	LIBUSB_REQUEST_TYPE_RESERVED = (0x03 << 5)
+};
+
+enum libusb_request_recipient {
+	LIBUSB_RECIPIENT_DEVICE = 0x00,
+	LIBUSB_RECIPIENT_INTERFACE = 0x01,
+	LIBUSB_RECIPIENT_ENDPOINT = 0x02,
+	LIBUSB_RECIPIENT_OTHER = 0x03
+};
+
+enum libusb_capability {
+	LIBUSB_CAP_HAS_CAPABILITY = 0x0000,
+	LIBUSB_CAP_HAS_HOTPLUG = 0x0001,
+	LIBUSB_CAP_HAS_HID_ACCESS = 0x0100,
+	LIBUSB_CAP_SUPPORTS_DETACH_KERNEL_DRIVER = 0x0101
+};
+
+struct libusb_device_descriptor {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint16_t	bcdUSB;
+	uint8_t		bDeviceClass;
+	uint8_t		bDeviceSubClass;
+	uint8_t		bDeviceProtocol;
+	uint8_t		bMaxPacketSize0;
+	uint16_t	idVendor;
+	uint16_t	idProduct;
+	uint16_t	bcdDevice;
+	uint8_t		iManufacturer;
+	uint8_t		iProduct;
+	uint8_t		iSerialNumber;
+	uint8_t		bNumConfigurations;
+};
+
+struct libusb_endpoint_descriptor {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bEndpointAddress;
+	uint8_t		bmAttributes;
+	uint16_t	wMaxPacketSize;
+	uint8_t		bInterval;
+	uint8_t		bRefresh;
+	uint8_t		bSynchAddress;
+	const unsigned char *extra;
+	int			extra_length;
+};
+
+struct libusb_interface_descriptor {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bInterfaceNumber;
+	uint8_t		bAlternateSetting;
+	uint8_t		bNumEndpoints;
+	uint8_t		bInterfaceClass;
+	uint8_t		bInterfaceSubClass;
+	uint8_t		bInterfaceProtocol;
+	uint8_t		iInterface;
+	const struct libusb_endpoint_descriptor *endpoint;
+	const unsigned char *extra;
+	int			extra_length;
+};
+
+struct libusb_interface {
+	const struct libusb_interface_descriptor *altsetting;
+	int			num_altsetting;
+};
+
+struct libusb_config_descriptor {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint16_t	wTotalLength;
+	uint8_t		bNumInterfaces;
+	uint8_t		bConfigurationValue;
+	uint8_t		iConfiguration;
+	uint8_t		bmAttributes;
+	uint8_t		MaxPower;
+	const struct libusb_interface *interface;
+	const unsigned char *extra;
+	int			extra_length;
+};
+
+struct libusb_transfer;
+typedef void (LIBUSB_CALL *libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+
+struct libusb_transfer {
+	libusb_device_handle *dev_handle;
+	uint8_t		flags;
+	unsigned char endpoint;
+	unsigned char type;
+	unsigned int timeout;
+	enum libusb_transfer_status status;
+	int			length;
+	int			actual_length;
+	libusb_transfer_cb_fn callback;
+	void *		user_data;
+	unsigned char *buffer;
+	int			num_iso_packets;
+};
+
+typedef enum {
+	LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED = (1 << 0),
+	LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT = (1 << 1)
+} libusb_hotplug_event;
+
+typedef enum {
+	LIBUSB_HOTPLUG_NO_FLAGS = 0,
+	LIBUSB_HOTPLUG_ENUMERATE = (1 << 0)
+} libusb_hotplug_flag;
+
+#define LIBUSB_HOTPLUG_MATCH_ANY	-1
+
+typedef int libusb_hotplug_callback_handle;
+typedef int (LIBUSB_CALL *libusb_hotplug_callback_fn)(libusb_context *ctx, libusb_device *device,
+													  libusb_hotplug_event event, void *user_data);
+
+int				libusb_init(libusb_context **ctx);
+void			libusb_exit(libusb_context *ctx);
+int				libusb_has_capability(uint32_t capability);
+const char *	libusb_error_name(int errcode);
+
+ssize_t			libusb_get_device_list(libusb_context *ctx, libusb_device ***list);
+void			libusb_free_device_list(libusb_device **list, int unref_devices);
+libusb_device *	libusb_ref_device(libusb_device *dev);
+void			libusb_unref_device(libusb_device *dev);
+uint8_t			libusb_get_bus_number(libusb_device *dev);
+uint8_t			libusb_get_device_address(libusb_device *dev);
+int				libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc);
+int				libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config_descriptor **config);
+void			libusb_free_config_descriptor(struct libusb_config_descriptor *config);
+
+int				libusb_open(libusb_device *dev, libusb_device_handle **dev_handle);
+void			libusb_close(libusb_device_handle *dev_handle);
+libusb_device *	libusb_get_device(libusb_device_handle *dev_handle);
+int				libusb_set_auto_detach_kernel_driver(libusb_device_handle *dev_handle, int enable);
+int				libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number);
+int				libusb_release_interface(libusb_device_handle *dev_handle, int interface_number);
+int				libusb_set_interface_alt_setting(libusb_device_handle *dev_handle, int interface_number, int alternate_setting);
+int				libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint);
+int				libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t request_type, uint8_t bRequest,
+										uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength,
+										unsigned int timeout);
+
+struct libusb_transfer *	libusb_alloc_transfer(int iso_packets);
+void			libusb_free_transfer(struct libusb_transfer *transfer);
+int				libusb_submit_transfer(struct libusb_transfer *transfer);
+int				libusb_cancel_transfer(struct libusb_transfer *transfer);
+
+int				libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed);
+void			libusb_interrupt_event_handler(libusb_context *ctx);
+
+int				libusb_hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id,
+												 int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn,
+												 void *user_data, libusb_hotplug_callback_handle *callback_handle);
+void			libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle);
+
+static inline void	libusb_fill_bulk_transfer(struct libusb_transfer *transfer, libusb_device_handle *dev_handle,
+											  unsigned char endpoint, unsigned char *buffer, int length,
+											  libusb_transfer_cb_fn callback, void *user_data, unsigned int timeout)
+{
+	transfer->dev_handle = dev_handle;
+	transfer->endpoint = endpoint;
+	transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+	transfer->timeout = timeout;
+	transfer->buffer = buffer;
+	transfer->length = length;
+	transfer->user_data = user_data;
+	transfer->callback = callback;
+}
+
+static inline void	libusb_fill_interrupt_transfer(struct libusb_transfer *transfer, libusb_device_handle *dev_handle,
+												   unsigned char endpoint, unsigned char *buffer, int length,
+												   libusb_transfer_cb_fn callback, void *user_data, unsigned int timeout)
+{
+	transfer->dev_handle = dev_handle;
+	transfer->endpoint = endpoint;
+	transfer->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+	transfer->timeout = timeout;
+	transfer->buffer = buffer;
+	transfer->length = length;
+	transfer->user_data = user_data;
+	transfer->callback = callback;
+}
+
+#endif // __MockLibUSB_libusb_h__
@@ -0,0 +1,112 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// What the tests and benchmarks of the Linux backend share.
+//
+
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include "MockHostSupport.h"
+#include "MidisportFormat.h"
+#include "Transport.h"
+
+bool	RecordingHost::GetInterfaceInfo(UInt16 devVendor, UInt16 /*devProduct*/, InterfaceInfo &info, int &numOutputPorts)
+{
+	if (devVendor != kMockVendor)
+		return false;
+	memset(&info, 0, sizeof(info));
+	info.inEndpointType = kPipeInterrupt;
+	info.outEndpointType = kPipeBulk;
+	info.readBufferSize = 32;
+	info.writeBufferSize = 32;
+	info.readsInFlight = 2;
+	info.writesInFlight = 2;
+	info.numInputPorts = 2;
+	info.sysexChunkSize = 256;
+	info.sysexTimeout = 100;
+	numOutputPorts = 2;
+	return true;
+}
+
+void	RecordingHost::Received(int device, int port, const MIDIPacketList *packets)
+{
+	const MIDIPacket *packet = &packets->packet[0];
+	std::lock_guard<std::mutex> locked(mMutex);
+
+	for (UInt32 i = 0; i < packets->numPackets; ++i) {
+		ReceivedBytes received;
+
+		received.device = device;
+		received.port = port;
+		received.data.assign(packet->data, packet->data + packet->length);
+		mReceived.push_back(received);
+		messages += (packet->length + 2) / 3;
+		packet = MIDIPacketNext(packet);
+	}
+}
+
+std::vector<Byte>	RecordingHost::Bytes(int device, int port)
+{
+	std::lock_guard<std::mutex> locked(mMutex);
+	std::vector<Byte> bytes;
+
+	for (size_t i = 0; i < mReceived.size(); ++i)
+		if (mReceived[i].device == device && mReceived[i].port == port)
+			bytes.insert(bytes.end(), mReceived[i].data.begin(), mReceived[i].data.end());
+	return bytes;
+}
+
+void	RecordingHost::Clear()
+{
+	std::lock_guard<std::mutex> locked(mMutex);
+
+	mReceived.clear();
+	messages = 0;
+}
+
+// __________________________________________________________________________________________________
+
+libusb_device *	PlugMidisport2x2(libusb_context *ctx)
+{
+	libusb_endpoint_descriptor endpoints[3];
+
+	memset(endpoints, 0, sizeof(endpoints));
+	endpoints[0].bEndpointAddress = 0x81;
+	endpoints[0].bmAttributes = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+	endpoints[0].wMaxPacketSize = 32;
+	endpoints[1].bEndpointAddress = 0x02;
+	endpoints[1].bmAttributes = LIBUSB_TRANSFER_TYPE_BULK;
+	endpoints[1].wMaxPacketSize = 32;
+	endpoints[2].bEndpointAddress = 0x04;
+	endpoints[2].bmAttributes = LIBUSB_TRANSFER_TYPE_BULK;
+	endpoints[2].wMaxPacketSize = 32;
+	return MockUSBAddDevice(ctx, kMockVendor, kMockProduct, 0, endpoints, 3);
+}
+
+bool	WaitFor(const std::function<bool()> &condition, int timeoutMillis)
+{
+	std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+
+	while (!condition()) {
+		if (std::chrono::steady_clock::now() >= until)
+			return false;
+		usleep(100);
+	}
+	return true;
+}
+
+std::vector<Byte>	Mspackets(int port, const std::vector<Byte> &midi)
+{
+	std::vector<Byte> mspackets;
+
+	for (size_t i = 0; i < midi.size(); i += 3) {
+		size_t count = std::min(midi.size() - i, (size_t)3);
+		Byte mspacket[MIDIPACKETLEN] = { 0, 0, 0, (Byte)((port << 4) | count) };
+
+		memcpy(mspacket, &midi[i], count);
+		mspackets.insert(mspackets.end(), mspacket, mspacket + MIDIPACKETLEN);
+	}
+	return mspackets;
+}
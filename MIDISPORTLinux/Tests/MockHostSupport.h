@@ -0,0 +1,63 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// What the tests and benchmarks of the Linux backend share: a MidisportHost running MIDISPORT 2x2s
+// over MockLibUSB, recording what its interfaces receive, and the mock device to plug in for it.
+//
+
+#ifndef __MockHostSupport_h__
+#define __MockHostSupport_h__
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "MockLibUSB.h"
+#include "MidisportHost.h"
+
+// the MIDISPORT 2x2 after its firmware is downloaded
+enum {
+	kMockVendor		= 0x0763,
+	kMockProduct	= 0x1011
+};
+
+// Runs every kMockVendor device as a MIDISPORT 2x2, as MIDISPORT_devices.xml has it but for 32 byte
+// transfers. What is received is recorded on the event thread, and read on any other.
+class RecordingHost : public MidisportHost {
+public:
+	RecordingHost(libusb_context *context) : MidisportHost(context), messages(0), added(0), removed(0) { }
+	virtual ~RecordingHost()	{ Stop(); }
+
+	std::vector<Byte>	Bytes(int device, int port);
+							// the bytes received from the interface's port, in order
+	void				Clear();
+
+	std::atomic<UInt64>	messages;		// MIDI messages received, counted as three bytes each
+	std::atomic<int>	added;
+	std::atomic<int>	removed;
+
+protected:
+	virtual bool		GetInterfaceInfo(UInt16 devVendor, UInt16 devProduct, InterfaceInfo &info, int &numOutputPorts);
+	virtual void		Received(int device, int port, const MIDIPacketList *packets);
+	virtual void		InterfaceAdded(int /*device*/, UInt16 /*devVendor*/, UInt16 /*devProduct*/)	{ ++added; }
+	virtual void		InterfaceRemoved(int /*device*/)	{ ++removed; }
+
+private:
+	struct ReceivedBytes {
+		int					device;
+		int					port;
+		std::vector<Byte>	data;
+	};
+
+	std::mutex					mMutex;
+	std::vector<ReceivedBytes>	mReceived;		// guarded by mMutex
+};
+
+libusb_device *	PlugMidisport2x2(libusb_context *ctx);
+					// a 2x2, with the IN endpoint 1 and the OUT endpoints 2 and 4
+bool			WaitFor(const std::function<bool()> &condition, int timeoutMillis = 5000);
+					// poll until the condition holds, false if it did not in time
+std::vector<Byte>	Mspackets(int port, const std::vector<Byte> &midi);
+					// the MIDI of the port in mspackets of three bytes, the last partly filled
+
+#endif // __MockHostSupport_h__
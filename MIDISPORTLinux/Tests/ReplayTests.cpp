@@ -0,0 +1,119 @@
+//
+// MacOS X driver for MIDIMan MIDISPORT USB MIDI interfaces.
+//
+// Recorded traffic replayed through MidisportHost: a usbmon capture of a MIDISPORT 2x2 delivered
+// to the host's sink, a stalled IN endpoint recovered, and an unplugged device's slot reclaimed
+// for it to be plugged in again.
+//
+
+#include "TestHarness.h"
+#include "MockHostSupport.h"
+#include "MidisportFormat.h"
+
+static std::vector<Byte>	Bytes(const Byte *data, ByteCount length)
+{
+	return std::vector<Byte>(data, data + length);
+}
+
+TEST(Replay, DeliversUsbmonCaptureToSink)
+{
+	static const Byte kNoteOn[3] = { 0x90, 0x3C, 0x40 };
+	static const Byte kPort0[12] = { 0x90, 0x3C, 0x40, 0xF0, 0x00, 0x20, 0x01, 0x02, 0xF7, 0x80, 0x3C, 0x00 };
+	static const Byte kPort1[3] = { 0xB1, 0x07, 0x64 };
+	libusb_context *ctx;
+	MockUSBRecording recording;
+
+	CHECK_EQUAL(0, libusb_init(&ctx));
+	// the capture of device 5, one of device 7's reads among its own
+	CHECK(recording.LoadUsbmon(MIDISPORTLINUX_TEST_DATA "/Midisport2x2.usbmon", 5));
+	CHECK_EQUAL(24, recording.InputBytes());
+	{
+		RecordingHost host(ctx);
+		libusb_device *dev = PlugMidisport2x2(ctx);
+		std::vector<Byte> written;
+
+		CHECK(host.Start());
+		CHECK(WaitFor([&] { return host.added == 1; }));
+		// the host writes what the device was recorded being sent
+		CHECK(host.Send(0, 0, 0, kNoteOn, sizeof(kNoteOn)));
+		CHECK(WaitFor([&] { MockUSBTakeWritten(dev, 0x02, written); return written.size() >= 2 * MIDIPACKETLEN; }));
+		CHECK(written == recording.Written(0x02));
+
+		// the input comes in order through the stall, until the device is unplugged
+		MockUSBReplay(dev, recording, 1);
+		CHECK(WaitFor([&] { return host.removed == 1; }));
+		CHECK(MockUSBReplayFinished(dev));
+		CHECK(host.Bytes(0, 0) == Bytes(kPort0, sizeof(kPort0)));
+		CHECK(host.Bytes(0, 1) == Bytes(kPort1, sizeof(kPort1)));
+		CHECK_EQUAL(1, MockUSBHaltsCleared(dev));
+	}
+	libusb_exit(ctx);
+}
+
+TEST(Replay, RecoversStalledInEndpoint)
+{
+	libusb_context *ctx;
+	MockUSBRecording recording;
+	std::vector<Byte> expected;
+
+	CHECK_EQUAL(0, libusb_init(&ctx));
+	// a note a read, the endpoint stalling halfway
+	for (int i = 0; i < 20; ++i) {
+		const Byte noteOn[3] = { 0x90, (Byte)(0x30 + i), 0x40 };
+		std::vector<Byte> read = Mspackets(0, Bytes(noteOn, sizeof(noteOn)));
+
+		if (i == 10)
+			recording.AddStall(0, 0x81);
+		recording.AddTransfer(0, 0x81, read.data(), read.size());
+		expected.insert(expected.end(), noteOn, noteOn + 3);
+	}
+	{
+		RecordingHost host(ctx);
+		libusb_device *dev = PlugMidisport2x2(ctx);
+		InputStatistics input;
+		TransferStatistics transfers;
+
+		CHECK(host.Start());
+		CHECK(WaitFor([&] { return host.added == 1; }));
+		MockUSBReplay(dev, recording, 0);
+		CHECK(WaitFor([&] { return host.messages == 20; }));
+		CHECK(host.Bytes(0, 0) == expected);
+		CHECK_EQUAL(1, MockUSBHaltsCleared(dev));
+		// the statistics are copied on the event thread's next pass
+		CHECK(WaitFor([&] { return host.GetStatistics(0, input, transfers) && transfers.restarts == 1; }));
+		CHECK_EQUAL(1, transfers.readErrors);
+		CHECK_EQUAL(1, transfers.stallsCleared);
+		CHECK_EQUAL(0, transfers.fatalErrors);
+	}
+	libusb_exit(ctx);
+}
+
+TEST(Replay, ReclaimsUnpluggedInterface)
+{
+	static const Byte kNoteOn[3] = { 0x90, 0x3C, 0x40 };
+	libusb_context *ctx;
+	MockUSBRecording recording;
+	std::vector<Byte> read = Mspackets(1, Bytes(kNoteOn, sizeof(kNoteOn)));
+
+	CHECK_EQUAL(0, libusb_init(&ctx));
+	for (int i = 0; i < 5; ++i)
+		recording.AddTransfer(0, 0x81, read.data(), read.size());
+	recording.AddUnplug(0);
+	{
+		RecordingHost host(ctx);
+		libusb_device *dev = PlugMidisport2x2(ctx);
+
+		CHECK(host.Start());
+		CHECK(WaitFor([&] { return host.added == 1; }));
+		MockUSBReplay(dev, recording, 0);
+		CHECK(WaitFor([&] { return host.removed == 1; }));
+		CHECK_EQUAL(5, host.messages);
+		// the slot is unlinked as the device goes, and taken again by the device plugged in next
+		CHECK(!host.Send(0, 0, 0, kNoteOn, sizeof(kNoteOn)));
+		dev = PlugMidisport2x2(ctx);
+		CHECK(WaitFor([&] { return host.added == 2; }));
+		CHECK(WaitFor([&] { return host.Send(0, 0, 0, kNoteOn, sizeof(kNoteOn)); }));
+		CHECK(!host.Send(1, 0, 0, kNoteOn, sizeof(kNoteOn)));
+	}
+	libusb_exit(ctx);
+}